@@ -140,6 +140,15 @@ LogProxy::Rewind()
   return;
 }
 
+void
+LogProxy::Seek(double aTime)
+{
+  scoped_lock_t lock(mPc->mMutex);
+  if (0 != playerc_log_set_read_seek(mDevice,aTime))
+    throw PlayerError("LogProxy::Seek()", "error seeking");
+  return;
+}
+
 void
 LogProxy::SetFilename(const std::string aFilename)
 {
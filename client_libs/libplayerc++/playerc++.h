@@ -1612,6 +1612,9 @@ class PLAYERCC_EXPORT LogProxy : public ClientProxy
     /// Rewind the log file.
     void Rewind();
 
+    /// Seek playback to the given log time (binary log files only).
+    void Seek(double aTime);
+
     /// Set the name of the logfile to write to.
     void SetFilename(const std::string aFilename);
 };
@@ -60,6 +60,7 @@
 #if !defined (WIN32)
   #include <sys/socket.h>
   #include <netinet/in.h>
+  #include <arpa/inet.h>   // for inet_addr()
   #include <unistd.h>
   #include <netdb.h>       // for gethostbyname()
   #include <sys/time.h>
@@ -72,6 +73,9 @@
 #include <replace/replace.h>  // for poll(2)
 #endif
 
+#include <libplayercommon/shmring.h>
+#include <libplayercommon/udpframe.h>
+
 #include "playerc.h"
 #include "error.h"
 
@@ -95,6 +99,19 @@
 // Have we done one-time intialization work yet?
 static int init_done;
 
+// Most senders on the multicast group that are told apart at once
+#define PLAYERC_MCAST_SENDERS 4
+
+// A sender heard from on the multicast group
+typedef struct playerc_mcast_sender
+{
+  int used;
+  struct sockaddr_in addr;
+  // Is it our server?  Messages from others are ignored.
+  int ours;
+  player_udpframe_reasm_t reasm;
+} playerc_mcast_sender_t;
+
 void dummy(int sig)
 {
 }
@@ -113,6 +130,11 @@ int playerc_client_pop(playerc_client_t *client,
                        player_msghdr_t *header, void *data);
 void *playerc_client_dispatch(playerc_client_t *client,
                               player_msghdr_t *header, void *data);
+static int playerc_client_connect_local(playerc_client_t *client);
+static int playerc_client_wait_ring(playerc_client_t *client, int timeout);
+static int playerc_client_join_multicast(playerc_client_t *client);
+static int playerc_client_local_addr(struct in_addr addr);
+static int playerc_client_recvudp(playerc_client_t *client, int timeout);
 
 int timed_recv(int s, void *buf, size_t len, int flags, int timeout);
 
@@ -186,7 +208,10 @@ playerc_client_t *playerc_client_create(playerc_mclient_t *mclient, const char *
   // TODO: make this memory allocation more conservative
   client->data = (char*)malloc(PLAYER_MAX_MESSAGE_SIZE);
   client->read_xdrdata = (char*)malloc(PLAYERXDR_MAX_MESSAGE_SIZE);
+  client->read_xdrdata_start = 0;
   client->read_xdrdata_len = 0;
+  client->shmring = NULL;
+  client->mcast_sock = -1;
   assert(client->data);
   assert(client->read_xdrdata);
 
@@ -216,6 +241,7 @@ playerc_client_t *playerc_client_create(playerc_mclient_t *mclient, const char *
 void playerc_client_destroy(playerc_client_t *client)
 {
   player_msghdr_t header;
+  int i;
   // Pop everything off the queue.
   while (!playerc_client_pop(client, &header, client->data))
   {
@@ -230,6 +256,17 @@ void playerc_client_destroy(playerc_client_t *client)
 
   free(client->data);
   free(client->read_xdrdata);
+  free(client->write_xdrdata);
+  if (client->udp_reasm)
+  {
+    player_udpframe_reasm_free(client->udp_reasm);
+    for (i = 0; i < PLAYERC_MCAST_SENDERS; i++)
+      player_udpframe_reasm_free(&client->mcast_senders[i].reasm);
+    free(client->udp_reasm);
+    free(client->mcast_senders);
+    free(client->udp_dgram);
+  }
+  free(client->mcast_group);
   free(client->host);
   free(client);
   return;
@@ -266,6 +303,10 @@ int playerc_client_connect(playerc_client_t *client)
   struct sigaction sigact;
 #endif
   struct sockaddr_in clientaddr;
+  int i;
+
+  if(client->transport == PLAYERC_TRANSPORT_SHM)
+    return(playerc_client_connect_local(client));
 
   // Construct socket
   if(client->transport == PLAYERC_TRANSPORT_UDP)
@@ -448,10 +489,40 @@ int playerc_client_connect(playerc_client_t *client)
     return -1;
   }
 
-  // For UDP, send an empty msg to get things going
+  // For UDP, say hello to get things going
   if(client->transport == PLAYERC_TRANSPORT_UDP)
   {
-    if(send(client->sock, NULL, 0, 0) < 0)
+    char hello[PLAYER_UDPFRAME_HDR_SIZE];
+    size_t hellolen;
+
+    if (!client->udp_reasm)
+    {
+      client->udp_reasm = malloc(sizeof(player_udpframe_reasm_t));
+      client->mcast_senders = calloc(PLAYERC_MCAST_SENDERS,
+                                     sizeof(playerc_mcast_sender_t));
+      client->udp_dgram = malloc(PLAYER_UDPFRAME_MAX_DATAGRAM);
+      assert(client->udp_reasm && client->mcast_senders && client->udp_dgram);
+      player_udpframe_reasm_init(client->udp_reasm, PLAYERXDR_MAX_MESSAGE_SIZE);
+      for (i = 0; i < PLAYERC_MCAST_SENDERS; i++)
+        player_udpframe_reasm_init(&client->mcast_senders[i].reasm,
+                                   PLAYERXDR_MAX_MESSAGE_SIZE);
+    }
+    player_udpframe_reasm_reset(client->udp_reasm);
+    for (i = 0; i < PLAYERC_MCAST_SENDERS; i++)
+      client->mcast_senders[i].used = 0;
+    client->mcast_sender_next = 0;
+    client->udp_seq = 0;
+
+    // Join the group before the server can start sending to it
+    if (client->mcast_group && (playerc_client_join_multicast(client) < 0))
+    {
+      playerc_client_disconnect(client);
+      return -1;
+    }
+
+    hellolen = player_udpframe_hello(hello, client->mcast_group ?
+                                     PLAYER_UDPFRAME_MULTICAST : 0);
+    if(send(client->sock, hello, hellolen, 0) < 0)
     {
       STRERROR(PLAYERC_ERR2, "send() failed with error [%d: %s]");
       return -1;
@@ -522,6 +593,7 @@ int playerc_client_disconnect_retry(playerc_client_t *client)
     else
     {
       /* Clean out buffers */
+      client->read_xdrdata_start = 0;
       client->read_xdrdata_len = 0;
 
       /* TODO: re-establish replacement rules, delivery modes, etc. */
@@ -566,9 +638,154 @@ int playerc_client_disconnect_retry(playerc_client_t *client)
   }
 }
 
+// Connect to a server on this host through its Unix domain socket, and
+// map the ring that comes back with the banner
+static int playerc_client_connect_local(playerc_client_t *client)
+{
+#if defined (WIN32)
+  PLAYERC_ERR("shared memory transport is not supported on this platform");
+  return -1;
+#else
+  struct pollfd fd;
+  char banner[PLAYER_IDENT_STRLEN];
+  int memfd, eventfd;
+  int ret;
+
+  if (!player_shmring_supported())
+  {
+    PLAYERC_ERR("shared memory transport is not supported on this platform");
+    return -1;
+  }
+
+  if ((client->sock = player_shmring_connect(client->port)) < 0)
+  {
+    PLAYERC_ERR1("failed to connect to the local server on port %d",
+                 client->port);
+    return -1;
+  }
+
+  // Get the banner, and the ring's descriptors along with it
+  fd.fd = client->sock;
+  fd.events = POLLIN;
+  fd.revents = 0;
+  ret = -1;
+  memfd = eventfd = -1;
+  if (poll(&fd, 1, 2000) > 0)
+    ret = player_shmring_recv(client->sock, banner, sizeof(banner),
+                              &memfd, &eventfd);
+  if ((ret < (int) sizeof(banner)) || (memfd < 0))
+  {
+    if (memfd >= 0)
+      close(memfd);
+    if (eventfd >= 0)
+      close(eventfd);
+    playerc_client_disconnect(client);
+    PLAYERC_ERR("incomplete initialization string");
+    return -1;
+  }
+
+  client->shmring = malloc(sizeof(player_shmring_t));
+  assert(client->shmring);
+  if (player_shmring_attach(client->shmring, memfd, eventfd) < 0)
+  {
+    free(client->shmring);
+    client->shmring = NULL;
+    playerc_client_disconnect(client);
+    return -1;
+  }
+
+  //set the datamode to pull
+  playerc_client_datamode(client, PLAYER_DATAMODE_PULL);
+
+  PLAYERC_WARN3("[%s] connected locally on port %d with sock %d\n", banner, client->port, client->sock);
+
+  client->connected = 1;
+  return 0;
+#endif
+}
+
+// Listen to the server's multicast group, on a socket of our own
+static int playerc_client_join_multicast(playerc_client_t *client)
+{
+  struct sockaddr_in addr;
+  struct ip_mreq mreq;
+  int yes = 1;
+
+  memset(&mreq, 0, sizeof(mreq));
+  mreq.imr_multiaddr.s_addr = inet_addr(client->mcast_group);
+  mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+  if (!IN_MULTICAST(ntohl(mreq.imr_multiaddr.s_addr)))
+  {
+    PLAYERC_ERR1("%s is not a multicast address", client->mcast_group);
+    return -1;
+  }
+
+#if defined (WIN32)
+  if ((client->mcast_sock = socket(PF_INET, SOCK_DGRAM, 0)) == INVALID_SOCKET)
+#else
+  if ((client->mcast_sock = socket(PF_INET, SOCK_DGRAM, 0)) < 0)
+#endif
+  {
+    STRERROR(PLAYERC_ERR2, "socket() failed with error [%d: %s]");
+    client->mcast_sock = -1;
+    return -1;
+  }
+
+  // Other clients on this host may be listening to the group too
+  if (setsockopt(client->mcast_sock, SOL_SOCKET, SO_REUSEADDR,
+                 (const char*)&yes, sizeof(yes)) < 0)
+    STRERROR(PLAYERC_WARN2, "setsockopt(SO_REUSEADDR) failed with error [%d: %s]");
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(client->mcast_port);
+  if ((bind(client->mcast_sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) ||
+      (setsockopt(client->mcast_sock, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                  (const char*)&mreq, sizeof(mreq)) < 0))
+  {
+    PLAYERC_ERR3("failed to join multicast group %s:%d with error [%s]",
+                 client->mcast_group, client->mcast_port, strerror(ErrNo));
+    return -1;
+  }
+  return 0;
+}
+
+// Ask for DATA messages through the server's multicast group
+int playerc_client_set_multicast(playerc_client_t *client,
+                                 const char *group, int port)
+{
+  if (client->transport != PLAYERC_TRANSPORT_UDP)
+  {
+    PLAYERC_ERR("multicast is only available with the UDP transport");
+    return -1;
+  }
+  free(client->mcast_group);
+  client->mcast_group = group ? strdup(group) : NULL;
+  client->mcast_port = port;
+  return 0;
+}
+
 // Disconnect from the server
 int playerc_client_disconnect(playerc_client_t *client)
 {
+  if (client->shmring)
+  {
+    player_shmring_destroy(client->shmring);
+    free(client->shmring);
+    client->shmring = NULL;
+  }
+
+  if (client->mcast_sock >= 0)
+  {
+#if defined (WIN32)
+    closesocket(client->mcast_sock);
+#else
+    close(client->mcast_sock);
+#endif
+    client->mcast_sock = -1;
+  }
+
 #if defined (WIN32)
   if (closesocket(client->sock) != 0)
   {
@@ -671,6 +888,45 @@ int playerc_client_internal_peek(playerc_client_t *client, int timeout)
     return -1;
   }
 
+  // A whole message may already be waiting in the receive buffer
+  if (playerc_client_internal_buffered(client))
+    return 1;
+
+  // The server writes to a local client's ring, not to its socket
+  if (client->shmring)
+  {
+    if ((count = playerc_client_wait_ring(client, timeout)) <= 0)
+      return count;
+    return(playerc_client_internal_buffered(client));
+  }
+
+  // Over UDP, take in datagrams until a whole message is ready, or time
+  // runs out
+  if (client->transport == PLAYERC_TRANSPORT_UDP)
+  {
+    struct timeval start, now;
+    int left = timeout;
+
+    gettimeofday(&start, NULL);
+    for (;;)
+    {
+      if ((count = playerc_client_recvudp(client, left)) < 0)
+        return(playerc_client_disconnect_retry(client));
+      if (playerc_client_internal_buffered(client))
+        return 1;
+      if (count == 0)
+        return 0;
+      if (timeout > 0)
+      {
+        gettimeofday(&now, NULL);
+        left = timeout - (int) ((now.tv_sec - start.tv_sec) * 1000 +
+                                (now.tv_usec - start.tv_usec) / 1000);
+        if (left < 0)
+          left = 0;
+      }
+    }
+  }
+
   fd.fd = client->sock;
   //fd.events = POLLIN | POLLHUP;
   fd.events = POLLIN | POLLPRI | POLLERR | POLLHUP | POLLNVAL;
@@ -1155,90 +1411,334 @@ int playerc_client_delcallback(playerc_client_t *client, playerc_device_t *devic
 }
 
 
-// Read a raw packet
-int playerc_client_readpacket(playerc_client_t *client,
-                              player_msghdr_t *header,
-                              char *data)
+// Read more data into the receive buffer, until it holds at least len
+// unread bytes.  Each recv() asks for as much as the socket has (up to
+// PLAYERC_READ_HIGHWATER, or the rest of a large message), so a burst
+// of small messages costs a single syscall.  Returns 0 on success, -1
+// on error, or 1 if the connection was re-established (and the buffer
+// emptied) along the way.
+static int playerc_client_fill(playerc_client_t *client, size_t len)
 {
   int nbytes;
-  player_pack_fn_t packfunc;
-  int decode_msglen;
+  size_t want, space;
 
-  if (client->sock < 0)
+  // Move the unread tail to the front of the buffer, to make room
+  if (client->read_xdrdata_start > 0)
   {
-    PLAYERC_WARN("no socket to read from");
-    return -1;
+    memmove(client->read_xdrdata,
+            client->read_xdrdata + client->read_xdrdata_start,
+            client->read_xdrdata_len);
+    client->read_xdrdata_start = 0;
+  }
+
+  // Over UDP, only whole messages are ever added to the buffer
+  if (client->transport == PLAYERC_TRANSPORT_UDP)
+  {
+    while (client->read_xdrdata_len < len)
+    {
+      if ((nbytes = playerc_client_recvudp(client,
+                                           (int) client->request_timeout * 1000)) < 0)
+        return(playerc_client_disconnect_retry(client) < 0 ? -1 : 1);
+      if (nbytes == 0)
+      {
+        PLAYERC_ERR("timed out waiting for a message");
+        return -1;
+      }
+    }
+    return 0;
   }
 
-  while(client->read_xdrdata_len < PLAYERXDR_MSGHDR_SIZE)
+  while (client->read_xdrdata_len < len)
   {
-    nbytes = timed_recv(client->sock,
-                        client->read_xdrdata + client->read_xdrdata_len,
-                        PLAYERXDR_MSGHDR_SIZE - client->read_xdrdata_len,
-                        0, (int) client->request_timeout * 1000);
+    want = len - client->read_xdrdata_len;
+    if (want < PLAYERC_READ_HIGHWATER)
+      want = PLAYERC_READ_HIGHWATER;
+    space = PLAYERXDR_MAX_MESSAGE_SIZE - client->read_xdrdata_len;
+    if (want > space)
+      want = space;
+
+    // Take whatever is already waiting before falling back on poll()
+    nbytes = -1;
+#if defined (MSG_DONTWAIT)
+    nbytes = recv(client->sock,
+                  client->read_xdrdata + client->read_xdrdata_len,
+                  want, MSG_DONTWAIT);
+    if (nbytes == 0)
+    {
+      PLAYERC_ERR("server closed the connection");
+      return(playerc_client_disconnect_retry(client) < 0 ? -1 : 1);
+    }
+#endif
+    if (nbytes < 0)
+      nbytes = timed_recv(client->sock,
+                          client->read_xdrdata + client->read_xdrdata_len,
+                          want, 0, (int) client->request_timeout * 1000);
     if (nbytes <= 0)
     {
-      if(nbytes == 0)
+      // Timed out (or the connection closed) between messages
+      if (nbytes == 0 && client->read_xdrdata_len < PLAYERXDR_MSGHDR_SIZE)
         return -1;
-      if(errno == EINTR)
+      if (nbytes < 0 && errno == EINTR)
         continue;
-      else
-      {
-        STRERROR (PLAYERC_ERR2, "recv failed with error [%d: %s]");
-        //playerc_client_disconnect(client);
-        if(playerc_client_disconnect_retry(client) < 0)
-          return(-1);
-        else
-          continue;
-      }
+      STRERROR (PLAYERC_ERR2, "recv failed with error [%d: %s]");
+      return(playerc_client_disconnect_retry(client) < 0 ? -1 : 1);
     }
     client->read_xdrdata_len += nbytes;
   }
+  return 0;
+}
 
-  // Unpack the header
-  if(player_msghdr_pack(client->read_xdrdata,
-                        PLAYERXDR_MSGHDR_SIZE,
-                        header, PLAYERXDR_DECODE) < 0)
+
+// Is a message that came through the multicast group for one of our
+// devices?  The group carries data for every client that listens to it.
+static int playerc_client_mine(playerc_client_t *client,
+                               const char *msg, int msglen)
+{
+  player_msghdr_t header;
+  int i;
+
+  if ((msglen < PLAYERXDR_MSGHDR_SIZE) ||
+      (player_msghdr_pack((char*)msg, PLAYERXDR_MSGHDR_SIZE,
+                          &header, PLAYERXDR_DECODE) < 0))
+    return 0;
+  if ((header.type != PLAYER_MSGTYPE_DATA) ||
+      ((int) header.addr.robot != client->port))
+    return 0;
+  for (i = 0; i < client->device_count; i++)
   {
-    PLAYERC_ERR("failed to unpack header");
-    return -1;
+    if (client->device[i]->subscribed &&
+        client->device[i]->addr.interf == header.addr.interf &&
+        client->device[i]->addr.index == header.addr.index)
+      return 1;
   }
-  if (header->size > PLAYERXDR_MAX_MESSAGE_SIZE - PLAYERXDR_MSGHDR_SIZE)
+  return 0;
+}
+
+
+// Is this one of the addresses of this host?  Only local addresses can be
+// bound to.
+static int playerc_client_local_addr(struct in_addr addr)
+{
+  struct sockaddr_in sa;
+  int sock, ret;
+
+#if defined (WIN32)
+  if ((sock = socket(PF_INET, SOCK_DGRAM, 0)) == INVALID_SOCKET)
+#else
+  if ((sock = socket(PF_INET, SOCK_DGRAM, 0)) < 0)
+#endif
+    return 0;
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr = addr;
+  sa.sin_port = 0;
+  ret = bind(sock, (struct sockaddr*)&sa, sizeof(sa));
+#if defined (WIN32)
+  closesocket(sock);
+#else
+  close(sock);
+#endif
+  return (ret == 0);
+}
+
+
+// Find the reassembly for a datagram that came through the multicast
+// group from addr, or NULL if it didn't come from our server.  Other
+// servers (other robots, or other ports on the server's host) may send to
+// the same group, each with its own sequence numbers.
+static player_udpframe_reasm_t *playerc_client_mcast_sender(playerc_client_t *client,
+                                                            struct sockaddr_in *addr)
+{
+  playerc_mcast_sender_t *sender;
+  int i;
+
+  for (i = 0; i < PLAYERC_MCAST_SENDERS; i++)
   {
-    PLAYERC_WARN1("packet is too large, %d bytes", header->size);
+    sender = client->mcast_senders + i;
+    if (sender->used &&
+        sender->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+        sender->addr.sin_port == addr->sin_port)
+      return sender->ours ? &sender->reasm : NULL;
   }
 
-  // Slide over the header
-  memmove(client->read_xdrdata,
-          client->read_xdrdata + PLAYERXDR_MSGHDR_SIZE,
-          client->read_xdrdata_len - PLAYERXDR_MSGHDR_SIZE);
-  client->read_xdrdata_len -= PLAYERXDR_MSGHDR_SIZE;
+  // A new sender.  The server's group messages come from its own address,
+  // or, if we reached it through the loopback interface, from whichever
+  // of this host's addresses it sent them out of.
+  sender = NULL;
+  for (i = 0; i < PLAYERC_MCAST_SENDERS && !sender; i++)
+  {
+    if (!client->mcast_senders[i].used)
+      sender = client->mcast_senders + i;
+  }
+  if (!sender)
+  {
+    sender = client->mcast_senders + client->mcast_sender_next;
+    client->mcast_sender_next = (client->mcast_sender_next + 1) % PLAYERC_MCAST_SENDERS;
+  }
+  sender->used = 1;
+  sender->addr = *addr;
+  if (addr->sin_addr.s_addr == client->server.sin_addr.s_addr)
+    sender->ours = 1;
+  else if ((ntohl(client->server.sin_addr.s_addr) >> 24) == 127)
+    sender->ours = playerc_client_local_addr(addr->sin_addr);
+  else
+    sender->ours = 0;
+  player_udpframe_reasm_reset(&sender->reasm);
+  return sender->ours ? &sender->reasm : NULL;
+}
 
-  while(client->read_xdrdata_len < header->size)
+
+// UDP: wait up to timeout ms for datagrams, from the server or the
+// multicast group, and add one from each to the message being put
+// together.  Messages that they complete are appended to the receive
+// buffer.  Returns 1 if anything arrived, 0 on timeout, or -1 on error.
+static int playerc_client_recvudp(playerc_client_t *client, int timeout)
+{
+  struct pollfd fds[2];
+  player_udpframe_reasm_t *reasm;
+  struct sockaddr_in from;
+  socklen_t fromlen;
+  const char *msg;
+  uint32_t dropped;
+  int nfds, count, i, nbytes, msglen;
+
+  fds[0].fd = client->sock;
+  fds[1].fd = client->mcast_sock;
+  fds[0].events = fds[1].events = POLLIN;
+  fds[0].revents = fds[1].revents = 0;
+  nfds = (client->mcast_sock >= 0) ? 2 : 1;
+
+  count = poll(fds, nfds, timeout);
+  if (count < 0)
   {
-    nbytes = timed_recv(client->sock,
-                        client->read_xdrdata + client->read_xdrdata_len,
-                        header->size - client->read_xdrdata_len,
-                        0, (int) client->request_timeout*1000);
-    if (nbytes <= 0)
+    if (errno == EINTR)
+      return 0;
+    PLAYERC_ERR1("poll returned error [%s]", strerror(errno));
+    return -1;
+  }
+  if (count == 0)
+    return 0;
+
+  for (i = 0; i < nfds; i++)
+  {
+    if (!fds[i].revents)
+      continue;
+    fromlen = sizeof(from);
+    if ((nbytes = recvfrom(fds[i].fd, client->udp_dgram,
+                           PLAYER_UDPFRAME_MAX_DATAGRAM, 0,
+                           (struct sockaddr*)&from, &fromlen)) < 0)
     {
-      if(errno == EINTR)
-        continue;
-      {
-        STRERROR (PLAYERC_ERR2, "recv failed with error [%d: %s]");
-        //playerc_client_disconnect(client);
-        if(playerc_client_disconnect_retry(client) < 0)
-          return(-1);
-        else
-        {
-          /* Need to start over; the easiest way is to recursively call
-           * myself.  Might be problematic... */
-          return(playerc_client_readpacket(client,header,data));
-        }
-      }
+      STRERROR(PLAYERC_ERR2, "recv failed with error [%d: %s]");
+      return -1;
     }
-    client->read_xdrdata_len += nbytes;
+
+    if (!i)
+      reasm = client->udp_reasm;
+    else if (!(reasm = playerc_client_mcast_sender(client, &from)))
+      continue;
+    dropped = reasm->dropped;
+    msglen = player_udpframe_reasm_add(reasm, client->udp_dgram, nbytes, &msg);
+    client->dropped_count += reasm->dropped - dropped;
+    if (msglen < 0)
+    {
+      PLAYERC_WARN1("skipping malformed datagram (%d bytes)", nbytes);
+      continue;
+    }
+    if (msglen == 0 || (i && !playerc_client_mine(client, msg, msglen)))
+      continue;
+
+    // Append the message, making room at the front if need be
+    if (client->read_xdrdata_start + client->read_xdrdata_len + msglen >
+        PLAYERXDR_MAX_MESSAGE_SIZE)
+    {
+      memmove(client->read_xdrdata,
+              client->read_xdrdata + client->read_xdrdata_start,
+              client->read_xdrdata_len);
+      client->read_xdrdata_start = 0;
+    }
+    if (client->read_xdrdata_len + msglen > PLAYERXDR_MAX_MESSAGE_SIZE)
+    {
+      PLAYERC_WARN("receive buffer is full; dropping message");
+      client->dropped_count++;
+      continue;
+    }
+    memcpy(client->read_xdrdata + client->read_xdrdata_start +
+           client->read_xdrdata_len, msg, msglen);
+    client->read_xdrdata_len += msglen;
   }
+  return 1;
+}
+
+
+// Is there a complete message in the receive buffer (or the ring)?
+int playerc_client_internal_buffered(playerc_client_t *client)
+{
+  player_msghdr_t header;
+  size_t len;
+
+  if (client->shmring)
+    return (player_shmring_peek(client->shmring, &len) != NULL);
+  if (client->read_xdrdata_len < PLAYERXDR_MSGHDR_SIZE)
+    return 0;
+  if (player_msghdr_pack(client->read_xdrdata + client->read_xdrdata_start,
+                         PLAYERXDR_MSGHDR_SIZE, &header, PLAYERXDR_DECODE) < 0)
+    return 0;
+  return (client->read_xdrdata_len >= PLAYERXDR_MSGHDR_SIZE + header.size);
+}
+
+
+// Wait for the server to add to the ring, or for the connection to drop.
+// Returns 1 if there may be something new in the ring, 0 on timeout, or
+// the result of trying to reconnect.
+static int playerc_client_wait_ring(playerc_client_t *client, int timeout)
+{
+  struct pollfd fds[2];
+  int count;
+
+  if (client->shmring->broken)
+  {
+    PLAYERC_ERR("message ring is corrupt");
+    return(playerc_client_disconnect_retry(client));
+  }
+
+  fds[0].fd = client->shmring->eventfd;
+  fds[0].events = POLLIN;
+  fds[0].revents = 0;
+  fds[1].fd = client->sock;
+  fds[1].events = POLLIN | POLLPRI | POLLERR | POLLHUP | POLLNVAL;
+  fds[1].revents = 0;
+
+  count = poll(fds, 2, timeout);
+  if (count < 0)
+  {
+    if(errno == EINTR)
+      return(0);
+    PLAYERC_ERR1("poll returned error [%s]", strerror(errno));
+    return(playerc_client_disconnect_retry(client));
+  }
+  // The server only sends on the socket when we connect, so anything
+  // more means that it has gone away
+  if (fds[1].revents)
+  {
+    PLAYERC_ERR("socket disconnected");
+    return(playerc_client_disconnect_retry(client));
+  }
+  if (fds[0].revents & POLLIN)
+  {
+    player_shmring_clear_signal(client->shmring);
+    return 1;
+  }
+  return 0;
+}
+
+
+// Decode the body of a message whose header has already been unpacked, and
+// rewrite the header's size with the decoded length
+static int playerc_client_decodebody(player_msghdr_t *header,
+                                     char *body, char *data)
+{
+  player_pack_fn_t packfunc;
+  int decode_msglen;
 
   if (header->size)
   {
@@ -1250,34 +1750,19 @@ int playerc_client_readpacket(playerc_client_t *client,
       // messages
       PLAYERC_ERR4("skipping message from %s:%u with unsupported type %s:%u",
                  interf_to_str(header->addr.interf), header->addr.index, msgtype_to_str(header->type), header->subtype);
-
-      // Slide over the body
-      memmove(client->read_xdrdata,
-            client->read_xdrdata + header->size,
-            client->read_xdrdata_len - header->size);
-      client->read_xdrdata_len -= header->size;
-
-      return(-1);
+      return -1;
     }
-
     // Unpack the body
-    if((decode_msglen = (*packfunc)(client->read_xdrdata,
+    if((decode_msglen = (*packfunc)(body,
                                   header->size, data, PLAYERXDR_DECODE)) < 0)
     {
       PLAYERC_ERR4("decoding failed on message from %s:%u with type %s:%u",
                  interf_to_str(header->addr.interf), header->addr.index, msgtype_to_str(header->type), header->subtype);
-      return(-1);
+      return -1;
     }
   }
   else
-  {
     decode_msglen = 0;
-  }
-  // Slide over the body
-  memmove(client->read_xdrdata,
-          client->read_xdrdata + header->size,
-          client->read_xdrdata_len - header->size);
-  client->read_xdrdata_len -= header->size;
 
   // Rewrite the header with the decoded message length
   header->size = decode_msglen;
@@ -1286,24 +1771,134 @@ int playerc_client_readpacket(playerc_client_t *client,
 }
 
 
-// Write a raw packet
-int playerc_client_writepacket(playerc_client_t *client,
-                               player_msghdr_t *header, const char *data)
+// Read a packet out of the ring, waiting for one if need be.  It is
+// decoded where it lies, and only then handed back to the server.
+static int playerc_client_readring(playerc_client_t *client,
+                                   player_msghdr_t *header,
+                                   char *data)
 {
-  int bytes, ret, length;
-  player_pack_fn_t packfunc;
-  int encode_msglen;
-  struct timeval curr;
-  char *write_xdrdata = (char *)malloc(sizeof(char[PLAYERXDR_MAX_MESSAGE_SIZE]));
+  const char *rec;
+  size_t len;
+  int ret;
+
+  while (!(rec = player_shmring_peek(client->shmring, &len)))
+  {
+    if ((ret = playerc_client_wait_ring(client,
+                                        (int) client->request_timeout * 1000)) < 0 ||
+        !client->shmring)
+      return -1;
+    if (ret == 0)
+    {
+      PLAYERC_ERR("timed out waiting for a message");
+      return -1;
+    }
+  }
+
+  if((len < PLAYERXDR_MSGHDR_SIZE) ||
+     (player_msghdr_pack((char*)rec, PLAYERXDR_MSGHDR_SIZE,
+                         header, PLAYERXDR_DECODE) < 0) ||
+     (PLAYERXDR_MSGHDR_SIZE + header->size != len))
+  {
+    PLAYERC_ERR("failed to unpack header");
+    ret = -1;
+  }
+  else
+    ret = playerc_client_decodebody(header,
+                                    (char*)rec + PLAYERXDR_MSGHDR_SIZE, data);
+  player_shmring_release(client->shmring, len);
+  return ret;
+}
+
+
+// Read a raw packet
+int playerc_client_readpacket(playerc_client_t *client,
+                              player_msghdr_t *header,
+                              char *data)
+{
+  int ret;
+  char *body;
 
   if (client->sock < 0)
   {
-    PLAYERC_WARN("no socket to write to");
-    free(write_xdrdata);
+    PLAYERC_WARN("no socket to read from");
     return -1;
   }
 
-  // Encode the body first, if it's non-NULL
+  if (client->shmring)
+    return(playerc_client_readring(client, header, data));
+
+  // Make sure we have the header
+  if (client->read_xdrdata_len < PLAYERXDR_MSGHDR_SIZE)
+  {
+    if ((ret = playerc_client_fill(client, PLAYERXDR_MSGHDR_SIZE)) < 0)
+      return -1;
+    else if (ret > 0)
+      return(playerc_client_readpacket(client, header, data));
+  }
+
+  // Unpack the header
+  if(player_msghdr_pack(client->read_xdrdata + client->read_xdrdata_start,
+                        PLAYERXDR_MSGHDR_SIZE,
+                        header, PLAYERXDR_DECODE) < 0)
+  {
+    // There's no finding the next header on the stream after this; start
+    // again on a new connection
+    PLAYERC_ERR("failed to unpack header");
+    playerc_client_disconnect_retry(client);
+    return -1;
+  }
+  if (header->size > PLAYERXDR_MAX_MESSAGE_SIZE - PLAYERXDR_MSGHDR_SIZE)
+  {
+    PLAYERC_ERR1("packet is too large, %d bytes", header->size);
+    playerc_client_disconnect_retry(client);
+    return -1;
+  }
+
+  // Make sure we have the body
+  if (client->read_xdrdata_len < PLAYERXDR_MSGHDR_SIZE + header->size)
+  {
+    if ((ret = playerc_client_fill(client,
+                                   PLAYERXDR_MSGHDR_SIZE + header->size)) < 0)
+      return -1;
+    else if (ret > 0)
+    {
+      /* Need to start over; the easiest way is to recursively call
+       * myself.  Might be problematic... */
+      return(playerc_client_readpacket(client, header, data));
+    }
+  }
+
+  // Consume the message up front, so that a bad one gets skipped; the
+  // bytes stay put until the next refill.
+  body = client->read_xdrdata + client->read_xdrdata_start + PLAYERXDR_MSGHDR_SIZE;
+  client->read_xdrdata_start += PLAYERXDR_MSGHDR_SIZE + header->size;
+  client->read_xdrdata_len -= PLAYERXDR_MSGHDR_SIZE + header->size;
+
+  ret = playerc_client_decodebody(header, body, data);
+
+  // Once the buffer is empty, start filling it from the front again
+  if (client->read_xdrdata_len == 0)
+    client->read_xdrdata_start = 0;
+  return ret;
+}
+
+
+// Write a raw packet
+// Encode a message (header and body) into the write buffer at the given
+// offset, growing the buffer if need be.  Returns the encoded length, or -1
+// on error.
+static int playerc_client_encodepacket(playerc_client_t *client,
+                                       player_msghdr_t *header,
+                                       const char *data, size_t offset)
+{
+  player_pack_fn_t packfunc = NULL;
+  player_sizeof_fn_t sizeoffunc;
+  size_t maxsize;
+  int encode_msglen;
+  struct timeval curr;
+
+  // Work out how much room the body could need
+  maxsize = 0;
   if(data)
   {
     // Locate the appropriate packing function for the message body
@@ -1315,18 +1910,39 @@ int playerc_client_writepacket(playerc_client_t *client,
       // messages
       PLAYERC_ERR4("skipping message to %s:%u with unsupported type %s:%u",
                    interf_to_str(header->addr.interf), header->addr.index, msgtype_to_str(header->type), header->subtype);
-      free(write_xdrdata);
       return(-1);
     }
+    // 4 times the message (including dynamic data) is a safe upper bound
+    maxsize = PLAYER_MAX_MESSAGE_SIZE - PLAYERXDR_MSGHDR_SIZE;
+    if((sizeoffunc = playerxdr_get_sizeoffunc(header->addr.interf,
+                                              header->type,
+                                              header->subtype)))
+    {
+      size_t estimate = 4 * (size_t)(*sizeoffunc)((void*)data);
+      if(estimate < maxsize)
+        maxsize = estimate;
+    }
+  }
+
+  if(offset + PLAYERXDR_MSGHDR_SIZE + maxsize > client->write_xdrdata_size)
+  {
+    size_t size = client->write_xdrdata_size ? client->write_xdrdata_size : 1024;
+    while(size < offset + PLAYERXDR_MSGHDR_SIZE + maxsize)
+      size *= 2;
+    client->write_xdrdata = (char*)realloc(client->write_xdrdata, size);
+    assert(client->write_xdrdata);
+    client->write_xdrdata_size = size;
+  }
 
+  // Encode the body first, if it's non-NULL
+  if(data)
+  {
     if((encode_msglen =
-        (*packfunc)(write_xdrdata + PLAYERXDR_MSGHDR_SIZE,
-                    PLAYER_MAX_MESSAGE_SIZE - PLAYERXDR_MSGHDR_SIZE,
-                    (void*) data, PLAYERXDR_ENCODE)) < 0)
+        (*packfunc)(client->write_xdrdata + offset + PLAYERXDR_MSGHDR_SIZE,
+                    maxsize, (void*) data, PLAYERXDR_ENCODE)) < 0)
     {
       PLAYERC_ERR4("encoding failed on message from %s:%u with type %s:%u",
                    interf_to_str(header->addr.interf), header->addr.index, msgtype_to_str(header->type), header->subtype);
-      free(write_xdrdata);
       return(-1);
     }
   }
@@ -1338,20 +1954,45 @@ int playerc_client_writepacket(playerc_client_t *client,
   gettimeofday(&curr,NULL);
   header->timestamp = curr.tv_sec + curr.tv_usec / 1e6;
   // Pack the header
-  if(player_msghdr_pack(write_xdrdata, PLAYERXDR_MSGHDR_SIZE,
+  if(player_msghdr_pack(client->write_xdrdata + offset, PLAYERXDR_MSGHDR_SIZE,
                         header, PLAYERXDR_ENCODE) < 0)
   {
     PLAYERC_ERR("failed to pack header");
-    free(write_xdrdata);
     return -1;
   }
 
-  // Send the message
-  length = PLAYERXDR_MSGHDR_SIZE + encode_msglen;
-  bytes = PLAYERXDR_MSGHDR_SIZE + encode_msglen;
+  return(PLAYERXDR_MSGHDR_SIZE + encode_msglen);
+}
+
+// Send the first length bytes of the write buffer
+static int playerc_client_sendpacket(playerc_client_t *client, int length)
+{
+  int bytes, ret;
+  size_t offset, len;
+
+  // Over UDP, split the message up into datagrams
+  if (client->transport == PLAYERC_TRANSPORT_UDP)
+  {
+    for (offset = 0; offset < (size_t) length;
+         offset += len - PLAYER_UDPFRAME_HDR_SIZE)
+    {
+      len = player_udpframe_build(client->udp_dgram, client->udp_seq,
+                                  client->write_xdrdata, length, NULL, 0,
+                                  offset);
+      if (send(client->sock, client->udp_dgram, len, 0) < 0)
+      {
+        STRERROR (PLAYERC_ERR2, "send on body failed with error [%d: %s]");
+        return(playerc_client_disconnect_retry(client));
+      }
+    }
+    client->udp_seq++;
+    return 0;
+  }
+
+  bytes = length;
   do
   {
-    ret = send(client->sock, &write_xdrdata[length-bytes],
+    ret = send(client->sock, &client->write_xdrdata[length-bytes],
                bytes, 0);
     if (ret > 0)
     {
@@ -1365,15 +2006,59 @@ int playerc_client_writepacket(playerc_client_t *client,
     {
       STRERROR (PLAYERC_ERR2, "send on body failed with error [%d: %s]");
       //playerc_client_disconnect(client);
-      free(write_xdrdata);
       return(playerc_client_disconnect_retry(client));
     }
   } while (bytes);
 
-  free(write_xdrdata);
   return 0;
 }
 
+int playerc_client_writepacket(playerc_client_t *client,
+                               player_msghdr_t *header, const char *data)
+{
+  int length;
+
+  if (client->sock < 0)
+  {
+    PLAYERC_WARN("no socket to write to");
+    return -1;
+  }
+
+  if((length = playerc_client_encodepacket(client, header, data, 0)) < 0)
+    return -1;
+
+  // Send the message
+  return playerc_client_sendpacket(client, length);
+}
+
+// Write several messages with one send
+int playerc_client_write_many(playerc_client_t *client,
+                              player_msghdr_t *headers,
+                              void **data, int count)
+{
+  int i, len;
+  size_t length;
+
+  if (client->sock < 0)
+  {
+    PLAYERC_WARN("no socket to write to");
+    return -1;
+  }
+
+  length = 0;
+  for(i = 0; i < count; i++)
+  {
+    if((len = playerc_client_encodepacket(client, headers + i,
+                                          (const char*)data[i], length)) < 0)
+      return -1;
+    length += len;
+  }
+  if(length == 0)
+    return 0;
+
+  return playerc_client_sendpacket(client, length);
+}
+
 
 // Push a packet onto the incoming queue.
 void playerc_client_push(playerc_client_t *client,
@@ -153,6 +153,22 @@ int playerc_log_set_read_rewind(playerc_log_t* device)
   return(0);
 }
 
+// Seek playback
+int playerc_log_set_read_seek(playerc_log_t* device, double time)
+{
+  player_log_set_read_seek_t req;
+
+  req.time = time;
+  if(playerc_client_request(device->info.client, 
+                            &device->info, PLAYER_LOG_REQ_SET_READ_SEEK,
+                            &req, NULL) < 0)
+  {
+    PLAYERC_ERR("failed to seek data playback");
+    return(-1);
+  }
+  return(0);
+}
+
 // Change filename 
 int playerc_log_set_filename(playerc_log_t* device, const char* fname)
 {
@@ -55,6 +55,7 @@
 #endif
 
 #include <replace/replace.h>  /* for poll */
+#include <libplayercommon/shmring.h>
 
 #include "playerc.h"
 #include "error.h"
@@ -70,7 +71,8 @@ playerc_mclient_t *playerc_mclient_create()
 
   mclient = malloc(sizeof(playerc_mclient_t));
   memset(mclient, 0, sizeof(playerc_mclient_t));
-  mclient->pollfd = calloc(128,sizeof(struct pollfd));
+  // Room for each client's socket, and its multicast socket
+  mclient->pollfd = calloc(2*128,sizeof(struct pollfd));
   mclient->time = 0.0;
 
   return mclient;
@@ -101,23 +103,51 @@ int playerc_mclient_addclient(playerc_mclient_t *mclient, playerc_client_t *clie
 }
 
 
+// The descriptor to poll for a client's incoming data: the socket, or for
+// a local client, the eventfd that its ring signals
+static int playerc_mclient_fd(playerc_client_t *client)
+{
+  if (client->shmring)
+    return client->shmring->eventfd;
+  return client->sock;
+}
+
+
+// Fill in the poll slot for client i's multicast socket, which follows
+// the slots for all the clients' own sockets (-1 is ignored by poll)
+static void playerc_mclient_mcast_fd(playerc_mclient_t *mclient, int i)
+{
+  struct pollfd *fd = mclient->pollfd + mclient->client_count + i;
+  fd->fd = mclient->client[i]->mcast_sock;
+  fd->events = POLLIN;
+  fd->revents = 0;
+}
+
 // Test to see if there is pending data.
 // Returns -1 on error, 0 or 1 otherwise.
 int playerc_mclient_peek(playerc_mclient_t *mclient, int timeout)
 {
   int i, count;
 
+  // Messages that have already been read off the socket count as data
+  for (i = 0; i < mclient->client_count; i++)
+  {
+    if (playerc_client_internal_buffered(mclient->client[i]))
+      return 1;
+  }
+
   // Configure poll structure to wait for incoming data 
   for (i = 0; i < mclient->client_count; i++)
   {
     playerc_client_requestdata(mclient->client[i]);
-    mclient->pollfd[i].fd = mclient->client[i]->sock;
+    mclient->pollfd[i].fd = playerc_mclient_fd(mclient->client[i]);
     mclient->pollfd[i].events = POLLIN;
     mclient->pollfd[i].revents = 0;
+    playerc_mclient_mcast_fd(mclient, i);
   }
 
   // Wait for incoming data 
-  count = poll(mclient->pollfd, mclient->client_count, timeout);
+  count = poll(mclient->pollfd, 2 * mclient->client_count, timeout);
   if (count < 0)
   {
     PLAYERC_ERR1("poll returned error [%s]", strerror(errno));
@@ -136,19 +166,23 @@ int playerc_mclient_read(playerc_mclient_t *mclient, int timeout)
   // Configure poll structure to wait for incoming data 
   for (i = 0; i < mclient->client_count; i++)
   {
-    mclient->pollfd[i].fd = mclient->client[i]->sock;
+    mclient->pollfd[i].fd = playerc_mclient_fd(mclient->client[i]);
     mclient->pollfd[i].events = POLLIN;
     mclient->pollfd[i].revents = 0;
+    playerc_mclient_mcast_fd(mclient, i);
     if(!mclient->client[i]->qlen)
     {
       // In case the client is in a PULL mode, first request a round of data.
       if(playerc_client_requestdata(mclient->client[i]) < 0)
         PLAYERC_ERR("playerc_client_requestdata errored");
     }
+    // Don't wait if there's already a message in the receive buffer
+    if(playerc_client_internal_buffered(mclient->client[i]))
+      timeout = 0;
   }
 
   // Wait for incoming data 
-  count = poll(mclient->pollfd, mclient->client_count, timeout);
+  count = poll(mclient->pollfd, 2 * mclient->client_count, timeout);
   if (count < 0)
   {
     PLAYERC_ERR1("poll returned error [%s]", strerror(errno));
@@ -159,7 +193,25 @@ int playerc_mclient_read(playerc_mclient_t *mclient, int timeout)
   count = 0;
   for (i = 0; i < mclient->client_count; i++)
   {
+    // A ring's wakeup only needs clearing; the ring itself is checked
+    // below
+    if(mclient->client[i]->shmring && mclient->pollfd[i].revents)
+    {
+      player_shmring_clear_signal(mclient->client[i]->shmring);
+      mclient->pollfd[i].revents = 0;
+    }
+    // A datagram need not complete a message; take in what has arrived,
+    // and read only if that made a whole one
+    if(mclient->client[i]->transport == PLAYERC_TRANSPORT_UDP &&
+       (mclient->pollfd[i].revents ||
+        mclient->pollfd[mclient->client_count + i].revents))
+    {
+      if(playerc_client_internal_peek(mclient->client[i], 0) < 0)
+        return(-1);
+      mclient->pollfd[i].revents = 0;
+    }
     if(mclient->client[i]->qlen ||
+       playerc_client_internal_buffered(mclient->client[i]) ||
        (mclient->pollfd[i].revents & POLLIN) > 0)
     {
       if(playerc_client_read_nonblock(mclient->client[i])>0)
@@ -113,9 +113,16 @@ extern "C" {
 /** The valid transports */
 #define PLAYERC_TRANSPORT_TCP 1
 #define PLAYERC_TRANSPORT_UDP 2
+/** Shared memory, for a client on the same host as the server; see
+    libplayercommon/shmring.h */
+#define PLAYERC_TRANSPORT_SHM 3
 
 #define PLAYERC_QUEUE_RING_SIZE 512
 
+/** The most data (bytes) to ask the socket for in one read, unless a
+    single message is larger. */
+#define PLAYERC_READ_HIGHWATER 65536
+
 /** @} */
 
 /**
@@ -531,10 +538,35 @@ typedef struct _playerc_client_t
   /** How many messages were lost on the server due to overflows, incremented by player, cleared by user. */
   uint32_t overflow_count;
 
+  /** How many incomplete messages were thrown away, over UDP, when a
+      fragment of a newer one arrived; cleared by user. */
+  uint32_t dropped_count;
 
   /** @internal Socket descriptor */
   int sock;
 
+  /** @internal Ring that the server writes to, when connected with
+      PLAYERC_TRANSPORT_SHM; NULL otherwise. */
+  struct player_shmring *shmring;
+
+  /** @internal UDP reassembly of messages from the server; datagram
+      buffer; sequence number of the next message sent. */
+  struct player_udpframe_reasm *udp_reasm;
+  char *udp_dgram;
+  uint32_t udp_seq;
+
+  /** @internal Senders heard from on the multicast group, each with its
+      own reassembly, and the slot to reuse next when they are all
+      taken. */
+  struct playerc_mcast_sender *mcast_senders;
+  int mcast_sender_next;
+
+  /** @internal Multicast group to listen to (NULL for none), its port,
+      and the socket joined to it (-1 if none). */
+  char *mcast_group;
+  int mcast_port;
+  int mcast_sock;
+
   /** @internal Data delivery mode */
   uint8_t mode;
 
@@ -563,7 +595,14 @@ typedef struct _playerc_client_t
   /** @internal Temp buffers for incoming / outgoing packets. */
   char *data;
   char *read_xdrdata;
+  /** @internal Offset of the first unread byte in read_xdrdata, and the
+      number of unread bytes after it. */
+  size_t read_xdrdata_start;
   size_t read_xdrdata_len;
+  /** @internal Buffer for encoding outgoing packets; grown as needed and
+      kept for the life of the client. */
+  char *write_xdrdata;
+  size_t write_xdrdata_size;
 
 
   /** Server time stamp on the last packet. */
@@ -604,11 +643,31 @@ PLAYERC_EXPORT void playerc_client_destroy(playerc_client_t *client);
 /** @brief Set the transport type.
 
 @param client Pointer to client object.
-@param transport Either PLAYERC_TRANSPORT_UDP or PLAYERC_TRANSPORT_TCP
+@param transport PLAYERC_TRANSPORT_UDP, PLAYERC_TRANSPORT_TCP or
+PLAYERC_TRANSPORT_SHM.  PLAYERC_TRANSPORT_SHM only reaches a server on the
+same host, and ignores the host name.
 */
 PLAYERC_EXPORT void playerc_client_set_transport(playerc_client_t* client,
                                   unsigned int transport);
 
+/** @brief Receive data through the server's multicast group.
+
+Over UDP, a server started with the -m option can send the DATA messages
+for clients that ask for it to a multicast group once, rather than to
+each client in turn.  Call this after playerc_client_set_transport() and
+before playerc_client_connect().  Only applies in PUSH mode; replies and
+PULL mode data still come straight from the server.
+
+@param client Pointer to client object.
+@param group Multicast group address, as given to the server (NULL to
+stop using it).
+@param port Port of the group.
+
+@returns Returns 0 on success, non-zero if the transport is not UDP.
+*/
+PLAYERC_EXPORT int playerc_client_set_multicast(playerc_client_t* client,
+                                                const char* group, int port);
+
 /** @brief Connect to the server.
 
 @param client Pointer to client object.
@@ -789,6 +848,16 @@ currently queued data.
 */
 PLAYERC_EXPORT int playerc_client_internal_peek(playerc_client_t *client, int timeout);
 
+/** @brief Test to see if a complete message has already been read from
+ * the socket and is waiting to be decoded.
+
+@param client Pointer to client object.
+
+@returns Returns 1 if there is a buffered message, 0 otherwise.
+
+*/
+PLAYERC_EXPORT int playerc_client_internal_buffered(playerc_client_t *client);
+
 /** @brief Read data from the server (blocking).
 
 In PUSH mode this will read and process a single message. In PULL mode this
@@ -842,6 +911,25 @@ PLAYERC_EXPORT int playerc_client_write(playerc_client_t *client,
                          uint8_t subtype,
                          void *cmd, double* timestamp);
 
+/** @brief Write several messages to the server at once.
+
+The messages are encoded back to back and sent with a single send(),
+which is cheaper than one playerc_client_write() per message when, say,
+a control loop commands several devices every cycle.  The size and
+timestamp fields of each header are filled in.
+
+@param client Pointer to client object.
+@param headers Array of @p count message headers.
+@param data Array of @p count message bodies (entries may be NULL).
+@param count Number of messages.
+
+@returns 0 on success, -1 if any message could not be encoded (in which
+case nothing is sent) or sending failed.
+*/
+PLAYERC_EXPORT int playerc_client_write_many(playerc_client_t *client,
+                                             player_msghdr_t *headers,
+                                             void **data, int count);
+
 
 /** @} */
 /**************************************************************************/
@@ -2507,6 +2595,9 @@ PLAYERC_EXPORT int playerc_log_set_read_state(playerc_log_t* device, int state);
 /** @brief Rewind playback */
 PLAYERC_EXPORT int playerc_log_set_read_rewind(playerc_log_t* device);
 
+/** @brief Seek playback to the given log time (binary logs only) */
+PLAYERC_EXPORT int playerc_log_set_read_seek(playerc_log_t* device, double time);
+
 /** @brief Get logging/playback state.
 
 The result is written into the proxy.
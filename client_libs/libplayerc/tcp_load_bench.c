@@ -0,0 +1,187 @@
+/*
+ *  libplayerc : a Player client library
+ *  Copyright (C) Andrew Howard 2002-2003
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+/*
+ * $Id$
+ *
+ * Load test for the server's TCP client handling.  Connects a number of
+ * clients to a server, each in its own thread, subscribes every one of
+ * them to the same laser or camera, and counts the messages they receive
+ * (in PUSH mode) over a fixed period.  Run it against a server with a
+ * fast data source, such as
+ *
+ *   driver ( name "dummy" provides ["camera:0"] rate 200 )
+ *
+ * and compare the total and slowest-client rates with and without the
+ * server's -j option, for increasing numbers of clients.  With "shm", the
+ * clients connect through the shared-memory transport instead of TCP;
+ * with "udp", over UDP, and with "mcast", over UDP through the multicast
+ * group given to the server with -m (239.255.0.1:6660 here).
+ *
+ * Usage: tcp_load_bench [host] [port] [clients] [seconds] [laser|camera] [tcp|shm|udp|mcast]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "playerc.h"
+
+typedef struct
+{
+  const char* host;
+  int port;
+  int camera;
+  const char* transport;
+  double seconds;
+  int ok;
+  int count;
+  double bytes;
+} bench_client_t;
+
+static double
+now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return(tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+// Receive data on one client until the time is up
+static void*
+bench_client(void* arg)
+{
+  bench_client_t* b = (bench_client_t*)arg;
+  playerc_client_t* client;
+  playerc_laser_t* laser = NULL;
+  playerc_camera_t* camera = NULL;
+  void* proxy;
+  double start;
+
+  client = playerc_client_create(NULL, b->host, b->port);
+  if(!strcmp(b->transport, "shm"))
+    playerc_client_set_transport(client, PLAYERC_TRANSPORT_SHM);
+  else if(!strcmp(b->transport, "udp") || !strcmp(b->transport, "mcast"))
+    playerc_client_set_transport(client, PLAYERC_TRANSPORT_UDP);
+  if(!strcmp(b->transport, "mcast"))
+    playerc_client_set_multicast(client, "239.255.0.1", 6660);
+  if(playerc_client_connect(client) != 0)
+  {
+    playerc_client_destroy(client);
+    return(NULL);
+  }
+  playerc_client_datamode(client, PLAYER_DATAMODE_PUSH);
+
+  if(b->camera)
+  {
+    camera = playerc_camera_create(client, 0);
+    if(playerc_camera_subscribe(camera, PLAYER_OPEN_MODE) != 0)
+      goto done;
+  }
+  else
+  {
+    laser = playerc_laser_create(client, 0);
+    if(playerc_laser_subscribe(laser, PLAYER_OPEN_MODE) != 0)
+      goto done;
+  }
+
+  b->ok = 1;
+  start = now();
+  while(now() - start < b->seconds)
+  {
+    if(playerc_client_peek(client, 100) <= 0)
+      continue;
+    if(!(proxy = playerc_client_read(client)))
+      break;
+    b->count++;
+    if(camera && proxy == camera->info.id)
+      b->bytes += camera->image_count;
+    else if(laser && proxy == laser->info.id)
+      b->bytes += laser->scan_count * sizeof(double);
+  }
+
+done:
+  if(camera)
+  {
+    playerc_camera_unsubscribe(camera);
+    playerc_camera_destroy(camera);
+  }
+  if(laser)
+  {
+    playerc_laser_unsubscribe(laser);
+    playerc_laser_destroy(laser);
+  }
+  playerc_client_disconnect(client);
+  playerc_client_destroy(client);
+  return(NULL);
+}
+
+int
+main(int argc, char** argv)
+{
+  const char* host = (argc > 1) ? argv[1] : "localhost";
+  int port = (argc > 2) ? atoi(argv[2]) : 6665;
+  int num_clients = (argc > 3) ? atoi(argv[3]) : 8;
+  double seconds = (argc > 4) ? atof(argv[4]) : 5.0;
+  int camera = (argc > 5) && !strcmp(argv[5], "camera");
+  const char* transport = (argc > 6) ? argv[6] : "tcp";
+  bench_client_t* clients;
+  pthread_t* threads;
+  int i, ok = 0, total = 0, slowest = -1;
+  double bytes = 0;
+
+  if(num_clients < 1)
+    num_clients = 1;
+  clients = calloc(num_clients, sizeof(bench_client_t));
+  threads = calloc(num_clients, sizeof(pthread_t));
+
+  for(i=0;i<num_clients;i++)
+  {
+    clients[i].host = host;
+    clients[i].port = port;
+    clients[i].camera = camera;
+    clients[i].transport = transport;
+    clients[i].seconds = seconds;
+    pthread_create(threads + i, NULL, bench_client, clients + i);
+  }
+  for(i=0;i<num_clients;i++)
+  {
+    pthread_join(threads[i], NULL);
+    if(!clients[i].ok)
+      continue;
+    ok++;
+    total += clients[i].count;
+    bytes += clients[i].bytes;
+    if((slowest < 0) || (clients[i].count < slowest))
+      slowest = clients[i].count;
+  }
+
+  printf("%d/%d clients connected to %s:%d (%s, %s)\n", ok, num_clients,
+         host, port, camera ? "camera" : "laser", transport);
+  if(ok)
+    printf("%10.1f msg/s total %10.1f msg/s per client (slowest %.1f) %10.2f MB/s\n",
+           total / seconds, total / seconds / ok, slowest / seconds,
+           bytes / seconds / 1e6);
+
+  free(clients);
+  free(threads);
+  return(ok == num_clients ? 0 : 1);
+}
@@ -0,0 +1,516 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000
+ *     Brian Gerkey, Kasper Stoy, Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Desc: Shared-memory message ring for the local transport
+ * CVS: $Id$
+ */
+
+#if !defined (_GNU_SOURCE)
+  #define _GNU_SOURCE
+#endif
+#include <config.h>
+
+#include <string.h>
+#include <errno.h>
+
+#include <libplayercommon/error.h>
+#include "shmring.h"
+
+#if HAVE_MEMFD_CREATE && HAVE_SYS_EVENTFD_H
+  #define PLAYER_SHMRING_ENABLED 1
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <stdio.h>
+  #include <stddef.h>
+  #include <sys/stat.h>
+  #include <sys/socket.h>
+  #include <sys/un.h>
+  #include <sys/uio.h>
+  #include <sys/eventfd.h>
+#endif
+
+#define PLAYER_SHMRING_MAGIC 0x504c5352
+#define PLAYER_SHMRING_RECHDR 8
+#define PLAYER_SHMRING_ALIGN(n) (((n) + 7) & ~((size_t)7))
+
+int
+player_shmring_supported(void)
+{
+#if PLAYER_SHMRING_ENABLED
+  return(1);
+#else
+  return(0);
+#endif
+}
+
+#if PLAYER_SHMRING_ENABLED
+
+// Fill in the abstract address of the local socket for a port
+static socklen_t
+player_shmring_addr(struct sockaddr_un* addr, int port)
+{
+  int len;
+
+  memset(addr, 0, sizeof(struct sockaddr_un));
+  addr->sun_family = AF_UNIX;
+  // A leading NUL puts the name in the abstract namespace
+  len = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1,
+                 PLAYER_SHMRING_SOCKET_NAME, port);
+  return((socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + len));
+}
+
+int
+player_shmring_listen(int port)
+{
+  struct sockaddr_un addr;
+  socklen_t len;
+  int fd;
+
+  len = player_shmring_addr(&addr, port);
+  if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+  {
+    PLAYER_ERROR1("socket() failed: %s", strerror(errno));
+    return(-1);
+  }
+  if((bind(fd, (struct sockaddr*)&addr, len) < 0) || (listen(fd, 200) < 0))
+  {
+    PLAYER_ERROR2("failed to listen on local socket @%s: %s",
+                  addr.sun_path + 1, strerror(errno));
+    close(fd);
+    return(-1);
+  }
+  return(fd);
+}
+
+int
+player_shmring_connect(int port)
+{
+  struct sockaddr_un addr;
+  struct ucred cred;
+  socklen_t len, credlen;
+  int fd;
+
+  len = player_shmring_addr(&addr, port);
+  if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+  {
+    PLAYER_ERROR1("socket() failed: %s", strerror(errno));
+    return(-1);
+  }
+  if(connect(fd, (struct sockaddr*)&addr, len) < 0)
+  {
+    PLAYER_ERROR2("failed to connect to local socket @%s: %s",
+                  addr.sun_path + 1, strerror(errno));
+    close(fd);
+    return(-1);
+  }
+
+  // Anyone can bind the name first; don't take a ring from a stranger
+  credlen = sizeof(cred);
+  if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credlen) < 0)
+  {
+    PLAYER_ERROR1("failed to identify local server: %s", strerror(errno));
+    close(fd);
+    return(-1);
+  }
+  if((cred.uid != getuid()) && (cred.uid != 0))
+  {
+    PLAYER_ERROR2("local socket @%s belongs to another user (uid %u)",
+                  addr.sun_path + 1, (unsigned)cred.uid);
+    close(fd);
+    return(-1);
+  }
+  return(fd);
+}
+
+// Map the segment behind ring->memfd
+static int
+player_shmring_map(player_shmring_t* ring)
+{
+  void* addr;
+  if((addr = mmap(NULL, ring->maplen, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  ring->memfd, 0)) == MAP_FAILED)
+  {
+    PLAYER_ERROR1("failed to map message ring: %s", strerror(errno));
+    return(-1);
+  }
+  ring->hdr = (player_shmring_header_t*)addr;
+  ring->data = (char*)addr + sizeof(player_shmring_header_t);
+  return(0);
+}
+
+int
+player_shmring_create(player_shmring_t* ring, size_t size)
+{
+  memset(ring, 0, sizeof(player_shmring_t));
+  ring->memfd = ring->eventfd = -1;
+  if((size < 4 * PLAYER_SHMRING_RECHDR) || (size > 0x7ffffff8U))
+  {
+    PLAYER_ERROR1("invalid message ring size %lu", (unsigned long)size);
+    return(-1);
+  }
+  ring->size = PLAYER_SHMRING_ALIGN(size);
+  ring->maplen = sizeof(player_shmring_header_t) + ring->size;
+
+  if((ring->memfd = memfd_create("player-ring", MFD_CLOEXEC)) < 0)
+  {
+    PLAYER_ERROR1("memfd_create() failed: %s", strerror(errno));
+    return(-1);
+  }
+  if(ftruncate(ring->memfd, ring->maplen) < 0)
+  {
+    PLAYER_ERROR1("failed to size message ring: %s", strerror(errno));
+    player_shmring_destroy(ring);
+    return(-1);
+  }
+  if((ring->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+  {
+    PLAYER_ERROR1("eventfd() failed: %s", strerror(errno));
+    player_shmring_destroy(ring);
+    return(-1);
+  }
+  if(player_shmring_map(ring) < 0)
+  {
+    player_shmring_destroy(ring);
+    return(-1);
+  }
+  ring->hdr->magic = PLAYER_SHMRING_MAGIC;
+  ring->hdr->size = (uint32_t)ring->size;
+  ring->hdr->head = ring->hdr->tail = 0;
+  return(0);
+}
+
+int
+player_shmring_attach(player_shmring_t* ring, int memfd, int eventfd)
+{
+  player_shmring_header_t hdr;
+  struct stat st;
+
+  memset(ring, 0, sizeof(player_shmring_t));
+  ring->memfd = memfd;
+  ring->eventfd = eventfd;
+  // The segment has to be as big as the header says, or reading the ring
+  // would run off the end of the mapping
+  if(pread(memfd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+     hdr.magic != PLAYER_SHMRING_MAGIC ||
+     hdr.size < 4 * PLAYER_SHMRING_RECHDR || (hdr.size % 8) != 0 ||
+     fstat(memfd, &st) < 0 ||
+     (uint64_t)st.st_size < sizeof(player_shmring_header_t) + (uint64_t)hdr.size)
+  {
+    PLAYER_ERROR("invalid message ring");
+    player_shmring_destroy(ring);
+    return(-1);
+  }
+  ring->size = hdr.size;
+  ring->maplen = sizeof(player_shmring_header_t) + ring->size;
+  if(player_shmring_map(ring) < 0)
+  {
+    player_shmring_destroy(ring);
+    return(-1);
+  }
+  return(0);
+}
+
+void
+player_shmring_destroy(player_shmring_t* ring)
+{
+  if(ring->hdr)
+    munmap(ring->hdr, ring->maplen);
+  if(ring->memfd >= 0)
+    close(ring->memfd);
+  if(ring->eventfd >= 0)
+    close(ring->eventfd);
+  ring->hdr = NULL;
+  ring->data = NULL;
+  ring->memfd = ring->eventfd = -1;
+}
+
+size_t
+player_shmring_max_record(const player_shmring_t* ring)
+{
+  // Anything up to half the ring fits once the ring is empty, wherever
+  // the write position happens to be.
+  return(ring->size / 2 - PLAYER_SHMRING_RECHDR);
+}
+
+char*
+player_shmring_reserve(player_shmring_t* ring, size_t len)
+{
+  size_t need, pos, room;
+  uint64_t head, tail;
+
+  if(ring->broken || (len > player_shmring_max_record(ring)))
+    return(NULL);
+  need = PLAYER_SHMRING_RECHDR + PLAYER_SHMRING_ALIGN(len);
+  // The consumer can write anything into the shared header, so use our
+  // own head, and only trust a tail that lies within the last lap of it
+  head = ring->head;
+  tail = ring->hdr->tail;
+  if((tail % 8) || (tail > head) || (head - tail > ring->size))
+  {
+    ring->broken = 1;
+    return(NULL);
+  }
+  pos = head % ring->size;
+  room = ring->size - (size_t)(head - tail);
+
+  // Skip to the start if the record won't fit before the end
+  ring->skip = (pos + need > ring->size) ? ring->size - pos : 0;
+  if(ring->skip + need > room)
+    return(NULL);
+  if(ring->skip)
+  {
+    *(uint32_t*)(ring->data + pos) = PLAYER_SHMRING_WRAP;
+    pos = 0;
+  }
+  *(uint32_t*)(ring->data + pos) = (uint32_t)len;
+  return(ring->data + pos + PLAYER_SHMRING_RECHDR);
+}
+
+void
+player_shmring_commit(player_shmring_t* ring, size_t len)
+{
+  // The record must be visible before the new head
+  __sync_synchronize();
+  ring->head += ring->skip + PLAYER_SHMRING_RECHDR + PLAYER_SHMRING_ALIGN(len);
+  ring->hdr->head = ring->head;
+  ring->skip = 0;
+}
+
+void
+player_shmring_signal(player_shmring_t* ring)
+{
+  uint64_t one = 1;
+  if(write(ring->eventfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    PLAYER_WARN1("failed to signal message ring: %s", strerror(errno));
+}
+
+const char*
+player_shmring_peek(player_shmring_t* ring, size_t* len)
+{
+  uint64_t tail, head;
+  size_t pos;
+  uint32_t reclen;
+
+  if(ring->broken)
+    return(NULL);
+  for(;;)
+  {
+    tail = ring->hdr->tail;
+    head = ring->hdr->head;
+    if(tail == head)
+      return(NULL);
+    if(head - tail > ring->size)
+      goto broken;
+    // Read the record only after seeing the head that covers it
+    __sync_synchronize();
+    pos = tail % ring->size;
+    if(pos % 8)
+      goto broken;
+    reclen = *(uint32_t*)(ring->data + pos);
+    if(reclen != PLAYER_SHMRING_WRAP)
+      break;
+    ring->hdr->tail = tail + (ring->size - pos);
+  }
+  // Whatever the producer wrote, don't read past the ring
+  if((reclen > player_shmring_max_record(ring)) ||
+     (pos + PLAYER_SHMRING_RECHDR + reclen > ring->size))
+    goto broken;
+  *len = reclen;
+  return(ring->data + pos + PLAYER_SHMRING_RECHDR);
+
+broken:
+  ring->broken = 1;
+  return(NULL);
+}
+
+void
+player_shmring_release(player_shmring_t* ring, size_t len)
+{
+  // Finish with the record before handing its space back
+  __sync_synchronize();
+  ring->hdr->tail += PLAYER_SHMRING_RECHDR + PLAYER_SHMRING_ALIGN(len);
+}
+
+void
+player_shmring_clear_signal(player_shmring_t* ring)
+{
+  uint64_t count;
+  if(read(ring->eventfd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    PLAYER_WARN1("failed to clear message ring signal: %s", strerror(errno));
+}
+
+int
+player_shmring_send(int sock, const void* data, size_t len,
+                    const player_shmring_t* ring)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  char control[CMSG_SPACE(2 * sizeof(int))];
+  struct cmsghdr* cmsg;
+  int fds[2];
+
+  memset(&msg, 0, sizeof(msg));
+  memset(control, 0, sizeof(control));
+  iov.iov_base = (void*)data;
+  iov.iov_len = len;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+  fds[0] = ring->memfd;
+  fds[1] = ring->eventfd;
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  return(sendmsg(sock, &msg, 0));
+}
+
+int
+player_shmring_recv(int sock, void* data, size_t len, int* memfd, int* eventfd)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  char control[CMSG_SPACE(2 * sizeof(int))];
+  struct cmsghdr* cmsg;
+  int fds[2];
+  int ret;
+
+  *memfd = *eventfd = -1;
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = data;
+  iov.iov_len = len;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  if((ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0)
+    return(ret);
+  for(cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+  {
+    if((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS) &&
+       (cmsg->cmsg_len == CMSG_LEN(2 * sizeof(int))))
+    {
+      memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+      *memfd = fds[0];
+      *eventfd = fds[1];
+    }
+  }
+  return(ret);
+}
+
+#else
+
+int
+player_shmring_listen(int port)
+{
+  PLAYER_ERROR("shared-memory transport is not supported on this platform");
+  return(-1);
+}
+
+int
+player_shmring_connect(int port)
+{
+  PLAYER_ERROR("shared-memory transport is not supported on this platform");
+  return(-1);
+}
+
+int
+player_shmring_create(player_shmring_t* ring, size_t size)
+{
+  memset(ring, 0, sizeof(player_shmring_t));
+  ring->memfd = ring->eventfd = -1;
+  PLAYER_ERROR("shared-memory transport is not supported on this platform");
+  return(-1);
+}
+
+int
+player_shmring_attach(player_shmring_t* ring, int memfd, int eventfd)
+{
+  memset(ring, 0, sizeof(player_shmring_t));
+  ring->memfd = ring->eventfd = -1;
+  PLAYER_ERROR("shared-memory transport is not supported on this platform");
+  return(-1);
+}
+
+void
+player_shmring_destroy(player_shmring_t* ring)
+{
+}
+
+size_t
+player_shmring_max_record(const player_shmring_t* ring)
+{
+  return(0);
+}
+
+char*
+player_shmring_reserve(player_shmring_t* ring, size_t len)
+{
+  return(NULL);
+}
+
+void
+player_shmring_commit(player_shmring_t* ring, size_t len)
+{
+}
+
+void
+player_shmring_signal(player_shmring_t* ring)
+{
+}
+
+const char*
+player_shmring_peek(player_shmring_t* ring, size_t* len)
+{
+  return(NULL);
+}
+
+void
+player_shmring_release(player_shmring_t* ring, size_t len)
+{
+}
+
+void
+player_shmring_clear_signal(player_shmring_t* ring)
+{
+}
+
+int
+player_shmring_send(int sock, const void* data, size_t len,
+                    const player_shmring_t* ring)
+{
+  return(-1);
+}
+
+int
+player_shmring_recv(int sock, void* data, size_t len, int* memfd, int* eventfd)
+{
+  *memfd = *eventfd = -1;
+  return(-1);
+}
+
+#endif
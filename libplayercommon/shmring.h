@@ -0,0 +1,183 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000
+ *     Brian Gerkey, Kasper Stoy, Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Desc: Shared-memory message ring for the local transport
+ * CVS: $Id$
+ *
+ * A client on the same host as the server can connect through a Unix
+ * domain socket instead of TCP.  The socket is in the abstract namespace,
+ * so there is no file for another user to create first; since anyone can
+ * still bind the name, clients only trust a server run by the same user
+ * or by root.  The server then hands it (with
+ * SCM_RIGHTS) an anonymous shared memory segment holding a ring of
+ * messages, and an eventfd that it signals after adding messages.  The
+ * client sends its own messages down the socket as usual, but reads
+ * everything the server sends straight out of the ring, without going
+ * through the network stack.
+ *
+ * The ring has a single producer (the server) and a single consumer (the
+ * client).  Each record is a 32-bit length, 32 bits of padding and the
+ * message (XDR-encoded header and body, as on the wire), padded to a
+ * multiple of 8 bytes.  Records never wrap around the end of the ring;
+ * a length of PLAYER_SHMRING_WRAP sends the reader back to the start.
+ * Only available where memfd_create() and eventfd() are.
+ */
+
+#ifndef _PLAYER_SHMRING_H
+#define _PLAYER_SHMRING_H
+
+#if defined (WIN32)
+  #if defined (PLAYER_STATIC)
+    #define PLAYERCOMMON_EXPORT
+  #elif defined (playercommon_EXPORTS)
+    #define PLAYERCOMMON_EXPORT    __declspec (dllexport)
+  #else
+    #define PLAYERCOMMON_EXPORT    __declspec (dllimport)
+  #endif
+#else
+  #define PLAYERCOMMON_EXPORT
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Name (in the abstract namespace) of the Unix domain socket on which a
+    server accepts local clients for a port (the port number is
+    substituted). */
+#define PLAYER_SHMRING_SOCKET_NAME "player-%d"
+
+/** Default size of a client's ring (bytes).  Every local client gets a
+    ring of its own, and once messages have gone all the way round it the
+    whole ring stays resident, so each local client costs this much shared
+    memory.  The largest message that can be passed is a little under half
+    of the ring; bigger ones are dropped. */
+#define PLAYER_SHMRING_DEFAULT_SIZE (4 << 20)
+
+/** Record length that marks a jump back to the start of the ring */
+#define PLAYER_SHMRING_WRAP 0xffffffffU
+
+/** Shared ring header, at the start of the segment */
+typedef struct player_shmring_header
+{
+  /** PLAYER_SHMRING_MAGIC */
+  uint32_t magic;
+  /** Size of the data area (bytes) */
+  uint32_t size;
+  /** Total bytes ever added, written by the producer only */
+  volatile uint64_t head;
+  char pad0[48];
+  /** Total bytes ever consumed, written by the consumer only */
+  volatile uint64_t tail;
+  char pad1[56];
+} player_shmring_header_t;
+
+/** One side's view of a ring */
+typedef struct player_shmring
+{
+  /** Shared header, followed by the data area */
+  player_shmring_header_t* hdr;
+  char* data;
+  size_t size;
+  size_t maplen;
+  /** Shared memory segment and signalling eventfd */
+  int memfd;
+  int eventfd;
+  /** Producer's own count of bytes added; the copy in the header is
+      only published to the consumer, which could overwrite it */
+  uint64_t head;
+  /** Space (bytes) skipped at the end of the ring by the last reserve */
+  size_t skip;
+  /** Set on finding a record or position that can't be right (by the
+      consumer) or a tail that can't be right (by the producer); the ring
+      is of no further use */
+  int broken;
+} player_shmring_t;
+
+/** Is the local transport available on this platform? */
+PLAYERCOMMON_EXPORT int player_shmring_supported(void);
+
+/** Bind and listen on the local socket for a port (server side).  Returns
+    the socket, or -1. */
+PLAYERCOMMON_EXPORT int player_shmring_listen(int port);
+
+/** Connect to the local socket for a port (client side), and make sure
+    that the server on the other end is run by this user or by root.
+    Returns the socket, or -1. */
+PLAYERCOMMON_EXPORT int player_shmring_connect(int port);
+
+/** Create a ring of the given size (producer side).  The size is rounded
+    up to a multiple of 8 bytes, and must be at least 32 bytes and under
+    2GB.  Returns 0 on success. */
+PLAYERCOMMON_EXPORT int player_shmring_create(player_shmring_t* ring, size_t size);
+
+/** Map a ring that was passed over a socket (consumer side).  Takes
+    ownership of the descriptors.  Returns 0 on success. */
+PLAYERCOMMON_EXPORT int player_shmring_attach(player_shmring_t* ring, int memfd, int eventfd);
+
+/** Unmap a ring and close its descriptors */
+PLAYERCOMMON_EXPORT void player_shmring_destroy(player_shmring_t* ring);
+
+/** Largest record that the ring can hold */
+PLAYERCOMMON_EXPORT size_t player_shmring_max_record(const player_shmring_t* ring);
+
+/** Reserve contiguous room for a record of len bytes (producer).  Returns
+    NULL if the ring is too full, or if the consumer has left its tail
+    somewhere it can't be, in which case @p broken is set too. */
+PLAYERCOMMON_EXPORT char* player_shmring_reserve(player_shmring_t* ring, size_t len);
+
+/** Publish the record filled in after player_shmring_reserve() */
+PLAYERCOMMON_EXPORT void player_shmring_commit(player_shmring_t* ring, size_t len);
+
+/** Wake the consumer (producer) */
+PLAYERCOMMON_EXPORT void player_shmring_signal(player_shmring_t* ring);
+
+/** Get the next record, if there is one (consumer).  Returns a pointer to
+    the record and its length, or NULL.  A record that does not fit in the
+    ring sets @p broken and also returns NULL. */
+PLAYERCOMMON_EXPORT const char* player_shmring_peek(player_shmring_t* ring, size_t* len);
+
+/** Consume the record returned by player_shmring_peek() */
+PLAYERCOMMON_EXPORT void player_shmring_release(player_shmring_t* ring, size_t len);
+
+/** Clear a pending wakeup (consumer); check the ring again afterwards */
+PLAYERCOMMON_EXPORT void player_shmring_clear_signal(player_shmring_t* ring);
+
+/** Send data over a Unix domain socket along with the ring's
+    descriptors.  Returns the number of bytes sent, or -1. */
+PLAYERCOMMON_EXPORT int player_shmring_send(int sock, const void* data, size_t len,
+                                            const player_shmring_t* ring);
+
+/** Receive data sent with player_shmring_send(), and the descriptors that
+    came with it (-1 if none).  Returns the number of bytes received, or
+    -1. */
+PLAYERCOMMON_EXPORT int player_shmring_recv(int sock, void* data, size_t len,
+                                            int* memfd, int* eventfd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,235 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000
+ *     Brian Gerkey, Kasper Stoy, Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Desc: Fragmentation of messages into UDP datagrams
+ * CVS: $Id$
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "udpframe.h"
+
+static void
+player_udpframe_put32(char* p, uint32_t v)
+{
+  p[0] = (char)(v >> 24);
+  p[1] = (char)(v >> 16);
+  p[2] = (char)(v >> 8);
+  p[3] = (char)v;
+}
+
+static void
+player_udpframe_put16(char* p, uint16_t v)
+{
+  p[0] = (char)(v >> 8);
+  p[1] = (char)v;
+}
+
+static uint32_t
+player_udpframe_get32(const char* p)
+{
+  const unsigned char* u = (const unsigned char*)p;
+  return(((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16) |
+         ((uint32_t)u[2] << 8) | (uint32_t)u[3]);
+}
+
+static uint16_t
+player_udpframe_get16(const char* p)
+{
+  const unsigned char* u = (const unsigned char*)p;
+  return((uint16_t)((u[0] << 8) | u[1]));
+}
+
+static void
+player_udpframe_pack(char* dgram, const player_udpframe_hdr_t* hdr)
+{
+  player_udpframe_put32(dgram, hdr->seq);
+  player_udpframe_put32(dgram + 4, hdr->size);
+  player_udpframe_put32(dgram + 8, hdr->offset);
+  player_udpframe_put16(dgram + 12, hdr->index);
+  player_udpframe_put16(dgram + 14, hdr->count);
+  player_udpframe_put32(dgram + 16, hdr->flags);
+}
+
+int
+player_udpframe_unpack(const char* dgram, size_t len,
+                       player_udpframe_hdr_t* hdr)
+{
+  if(len < PLAYER_UDPFRAME_HDR_SIZE)
+    return(-1);
+  hdr->seq = player_udpframe_get32(dgram);
+  hdr->size = player_udpframe_get32(dgram + 4);
+  hdr->offset = player_udpframe_get32(dgram + 8);
+  hdr->index = player_udpframe_get16(dgram + 12);
+  hdr->count = player_udpframe_get16(dgram + 14);
+  hdr->flags = player_udpframe_get32(dgram + 16);
+
+  // A hello carries nothing else
+  if(!hdr->count)
+    return(0);
+  if((hdr->index >= hdr->count) ||
+     (hdr->offset > hdr->size) ||
+     (len - PLAYER_UDPFRAME_HDR_SIZE > hdr->size - hdr->offset))
+    return(-1);
+  return(0);
+}
+
+size_t
+player_udpframe_hello(char* dgram, uint32_t flags)
+{
+  player_udpframe_hdr_t hdr;
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.flags = flags;
+  player_udpframe_pack(dgram, &hdr);
+  return(PLAYER_UDPFRAME_HDR_SIZE);
+}
+
+size_t
+player_udpframe_build(char* dgram, uint32_t seq,
+                      const char* head, size_t headlen,
+                      const char* body, size_t bodylen,
+                      size_t offset)
+{
+  player_udpframe_hdr_t hdr;
+  size_t total = headlen + bodylen;
+  size_t len, n;
+  char* p;
+
+  assert(offset < total);
+  len = total - offset;
+  if(len > PLAYER_UDPFRAME_PAYLOAD)
+    len = PLAYER_UDPFRAME_PAYLOAD;
+
+  hdr.seq = seq;
+  hdr.size = (uint32_t)total;
+  hdr.offset = (uint32_t)offset;
+  hdr.index = (uint16_t)(offset / PLAYER_UDPFRAME_PAYLOAD);
+  hdr.count = (uint16_t)((total + PLAYER_UDPFRAME_PAYLOAD - 1) /
+                         PLAYER_UDPFRAME_PAYLOAD);
+  hdr.flags = 0;
+  player_udpframe_pack(dgram, &hdr);
+
+  // Copy in whatever part of each piece falls within this fragment
+  p = dgram + PLAYER_UDPFRAME_HDR_SIZE;
+  if(offset < headlen)
+  {
+    n = headlen - offset;
+    if(n > len)
+      n = len;
+    memcpy(p, head + offset, n);
+    p += n;
+    offset += n;
+  }
+  n = (dgram + PLAYER_UDPFRAME_HDR_SIZE + len) - p;
+  if(n)
+    memcpy(p, body + (offset - headlen), n);
+
+  return(PLAYER_UDPFRAME_HDR_SIZE + len);
+}
+
+void
+player_udpframe_reasm_init(player_udpframe_reasm_t* r, size_t maxsize)
+{
+  memset(r, 0, sizeof(player_udpframe_reasm_t));
+  r->maxsize = maxsize;
+}
+
+void
+player_udpframe_reasm_reset(player_udpframe_reasm_t* r)
+{
+  r->started = 0;
+  r->complete = 0;
+}
+
+void
+player_udpframe_reasm_free(player_udpframe_reasm_t* r)
+{
+  free(r->buf);
+  free(r->have);
+  r->buf = NULL;
+  r->have = NULL;
+  r->bufsize = r->havesize = 0;
+  player_udpframe_reasm_reset(r);
+}
+
+int
+player_udpframe_reasm_add(player_udpframe_reasm_t* r,
+                          const char* dgram, size_t len,
+                          const char** msg)
+{
+  player_udpframe_hdr_t hdr;
+  int32_t age;
+
+  if((player_udpframe_unpack(dgram, len, &hdr) < 0) ||
+     !hdr.count || (hdr.size > r->maxsize))
+    return(-1);
+
+  if(r->started)
+  {
+    // Serial number arithmetic, so that wrapping around is harmless
+    age = (int32_t)(hdr.seq - r->seq);
+    if((age < 0) || ((age == 0) && r->complete))
+      return(0);
+    if((age > 0) && !r->complete)
+      r->dropped++;
+  }
+  if(!r->started || (hdr.seq != r->seq))
+  {
+    // Start on a new message
+    if(hdr.size > r->bufsize)
+    {
+      r->buf = (char*)realloc(r->buf, hdr.size);
+      assert(r->buf);
+      r->bufsize = hdr.size;
+    }
+    if(hdr.count > r->havesize)
+    {
+      r->have = (unsigned char*)realloc(r->have, hdr.count);
+      assert(r->have);
+      r->havesize = hdr.count;
+    }
+    memset(r->have, 0, hdr.count);
+    r->started = 1;
+    r->complete = 0;
+    r->seq = hdr.seq;
+    r->size = hdr.size;
+    r->count = hdr.count;
+    r->received = 0;
+  }
+  else if((hdr.size != r->size) || (hdr.count != r->count))
+    return(-1);
+
+  if(r->have[hdr.index])
+    return(0);
+  memcpy(r->buf + hdr.offset, dgram + PLAYER_UDPFRAME_HDR_SIZE,
+         len - PLAYER_UDPFRAME_HDR_SIZE);
+  r->have[hdr.index] = 1;
+  if(++r->received < r->count)
+    return(0);
+
+  r->complete = 1;
+  *msg = r->buf;
+  return((int)r->size);
+}
@@ -0,0 +1,160 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000
+ *     Brian Gerkey, Kasper Stoy, Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Desc: Fragmentation of messages into UDP datagrams
+ * CVS: $Id$
+ *
+ * Over UDP, each message (XDR-encoded header and body, as on a TCP
+ * connection) is split into fragments of at most PLAYER_UDPFRAME_PAYLOAD
+ * bytes, each sent as one datagram behind a small frame header:
+ *
+ *   uint32 seq     sequence number of the message, per sender
+ *   uint32 size    length of the whole message
+ *   uint32 offset  where this fragment goes in the message
+ *   uint16 index   number of this fragment
+ *   uint16 count   number of fragments in the message
+ *   uint32 flags   PLAYER_UDPFRAME_* flags (hello datagrams only)
+ *
+ * all in network byte order.  Lost fragments are never retransmitted: the
+ * receiver holds one message at a time, and throws away an incomplete one
+ * as soon as a fragment of a newer one arrives.  For sensor data, the
+ * next message is worth more than the rest of an old one.
+ *
+ * A datagram with a count of zero carries no message.  A client sends one
+ * to say hello (instead of the empty datagram used before framing), with
+ * flags saying how it wants its data.
+ */
+
+#ifndef _PLAYER_UDPFRAME_H
+#define _PLAYER_UDPFRAME_H
+
+#if defined (WIN32)
+  #if defined (PLAYER_STATIC)
+    #define PLAYERCOMMON_EXPORT
+  #elif defined (playercommon_EXPORTS)
+    #define PLAYERCOMMON_EXPORT    __declspec (dllexport)
+  #else
+    #define PLAYERCOMMON_EXPORT    __declspec (dllimport)
+  #endif
+#else
+  #define PLAYERCOMMON_EXPORT
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Length of the frame header (bytes) */
+#define PLAYER_UDPFRAME_HDR_SIZE 20
+
+/** Most message bytes per datagram; with the frame, IP and UDP headers,
+    a datagram still fits in an Ethernet frame, so IP never has to
+    fragment it. */
+#define PLAYER_UDPFRAME_PAYLOAD 1400
+
+/** Largest datagram that will be sent */
+#define PLAYER_UDPFRAME_MAX_DATAGRAM (PLAYER_UDPFRAME_HDR_SIZE + PLAYER_UDPFRAME_PAYLOAD)
+
+/** Hello flag: send DATA messages to the server's multicast group instead
+    of to this client */
+#define PLAYER_UDPFRAME_MULTICAST 0x1
+
+/** Frame header */
+typedef struct player_udpframe_hdr
+{
+  uint32_t seq;
+  uint32_t size;
+  uint32_t offset;
+  uint16_t index;
+  uint16_t count;
+  uint32_t flags;
+} player_udpframe_hdr_t;
+
+/** Reassembly of the messages from one sender */
+typedef struct player_udpframe_reasm
+{
+  /** Largest message that will be accepted */
+  size_t maxsize;
+  /** The message being put together, and its allocated size */
+  char* buf;
+  size_t bufsize;
+  /** Which of its fragments have arrived, and its allocated size */
+  unsigned char* have;
+  size_t havesize;
+  /** Has any fragment arrived yet? */
+  int started;
+  /** Was the current message completed? */
+  int complete;
+  uint32_t seq;
+  uint32_t size;
+  uint16_t count;
+  uint16_t received;
+  /** Number of incomplete messages thrown away for newer ones */
+  uint32_t dropped;
+} player_udpframe_reasm_t;
+
+/** Unpack a frame header.  Returns 0 on success, or -1 if the datagram is
+    malformed. */
+PLAYERCOMMON_EXPORT int player_udpframe_unpack(const char* dgram, size_t len,
+                                               player_udpframe_hdr_t* hdr);
+
+/** Build a hello datagram in @p dgram (PLAYER_UDPFRAME_HDR_SIZE bytes) and
+    return its length. */
+PLAYERCOMMON_EXPORT size_t player_udpframe_hello(char* dgram, uint32_t flags);
+
+/** Build the datagram holding the fragment of a message that starts at
+    @p offset (a multiple of PLAYER_UDPFRAME_PAYLOAD) in @p dgram, which
+    must hold PLAYER_UDPFRAME_MAX_DATAGRAM bytes.  The message is given
+    in two pieces, @p head and @p body, either of which may be empty.
+    Returns the length of the datagram; the next fragment starts at
+    @p offset plus that length, less PLAYER_UDPFRAME_HDR_SIZE. */
+PLAYERCOMMON_EXPORT size_t player_udpframe_build(char* dgram, uint32_t seq,
+                                                 const char* head, size_t headlen,
+                                                 const char* body, size_t bodylen,
+                                                 size_t offset);
+
+/** Set up reassembly of messages of up to @p maxsize bytes */
+PLAYERCOMMON_EXPORT void player_udpframe_reasm_init(player_udpframe_reasm_t* r,
+                                                    size_t maxsize);
+
+/** Forget any message being put together (e.g., after reconnecting) */
+PLAYERCOMMON_EXPORT void player_udpframe_reasm_reset(player_udpframe_reasm_t* r);
+
+/** Free the reassembly buffers */
+PLAYERCOMMON_EXPORT void player_udpframe_reasm_free(player_udpframe_reasm_t* r);
+
+/** Add a received datagram.  Returns the length of the message once its
+    last fragment is in, pointing @p msg at it (it stays valid until the
+    next call); 0 if the message is not complete yet, or the datagram was
+    stale; or -1 if the datagram is malformed. */
+PLAYERCOMMON_EXPORT int player_udpframe_reasm_add(player_udpframe_reasm_t* r,
+                                                  const char* dgram, size_t len,
+                                                  const char** msg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
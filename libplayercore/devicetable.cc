@@ -240,11 +240,12 @@ DeviceTable::GetDevice(const char* str_addr,
 //
 // NOTE: this will call Update() once for each subscribed interface to a
 // multi-interface driver.
-void
+int
 DeviceTable::UpdateDevices()
 {
   Device* thisentry;
   Driver* dri;
+  int count = 0;
 
   // We don't lock here, on the assumption that the caller is also the only
   // thread that can make changes to the device table.
@@ -252,8 +253,13 @@ DeviceTable::UpdateDevices()
   {
     dri = thisentry->driver;
     if((dri->HasSubscriptions()) || dri->alwayson)
+    {
       dri->Update();
+      if(!dynamic_cast<ThreadedDriver*>(dri))
+        count++;
+    }
   }
+  return(count);
 }
 
 int
@@ -111,8 +111,9 @@ class PLAYERCORE_EXPORT DeviceTable
     int Size() {return(numdevices);}
 
     // Call ProcessMessages() on each non-threaded driver with non-zero
-    // subscriptions
-    void UpdateDevices();
+    // subscriptions.  Returns the number of non-threaded drivers updated,
+    // which need calling again periodically.
+    int UpdateDevices();
 
     // Subscribe to each device whose driver is marked 'alwayson'.  Returns
     // 0 on success, -1 on error (at least one driver failed to start).
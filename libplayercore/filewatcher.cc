@@ -26,6 +26,8 @@
  *      Author: tcollett
  */
 
+#include <config.h>
+
 #include <libplayercommon/playercommon.h>
 
 
@@ -35,12 +37,24 @@
 #include <assert.h>
 #include <math.h>
 #include <string.h>
+#include <errno.h>
 #if defined (WIN32)
   #include <windows.h>
 #else
   #include <sys/time.h>
+  #include <unistd.h>
+  #include <fcntl.h>
+#endif
+#if HAVE_SYS_EPOLL_H
+  #include <sys/epoll.h>
+#endif
+#if HAVE_SYS_EVENTFD_H
+  #include <sys/eventfd.h>
 #endif
 
+// Largest number of events to collect from one epoll_wait() call
+#define FILEWATCHER_MAX_EVENTS 64
+
 FileWatcher::FileWatcher()
 {
 	WatchedFilesArraySize = INITIAL_WATCHED_FILES_ARRAY_SIZE;
@@ -49,10 +63,62 @@ FileWatcher::FileWatcher()
 	assert(WatchedFiles);
 	pthread_mutex_init(&this->lock,NULL);
 
+	epollfd = -1;
+	wakefd[0] = wakefd[1] = -1;
+	wake_pending = 0;
+#if HAVE_SYS_EVENTFD_H
+	wakefd[0] = wakefd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wakefd[0] < 0)
+		PLAYER_WARN1("eventfd() failed, falling back to a pipe: %s", strerror(errno));
+#endif
+#if !defined (WIN32)
+	if (wakefd[0] < 0)
+	{
+		if (pipe(wakefd) == 0)
+		{
+			for (int ii = 0; ii < 2; ++ii)
+			{
+				fcntl(wakefd[ii], F_SETFL, fcntl(wakefd[ii], F_GETFL) | O_NONBLOCK);
+				fcntl(wakefd[ii], F_SETFD, FD_CLOEXEC);
+			}
+		}
+		else
+		{
+			PLAYER_WARN1("pipe() failed, Wake() will not work: %s", strerror(errno));
+			wakefd[0] = wakefd[1] = -1;
+		}
+	}
+#endif
+#if HAVE_SYS_EPOLL_H
+	epollfd = epoll_create(INITIAL_WATCHED_FILES_ARRAY_SIZE);
+	if (epollfd < 0)
+		PLAYER_WARN1("epoll_create() failed, falling back to select(): %s", strerror(errno));
+	else
+	{
+		fcntl(epollfd, F_SETFD, FD_CLOEXEC);
+		if (wakefd[0] >= 0)
+		{
+			struct epoll_event ev;
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.u64 = static_cast<uint32_t> (wakefd[0]) | (0xffffffffULL << 32);
+			if (epoll_ctl(epollfd, EPOLL_CTL_ADD, wakefd[0], &ev) < 0)
+				PLAYER_ERROR1("failed to watch the wakeup channel: %s", strerror(errno));
+		}
+	}
+#endif
 }
 
 FileWatcher::~FileWatcher()
 {
+#if !defined (WIN32)
+	if (epollfd >= 0)
+		close(epollfd);
+	if (wakefd[0] >= 0)
+		close(wakefd[0]);
+	if (wakefd[1] >= 0 && wakefd[1] != wakefd[0])
+		close(wakefd[1]);
+#endif
 	free(WatchedFiles);
 }
 
@@ -66,16 +132,111 @@ void FileWatcher::Unlock()
   pthread_mutex_unlock(&lock);
 }
 
+void FileWatcher::Wake()
+{
+#if !defined (WIN32)
+	if (wakefd[1] < 0)
+		return;
+	// Only the first call since the last Wait() needs to write anything
+	if (!__sync_bool_compare_and_swap(&wake_pending, 0, 1))
+		return;
+	uint64_t one = 1;
+	if (write(wakefd[1], &one, sizeof(one)) < 0 && errno != EAGAIN)
+		PLAYER_ERROR1("failed to wake file watcher: %s", strerror(errno));
+#endif
+}
+
+void FileWatcher::ClearWake()
+{
+#if !defined (WIN32)
+	// Reset the flag before draining: a Wake() that races with us then
+	// writes again rather than being lost
+	wake_pending = 0;
+	__sync_synchronize();
+	uint64_t buf;
+	while (read(wakefd[0], &buf, sizeof(buf)) > 0);
+#endif
+}
 
 int FileWatcher::Wait(double Timeout)
 {
 	Lock();
-	if (WatchedFilesArrayCount == 0)
+	// With nothing to watch, only a wakeup can end the wait
+	if (WatchedFilesArrayCount == 0 && wakefd[0] < 0)
 	{
 		PLAYER_ERROR("File watcher wait called with no files to watch");
 		Unlock();
 		return 0;
 	}
+	Unlock();
+
+	// Without a wakeup channel nobody can interrupt us, so keep polling
+	if (wakefd[0] < 0 && Timeout < 0)
+		Timeout = 0.01;
+
+	if (epollfd >= 0)
+		return WaitEpoll(Timeout);
+	return WaitSelect(Timeout);
+}
+
+int FileWatcher::WaitEpoll(double Timeout)
+{
+#if HAVE_SYS_EPOLL_H
+	struct epoll_event events[FILEWATCHER_MAX_EVENTS];
+	int ms = Timeout < 0 ? -1 : static_cast<int> (ceil(Timeout * 1e3));
+
+	// The registrations are persistent, so there is nothing to set up and the
+	// lock need not be held while waiting
+	int ret = epoll_wait(epollfd, events, FILEWATCHER_MAX_EVENTS, ms);
+	if (ret < 0)
+	{
+		// dont print a warning if we are ctrl+c'd
+		if (errno != EINTR)
+			PLAYER_ERROR2("epoll_wait failed in File Watcher: %d %s",errno,strerror(errno));
+		return ret;
+	}
+
+	int queueless_count = 0;
+
+	Lock();
+	for (int ii = 0; ii < ret; ++ii)
+	{
+		int fd = static_cast<int> (events[ii].data.u64 & 0xffffffffULL);
+		int first = static_cast<int> (events[ii].data.u64 >> 32);
+		uint32_t ev = events[ii].events;
+		if (first == -1)
+		{
+			ClearWake();
+			continue;
+		}
+		// The watches may have changed while we were not holding the lock
+		if (static_cast<size_t> (first) >= WatchedFilesArrayCount || WatchedFiles[first].fd != fd)
+			first = FindFirstWatch(fd);
+		for (int jj = first; jj >= 0; jj = WatchedFiles[jj].next)
+		{
+			struct fd_driver_pair & w = WatchedFiles[jj];
+			if ((w.Read && (ev & (EPOLLIN | EPOLLERR | EPOLLHUP))) ||
+					(w.Write && (ev & (EPOLLOUT | EPOLLERR))) ||
+					(w.Except && (ev & EPOLLPRI)))
+			{
+				if (w.queue != NULL)
+					w.queue->DataAvailable();
+				else
+					queueless_count++;
+			}
+		}
+	}
+	Unlock();
+
+	return queueless_count;
+#else
+	return WaitSelect(Timeout);
+#endif
+}
+
+int FileWatcher::WaitSelect(double Timeout)
+{
+	Lock();
 
 	// intialise our FD sets for the select call
 	fd_set ReadFds,WriteFds,ExceptFds;
@@ -99,6 +260,12 @@ int FileWatcher::Wait(double Timeout)
 				FD_SET(WatchedFiles[ii].fd,&ExceptFds);
 		}
 	}
+	if (wakefd[0] >= 0)
+	{
+		FD_SET(wakefd[0],&ReadFds);
+		if (wakefd[0] > maxfd)
+			maxfd = wakefd[0];
+	}
 
 	struct timeval t;
 	t.tv_sec = static_cast<int> (floor(Timeout));
@@ -109,7 +276,7 @@ int FileWatcher::Wait(double Timeout)
 	// not be able to match an event on a deleted fd, or will get spurious wake ups
 	// on a newly added fd all of which are non fatal
 	Unlock();
-	int ret = select (maxfd+1,&ReadFds,&WriteFds,&ExceptFds,&t);
+	int ret = select (maxfd+1,&ReadFds,&WriteFds,&ExceptFds,Timeout < 0 ? NULL : &t);
 
 	if (ret < 0)
 	{
@@ -123,6 +290,12 @@ int FileWatcher::Wait(double Timeout)
 		return 0;
 	}
 
+	if (wakefd[0] >= 0 && FD_ISSET(wakefd[0],&ReadFds))
+	{
+		ClearWake();
+		ret--;
+	}
+
 	Lock();
 
 	int queueless_count = 0;
@@ -161,6 +334,50 @@ int FileWatcher::Wait(double Timeout)
 	return queueless_count;
 }
 
+int FileWatcher::FindFirstWatch(int fd)
+{
+	// The watches on each fd are chained in index order, so the first one
+	// found is the head
+	for (unsigned int ii = 0; ii < WatchedFilesArrayCount; ++ii)
+		if (WatchedFiles[ii].fd == fd)
+			return ii;
+	return -1;
+}
+
+void FileWatcher::UpdateEpoll(int fd, int first, bool existed)
+{
+#if HAVE_SYS_EPOLL_H
+	if (epollfd < 0)
+		return;
+	if (first < 0)
+	{
+		if (epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, NULL) < 0 && errno != ENOENT && errno != EBADF)
+			PLAYER_WARN2("failed to stop watching fd %d: %s", fd, strerror(errno));
+		return;
+	}
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	for (int ii = first; ii >= 0; ii = WatchedFiles[ii].next)
+	{
+		if (WatchedFiles[ii].Read)
+			ev.events |= EPOLLIN;
+		if (WatchedFiles[ii].Write)
+			ev.events |= EPOLLOUT;
+		if (WatchedFiles[ii].Except)
+			ev.events |= EPOLLPRI;
+	}
+	ev.data.u64 = static_cast<uint32_t> (fd) | (static_cast<uint64_t> (first) << 32);
+	int ret = epoll_ctl(epollfd, existed ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev);
+	// closing an fd drops its registration, so an fd that was closed without
+	// being unwatched and then reused needs adding again
+	if (ret < 0 && existed && errno == ENOENT)
+		ret = epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev);
+	if (ret < 0)
+		PLAYER_ERROR2("failed to watch fd %d: %s", fd, strerror(errno));
+#endif
+}
+
 int FileWatcher::AddFileWatch(int fd, bool WatchRead, bool WatchWrite, bool WatchExcept)
 {
 	QueuePointer q;
@@ -196,11 +413,31 @@ int FileWatcher::AddFileWatch(int fd, QueuePointer & queue, bool WatchRead, bool
 		WatchedFilesArrayCount++;
 	}
 
+	int first = FindFirstWatch(fd);
+	int index = next_entry - WatchedFiles;
+
 	next_entry->fd = fd;
 	next_entry->queue = queue;
 	next_entry->Read = WatchRead;
 	next_entry->Write = WatchWrite;
 	next_entry->Except = WatchExcept;
+	next_entry->next = -1;
+
+	// link it into the chain of watches on this fd, keeping index order
+	if (first < 0 || index < first)
+	{
+		next_entry->next = first;
+		UpdateEpoll(fd, index, first >= 0);
+	}
+	else
+	{
+		int prev = first;
+		while (WatchedFiles[prev].next >= 0 && WatchedFiles[prev].next < index)
+			prev = WatchedFiles[prev].next;
+		next_entry->next = WatchedFiles[prev].next;
+		WatchedFiles[prev].next = index;
+		UpdateEpoll(fd, first, true);
+	}
 
 	Unlock();
 	return 0;
@@ -217,15 +454,21 @@ int FileWatcher::RemoveFileWatch(int fd, QueuePointer &queue, bool WatchRead, bo
 {
 	Lock();
 	// this finds the first matching entry and removes it. It only removes one entry so call remove for every add
-	for (unsigned int ii = 0; ii < WatchedFilesArrayCount; ++ii)
+	int prev = -1;
+	for (int ii = FindFirstWatch(fd); ii >= 0; prev = ii, ii = WatchedFiles[ii].next)
 	{
-		if (WatchedFiles[ii].fd == fd &&
-				WatchedFiles[ii].queue == queue &&
+		if (WatchedFiles[ii].queue == queue &&
 				WatchedFiles[ii].Read == WatchRead &&
 				WatchedFiles[ii].Write == WatchWrite &&
 				WatchedFiles[ii].Except == WatchExcept)
 		{
+			int first = prev < 0 ? WatchedFiles[ii].next : FindFirstWatch(fd);
+			if (prev >= 0)
+				WatchedFiles[prev].next = WatchedFiles[ii].next;
 			WatchedFiles[ii].fd = -1;
+			WatchedFiles[ii].next = -1;
+			WatchedFiles[ii].queue = QueuePointer();
+			UpdateEpoll(fd, first, true);
 			Unlock();
 			return 0;
 		}
@@ -233,4 +476,3 @@ int FileWatcher::RemoveFileWatch(int fd, QueuePointer &queue, bool WatchRead, bo
 	Unlock();
 	return -1;
 }
-
@@ -58,6 +58,8 @@ struct fd_driver_pair
 	bool Read;
 	bool Write;
 	bool Except;
+	/// Index of the next entry watching the same fd, or -1.
+	int next;
 };
 
 const size_t INITIAL_WATCHED_FILES_ARRAY_SIZE = 32;
@@ -68,7 +70,14 @@ public:
 	FileWatcher();
 	virtual ~FileWatcher();
 
+	/** Wait up to Timeout seconds (indefinitely if negative) for activity on
+	 * the watched files, or for a call to Wake().  Queues attached to ready
+	 * files are signalled; the return value is the number of ready files
+	 * without a queue. */
 	int Wait(double Timeout = 0);
+	/** Make a Wait() in progress, or else the next one, return straight
+	 * away.  May be called from any thread. */
+	void Wake();
 	int AddFileWatch(int fd, QueuePointer & queue, bool WatchRead = true, bool WatchWrite = false, bool WatchExcept = true);
 	int RemoveFileWatch(int fd, QueuePointer & queue, bool WatchRead = true, bool WatchWrite = false, bool WatchExcept = true);
 	int AddFileWatch(int fd, bool WatchRead = true, bool WatchWrite = false, bool WatchExcept = true);
@@ -79,6 +88,25 @@ private:
 	size_t WatchedFilesArraySize;
 	size_t WatchedFilesArrayCount;
 
+	/// epoll instance holding one registration per watched fd, or -1 if
+	/// select() is used.
+	int epollfd;
+	/// Read and write ends of the Wake() channel (the same eventfd twice
+	/// where available), or -1.
+	int wakefd[2];
+	/// Set while a wakeup is waiting to be consumed, so that repeated
+	/// Wake() calls cost one write.
+	volatile int wake_pending;
+
+	/// Find the entry that heads the list of watches on fd, or -1.
+	int FindFirstWatch(int fd);
+	/// Update the epoll registration of fd after its watches changed.
+	void UpdateEpoll(int fd, int first, bool existed);
+	/// Drain the Wake() channel.
+	void ClearWake();
+	int WaitSelect(double Timeout);
+	int WaitEpoll(double Timeout);
+
     /** @brief Lock access to watcher internals. */
     virtual void Lock(void);
     /** @brief Unlock access to watcher internals. */
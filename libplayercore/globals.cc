@@ -71,6 +71,7 @@ PLAYERCORE_EXPORT char playerversion[32];
 
 PLAYERCORE_EXPORT bool player_quit;
 PLAYERCORE_EXPORT bool player_quiet_startup;
+PLAYERCORE_EXPORT bool player_lockfree_queues;
 
 // global access to the cmdline arguments
 int player_argc;
@@ -90,6 +91,7 @@ player_globals_init()
   strncpy(playerversion, PLAYER_VERSION, sizeof(playerversion));
   player_quit = false;
   player_quiet_startup = false;
+  player_lockfree_queues = false;
 #if HAVE_PLAYERSD
   globalSD = player_sd_init();
 #endif
@@ -66,6 +66,8 @@ PLAYERCORE_EXPORT extern FileWatcher* fileWatcher;
 PLAYERCORE_EXPORT extern char playerversion[];
 PLAYERCORE_EXPORT extern bool player_quit;
 PLAYERCORE_EXPORT extern bool player_quiet_startup;
+// use lock-free client queues (see MessageQueue::SetLockFree())
+PLAYERCORE_EXPORT extern bool player_lockfree_queues;
 
 // global access to the command line arguments
 PLAYERCORE_EXPORT extern int player_argc;
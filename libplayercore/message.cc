@@ -45,7 +45,9 @@
 
 #include <pthread.h>
 #include <assert.h>
+#include <stddef.h>
 #include <string.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
 #include <time.h>
@@ -56,8 +58,229 @@
 #include <libplayerinterface/playerxdr.h>
 
 #include <libplayercore/message.h>
+#include <libplayercore/filewatcher.h>
+#include <libplayercore/globals.h>
 #include <replace/replace.h>
 
+#if defined (WIN32)
+  #include <windows.h>
+  #define MESSAGE_ATOMIC_INC(p) ((unsigned int)InterlockedIncrement((LONG volatile*)(p)))
+  #define MESSAGE_ATOMIC_DEC(p) ((unsigned int)InterlockedDecrement((LONG volatile*)(p)))
+  #define MESSAGE_ATOMIC_CAS(p,o,n) (InterlockedCompareExchange((LONG volatile*)(p),(n),(o)) == (o))
+  #define MESSAGE_ATOMIC_SYNC() MemoryBarrier()
+  #define MESSAGE_YIELD() Sleep(0)
+#else
+  #include <sched.h>
+  #define MESSAGE_YIELD() sched_yield()
+  #define MESSAGE_ATOMIC_INC(p) __sync_add_and_fetch((p),1)
+  #define MESSAGE_ATOMIC_DEC(p) __sync_sub_and_fetch((p),1)
+  #define MESSAGE_ATOMIC_CAS(p,o,n) __sync_bool_compare_and_swap((p),(o),(n))
+  #define MESSAGE_ATOMIC_SYNC() __sync_synchronize()
+#endif
+
+/// The part of a message that is shared between all of its copies.
+struct MessageBody
+{
+  /// Reference count.
+  unsigned int refcount;
+  /// Pointer to the message data.
+  uint8_t * data;
+  /// Signature of the data, needed to free it.
+  uint16_t interf;
+  uint8_t type, subtype;
+  /// Encoded payload (see Message::GetEncoded()).
+  char * encoded;
+  /// Length of @p encoded: -1 if not encoded yet, -2 while being stored.
+  volatile int encoded_len;
+};
+
+/** Free-list allocator for the small fixed-size objects that are created and
+destroyed for every message delivery (message bodies, Message objects and
+queue elements).
+
+Each thread keeps its own list of free blocks, so allocation and release
+normally take no lock at all.  Messages are typically allocated on a driver
+thread and released on the server thread, so a thread whose list grows too
+long hands a batch of blocks over to a shared list, from which threads whose
+own list is empty take a batch back. */
+class MessagePool
+{
+  public:
+    MessagePool(size_t _size) : size(_size), shared(NULL), shared_count(0)
+    {
+      if(this->size < sizeof(Node))
+        this->size = sizeof(Node);
+      pthread_mutex_init(&this->lock,NULL);
+      pthread_key_create(&this->key,MessagePool::ReleaseCache);
+    }
+
+    void * Alloc()
+    {
+      Cache * cache = this->GetCache();
+      if(!cache->head)
+        this->Refill(cache);
+      if(!cache->head)
+        return(malloc(this->size));
+      Node * node = cache->head;
+      cache->head = node->next;
+      cache->count--;
+      return(node);
+    }
+
+    void Free(void * ptr)
+    {
+      if(!ptr)
+        return;
+      Cache * cache = this->GetCache();
+      Node * node = (Node*)ptr;
+      node->next = cache->head;
+      cache->head = node;
+      if(++cache->count > MESSAGEPOOL_CACHE_MAX)
+        this->Spill(cache, MESSAGEPOOL_BATCH);
+    }
+
+  private:
+    /// Number of free blocks a thread keeps before returning a batch
+    static const size_t MESSAGEPOOL_CACHE_MAX = 512;
+    /// Number of blocks moved between a thread and the shared list at once
+    static const size_t MESSAGEPOOL_BATCH = 256;
+    /// Number of free blocks kept on the shared list; beyond that they are
+    /// released to the heap
+    static const size_t MESSAGEPOOL_SHARED_MAX = 65536;
+
+    struct Node { Node * next; };
+    struct Cache { MessagePool * pool; Node * head; size_t count; };
+
+    Cache * GetCache()
+    {
+      Cache * cache = (Cache*)pthread_getspecific(this->key);
+      if(!cache)
+      {
+        cache = (Cache*)calloc(1,sizeof(Cache));
+        assert(cache);
+        cache->pool = this;
+        pthread_setspecific(this->key,cache);
+      }
+      return(cache);
+    }
+
+    // Take a batch of blocks from the shared list
+    void Refill(Cache * cache)
+    {
+      pthread_mutex_lock(&this->lock);
+      while(this->shared && cache->count < MESSAGEPOOL_BATCH)
+      {
+        Node * node = this->shared;
+        this->shared = node->next;
+        this->shared_count--;
+        node->next = cache->head;
+        cache->head = node;
+        cache->count++;
+      }
+      pthread_mutex_unlock(&this->lock);
+    }
+
+    // Give (up to) n blocks back to the shared list
+    void Spill(Cache * cache, size_t n)
+    {
+      pthread_mutex_lock(&this->lock);
+      while(cache->head && n--)
+      {
+        Node * node = cache->head;
+        cache->head = node->next;
+        cache->count--;
+        if(this->shared_count < MESSAGEPOOL_SHARED_MAX)
+        {
+          node->next = this->shared;
+          this->shared = node;
+          this->shared_count++;
+        }
+        else
+          free(node);
+      }
+      pthread_mutex_unlock(&this->lock);
+    }
+
+    // Called when a thread exits
+    static void ReleaseCache(void * ptr)
+    {
+      Cache * cache = (Cache*)ptr;
+      cache->pool->Spill(cache, cache->count);
+      free(cache);
+    }
+
+    size_t size;
+    pthread_key_t key;
+    pthread_mutex_t lock;
+    Node * shared;
+    size_t shared_count;
+};
+
+// The pools are created on first use and never destroyed, so that messages
+// can safely be released during static destruction.
+static pthread_once_t message_pools_once = PTHREAD_ONCE_INIT;
+static MessagePool * body_pool = NULL;
+static MessagePool * message_pool = NULL;
+static MessagePool * element_pool = NULL;
+
+static void
+message_pools_init(void)
+{
+  body_pool = new MessagePool(sizeof(MessageBody));
+  message_pool = new MessagePool(sizeof(Message));
+  element_pool = new MessagePool(sizeof(MessageQueueElement));
+}
+
+static MessageBody *
+message_body_alloc(void)
+{
+  pthread_once(&message_pools_once, message_pools_init);
+  MessageBody * body = (MessageBody*)body_pool->Alloc();
+  assert(body);
+  return(body);
+}
+
+void *
+Message::operator new(size_t size)
+{
+  pthread_once(&message_pools_once, message_pools_init);
+  // Derived classes are bigger than the pooled blocks
+  if(size != sizeof(Message))
+    return(::operator new(size));
+  void * ptr = message_pool->Alloc();
+  assert(ptr);
+  return(ptr);
+}
+
+void
+Message::operator delete(void * ptr, size_t size)
+{
+  if(size != sizeof(Message))
+    ::operator delete(ptr);
+  else
+    message_pool->Free(ptr);
+}
+
+void *
+MessageQueueElement::operator new(size_t size)
+{
+  pthread_once(&message_pools_once, message_pools_init);
+  if(size != sizeof(MessageQueueElement))
+    return(::operator new(size));
+  void * ptr = element_pool->Alloc();
+  assert(ptr);
+  return(ptr);
+}
+
+void
+MessageQueueElement::operator delete(void * ptr, size_t size)
+{
+  if(size != sizeof(MessageQueueElement))
+    ::operator delete(ptr);
+  else
+    element_pool->Free(ptr);
+}
+
 Message::Message(const struct player_msghdr & aHeader,
                   void * data,
                   bool copy)
@@ -75,19 +298,13 @@ Message::Message(const struct player_msghdr & aHeader,
 
 Message::Message(const Message & rhs)
 {
-  assert(rhs.Lock);
-  pthread_mutex_lock(rhs.Lock);
-
-  assert(rhs.RefCount);
-  assert(*(rhs.RefCount));
-  Lock = rhs.Lock;
-  Data = rhs.Data;
+  assert(rhs.Body);
+  assert(rhs.Body->refcount);
+  MESSAGE_ATOMIC_INC(&rhs.Body->refcount);
+  Body = rhs.Body;
   Header = rhs.Header;
   Queue = rhs.Queue;
-  RefCount = rhs.RefCount;
-  (*RefCount)++;
-
-  pthread_mutex_unlock(rhs.Lock);
+  RefCount = &Body->refcount;
 }
 
 Message::~Message()
@@ -99,18 +316,20 @@ void Message::CreateMessage(const struct player_msghdr & aHeader,
                   void * data,
                   bool copy)
 {
-  this->Lock = new pthread_mutex_t;
-  assert(this->Lock);
-  pthread_mutex_init(this->Lock,NULL);
-  this->RefCount = new unsigned int;
-  assert(this->RefCount);
-  *this->RefCount = 1;
+  this->Body = message_body_alloc();
+  this->Body->refcount = 1;
+  this->Body->data = NULL;
+  this->Body->encoded = NULL;
+  this->Body->encoded_len = -1;
+  this->RefCount = &this->Body->refcount;
 
   // copy the header and then the data into out message data buffer
   memcpy(&this->Header,&aHeader,sizeof(struct player_msghdr));
+  this->Body->interf = Header.addr.interf;
+  this->Body->type = Header.type;
+  this->Body->subtype = Header.subtype;
   if (data == NULL)
   {
-    Data = NULL;
     Header.size = 0;
     return;
   }
@@ -126,23 +345,28 @@ void Message::CreateMessage(const struct player_msghdr & aHeader,
     player_clone_fn_t clonefunc = NULL;
     if((clonefunc = playerxdr_get_clonefunc(Header.addr.interf, Header.type, Header.subtype)) != NULL)
     {
-      if ((this->Data = (uint8_t*)(*clonefunc)(data)) == NULL)
+      if ((this->Body->data = (uint8_t*)(*clonefunc)(data)) == NULL)
       {
         PLAYER_ERROR3 ("failed to clone message %s: %s, %d", interf_to_str (Header.addr.interf), msgtype_to_str (Header.type), Header.subtype);
       }
     }
     else
     {
-      this->Data = NULL;
       PLAYER_ERROR5 ("failed to find clone function for  message %s[%d]: %s[%d], %d", interf_to_str (Header.addr.interf),Header.addr.interf, msgtype_to_str (Header.type), Header.type, Header.subtype);
     }
   }
   else
   {
-    this->Data = (uint8_t*)data;
+    this->Body->data = (uint8_t*)data;
   }
 }
 
+void*
+Message::GetPayload()
+{
+  return((void*)this->Body->data);
+}
+
 bool
 Message::Compare(Message &other)
 {
@@ -154,32 +378,100 @@ Message::Compare(Message &other)
                                otherhdr->addr));
 };
 
+int
+Message::GetEncoded(const char ** buf)
+{
+  int len = this->Body->encoded_len;
+  if(len < 0)
+    return(-1);
+  MESSAGE_ATOMIC_SYNC();
+  *buf = this->Body->encoded;
+  return(len);
+}
+
+int
+Message::SetEncoded(char * buf, int len, const char ** cached)
+{
+  if(MESSAGE_ATOMIC_CAS(&this->Body->encoded_len, -1, -2))
+  {
+    this->Body->encoded = buf;
+    MESSAGE_ATOMIC_SYNC();
+    this->Body->encoded_len = len;
+  }
+  else
+  {
+    // Another thread got there first; wait for it to finish storing
+    free(buf);
+    while(this->Body->encoded_len < 0)
+      MESSAGE_ATOMIC_SYNC();
+  }
+  return(this->GetEncoded(cached));
+}
+
 void
 Message::DecRef()
 {
-  pthread_mutex_lock(Lock);
-  (*RefCount)--;
-  assert((*RefCount) >= 0);
-  if((*RefCount)==0)
+  if(!this->Body)
+    return;
+  if(MESSAGE_ATOMIC_DEC(&this->Body->refcount) == 0)
   {
-    if (Data)
-      playerxdr_free_message (Data, Header.addr.interf, Header.type, Header.subtype);
-    Data = NULL;
-    delete RefCount;
-    RefCount = NULL;
-    pthread_mutex_unlock(Lock);
-    pthread_mutex_destroy(Lock);
-    delete Lock;
-    Lock = NULL;
+    if (this->Body->data)
+      playerxdr_free_message (this->Body->data, this->Body->interf,
+                              this->Body->type, this->Body->subtype);
+    free(this->Body->encoded);
+    body_pool->Free(this->Body);
   }
-  else
-    pthread_mutex_unlock(Lock);
+  this->Body = NULL;
+  this->RefCount = NULL;
+}
+
+/// A slot in the lock-free ring of a MessageQueue.  Producers claim slots
+/// by advancing ring_head with a compare-and-swap; @p seq tells the
+/// consumer whether the message in the slot has been stored yet (see
+/// Dmitry Vyukov's bounded MPMC queue).
+struct MessageRingCell
+{
+  volatile size_t seq;
+  Message * msg;
+};
+
+/// A cached CheckReplace() result for one message signature.
+struct MessageReplaceCacheEntry
+{
+  player_devaddr_t addr;
+  uint8_t type, subtype;
+  bool used;
+  int replace;
+};
+
+// Initial number of buckets in a queue's signature index and replace cache
+#define MESSAGE_INDEX_INITIAL 16
+// The replace cache is flushed rather than grown beyond this many entries
+#define MESSAGE_REPLACE_CACHE_MAX 4096
+
+/// Hash of a message's (addr,type,subtype) signature.
+static uint32_t
+message_signature_hash(const player_msghdr_t* hdr)
+{
+  uint32_t h = hdr->addr.host;
+  h = h * 0x01000193 ^ hdr->addr.robot;
+  h = h * 0x01000193 ^ (((uint32_t)hdr->addr.interf << 16) | hdr->addr.index);
+  h = h * 0x01000193 ^ (((uint32_t)hdr->type << 8) | hdr->subtype);
+  // murmur3 finalizer
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return(h);
 }
 
 MessageQueueElement::MessageQueueElement()
 {
   msg = NULL;
   prev = next = NULL;
+  sig_prev = sig_next = bucket_next = NULL;
+  hash = 0;
 }
 
 MessageQueueElement::~MessageQueueElement()
@@ -202,11 +494,26 @@ MessageQueue::MessageQueue(bool _Replace, size_t _Maxlen)
   this->data_requested = false;
   this->data_delivered = false;
   this->drop_count = 0;
+  this->lockfree = false;
+  this->ring = NULL;
+  this->ring_mask = 0;
+  this->ring_head = this->ring_tail = 0;
+  this->waiters = 0;
+  this->wake_watcher = NULL;
+  this->replaceCache_mask = MESSAGE_INDEX_INITIAL - 1;
+  this->replaceCache = new MessageReplaceCacheEntry[this->replaceCache_mask + 1];
+  this->ClearReplaceCache();
+  this->index_mask = MESSAGE_INDEX_INITIAL - 1;
+  this->index = new MessageQueueElement*[this->index_mask + 1];
+  memset(this->index, 0, (this->index_mask + 1) * sizeof(MessageQueueElement*));
+  this->index_count = 0;
 }
 
 MessageQueue::~MessageQueue()
 {
   // clear the queue
+  this->RingDrain(true);
+  delete [] this->ring;
   MessageQueueElement *e, *n;
   for(e = this->head; e;)
   {
@@ -225,6 +532,8 @@ MessageQueue::~MessageQueue()
     delete curr;
     curr = tmp;
   }
+  delete [] this->replaceCache;
+  delete [] this->index;
 
   pthread_mutex_destroy(&this->lock);
   pthread_mutex_destroy(&this->condMutex);
@@ -237,12 +546,16 @@ MessageQueue::AddReplaceRule(int _host, int _robot, int _interf, int _index,
                              int _type, int _subtype, int _replace)
 {
   MessageReplaceRule* curr;
+  this->Lock();
+  // Cached decisions may no longer hold
+  this->ClearReplaceCache();
   for(curr=this->replaceRules;curr;curr=curr->next)
   {
     // Check for an existing rule with the same criteria; replace if found
     if (curr->Equivalent (_host, _robot, _interf, _index, _type, _subtype))
     {
       curr->replace = _replace;
+      this->Unlock();
       return;
     }
 	if (curr->next == NULL)
@@ -265,6 +578,7 @@ MessageQueue::AddReplaceRule(int _host, int _robot, int _interf, int _index,
     if (!curr->next)
       PLAYER_ERROR ("memory allocation failure; could not add new replace rule");
   }
+  this->Unlock();
 }
 
 /// @brief Add a replacement rule to the list
@@ -276,8 +590,98 @@ MessageQueue::AddReplaceRule(const player_devaddr_t &device,
                         _type, _subtype, _replace);
 }
 
+void
+MessageQueue::SetReplace(bool _Replace)
+{
+  this->Lock();
+  this->Replace = _Replace;
+  this->ClearReplaceCache();
+  this->Unlock();
+}
+
+void
+MessageQueue::ClearReplaceCache()
+{
+  for(size_t i=0;i<=this->replaceCache_mask;i++)
+    this->replaceCache[i].used = false;
+  this->replaceCache_count = 0;
+}
+
 int
 MessageQueue::CheckReplace(player_msghdr_t* hdr)
+{
+  this->Lock();
+  int replaceOp = this->CheckReplaceLocked(hdr, message_signature_hash(hdr));
+  this->Unlock();
+  return(replaceOp);
+}
+
+int
+MessageQueue::CheckReplaceLocked(player_msghdr_t* hdr, uint32_t hash)
+{
+  // Most messages have a signature that has been seen before
+  size_t i;
+  for(i = hash & this->replaceCache_mask;
+      this->replaceCache[i].used;
+      i = (i + 1) & this->replaceCache_mask)
+  {
+    MessageReplaceCacheEntry* entry = this->replaceCache + i;
+    if(entry->type == hdr->type && entry->subtype == hdr->subtype &&
+       entry->addr.host == hdr->addr.host &&
+       entry->addr.robot == hdr->addr.robot &&
+       entry->addr.interf == hdr->addr.interf &&
+       entry->addr.index == hdr->addr.index)
+      return(entry->replace);
+  }
+
+  int replaceOp = this->CheckReplaceRules(hdr);
+
+  // Keep the table at most half full
+  if(2 * (this->replaceCache_count + 1) > this->replaceCache_mask + 1)
+  {
+    size_t size = this->replaceCache_mask + 1;
+    if(size < MESSAGE_REPLACE_CACHE_MAX)
+    {
+      MessageReplaceCacheEntry* old = this->replaceCache;
+      this->replaceCache = new MessageReplaceCacheEntry[2 * size];
+      this->replaceCache_mask = 2 * size - 1;
+      this->ClearReplaceCache();
+      for(size_t j=0;j<size;j++)
+      {
+        if(!old[j].used)
+          continue;
+        player_msghdr_t oldhdr;
+        oldhdr.addr = old[j].addr;
+        oldhdr.type = old[j].type;
+        oldhdr.subtype = old[j].subtype;
+        size_t k;
+        for(k = message_signature_hash(&oldhdr) & this->replaceCache_mask;
+            this->replaceCache[k].used;
+            k = (k + 1) & this->replaceCache_mask);
+        this->replaceCache[k] = old[j];
+        this->replaceCache_count++;
+      }
+      delete [] old;
+    }
+    else
+      this->ClearReplaceCache();
+    for(i = hash & this->replaceCache_mask;
+        this->replaceCache[i].used;
+        i = (i + 1) & this->replaceCache_mask);
+  }
+
+  MessageReplaceCacheEntry* entry = this->replaceCache + i;
+  entry->addr = hdr->addr;
+  entry->type = hdr->type;
+  entry->subtype = hdr->subtype;
+  entry->replace = replaceOp;
+  entry->used = true;
+  this->replaceCache_count++;
+  return(replaceOp);
+}
+
+int
+MessageQueue::CheckReplaceRules(player_msghdr_t* hdr)
 {
   // First look through the replacement rules
   for(MessageReplaceRule* curr=this->replaceRules;curr;curr=curr->next)
@@ -307,6 +711,14 @@ MessageQueue::CheckReplace(player_msghdr_t* hdr)
   }
 }
 
+// Cleanup handler for Wait(), in case the thread is cancelled while waiting
+static void
+message_queue_wait_cleanup(void * arg)
+{
+  MessageQueue * q = (MessageQueue*)arg;
+  q->WaitDone();
+}
+
 // Waits on the condition variable associated with this queue.
 bool
 MessageQueue::Wait(double TimeOut)
@@ -314,8 +726,19 @@ MessageQueue::Wait(double TimeOut)
   bool result = true;
   MessageQueueElement* el;
 
+  // need to push this cleanup function, cause if a thread is cancelled while
+  // in pthread_cond_wait(), it will immediately relock the mutex.  thus we
+  // need to unlock ourselves before exiting.
+  pthread_cleanup_push(message_queue_wait_cleanup, (void*)this);
+  pthread_mutex_lock(&this->condMutex);
+
+  // Announce that we are waiting before checking for data, so that a
+  // Push() either sees us waiting or we see its message.
+  MESSAGE_ATOMIC_INC(&this->waiters);
+
   // don't wait if there's data on the queue
   this->Lock();
+  this->RingDrain(false);
   // start at the head and traverse the queue until a filter-friendly
   // message is found
   for(el = this->head; el; el = el->next)
@@ -324,37 +747,38 @@ MessageQueue::Wait(double TimeOut)
       break;
   }
   this->Unlock();
-  if(el)
-    return result;
 
-  // need to push this cleanup function, cause if a thread is cancelled while
-  // in pthread_cond_wait(), it will immediately relock the mutex.  thus we
-  // need to unlock ourselves before exiting.
-  pthread_cleanup_push((void(*)(void*))pthread_mutex_unlock,
-                       (void*)&this->condMutex);
-  pthread_mutex_lock(&this->condMutex);
-  if (TimeOut > 0)
-  {
-    struct timespec tp;
-    clock_gettime(CLOCK_REALTIME, &tp);
-    TimeOut += static_cast<double> (tp.tv_nsec) * 1e-9;
-    tp.tv_sec += static_cast<int> (floor(TimeOut));
-    tp.tv_nsec = static_cast<int> ((TimeOut - floor(TimeOut))*1e9);
-    int ret = pthread_cond_timedwait(&this->cond, &this->condMutex, &tp);
-    // if we got an error or timed out
-    if (ret != 0)
-      result = false;
-  }
-  else
+  if(!el)
   {
-    pthread_cond_wait(&this->cond,&this->condMutex);
+    if (TimeOut > 0)
+    {
+      struct timespec tp;
+      clock_gettime(CLOCK_REALTIME, &tp);
+      TimeOut += static_cast<double> (tp.tv_nsec) * 1e-9;
+      tp.tv_sec += static_cast<int> (floor(TimeOut));
+      tp.tv_nsec = static_cast<int> ((TimeOut - floor(TimeOut))*1e9);
+      int ret = pthread_cond_timedwait(&this->cond, &this->condMutex, &tp);
+      // if we got an error or timed out
+      if (ret != 0)
+        result = false;
+    }
+    else
+    {
+      pthread_cond_wait(&this->cond,&this->condMutex);
+    }
   }
 
-  pthread_mutex_unlock(&this->condMutex);
-  pthread_cleanup_pop(0);
+  pthread_cleanup_pop(1);
   return result;
 }
 
+void
+MessageQueue::WaitDone(void)
+{
+  MESSAGE_ATOMIC_DEC(&this->waiters);
+  pthread_mutex_unlock(&this->condMutex);
+}
+
 bool
 MessageQueue::Filter(Message& msg)
 {
@@ -393,7 +817,7 @@ MessageQueue::GetLength(void)
 {
   size_t len;
   this->Lock();
-  len = this->Length;
+  len = this->Length + (this->ring_head - this->ring_tail);
   this->Unlock();
   return(len);
 }
@@ -405,12 +829,24 @@ MessageQueue::ClearFilter(void)
 }
 
 
+void
+MessageQueue::SetWakeFileWatcher(bool _wake)
+{
+  this->wake_watcher = _wake ? fileWatcher : NULL;
+}
+
 // Signal that new data is available (calls pthread_cond_broadcast()
 // on this device's condition variable, which will release other
 // devices that are waiting on this one).
 void
 MessageQueue::DataAvailable(void)
 {
+  if(this->wake_watcher)
+    this->wake_watcher->Wake();
+  // Nobody to wake?  (Pairs with the increment in Wait().)
+  MESSAGE_ATOMIC_SYNC();
+  if(this->waiters == 0)
+    return;
   pthread_mutex_lock(&this->condMutex);
   pthread_cond_broadcast(&this->cond);
   pthread_mutex_unlock(&this->condMutex);
@@ -437,21 +873,10 @@ MessageQueue::PushFront(Message & msg, bool haveLock)
 {
   if(!haveLock)
     this->Lock();
+  this->RingDrain(false);
   MessageQueueElement* newelt = new MessageQueueElement();
   newelt->msg = new Message(msg);
-  if(!this->tail)
-  {
-    this->head = this->tail = newelt;
-    newelt->prev = newelt->next = NULL;
-  }
-  else
-  {
-    newelt->prev = NULL;
-    newelt->next = this->head;
-    this->head->prev = newelt;
-    this->head = newelt;
-  }
-  this->Length++;
+  this->Insert(newelt, false);
   if(!haveLock)
     this->Unlock();
 }
@@ -465,21 +890,10 @@ MessageQueue::PushBack(Message & msg, bool haveLock)
 {
   if(!haveLock)
     this->Lock();
+  this->RingDrain(true);
   MessageQueueElement* newelt = new MessageQueueElement();
   newelt->msg = new Message(msg);
-  if(!this->tail)
-  {
-    this->head = this->tail = newelt;
-    newelt->prev = newelt->next = NULL;
-  }
-  else
-  {
-    this->tail->next = newelt;
-    newelt->prev = this->tail;
-    newelt->next = NULL;
-    this->tail = newelt;
-  }
-  this->Length++;
+  this->Insert(newelt, true);
   if(!haveLock)
     this->Unlock();
 }
@@ -490,10 +904,36 @@ MessageQueue::Push(Message & msg)
   player_msghdr_t* hdr;
 
   assert(*msg.RefCount);
-  this->Lock();
   hdr = msg.GetHeader();
+
+  // Common case: nothing about this queue requires looking at what is
+  // already on it
+  if(this->lockfree && !this->replaceRules && !this->Replace &&
+     !this->filter_on && !this->pull)
+  {
+    bool dropped = false;
+    if((hdr->type == PLAYER_MSGTYPE_DATA || hdr->type == PLAYER_MSGTYPE_CMD) &&
+       this->Length + (this->ring_head - this->ring_tail) >= this->Maxlen)
+    {
+      // record the fact that we are dropping a message
+      this->drop_count++;
+      dropped = true;
+    }
+    if(dropped || this->RingPush(msg))
+    {
+      if(!dropped)
+        this->DataAvailable();
+      return(true);
+    }
+    // The ring is full; fall through to the locked path
+  }
+
+  this->Lock();
+  // Anything still on the ring was pushed before this message
+  this->RingDrain(true);
   // Should we try to replace an older message of the same signature?
-  int replaceOp = this->CheckReplace(hdr);
+  uint32_t hash = message_signature_hash(hdr);
+  int replaceOp = this->CheckReplaceLocked(hdr, hash);
   // if our queue is over size discard any data or command packets
   // if we discard requests or replies this will potentially lock up the client so we will let those through
   if (PLAYER_PLAYER_MSG_REPLACE_RULE_IGNORE == replaceOp)
@@ -512,17 +952,12 @@ MessageQueue::Push(Message & msg)
   }
   else if (replaceOp == PLAYER_PLAYER_MSG_REPLACE_RULE_REPLACE)
   {
-    for(MessageQueueElement* el = this->tail;
-        el != NULL;
-        el = el->prev)
+    MessageQueueElement* el = this->IndexFind(hdr, hash);
+    if(el)
     {
-      if(el->msg->Compare(msg))
-      {
-        this->Remove(el);
-        delete el->msg;
-        delete el;
-        break;
-      }
+      this->Remove(el);
+      delete el->msg;
+      delete el;
     }
   }
 
@@ -540,6 +975,8 @@ MessageQueue::Pop()
   MessageQueueElement* el;
   Lock();
 
+  this->RingDrain(false);
+
   // Look for the last response in the queue, starting at the tail.
   // If any responses are pending, we always send all messages up to and
   // including the last response.
@@ -613,9 +1050,233 @@ MessageQueue::Pop()
   }
 }
 
+void
+MessageQueue::SetLockFree(bool _lockfree)
+{
+  this->Lock();
+  if(_lockfree && !this->ring)
+  {
+    // Room for a full queue's worth of messages (within reason; the
+    // locked path takes over when the ring fills up)
+    size_t size;
+    for(size = 16; size < this->Maxlen && size < 4096; size <<= 1);
+    this->ring = new MessageRingCell[size];
+    assert(this->ring);
+    for(size_t i=0;i<size;i++)
+    {
+      this->ring[i].seq = i;
+      this->ring[i].msg = NULL;
+    }
+    this->ring_mask = size - 1;
+    this->ring_head = this->ring_tail = 0;
+  }
+  this->lockfree = _lockfree && this->ring;
+  this->Unlock();
+}
+
+bool
+MessageQueue::RingPush(Message & msg)
+{
+  MessageRingCell * cell;
+  size_t pos = this->ring_head;
+
+  for(;;)
+  {
+    cell = this->ring + (pos & this->ring_mask);
+    ptrdiff_t dif = (ptrdiff_t)cell->seq - (ptrdiff_t)pos;
+    if(dif == 0)
+    {
+      // The slot is free; try to claim it
+      if(MESSAGE_ATOMIC_CAS(&this->ring_head, pos, pos + 1))
+        break;
+      pos = this->ring_head;
+    }
+    else if(dif < 0)
+      return(false); // full
+    else
+      pos = this->ring_head; // another producer got there first
+  }
+
+  cell->msg = new Message(msg);
+  MESSAGE_ATOMIC_SYNC();
+  cell->seq = pos + 1;
+  return(true);
+}
+
+void
+MessageQueue::RingDrain(bool complete)
+{
+  if(!this->ring)
+    return;
+
+  size_t head = this->ring_head;
+  while(this->ring_tail != head)
+  {
+    size_t pos = this->ring_tail;
+    MessageRingCell * cell = this->ring + (pos & this->ring_mask);
+    if((ptrdiff_t)cell->seq - (ptrdiff_t)(pos + 1) < 0)
+    {
+      // A producer has claimed this slot but not filled it yet
+      if(!complete)
+        break;
+      MESSAGE_YIELD();
+      continue;
+    }
+    MESSAGE_ATOMIC_SYNC();
+
+    MessageQueueElement* newelt = new MessageQueueElement();
+    newelt->msg = cell->msg;
+    cell->msg = NULL;
+    this->Insert(newelt, true);
+
+    // Count the element as on the queue before freeing the slot, so that
+    // GetLength() does not under-report.
+    MESSAGE_ATOMIC_SYNC();
+    this->ring_tail = pos + 1;
+    cell->seq = pos + this->ring_mask + 1;
+  }
+}
+
+void
+MessageQueue::Insert(MessageQueueElement* el, bool back)
+{
+  if(!this->tail)
+  {
+    this->head = this->tail = el;
+    el->prev = el->next = NULL;
+  }
+  else if(back)
+  {
+    this->tail->next = el;
+    el->prev = this->tail;
+    el->next = NULL;
+    this->tail = el;
+  }
+  else
+  {
+    el->prev = NULL;
+    el->next = this->head;
+    this->head->prev = el;
+    this->head = el;
+  }
+  this->Length++;
+  this->IndexInsert(el, back);
+}
+
+MessageQueueElement*
+MessageQueue::IndexFind(player_msghdr_t* hdr, uint32_t hash)
+{
+  for(MessageQueueElement* el = this->index[hash & this->index_mask];
+      el;
+      el = el->bucket_next)
+  {
+    if(el->hash == hash &&
+       Message::MatchMessage(el->msg->GetHeader(), hdr->type, hdr->subtype,
+                             hdr->addr))
+      return(el);
+  }
+  return(NULL);
+}
+
+void
+MessageQueue::IndexInsert(MessageQueueElement* el, bool newest)
+{
+  player_msghdr_t* hdr = el->msg->GetHeader();
+  el->hash = message_signature_hash(hdr);
+  el->sig_prev = el->sig_next = el->bucket_next = NULL;
+
+  MessageQueueElement** link;
+  for(link = this->index + (el->hash & this->index_mask);
+      *link;
+      link = &(*link)->bucket_next)
+  {
+    MessageQueueElement* e = *link;
+    if(e->hash != el->hash ||
+       !Message::MatchMessage(e->msg->GetHeader(), hdr->type, hdr->subtype,
+                              hdr->addr))
+      continue;
+    if(newest)
+    {
+      // el takes over from e as the bucket entry for this signature
+      el->sig_prev = e;
+      e->sig_next = el;
+      el->bucket_next = e->bucket_next;
+      e->bucket_next = NULL;
+      *link = el;
+    }
+    else
+    {
+      // Only PushFront() gets here, and rarely; walk to the oldest
+      while(e->sig_prev)
+        e = e->sig_prev;
+      e->sig_prev = el;
+      el->sig_next = e;
+    }
+    return;
+  }
+
+  // First element with this signature
+  *link = el;
+  if(++this->index_count > this->index_mask + 1)
+    this->IndexGrow();
+}
+
+void
+MessageQueue::IndexRemove(MessageQueueElement* el)
+{
+  if(el->sig_next)
+  {
+    // Not the newest of its signature, so not in a bucket chain
+    el->sig_next->sig_prev = el->sig_prev;
+    if(el->sig_prev)
+      el->sig_prev->sig_next = el->sig_next;
+    return;
+  }
+
+  MessageQueueElement** link;
+  for(link = this->index + (el->hash & this->index_mask);
+      *link != el;
+      link = &(*link)->bucket_next)
+    assert(*link);
+  if(el->sig_prev)
+  {
+    el->sig_prev->sig_next = NULL;
+    el->sig_prev->bucket_next = el->bucket_next;
+    *link = el->sig_prev;
+  }
+  else
+  {
+    *link = el->bucket_next;
+    this->index_count--;
+  }
+}
+
+void
+MessageQueue::IndexGrow()
+{
+  size_t size = this->index_mask + 1;
+  MessageQueueElement** old = this->index;
+  this->index = new MessageQueueElement*[2 * size];
+  memset(this->index, 0, 2 * size * sizeof(MessageQueueElement*));
+  this->index_mask = 2 * size - 1;
+  for(size_t i=0;i<size;i++)
+  {
+    MessageQueueElement *el, *n;
+    for(el = old[i]; el; el = n)
+    {
+      n = el->bucket_next;
+      MessageQueueElement** bucket = this->index + (el->hash & this->index_mask);
+      el->bucket_next = *bucket;
+      *bucket = el;
+    }
+  }
+  delete [] old;
+}
+
 void
 MessageQueue::Remove(MessageQueueElement* el)
 {
+  this->IndexRemove(el);
   if(el->prev)
     el->prev->next = el->next;
   else
@@ -630,7 +1291,6 @@ MessageQueue::Remove(MessageQueueElement* el)
 /// Create a null pointer
 QueuePointer::QueuePointer()
 {
-  Lock = NULL;
   RefCount = NULL;
   Queue = NULL;
 }
@@ -638,9 +1298,6 @@ QueuePointer::QueuePointer()
 /// Create an empty message queue and an auto pointer to it.
 QueuePointer::QueuePointer(bool _Replace, size_t _Maxlen)
 {
-  this->Lock = new pthread_mutex_t;
-  assert(this->Lock);
-  pthread_mutex_init(this->Lock,NULL);
   this->Queue = new MessageQueue(_Replace, _Maxlen);
   assert(this->Queue);
 
@@ -661,29 +1318,25 @@ QueuePointer::QueuePointer(const QueuePointer & rhs)
 {
   if (rhs.Queue == NULL)
   {
-    Lock = NULL;
     RefCount = NULL;
     Queue = NULL;
   }
   else
   {
-    assert(rhs.Lock);
-    pthread_mutex_lock(rhs.Lock);
-
-    assert(rhs.Queue);
     assert(rhs.RefCount);
     assert(*(rhs.RefCount));
-    Lock = rhs.Lock;
+    MESSAGE_ATOMIC_INC(rhs.RefCount);
     Queue = rhs.Queue;
     RefCount = rhs.RefCount;
-    (*RefCount)++;
-    pthread_mutex_unlock(Lock);
   }
 }
 
 /// assign reference to our message queue
 QueuePointer & QueuePointer::operator = (const QueuePointer & rhs)
 {
+  if (rhs.Queue == Queue)
+    return *this;
+
   // first remove our current reference
   DecRef();
 
@@ -691,17 +1344,11 @@ QueuePointer & QueuePointer::operator = (const QueuePointer & rhs)
   	return *this;
 
   // then copy the rhs
-  assert(rhs.Lock);
-  pthread_mutex_lock(rhs.Lock);
-
-  assert(rhs.Queue);
   assert(rhs.RefCount);
   assert(*(rhs.RefCount));
-  Lock = rhs.Lock;
+  MESSAGE_ATOMIC_INC(rhs.RefCount);
   Queue = rhs.Queue;
   RefCount = rhs.RefCount;
-  (*RefCount)++;
-  pthread_mutex_unlock(Lock);
   return *this;
 }
 
@@ -754,25 +1401,11 @@ void QueuePointer::DecRef()
   if (Queue == NULL)
     return;
 
-  pthread_mutex_lock(Lock);
-  (*RefCount)--;
-  assert((*RefCount) >= 0);
-  if((*RefCount)==0)
+  if(MESSAGE_ATOMIC_DEC(RefCount) == 0)
   {
     delete Queue;
-    Queue = NULL;
     delete RefCount;
-    RefCount = NULL;
-    pthread_mutex_unlock(Lock);
-    pthread_mutex_destroy(Lock);
-    delete Lock;
-    Lock = NULL;
-  }
-  else
-  {
-    Queue = NULL;
-    RefCount = NULL;
-    pthread_mutex_unlock(Lock);
-    Lock = NULL;
   }
+  Queue = NULL;
+  RefCount = NULL;
 }
@@ -63,6 +63,10 @@
 #include <libplayerinterface/player.h>
 
 class MessageQueue;
+class FileWatcher;
+struct MessageBody;
+struct MessageRingCell;
+struct MessageReplaceCacheEntry;
 
 /** @brief An autopointer for the message queue
 
@@ -106,11 +110,9 @@ class PLAYERCORE_EXPORT QueuePointer
     /// The queue we are pointing to
     MessageQueue * Queue;
 
-    /// Reference count.
+    /// Reference count, shared with the other references and updated
+    /// atomically.
     unsigned int * RefCount;
-
-    /// Used to lock access to refcount.
-    pthread_mutex_t * Lock;
 };
 
 
@@ -185,20 +187,38 @@ class PLAYERCORE_EXPORT Message
     /// Get pointer to header.
     player_msghdr_t * GetHeader() {return &Header;};
     /// Get pointer to payload.
-    void* GetPayload() {return (void*)Data;};
+    void* GetPayload();
     /// Size of message data.
     unsigned int GetDataSize() {return Header.size;};
     /// Compare type, subtype, device, and device_index.
     bool Compare(Message &other);
+    /** @brief Get the cached encoding of the payload.
+
+    Returns the length of the encoded payload and points @p buf at it, or
+    returns -1 if the payload has not been encoded yet. */
+    int GetEncoded(const char ** buf);
+    /** @brief Cache an encoding of the payload.
+
+    The message claims @p buf (which must have been allocated with malloc())
+    and frees it when the last reference goes away.  If another copy of the
+    message was encoded in the meantime, @p buf is freed and the existing
+    encoding is used instead.  Returns the length of the cached encoding and
+    points @p cached at it. */
+    int SetEncoded(char * buf, int len, const char ** cached);
     /// Decrement ref count
     void DecRef();
 
     /// queue to which any response to this message should be directed
     QueuePointer Queue;
 
-    /// Reference count.
+    /// Reference count (points into the shared message body).
     unsigned int * RefCount;
 
+    /// Messages are allocated from a per-thread pool rather than the heap.
+    static void * operator new(size_t size);
+    /// Return a message to the pool.
+    static void operator delete(void * ptr, size_t size);
+
   private:
     void CreateMessage(const struct player_msghdr & Header,
             void* data,
@@ -206,10 +226,8 @@ class PLAYERCORE_EXPORT Message
 	  
     /// message header
     player_msghdr_t Header;
-    /// Pointer to the message data.
-    uint8_t * Data;
-    /// Used to lock access to Data.
-    pthread_mutex_t * Lock;
+    /// Payload, encoding and reference count, shared between copies.
+    MessageBody * Body;
 };
 
 /**
@@ -225,11 +243,25 @@ class PLAYERCORE_EXPORT MessageQueueElement
 
     /// The message stored in this queue element.
     Message* msg;
+
+    /// Queue elements are allocated from a per-thread pool rather than the heap.
+    static void * operator new(size_t size);
+    /// Return a queue element to the pool.
+    static void operator delete(void * ptr, size_t size);
   private:
     /// Pointer to previous queue element.
     MessageQueueElement * prev;
     /// Pointer to next queue element.
     MessageQueueElement * next;
+    /// Next older / newer element with the same signature (see
+    /// MessageQueue::IndexFind()).
+    MessageQueueElement * sig_prev;
+    MessageQueueElement * sig_next;
+    /// Next entry in the same index bucket; only used by the newest element
+    /// of each signature.
+    MessageQueueElement * bucket_next;
+    /// Hash of the message signature.
+    uint32_t hash;
 
     friend class MessageQueue;
 };
@@ -327,6 +359,11 @@ interfaces.  For example, the @ref driver_p2os driver has incoming commands
 to the wheelmotors overwrite each other, but queues up commands to the
 manipulator arm.
 
+The cost of replacement does not grow with the length of the queue: the
+queue keeps an index from signature to the newest message with that
+signature, and remembers the outcome of the rule lookup for each signature
+until the rules or the Replace flag change.
+
 The queue also supports filtering based on device address.  After
 SetFilter() is called, Pop() will only return messages that match the given
 filter.  Use ClearFilter() to return to normal operation.  This filter is
@@ -342,7 +379,7 @@ class PLAYERCORE_EXPORT MessageQueue
     /// Destroy a message queue.
     ~MessageQueue();
     /// Check whether a queue is empty
-    bool Empty() { return(this->head == NULL); }
+    bool Empty() { return(this->head == NULL && this->ring_head == this->ring_tail); }
     /** Push a message onto the queue.  Returns the success state of the Push
     operation (true if successful, false otherwise). */
     bool Push(Message& msg);
@@ -366,7 +403,7 @@ class PLAYERCORE_EXPORT MessageQueue
     /** Set the @p Replace flag, which governs whether data and command
     messages of the same subtype from the same device are replaced in
     the queue. */
-    void SetReplace(bool _Replace) { this->Replace = _Replace; };
+    void SetReplace(bool _Replace);
     /** Add a replacement rule to the list.  The first 6 arguments
      * determine the signature that a message will have to match in order
      * for this rule to be applied.  If an incoming message matches this
@@ -395,6 +432,8 @@ class PLAYERCORE_EXPORT MessageQueue
     /** Signal that new data is available.  Calling this method will
      release any threads currently waiting on this queue. */
     void DataAvailable(void);
+    /// Used by Wait() to leave the waiting state; not for use by drivers.
+    void WaitDone(void);
     /// @brief Check whether a message passes the current filter.
     bool Filter(Message& msg);
     /// @brief Clear (i.e., turn off) message filter.
@@ -411,6 +450,28 @@ class PLAYERCORE_EXPORT MessageQueue
     /// @brief Set the data_requested flag
     void SetDataRequested(bool d, bool haveLock);
 
+    /** @brief Enable or disable the lock-free push path.
+
+    When enabled, Push() places messages on a bounded lock-free ring
+    instead of taking the queue mutex, and only wakes waiting threads when
+    there are any.  This suits queues with one consumer and few producers,
+    such as a client queue fed by threaded drivers and drained by the
+    server thread.  Messages go through the locked path whenever the queue
+    has replacement rules, a filter, pull mode or the Replace flag set, or
+    when the ring is full; ordering is preserved in either case. */
+    void SetLockFree(bool _lockfree);
+
+    /** @brief Wake the global FileWatcher whenever data becomes available
+    on this queue.  Used for the outgoing queues of clients, so that the
+    server thread writes out new messages straight away instead of when
+    its next Wait() times out. */
+    void SetWakeFileWatcher(bool _wake);
+
+    /** @brief Wake the given FileWatcher (or none, if NULL) whenever data
+    becomes available on this queue.  Used when a client's messages are
+    written out by a thread other than the server thread. */
+    void SetWakeFileWatcher(FileWatcher* _watcher) { this->wake_watcher = _watcher; }
+
   private:
     /// @brief Lock the mutex associated with this queue.
     void Lock() {pthread_mutex_lock(&lock);};
@@ -419,6 +480,32 @@ class PLAYERCORE_EXPORT MessageQueue
     /** Remove element @p el from the queue, and rearrange pointers
     appropriately. */
     void Remove(MessageQueueElement* el);
+    /// @brief Link element @p el in at the back (or front) of the queue.
+    void Insert(MessageQueueElement* el, bool back);
+    /// @brief Add @p el to the signature index, as the newest (or oldest)
+    /// element with its signature.
+    void IndexInsert(MessageQueueElement* el, bool newest);
+    /// @brief Take @p el out of the signature index.
+    void IndexRemove(MessageQueueElement* el);
+    /// @brief Find the newest element whose message has the same
+    /// (addr,type,subtype) signature as @p hdr, or NULL.
+    MessageQueueElement* IndexFind(player_msghdr_t* hdr, uint32_t hash);
+    /// @brief Double the number of index buckets.
+    void IndexGrow();
+    /// @brief CheckReplace(), for callers that hold the lock.  Results are
+    /// cached per signature until the rules change.
+    int CheckReplaceLocked(player_msghdr_t* hdr, uint32_t hash);
+    /// @brief Work out CheckReplace() from the rules and the Replace flag.
+    int CheckReplaceRules(player_msghdr_t* hdr);
+    /// @brief Forget all cached CheckReplace() results.
+    void ClearReplaceCache();
+    /// @brief Try to push a message onto the lock-free ring.
+    bool RingPush(Message & msg);
+    /// @brief Move messages from the ring to the back of the queue.  If
+    /// @p complete is set, wait for producers that are half-way through a
+    /// push, so that everything pushed so far ends up on the queue.  Must be
+    /// called with the queue locked.
+    void RingDrain(bool complete);
     /// @brief Head of the queue.
     MessageQueueElement* head;
     /// @brief Tail of the queue.
@@ -429,6 +516,20 @@ class PLAYERCORE_EXPORT MessageQueue
     size_t Maxlen;
     /// @brief Singly-linked list of replacement rules
     MessageReplaceRule* replaceRules;
+    /// @brief Open-addressed table of CheckReplace() results, by signature.
+    MessageReplaceCacheEntry* replaceCache;
+    /// @brief Size of @p replaceCache, minus one (the size is a power of two).
+    size_t replaceCache_mask;
+    /// @brief Number of used entries in @p replaceCache.
+    size_t replaceCache_count;
+    /// @brief Hash buckets of the signature index.  Each bucket chains
+    /// (via bucket_next) the newest element of each signature that hashes
+    /// there; older elements hang off it via sig_prev.
+    MessageQueueElement** index;
+    /// @brief Number of buckets in @p index, minus one.
+    size_t index_mask;
+    /// @brief Number of distinct signatures in @p index.
+    size_t index_count;
     /// @brief When a (data or command) message doesn't match a rule in
     /// replaceRules, should we replace it?
     bool Replace;
@@ -454,6 +555,20 @@ class PLAYERCORE_EXPORT MessageQueue
     bool data_delivered;
     /// @brief Count of the number of messages discarded due to queue overflow.
     bool drop_count;
+    /// @brief Whether the lock-free push path is enabled.
+    volatile bool lockfree;
+    /// @brief Lock-free ring of messages not yet moved onto the queue.
+    MessageRingCell * ring;
+    /// @brief Size of @p ring, minus one (the size is a power of two).
+    size_t ring_mask;
+    /// @brief Next ring position to push to.
+    volatile size_t ring_head;
+    /// @brief Next ring position to drain from.
+    volatile size_t ring_tail;
+    /// @brief Number of threads in Wait().
+    volatile unsigned int waiters;
+    /// @brief FileWatcher for DataAvailable() to wake, or NULL.
+    FileWatcher* wake_watcher;
 };
 
 
@@ -0,0 +1,272 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000
+ *     Brian Gerkey, Kasper Stoy, Richard Vaughan, & Andrew Howard
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Desc: Test for message queue replacement.
+ * CVS: $Id$
+ *
+ * Runs random sequences of Push(), PushFront(), PushBack(), Pop(),
+ * SetReplace() and AddReplaceRule() on a MessageQueue, locked and
+ * lock-free, next to a plain list that replaces by walking back from the
+ * tail and looks up rules in order, as the queue used to.  Every message
+ * popped, and whatever is left at the end, has to match.  Exits with a
+ * non-zero status on any mismatch.
+ *
+ * Usage: message_queue_test [runs]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include <libplayercore/message.h>
+
+// A queued message in the model: its header and the id in its timestamp
+struct ModelMsg
+{
+  player_msghdr_t hdr;
+  int id;
+};
+
+struct ModelRule
+{
+  int host, robot, interf, index, type, subtype, replace;
+};
+
+// The queue as it used to work
+struct ModelQueue
+{
+  std::vector<ModelMsg> msgs;
+  std::vector<ModelRule> rules;
+  bool replace;
+  size_t maxlen;
+
+  int CheckReplace(const player_msghdr_t &hdr)
+  {
+    for (size_t i = 0; i < this->rules.size(); i++)
+    {
+      const ModelRule &r = this->rules[i];
+      if ((r.host < 0 || (uint32_t)r.host == hdr.addr.host) &&
+          (r.robot < 0 || (uint32_t)r.robot == hdr.addr.robot) &&
+          (r.interf < 0 || (uint16_t)r.interf == hdr.addr.interf) &&
+          (r.index < 0 || (uint16_t)r.index == hdr.addr.index) &&
+          (r.type < 0 || (uint8_t)r.type == hdr.type) &&
+          (r.subtype < 0 || (uint8_t)r.subtype == hdr.subtype))
+        return r.replace;
+    }
+    if (hdr.type == PLAYER_MSGTYPE_DATA || hdr.type == PLAYER_MSGTYPE_CMD)
+      return this->replace ? PLAYER_PLAYER_MSG_REPLACE_RULE_REPLACE :
+                             PLAYER_PLAYER_MSG_REPLACE_RULE_ACCEPT;
+    return PLAYER_PLAYER_MSG_REPLACE_RULE_ACCEPT;
+  }
+
+  void AddReplaceRule(const ModelRule &rule)
+  {
+    for (size_t i = 0; i < this->rules.size(); i++)
+    {
+      ModelRule &r = this->rules[i];
+      if (r.host == rule.host && r.robot == rule.robot &&
+          r.interf == rule.interf && r.index == rule.index &&
+          r.type == rule.type && r.subtype == rule.subtype)
+      {
+        r.replace = rule.replace;
+        return;
+      }
+    }
+    this->rules.push_back(rule);
+  }
+
+  void Push(const ModelMsg &msg)
+  {
+    int op = this->CheckReplace(msg.hdr);
+    if (op == PLAYER_PLAYER_MSG_REPLACE_RULE_IGNORE)
+      return;
+    if (op == PLAYER_PLAYER_MSG_REPLACE_RULE_ACCEPT &&
+        (msg.hdr.type == PLAYER_MSGTYPE_DATA || msg.hdr.type == PLAYER_MSGTYPE_CMD) &&
+        this->msgs.size() >= this->maxlen)
+      return;
+    if (op == PLAYER_PLAYER_MSG_REPLACE_RULE_REPLACE)
+    {
+      for (size_t i = this->msgs.size(); i-- > 0;)
+      {
+        const player_msghdr_t &h = this->msgs[i].hdr;
+        if (h.addr.host == msg.hdr.addr.host && h.addr.robot == msg.hdr.addr.robot &&
+            h.addr.interf == msg.hdr.addr.interf && h.addr.index == msg.hdr.addr.index &&
+            h.type == msg.hdr.type && h.subtype == msg.hdr.subtype)
+        {
+          this->msgs.erase(this->msgs.begin() + i);
+          break;
+        }
+      }
+    }
+    this->msgs.push_back(msg);
+  }
+};
+
+
+// A message with a small range of signatures, so that they collide often
+static ModelMsg random_msg(int id)
+{
+  static const uint8_t types[] = {PLAYER_MSGTYPE_DATA, PLAYER_MSGTYPE_DATA,
+                                  PLAYER_MSGTYPE_CMD, PLAYER_MSGTYPE_REQ,
+                                  PLAYER_MSGTYPE_RESP_ACK, PLAYER_MSGTYPE_RESP_NACK};
+  ModelMsg m;
+  memset(&m.hdr, 0, sizeof(m.hdr));
+  m.hdr.addr.host = lrand48() % 2;
+  m.hdr.addr.robot = 6665;
+  m.hdr.addr.interf = 1 + lrand48() % 2;
+  m.hdr.addr.index = 0;
+  m.hdr.type = types[lrand48() % (sizeof(types) / sizeof(types[0]))];
+  m.hdr.subtype = 1;
+  m.hdr.timestamp = id;
+  m.id = id;
+  return m;
+}
+
+// A rule that matches some of those signatures, with wildcards
+static ModelRule random_rule()
+{
+  ModelRule r;
+  r.host = (lrand48() % 2) ? -1 : (int)(lrand48() % 2);
+  r.robot = (lrand48() % 4) ? -1 : 6665;
+  r.interf = (lrand48() % 2) ? -1 : (int)(1 + lrand48() % 2);
+  r.index = (lrand48() % 4) ? -1 : 0;
+  r.type = (lrand48() % 2) ? -1 : (int)(1 + lrand48() % 3);
+  r.subtype = (lrand48() % 4) ? -1 : 1;
+  r.replace = lrand48() % 3;
+  return r;
+}
+
+
+// Compare a popped message with the head of the model, and drop that;
+// returns non-zero on a mismatch
+static int check_pop(Message *msg, ModelQueue &model)
+{
+  int bad;
+
+  if (!msg)
+  {
+    // Everything the model still holds went missing
+    bad = model.msgs.size();
+    model.msgs.clear();
+    return bad;
+  }
+  if (model.msgs.empty())
+  {
+    delete msg;
+    return 1;
+  }
+  bad = ((int)msg->GetHeader()->timestamp != model.msgs[0].id);
+  model.msgs.erase(model.msgs.begin());
+  delete msg;
+  return bad;
+}
+
+
+// One random sequence of operations; returns the number of mismatches
+static int run(int steps, bool lockfree)
+{
+  size_t maxlen = 4 + lrand48() % 60;
+  bool replace = lrand48() % 2;
+  MessageQueue q(replace, maxlen);
+  ModelQueue model;
+  int i, id, bad;
+  double r;
+
+  model.replace = replace;
+  model.maxlen = maxlen;
+  if (lockfree)
+    q.SetLockFree(true);
+
+  bad = 0;
+  id = 0;
+  for (i = 0; i < steps; i++)
+  {
+    r = drand48();
+    if (r < 0.5)
+    {
+      ModelMsg m = random_msg(id++);
+      Message msg(m.hdr, NULL);
+      q.Push(msg);
+      model.Push(m);
+    }
+    else if (r < 0.58)
+    {
+      // Straight to the front, without rules or limits
+      ModelMsg m = random_msg(id++);
+      Message msg(m.hdr, NULL);
+      q.PushFront(msg, false);
+      model.msgs.insert(model.msgs.begin(), m);
+    }
+    else if (r < 0.66)
+    {
+      ModelMsg m = random_msg(id++);
+      Message msg(m.hdr, NULL);
+      q.PushBack(msg, false);
+      model.msgs.push_back(m);
+    }
+    else if (r < 0.92)
+      bad += check_pop(q.Pop(), model);
+    else if (r < 0.96)
+    {
+      replace = !replace;
+      q.SetReplace(replace);
+      model.replace = replace;
+    }
+    else
+    {
+      ModelRule rule = random_rule();
+      q.AddReplaceRule(rule.host, rule.robot, rule.interf, rule.index,
+                       rule.type, rule.subtype, rule.replace);
+      model.AddReplaceRule(rule);
+    }
+  }
+
+  // Whatever is left has to come out in the same order
+  while (!model.msgs.empty())
+    bad += check_pop(q.Pop(), model);
+  bad += check_pop(q.Pop(), model);
+
+  return bad;
+}
+
+
+int main(int argc, char *argv[])
+{
+  int runs, bad, i;
+
+  runs = (argc > 1) ? atoi(argv[1]) : 2000;
+  bad = 0;
+  srand48(42);
+
+  for (i = 0; i < runs; i++)
+    bad += run(200 + lrand48() % 2000, i % 2);
+  printf("%d runs: %d mismatches\n", runs, bad);
+
+  if (bad)
+  {
+    printf("FAILED\n");
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2005 -
+ *     Brian Gerkey
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+/********************************************************************
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ ********************************************************************/
+
+/*
+ * $Id$
+ *
+ * Micro-benchmark for the XDR function table lookup.  Times
+ * playerxdr_get_packfunc() against a front-to-back scan of the same
+ * generated table (which is how lookups used to be done), and checks that
+ * both find the same functions.
+ *
+ * Usage: ftable_bench [iterations]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "libplayerinterface/playerxdr.h"
+#include "functiontable.h"
+
+static playerxdr_function_t gen_ftable[] =
+{
+#include "functiontable_gen.h"
+  {0,0,0,NULL,NULL,NULL}
+};
+
+static int gen_ftable_len;
+
+// Reference lookup: the old linear scan
+static player_pack_fn_t
+linear_get_packfunc(uint16_t interf, uint8_t type, uint8_t subtype)
+{
+  int i, pass;
+
+  for(pass=0;pass<2;pass++)
+  {
+    for(i=0;i<gen_ftable_len;i++)
+    {
+      if(gen_ftable[i].interf == interf &&
+         gen_ftable[i].type == type &&
+         gen_ftable[i].subtype == subtype)
+        return(gen_ftable[i].packfunc);
+    }
+    if(type != PLAYER_MSGTYPE_RESP_ACK && type != PLAYER_MSGTYPE_RESP_NACK)
+      break;
+    type = PLAYER_MSGTYPE_REQ;
+  }
+  return(NULL);
+}
+
+static double
+now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return(tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+int
+main(int argc, char** argv)
+{
+  int iterations = (argc > 1) ? atoi(argv[1]) : 200;
+  int i, j, k;
+  double t, t_linear, t_hashed;
+  uintptr_t sink = 0;
+  uint8_t types[] = {PLAYER_MSGTYPE_DATA, PLAYER_MSGTYPE_CMD,
+                     PLAYER_MSGTYPE_REQ, PLAYER_MSGTYPE_RESP_ACK};
+  long lookups;
+
+  playerxdr_ftable_init();
+
+  for(gen_ftable_len=0; gen_ftable[gen_ftable_len].packfunc; gen_ftable_len++);
+
+  // Every signature in the table, as each message type
+  for(i=0;i<gen_ftable_len;i++)
+  {
+    for(k=0;k<4;k++)
+    {
+      if(playerxdr_get_packfunc(gen_ftable[i].interf, types[k], gen_ftable[i].subtype) !=
+         linear_get_packfunc(gen_ftable[i].interf, types[k], gen_ftable[i].subtype))
+      {
+        printf("mismatch for %u:%u:%u\n", gen_ftable[i].interf, types[k], gen_ftable[i].subtype);
+        return(1);
+      }
+    }
+  }
+
+  lookups = (long)iterations * gen_ftable_len * 4;
+
+  t = now();
+  for(j=0;j<iterations;j++)
+    for(i=0;i<gen_ftable_len;i++)
+      for(k=0;k<4;k++)
+        sink += (uintptr_t)linear_get_packfunc(gen_ftable[i].interf, types[k],
+                                               gen_ftable[i].subtype);
+  t_linear = now() - t;
+
+  t = now();
+  for(j=0;j<iterations;j++)
+    for(i=0;i<gen_ftable_len;i++)
+      for(k=0;k<4;k++)
+        sink += (uintptr_t)playerxdr_get_packfunc(gen_ftable[i].interf, types[k],
+                                                  gen_ftable[i].subtype);
+  t_hashed = now() - t;
+
+  printf("%d table entries, %ld lookups each\n", gen_ftable_len, lookups);
+  printf("linear scan : %12.0f lookups/s\n", lookups / t_linear);
+  printf("hashed      : %12.0f lookups/s\n", lookups / t_hashed);
+  printf("speedup     : %12.1fx\n", t_linear / t_hashed);
+
+  return(sink == 0);
+}
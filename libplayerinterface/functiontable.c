@@ -129,6 +129,94 @@ static playerxdr_function_t init_ftable[] =
 static playerxdr_function_t* ftable=NULL;
 static int ftable_len=0;
 
+/* Open-addressed hash index over ftable, keyed on (interf, type, subtype).
+ * Each slot holds an index into ftable, or -1 if the slot is empty.  Only
+ * the first row for a given signature is indexed, so lookups return the same
+ * row as a front-to-back scan of the table would. */
+static int* ftable_index=NULL;
+static uint32_t ftable_index_mask=0;
+
+#define FTABLE_KEY(interf,type,subtype) \
+  (((uint32_t)(interf) << 16) | ((uint32_t)(type) << 8) | (uint32_t)(subtype))
+
+static uint32_t
+ftable_hash(uint32_t key)
+{
+  // Integer mix (from MurmurHash3's finalizer) so that the sequential
+  // subtypes of one interface spread over the whole index
+  key ^= key >> 16;
+  key *= 0x85ebca6b;
+  key ^= key >> 13;
+  key *= 0xc2b2ae35;
+  key ^= key >> 16;
+  return(key);
+}
+
+// Find the ftable row for an exact signature, or -1 if there isn't one
+static int
+ftable_index_find(uint16_t interf, uint8_t type, uint8_t subtype)
+{
+  uint32_t key = FTABLE_KEY(interf, type, subtype);
+  uint32_t slot;
+  playerxdr_function_t* curr;
+
+  if(!ftable_index)
+    return(-1);
+
+  for(slot = ftable_hash(key) & ftable_index_mask;
+      ftable_index[slot] >= 0;
+      slot = (slot + 1) & ftable_index_mask)
+  {
+    curr = ftable + ftable_index[slot];
+    if(FTABLE_KEY(curr->interf, curr->type, curr->subtype) == key)
+      return(ftable_index[slot]);
+  }
+  return(-1);
+}
+
+// Add ftable row i to the index, unless an earlier row has the same signature
+static void
+ftable_index_insert(int i)
+{
+  playerxdr_function_t* row = ftable + i;
+  uint32_t key = FTABLE_KEY(row->interf, row->type, row->subtype);
+  uint32_t slot;
+  playerxdr_function_t* curr;
+
+  for(slot = ftable_hash(key) & ftable_index_mask;
+      ftable_index[slot] >= 0;
+      slot = (slot + 1) & ftable_index_mask)
+  {
+    curr = ftable + ftable_index[slot];
+    if(FTABLE_KEY(curr->interf, curr->type, curr->subtype) == key)
+      return;
+  }
+  ftable_index[slot] = i;
+}
+
+// (Re)build the index so that it covers the first ftable_len rows, keeping
+// the load factor at or below one half
+static void
+ftable_index_rebuild(void)
+{
+  uint32_t size;
+  int i;
+
+  for(size = 16; size < 2 * (uint32_t)ftable_len; size <<= 1);
+
+  if(size - 1 != ftable_index_mask || !ftable_index)
+  {
+    free(ftable_index);
+    ftable_index = (int*)malloc(size * sizeof(int));
+    assert(ftable_index);
+    ftable_index_mask = size - 1;
+  }
+  memset(ftable_index, -1, size * sizeof(int));
+
+  for(i=0;i<ftable_len;i++)
+    ftable_index_insert(i);
+}
+
 void
 playerxdr_ftable_init()
 {
@@ -147,6 +235,7 @@ playerxdr_ftable_init()
   assert(ftable);
 
   memcpy(ftable,init_ftable,ftable_len*sizeof(playerxdr_function_t));
+  ftable_index_rebuild();
 }
 
 int
@@ -162,23 +251,13 @@ playerxdr_ftable_add(playerxdr_function_t f, int replace)
     }
     else
     {
-      // Yes; replace (it's clearly inefficient to iterate through the
-      // table again to find the entry to replace, but the table is pretty
-      // small and this doesn't happen very often)
-      int i;
-      playerxdr_function_t* curr;
-
-      for(i=0;i<ftable_len;i++)
+      // Yes; replace.  Make sure the interface, type, and subtype match
+      // exactly
+      int i = ftable_index_find(f.interf, f.type, f.subtype);
+      if(i >= 0)
       {
-        curr = ftable + i;
-        // Make sure the interface, type, and subtype match exactly
-        if((curr->interf == f.interf) &&
-           (curr->subtype == f.subtype) &&
-           (curr->type == f.type))
-        {
-          *curr = f;
-          return(0);
-        }
+        ftable[i] = f;
+        return(0);
       }
       // Can't use libplayercommon here because of an unresolved circular build
       // dependency
@@ -195,6 +274,10 @@ playerxdr_ftable_add(playerxdr_function_t f, int replace)
                                              sizeof(playerxdr_function_t)));
     assert(ftable);
     ftable[ftable_len++] = f;
+    if(!ftable_index || (uint32_t)ftable_len * 2 > ftable_index_mask + 1)
+      ftable_index_rebuild();
+    else
+      ftable_index_insert(ftable_len - 1);
     return(0);
   }
 }
@@ -215,40 +298,38 @@ playerxdr_ftable_add_multi(playerxdr_function_t *flist, int replace)
   return(0);
 }
 
+// Find the first row that matches the interface exactly, or matches
+// anyway because it is registered for interface 0 (universal data types)
+static int
+ftable_lookup(uint16_t interf, uint8_t type, uint8_t subtype)
+{
+  int i, j;
+
+  i = ftable_index_find(interf, type, subtype);
+  if(interf == 0)
+    return(i);
+  j = ftable_index_find(0, type, subtype);
+  if(j >= 0 && (i < 0 || j < i))
+    return(j);
+  return(i);
+}
+
 playerxdr_function_t*
 playerxdr_get_ftrow(uint16_t interf, uint8_t type, uint8_t subtype)
 {
-  playerxdr_function_t* curr=NULL;
   int i;
 
   if(!ftable_len)
     return(NULL);
 
-  for(i=0;i<ftable_len;i++)
-  {
-    curr = ftable + i;
-    // Make sure the interface and subtype match exactly.
-    // match anyway if interface = 0 (universal data types)
-
-    if((curr->interf == interf || curr->interf == 0) &&
-      curr->type == type &&
-      curr->subtype == subtype)
-      return(curr);
-  }
+  if((i = ftable_lookup(interf, type, subtype)) >= 0)
+    return(ftable + i);
 
   // The supplied type can be RESP_ACK if the registered type is REQ.
   if (type == PLAYER_MSGTYPE_RESP_ACK || type == PLAYER_MSGTYPE_RESP_NACK)
-    type = PLAYER_MSGTYPE_REQ;
-
-  for(i=0;i<ftable_len;i++)
   {
-    curr = ftable + i;
-    // Make sure the interface and subtype match exactly.
-    // match anyway if interface = 0 (universal data types)
-    if((curr->interf == interf || curr->interf == 0) &&
-      curr->type == type &&
-      curr->subtype == subtype)
-      return(curr);
+    if((i = ftable_lookup(interf, PLAYER_MSGTYPE_REQ, subtype)) >= 0)
+      return(ftable + i);
   }
 
   return(NULL);
@@ -23,6 +23,214 @@ hasdynamic = []    # A list of types that contain dynamic data. During pass 1,
                     # other types, necessary deep copy/clean up functions can
                     # be created and called.
 
+# Types whose XDR encoding is a fixed number of 4- or 8-byte big-endian
+# words, mapped to (bulk codec, wire size).  Arrays of these are encoded by
+# the xdrbulk_* routines below rather than one xdr_* call per element.
+bulktypes = {'float' : ('xdrbulk_vector_32', 4),
+             'int32_t' : ('xdrbulk_vector_32', 4),
+             'uint32_t' : ('xdrbulk_vector_32', 4),
+             'double' : ('xdrbulk_vector_64', 8),
+             'int64_t' : ('xdrbulk_vector_64', 8)}
+
+# Scalar types that may appear in a flat struct, mapped to the expressions
+# used to store (%(v)s is the value) and load (%(b)s is the buffer) them.
+flatscalars = {'float' : ('xdrbulk_putf(%(b)s, %(v)s)', 'xdrbulk_getf(%(b)s)', 4),
+               'double' : ('xdrbulk_putd(%(b)s, %(v)s)', 'xdrbulk_getd(%(b)s)', 8),
+               'int64_t' : ('xdrbulk_put64(%(b)s, (uint64_t)%(v)s)', '(int64_t)xdrbulk_get64(%(b)s)', 8),
+               'int32_t' : ('xdrbulk_put32(%(b)s, (uint32_t)%(v)s)', '(int32_t)xdrbulk_get32(%(b)s)', 4),
+               'uint32_t' : ('xdrbulk_put32(%(b)s, %(v)s)', 'xdrbulk_get32(%(b)s)', 4),
+               'int16_t' : ('xdrbulk_put32(%(b)s, (uint32_t)(int32_t)%(v)s)', '(int16_t)xdrbulk_get32(%(b)s)', 4),
+               'uint16_t' : ('xdrbulk_put32(%(b)s, %(v)s)', '(uint16_t)xdrbulk_get32(%(b)s)', 4),
+               'int8_t' : ('xdrbulk_put32(%(b)s, (uint32_t)(int32_t)%(v)s)', '(int8_t)xdrbulk_get32(%(b)s)', 4),
+               'char' : ('xdrbulk_put32(%(b)s, (uint32_t)(int32_t)%(v)s)', '(char)xdrbulk_get32(%(b)s)', 4),
+               'uint8_t' : ('xdrbulk_put32(%(b)s, %(v)s)', '(uint8_t)xdrbulk_get32(%(b)s)', 4),
+               'bool_t' : ('xdrbulk_put32(%(b)s, %(v)s ? 1 : 0)', '(xdrbulk_get32(%(b)s) ? 1 : 0)', 4)}
+
+flattypes = {}      # Structs made only of scalars (or other flat structs),
+                    # mapped to their encoded size.  Arrays of these get a
+                    # generated xdrbulk_vector_<type> routine.
+
+# Helpers shared by the generated bulk codecs.  They fall back to the
+# per-element XDR routines for streams that cannot hand out a contiguous
+# buffer (xdr_inline() returns NULL) and on hosts of unknown byte order.
+bulkpreamble = """
+#if defined (__BYTE_ORDER__) && defined (__ORDER_LITTLE_ENDIAN__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+  #define XDRBULK_SWAP 1
+#elif defined (__BYTE_ORDER__) && defined (__ORDER_BIG_ENDIAN__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  #define XDRBULK_SWAP 0
+#elif defined (WIN32)
+  #define XDRBULK_SWAP 1
+#endif
+/* Unoptimised, the intrinsics are slower than the plain swap loop */
+#if defined (XDRBULK_SWAP) && XDRBULK_SWAP && defined (__SSE2__) && defined (__OPTIMIZE__)
+  #include <emmintrin.h>
+  #define XDRBULK_SSE2 1
+#endif
+#if defined (__GNUC__)
+  #define XDRBULK_UNUSED __attribute__((unused))
+  #define XDRBULK_BSWAP32(x) __builtin_bswap32(x)
+  #define XDRBULK_BSWAP64(x) __builtin_bswap64(x)
+#else
+  #define XDRBULK_UNUSED
+#endif
+
+typedef int (*xdrbulk_vector_fn)(XDR* xdrs, void* p, u_int n, u_int elsize, xdrproc_t elproc);
+
+/* Big-endian loads and stores of single values */
+static void xdrbulk_put32(char* b, uint32_t v)
+{
+  b[0] = (char)(v >> 24); b[1] = (char)(v >> 16); b[2] = (char)(v >> 8); b[3] = (char)v;
+}
+static uint32_t xdrbulk_get32(const char* b)
+{
+  const unsigned char* u = (const unsigned char*)b;
+  return(((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16) | ((uint32_t)u[2] << 8) | u[3]);
+}
+static void xdrbulk_put64(char* b, uint64_t v)
+{
+  xdrbulk_put32(b, (uint32_t)(v >> 32));
+  xdrbulk_put32(b + 4, (uint32_t)v);
+}
+static uint64_t xdrbulk_get64(const char* b)
+{
+  return(((uint64_t)xdrbulk_get32(b) << 32) | xdrbulk_get32(b + 4));
+}
+static XDRBULK_UNUSED void xdrbulk_putf(char* b, float v)
+{
+  uint32_t u;
+  memcpy(&u, &v, 4);
+  xdrbulk_put32(b, u);
+}
+static XDRBULK_UNUSED float xdrbulk_getf(const char* b)
+{
+  uint32_t u = xdrbulk_get32(b);
+  float v;
+  memcpy(&v, &u, 4);
+  return(v);
+}
+static XDRBULK_UNUSED void xdrbulk_putd(char* b, double v)
+{
+  uint64_t u;
+  memcpy(&u, &v, 8);
+  xdrbulk_put64(b, u);
+}
+static XDRBULK_UNUSED double xdrbulk_getd(const char* b)
+{
+  uint64_t u = xdrbulk_get64(b);
+  double v;
+  memcpy(&v, &u, 8);
+  return(v);
+}
+
+#if defined (XDRBULK_SWAP)
+/* Copy n words of the given size (4 or 8 bytes), converting between host
+   and network byte order */
+static void xdrbulk_copy(char* dst, const char* src, u_int n, u_int size)
+{
+  u_int i = 0;
+#if !XDRBULK_SWAP
+  memcpy(dst, src, (size_t)n * size);
+#else
+#if XDRBULK_SSE2
+  u_int bytes = n * size;
+  for(; i + 16 <= bytes; i += 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+    /* swap the bytes of each 16-bit half, then the halves of each word */
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2,3,0,1));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2,3,0,1));
+    /* and the words of each 64-bit value */
+    if(size == 8)
+      v = _mm_shuffle_epi32(v, _MM_SHUFFLE(2,3,0,1));
+    _mm_storeu_si128((__m128i*)(dst + i), v);
+  }
+  i /= size;
+#endif
+#if defined (XDRBULK_BSWAP32)
+  /* one swap per word, so this stays faster than xdr_vector() even in
+     unoptimised builds */
+  if(size == 4)
+    for(; i < n; i++)
+    {
+      uint32_t v;
+      memcpy(&v, src + 4 * i, 4);
+      v = XDRBULK_BSWAP32(v);
+      memcpy(dst + 4 * i, &v, 4);
+    }
+  else
+    for(; i < n; i++)
+    {
+      uint64_t v;
+      memcpy(&v, src + 8 * i, 8);
+      v = XDRBULK_BSWAP64(v);
+      memcpy(dst + 8 * i, &v, 8);
+    }
+#else
+  if(size == 4)
+    for(; i < n; i++)
+      xdrbulk_put32(dst + 4 * i, *(const uint32_t*)(src + 4 * i));
+  else
+    for(; i < n; i++)
+      xdrbulk_put64(dst + 8 * i, *(const uint64_t*)(src + 8 * i));
+#endif
+#endif
+}
+#endif
+
+static int xdrbulk_vector(XDR* xdrs, void* p, u_int n, u_int size, u_int elsize, xdrproc_t elproc)
+{
+#if defined (XDRBULK_SWAP)
+  char* buf;
+  if(((xdrs->x_op == XDR_ENCODE) || (xdrs->x_op == XDR_DECODE)) &&
+     (n > 0) && (n <= 0x7fffffff / size) &&
+     ((buf = (char*)xdr_inline(xdrs, n * size)) != NULL))
+  {
+    if(xdrs->x_op == XDR_ENCODE)
+      xdrbulk_copy(buf, (const char*)p, n, size);
+    else
+      xdrbulk_copy((char*)p, buf, n, size);
+    return(1);
+  }
+#endif
+  return(xdr_vector(xdrs, (char*)p, n, elsize, elproc));
+}
+
+static XDRBULK_UNUSED int xdrbulk_vector_32(XDR* xdrs, void* p, u_int n, u_int elsize, xdrproc_t elproc)
+{
+  return(xdrbulk_vector(xdrs, p, n, 4, elsize, elproc));
+}
+
+static XDRBULK_UNUSED int xdrbulk_vector_64(XDR* xdrs, void* p, u_int n, u_int elsize, xdrproc_t elproc)
+{
+  return(xdrbulk_vector(xdrs, p, n, 8, elsize, elproc));
+}
+
+/* Same encoding as xdr_array(), with the elements done by vec */
+static XDRBULK_UNUSED int xdrbulk_array(XDR* xdrs, char** addrp, u_int* sizep, u_int maxsize,
+                                        u_int elsize, xdrproc_t elproc, xdrbulk_vector_fn vec)
+{
+  u_int c;
+  if((xdrs->x_op != XDR_ENCODE) && (xdrs->x_op != XDR_DECODE))
+    return(xdr_array(xdrs, addrp, sizep, maxsize, elsize, elproc));
+  if(xdr_u_int(xdrs, sizep) != 1)
+    return(0);
+  c = *sizep;
+  if((c > maxsize) || (c > 0xffffffffU / elsize))
+    return(0);
+  if(c == 0)
+    return(1);
+  if(*addrp == NULL)
+  {
+    if(xdrs->x_op == XDR_ENCODE)
+      return(0);
+    if((*addrp = (char*)calloc(c, elsize)) == NULL)
+      return(0);
+  }
+  return((*vec)(xdrs, *addrp, c, elsize, elproc));
+}
+"""
+
 class DataTypeMember:
   arraypattern = re.compile('\[(.*?)\]')
   pointerpattern = re.compile('\*')
@@ -112,6 +320,29 @@ class DataType:
     if self.dynamic:
       hasdynamic.append (self.typename)
 
+    # Is it flat, i.e. a fixed sequence of scalars?
+    self.flat = []
+    size = 0
+    for m in self.members:
+      for v in m.variables:
+        if v.array:
+          self.flat = None
+        elif m.typename in flatscalars:
+          self.flat.append((v.Name, m.typename, size))
+          size += flatscalars[m.typename][2]
+        elif m.typename in flattypes:
+          self.flat.append((v.Name, m.typename, size))
+          size += flattypes[m.typename]
+        else:
+          self.flat = None
+        if self.flat is None:
+          break
+      if self.flat is None:
+        break
+    if self.flat:
+      self.flatsize = size
+      flattypes[self.typename] = size
+
       
   def GetVarNames(self):
     varnames = []
@@ -135,6 +366,51 @@ class MethodGenerator:
     self.sourcefile = sourcefile
     
           
+  def gen_bulk(self,datatype):
+    # Load / store routines for flat structs, and a bulk codec for arrays
+    # of them
+    if not datatype.flat:
+      return
+    subs = {"typename":datatype.typename, "size":datatype.flatsize}
+    puts = ''
+    gets = ''
+    for (name, typename, offset) in datatype.flat:
+      if typename in flatscalars:
+        puts += '  ' + flatscalars[typename][0] % {"b" : 'b + %d' % offset, "v" : 'msg->' + name} + ';\n'
+        gets += '  msg->' + name + ' = ' + flatscalars[typename][1] % {"b" : 'b + %d' % offset} + ';\n'
+      else:
+        puts += '  xdrbulk_put_%s(b + %d, &msg->%s);\n' % (typename, offset, name)
+        gets += '  xdrbulk_get_%s(b + %d, &msg->%s);\n' % (typename, offset, name)
+    subs["puts"] = puts
+    subs["gets"] = gets
+    self.sourcefile.write("""
+static XDRBULK_UNUSED void xdrbulk_put_%(typename)s(char* b, const %(typename)s* msg)
+{
+%(puts)s}
+static XDRBULK_UNUSED void xdrbulk_get_%(typename)s(const char* b, %(typename)s* msg)
+{
+%(gets)s}
+static XDRBULK_UNUSED int xdrbulk_vector_%(typename)s(XDR* xdrs, void* p, u_int n, u_int elsize, xdrproc_t elproc)
+{
+  %(typename)s* msg = (%(typename)s*)p;
+  char* buf;
+  u_int i;
+  if(((xdrs->x_op == XDR_ENCODE) || (xdrs->x_op == XDR_DECODE)) &&
+     (n > 0) && (n <= 0x7fffffff / %(size)d) &&
+     ((buf = (char*)xdr_inline(xdrs, n * %(size)d)) != NULL))
+  {
+    if(xdrs->x_op == XDR_ENCODE)
+      for(i = 0; i < n; i++)
+        xdrbulk_put_%(typename)s(buf + i * %(size)d, msg + i);
+    else
+      for(i = 0; i < n; i++)
+        xdrbulk_get_%(typename)s(buf + i * %(size)d, msg + i);
+    return(1);
+  }
+  return(xdr_vector(xdrs, (char*)p, n, elsize, elproc));
+}
+""" % subs)
+
   def gen_internal_pack(self,datatype):
     self.headerfile.write("int xdr_%(typename)s (XDR* xdrs, %(typename)s * msg);\n" % {"typename":datatype.typename})
     
@@ -194,7 +470,7 @@ int xdr_%(typename)s (XDR* xdrs, %(typename)s * msg)
             else:
               sourcefile.write('  {\n')
               sourcefile.write('    ' + member.typename + '* ' + var.pointervar + ' = msg->' + var.Name + ';\n')
-              sourcefile.write('    if(xdr_array(xdrs, (char**)&' + var.pointervar + ', &msg->' + var.countvar + ', msg->' + var.countvar +', sizeof(' + member.typename + '), (xdrproc_t)' + xdr_proc + ') != 1)\n      return(0);\n')
+              sourcefile.write('    if(' + self.array_call(member, var, 'msg->' + var.countvar, xdr_proc) + ' != 1)\n      return(0);\n')
               sourcefile.write('  }\n')
           else:           # Handle a static array
             # Was a _count variable declared? If so, we'll encode as a
@@ -220,10 +496,7 @@ int xdr_%(typename)s (XDR* xdrs, %(typename)s * msg)
                 sourcefile.write('  {\n')
                 sourcefile.write('    ' + member.typename + '* ' + var.pointervar +
                                 ' = msg->' + var.Name + ';\n')
-                sourcefile.write('    if(xdr_array(xdrs, (char**)&' + var.pointervar +
-                                ', &msg->' + var.countvar +
-                                ', ' + var.arraysize + ', sizeof(' + member.typename + '), (xdrproc_t)' +
-                                xdr_proc + ') != 1)\n      return(0);\n')
+                sourcefile.write('    if(' + self.array_call(member, var, var.arraysize, xdr_proc) + ' != 1)\n      return(0);\n')
                 sourcefile.write('  }\n')
             else:
               # Is it an array of bytes?  If so, then we'll encode
@@ -233,10 +506,17 @@ int xdr_%(typename)s (XDR* xdrs, %(typename)s * msg)
                 sourcefile.write('  if(xdr_opaque(xdrs, (char*)&msg->' +
                                   var.Name + ', ' + var.arraysize + ') != 1)\n    return(0);\n')
               else:
-                sourcefile.write('  if(xdr_vector(xdrs, (char*)&msg->' +
-                                  var.Name + ', ' + var.arraysize +
-                                  ', sizeof(' + member.typename + '), (xdrproc_t)' +
-                                  xdr_proc + ') != 1)\n    return(0);\n')
+                vector_fn = self.bulk_vector_fn(member)
+                if vector_fn:
+                  sourcefile.write('  if(' + vector_fn + '(xdrs, msg->' +
+                                    var.Name + ', ' + var.arraysize +
+                                    ', sizeof(' + member.typename + '), (xdrproc_t)' +
+                                    xdr_proc + ') != 1)\n    return(0);\n')
+                else:
+                  sourcefile.write('  if(xdr_vector(xdrs, (char*)&msg->' +
+                                    var.Name + ', ' + var.arraysize +
+                                    ', sizeof(' + member.typename + '), (xdrproc_t)' +
+                                    xdr_proc + ') != 1)\n    return(0);\n')
         else:
           sourcefile.write('  if(' + xdr_proc + '(xdrs,&msg->' +
                               var.Name + ') != 1)\n    return(0);\n')
@@ -244,6 +524,24 @@ int xdr_%(typename)s (XDR* xdrs, %(typename)s * msg)
     sourcefile.write('  return(1);\n}\n')
 
 
+  def bulk_vector_fn(self,member):
+    # The bulk codec for an array of this member's type, if there is one
+    if member.typename in bulktypes:
+      return bulktypes[member.typename][0]
+    if member.typename in flattypes:
+      return 'xdrbulk_vector_' + member.typename
+    return None
+
+  def array_call(self,member,var,maxsize,xdr_proc):
+    # Code to (un)pack a counted array, as xdr_array() would
+    vector_fn = self.bulk_vector_fn(member)
+    if vector_fn:
+      return ('xdrbulk_array(xdrs, (char**)&' + var.pointervar + ', &msg->' + var.countvar +
+              ', ' + maxsize + ', sizeof(' + member.typename + '), (xdrproc_t)' + xdr_proc +
+              ', ' + vector_fn + ')')
+    return ('xdr_array(xdrs, (char**)&' + var.pointervar + ', &msg->' + var.countvar +
+            ', ' + maxsize + ', sizeof(' + member.typename + '), (xdrproc_t)' + xdr_proc + ')')
+
   def gen_external_pack(self,datatype):
     self.headerfile.write("PLAYERXDR_EXPORT int %(prefix)s_pack(void* buf, size_t buflen, %(typename)s * msg, int op);\n" % {"typename":datatype.typename, "prefix":datatype.prefix})
 
@@ -538,6 +836,7 @@ if __name__ == '__main__':
 
 #include <stdlib.h>
 """ % {"headerfilename":headerfilename})
+    sourcefile.write(bulkpreamble)
   else:
     ifndefsymbol = '_' + os.path.split (infilenames[0])[1].replace('.','_').replace('/','_').upper() + '_XDR_'
     headerfile.write('#ifndef ' + ifndefsymbol + '\n')
@@ -551,6 +850,7 @@ if __name__ == '__main__':
     sourcefile.write('#include "' + os.path.split(headerfilename)[-1] + '"\n')
     sourcefile.write('#include <string.h>\n')
     sourcefile.write('#include <stdlib.h>\n\n')
+    sourcefile.write(bulkpreamble)
 
 
   # strip C++-style comments
@@ -582,6 +882,7 @@ if __name__ == '__main__':
     current = DataType(s)
 
     # Generate the methods
+    gen.gen_bulk(current)
     gen.gen_internal_pack(current)
     gen.gen_external_pack(current)
     gen.gen_copy(current)
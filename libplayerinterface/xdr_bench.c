@@ -0,0 +1,275 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2005 -
+ *     Brian Gerkey
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+/********************************************************************
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ ********************************************************************/
+
+/*
+ * $Id$
+ *
+ * Micro-benchmark for the bulk array codecs emitted by playerxdrgen.py.
+ * Packs and unpacks a laser scan, a ranger scan and a point cloud with the
+ * generated functions and with hand-written equivalents that do one
+ * xdr_float / xdr_double / struct call per element (which is what the
+ * generator used to emit), and checks that both produce the same bytes.
+ *
+ * Usage: xdr_bench [iterations]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "libplayerinterface/playerxdr.h"
+
+#define LASER_BEAMS 1081
+#define CLOUD_POINTS 300000
+
+// Reference codecs: the per-element encoding
+
+static int
+ref_xdr_laser_data(XDR* xdrs, player_laser_data_t* msg)
+{
+  float* ranges_p;
+  uint8_t* intensity_p;
+  if(xdr_float(xdrs,&msg->min_angle) != 1 ||
+     xdr_float(xdrs,&msg->max_angle) != 1 ||
+     xdr_float(xdrs,&msg->resolution) != 1 ||
+     xdr_float(xdrs,&msg->max_range) != 1 ||
+     xdr_u_int(xdrs,&msg->ranges_count) != 1)
+    return(0);
+  if(xdrs->x_op == XDR_DECODE)
+    msg->ranges = malloc(msg->ranges_count*sizeof(float));
+  ranges_p = msg->ranges;
+  if(xdr_array(xdrs, (char**)&ranges_p, &msg->ranges_count, msg->ranges_count,
+               sizeof(float), (xdrproc_t)xdr_float) != 1)
+    return(0);
+  if(xdr_u_int(xdrs,&msg->intensity_count) != 1)
+    return(0);
+  if(xdrs->x_op == XDR_DECODE)
+    msg->intensity = malloc(msg->intensity_count*sizeof(uint8_t));
+  intensity_p = msg->intensity;
+  if(xdr_bytes(xdrs, (char**)&intensity_p, &msg->intensity_count,
+               msg->intensity_count) != 1)
+    return(0);
+  return(xdr_u_int(xdrs,&msg->id));
+}
+
+static int
+ref_xdr_ranger_data_range(XDR* xdrs, player_ranger_data_range_t* msg)
+{
+  double* ranges_p;
+  if(xdr_u_int(xdrs,&msg->ranges_count) != 1)
+    return(0);
+  if(xdrs->x_op == XDR_DECODE)
+    msg->ranges = malloc(msg->ranges_count*sizeof(double));
+  ranges_p = msg->ranges;
+  return(xdr_array(xdrs, (char**)&ranges_p, &msg->ranges_count,
+                   msg->ranges_count, sizeof(double), (xdrproc_t)xdr_double));
+}
+
+static int
+ref_xdr_pointcloud3d_data(XDR* xdrs, player_pointcloud3d_data_t* msg)
+{
+  player_pointcloud3d_element_t* points_p;
+  if(xdr_u_int(xdrs,&msg->points_count) != 1)
+    return(0);
+  if(xdrs->x_op == XDR_DECODE)
+    msg->points = malloc(msg->points_count*sizeof(player_pointcloud3d_element_t));
+  points_p = msg->points;
+  return(xdr_array(xdrs, (char**)&points_p, &msg->points_count,
+                   msg->points_count, sizeof(player_pointcloud3d_element_t),
+                   (xdrproc_t)xdr_player_pointcloud3d_element_t));
+}
+
+static int
+ref_pack(xdrproc_t proc, void* buf, size_t buflen, void* msg, int op)
+{
+  XDR xdrs;
+  int len;
+  xdrmem_create(&xdrs, buf, buflen, op);
+  if((*proc)(&xdrs, msg) != 1)
+    return(-1);
+  len = xdr_getpos(&xdrs);
+  xdr_destroy(&xdrs);
+  return(len);
+}
+
+static double
+now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return(tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+// Times iterations of encoding and decoding msg both ways, and compares
+// the results.  Returns non-zero on a mismatch.
+static int
+bench(const char* name, int iterations, player_pack_fn_t packfunc,
+      xdrproc_t refproc, player_cleanup_fn_t cleanupfunc,
+      void* msg, size_t msgsize, size_t buflen)
+{
+  char* buf = malloc(buflen);
+  char* refbuf = malloc(buflen);
+  void* decoded = calloc(1, msgsize);
+  void* refdecoded = calloc(1, msgsize);
+  int len, reflen, i;
+  double t, t_ref_enc, t_ref_dec, t_enc, t_dec;
+
+  if((reflen = ref_pack(refproc, refbuf, buflen, msg, XDR_ENCODE)) < 0 ||
+     (len = (*packfunc)(buf, buflen, msg, PLAYERXDR_ENCODE)) < 0)
+  {
+    printf("%s: encoding failed\n", name);
+    return(1);
+  }
+  if(len != reflen || memcmp(buf, refbuf, len))
+  {
+    printf("%s: encodings differ\n", name);
+    return(1);
+  }
+  if((*packfunc)(buf, len, decoded, PLAYERXDR_DECODE) < 0 ||
+     ref_pack(refproc, refbuf, len, refdecoded, XDR_DECODE) < 0 ||
+     (*packfunc)(refbuf, buflen, decoded, PLAYERXDR_ENCODE) != len ||
+     memcmp(buf, refbuf, len))
+  {
+    printf("%s: decoding does not round-trip\n", name);
+    return(1);
+  }
+  (*cleanupfunc)(decoded);
+  (*cleanupfunc)(refdecoded);
+
+  t = now();
+  for(i=0;i<iterations;i++)
+    ref_pack(refproc, refbuf, buflen, msg, XDR_ENCODE);
+  t_ref_enc = now() - t;
+  t = now();
+  for(i=0;i<iterations;i++)
+    (*packfunc)(buf, buflen, msg, PLAYERXDR_ENCODE);
+  t_enc = now() - t;
+  t = now();
+  for(i=0;i<iterations;i++)
+  {
+    ref_pack(refproc, refbuf, len, refdecoded, XDR_DECODE);
+    (*cleanupfunc)(refdecoded);
+  }
+  t_ref_dec = now() - t;
+  t = now();
+  for(i=0;i<iterations;i++)
+  {
+    (*packfunc)(buf, len, decoded, PLAYERXDR_DECODE);
+    (*cleanupfunc)(decoded);
+  }
+  t_dec = now() - t;
+
+  printf("%-12s %9d bytes  encode %8.1f -> %8.1f us (%4.1fx)  decode %8.1f -> %8.1f us (%4.1fx)\n",
+         name, len,
+         1e6 * t_ref_enc / iterations, 1e6 * t_enc / iterations, t_ref_enc / t_enc,
+         1e6 * t_ref_dec / iterations, 1e6 * t_dec / iterations, t_ref_dec / t_dec);
+
+  free(buf);
+  free(refbuf);
+  free(decoded);
+  free(refdecoded);
+  return(0);
+}
+
+int
+main(int argc, char** argv)
+{
+  int iterations = (argc > 1) ? atoi(argv[1]) : 2000;
+  player_laser_data_t laser;
+  player_ranger_data_range_t ranger;
+  player_pointcloud3d_data_t cloud;
+  int i, ret = 0;
+
+  memset(&laser, 0, sizeof(laser));
+  laser.min_angle = -2.35f;
+  laser.max_angle = 2.35f;
+  laser.resolution = 0.25f * 3.14159f / 180.0f;
+  laser.max_range = 30.0f;
+  laser.ranges_count = LASER_BEAMS;
+  laser.ranges = malloc(LASER_BEAMS * sizeof(float));
+  laser.intensity_count = LASER_BEAMS;
+  laser.intensity = malloc(LASER_BEAMS);
+  for(i=0;i<LASER_BEAMS;i++)
+  {
+    laser.ranges[i] = 0.5f + (float)i / 37.0f;
+    laser.intensity[i] = (uint8_t)i;
+  }
+  laser.id = 42;
+
+  ranger.ranges_count = LASER_BEAMS;
+  ranger.ranges = malloc(LASER_BEAMS * sizeof(double));
+  for(i=0;i<LASER_BEAMS;i++)
+    ranger.ranges[i] = 0.5 + i / 37.0;
+
+  cloud.points_count = CLOUD_POINTS;
+  cloud.points = malloc(CLOUD_POINTS * sizeof(player_pointcloud3d_element_t));
+  for(i=0;i<CLOUD_POINTS;i++)
+  {
+    cloud.points[i].point.px = i * 0.001;
+    cloud.points[i].point.py = -i * 0.002;
+    cloud.points[i].point.pz = 1.0 / (i + 1);
+    cloud.points[i].color.alpha = 255;
+    cloud.points[i].color.red = (uint8_t)i;
+    cloud.points[i].color.green = (uint8_t)(i >> 8);
+    cloud.points[i].color.blue = (uint8_t)(i >> 16);
+  }
+
+  ret |= bench("laser", iterations,
+               (player_pack_fn_t)player_laser_data_pack,
+               (xdrproc_t)ref_xdr_laser_data,
+               (player_cleanup_fn_t)player_laser_data_t_cleanup,
+               &laser, sizeof(laser), 4 * sizeof(float) * (LASER_BEAMS + 16));
+  ret |= bench("ranger", iterations,
+               (player_pack_fn_t)player_ranger_data_range_pack,
+               (xdrproc_t)ref_xdr_ranger_data_range,
+               (player_cleanup_fn_t)player_ranger_data_range_t_cleanup,
+               &ranger, sizeof(ranger), sizeof(double) * (LASER_BEAMS + 16));
+  ret |= bench("pointcloud3d", MAX(iterations / 200, 1),
+               (player_pack_fn_t)player_pointcloud3d_data_pack,
+               (xdrproc_t)ref_xdr_pointcloud3d_data,
+               (player_cleanup_fn_t)player_pointcloud3d_data_t_cleanup,
+               &cloud, sizeof(cloud), 48 * (CLOUD_POINTS + 16));
+
+  free(laser.ranges);
+  free(laser.intensity);
+  free(ranger.ranges);
+  free(cloud.points);
+  return(ret);
+}
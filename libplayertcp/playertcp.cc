@@ -58,8 +58,12 @@
 #if HAVE_Z
   #include <zlib.h>
 #endif
+#if !defined (WIN32)
+  #include <sys/uio.h>
+#endif
 
 #include <replace/replace.h>
+#include <libplayercommon/shmring.h>
 #include <libplayercore/playercore.h>
 #include <libplayerinterface/playerxdr.h>
 
@@ -77,8 +81,23 @@ typedef struct playertcp_listener
 {
   int fd;
   int port;
+  /** Is this a Unix domain socket for local clients? */
+  int local;
 } playertcp_listener_t;
 
+/** @brief An encoded message waiting to be written to a client */
+typedef struct playertcp_outmsg
+{
+  /** The message, which keeps the shared encoded body alive */
+  Message* msg;
+  /** Header, encoded for this client */
+  char hdr[PLAYERXDR_MSGHDR_SIZE];
+  /** Encoded body (see PlayerTCP::EncodeBody()) */
+  const char* body;
+  /** Length of @p body */
+  size_t bodylen;
+} playertcp_outmsg_t;
+
 /** @brief A TCP Connection */
 typedef struct playertcp_conn
 {
@@ -108,13 +127,19 @@ typedef struct playertcp_conn
   /** How much of @p readbuffer is currently in use (i.e., holding a
     partial message) */
   int readbufferlen;
-  /** Buffer in which to store partial outgoint messages */
-  char* writebuffer;
-  /** Total size of @p writebuffer */
-  int writebuffersize;
-  /** How much of @p writebuffer is currently in use (i.e., holding a
-    partial message) */
-  int writebufferlen;
+  /** Outgoing messages taken off @p queue but not yet (fully) written.
+    They are sent straight from their headers and shared encoded bodies
+    with writev(), so nothing is copied into a per-client buffer. */
+  playertcp_outmsg_t pending[PLAYERTCP_MAX_PENDING];
+  /** Number of entries in @p pending */
+  int num_pending;
+  /** Bytes of the first entry in @p pending that have already been sent */
+  size_t pending_offset;
+  /** Bytes in @p pending still to be sent */
+  size_t pending_bytes;
+  /** For a local client, the shared-memory ring that outgoing messages
+    are copied into instead of being written to the socket */
+  player_shmring_t* ring;
   /** Linked list of devices to which we are subscribed */
   Device** dev_subs;
   size_t num_dev_subs;
@@ -144,6 +169,49 @@ PlayerTCP::PlayerTCP()
   }
 #endif
 
+  this->InitClients();
+  this->watcher = fileWatcher;
+  this->owner = NULL;
+
+  this->num_listeners = 0;
+  this->listeners = (playertcp_listener_t*)NULL;
+  this->listen_ufds = (struct pollfd*)NULL;
+  this->local_ring_size = PLAYER_SHMRING_DEFAULT_SIZE;
+
+  if(hostname_to_packedaddr(&this->host,"localhost") < 0)
+  {
+    PLAYER_WARN("address lookup failed for localhost");
+    this->host = 0;
+  }
+
+  deviceTable->AddRemoteDriverFn(TCPRemoteDriver::TCPRemoteDriver_Init,this);
+}
+
+// An I/O thread's share of the clients: it has no listeners, and wakes on
+// its own FileWatcher rather than the server's.
+PlayerTCP::PlayerTCP(PlayerTCP* owner)
+{
+#if defined (WIN32)
+  WSADATA info;
+  WSAStartup (MAKEWORD (2, 2), &info);
+#endif
+
+  this->InitClients();
+  this->watcher = new FileWatcher();
+  assert(this->watcher);
+  this->owner = owner;
+
+  this->num_listeners = 0;
+  this->listeners = (playertcp_listener_t*)NULL;
+  this->listen_ufds = (struct pollfd*)NULL;
+  this->local_ring_size = PLAYER_SHMRING_DEFAULT_SIZE;
+
+  this->host = owner->host;
+}
+
+void
+PlayerTCP::InitClients()
+{
   this->thread = pthread_self();
   this->size_clients = 0;
   this->num_clients = 0;
@@ -151,34 +219,41 @@ PlayerTCP::PlayerTCP()
   this->client_ufds = (struct pollfd*)NULL;
 
   pthread_mutex_init(&this->clients_mutex,NULL);
+  pthread_mutex_init(&this->devices_mutex,NULL);
 
-  this->num_listeners = 0;
-  this->listeners = (playertcp_listener_t*)NULL;
-  this->listen_ufds = (struct pollfd*)NULL;
+  this->shards = NULL;
+  this->num_shards = 0;
+  this->quit = false;
+  this->delivered = false;
+  this->backlog = false;
 
   // Create a buffer to hold decoded incoming messages
   this->decode_readbuffersize = PLAYER_MAX_MESSAGE_SIZE;
   this->decode_readbuffer = (char*)malloc(this->decode_readbuffersize);
   assert(this->decode_readbuffer);
-
-  if(hostname_to_packedaddr(&this->host,"localhost") < 0)
-  {
-    PLAYER_WARN("address lookup failed for localhost");
-    this->host = 0;
-  }
-
-  deviceTable->AddRemoteDriverFn(TCPRemoteDriver::TCPRemoteDriver_Init,this);
 }
 
 PlayerTCP::~PlayerTCP()
 {
+  this->StopIOThreads();
   for(int i=0;i<this->num_clients;i++)
     this->Close(i);
+#if !defined (WIN32)
+  for(int i=0;i<this->num_listeners;i++)
+  {
+    if(this->listeners[i].local)
+      close(this->listeners[i].fd);
+  }
+#endif
   free(this->clients);
   free(this->client_ufds);
   free(this->listeners);
   free(this->listen_ufds);
   free(this->decode_readbuffer);
+  if(this->owner)
+    delete this->watcher;
+  pthread_mutex_destroy(&this->clients_mutex);
+  pthread_mutex_destroy(&this->devices_mutex);
 
 #if defined (WIN32)
   // Clean up the Windows sockets API (this can safely be done as many times as we like)
@@ -187,6 +262,102 @@ PlayerTCP::~PlayerTCP()
 #endif
 }
 
+int
+PlayerTCP::StartIOThreads(int num_threads)
+{
+  if(this->owner || this->num_shards)
+  {
+    PLAYER_ERROR("I/O threads have already been started");
+    return(-1);
+  }
+
+  this->shards = (PlayerTCP**)calloc(num_threads, sizeof(PlayerTCP*));
+  assert(this->shards);
+  for(int i=0;i<num_threads;i++)
+  {
+    this->shards[i] = new PlayerTCP(this);
+    assert(this->shards[i]);
+    if(pthread_create(&this->shards[i]->thread, NULL,
+                      &PlayerTCP::IOThread, this->shards[i]) != 0)
+    {
+      PLAYER_ERROR1("failed to start TCP I/O thread %d", i);
+      delete this->shards[i];
+      break;
+    }
+    this->num_shards++;
+  }
+
+  if(this->num_shards < num_threads)
+  {
+    this->StopIOThreads();
+    return(-1);
+  }
+  PLAYER_MSG1(1, "serving TCP clients from %d I/O threads", this->num_shards);
+  return(0);
+}
+
+void
+PlayerTCP::StopIOThreads()
+{
+  for(int i=0;i<this->num_shards;i++)
+  {
+    this->shards[i]->quit = true;
+    this->shards[i]->watcher->Wake();
+    pthread_join(this->shards[i]->thread, NULL);
+    delete this->shards[i];
+  }
+  free(this->shards);
+  this->shards = NULL;
+  this->num_shards = 0;
+}
+
+void*
+PlayerTCP::IOThread(void* arg)
+{
+  reinterpret_cast<PlayerTCP*>(arg)->IOLoop();
+  return(NULL);
+}
+
+// Main loop of an I/O thread
+void
+PlayerTCP::IOLoop()
+{
+  while(!this->quit)
+  {
+    // Sleep until a client sends something or has new data queued, but
+    // keep trying clients whose sockets were full.
+    this->watcher->Wait(this->backlog ? PLAYERTCP_WRITE_RETRY : -1);
+    if(this->quit)
+      break;
+
+    this->delivered = false;
+    if(this->Read(0,false) < 0)
+      PLAYER_ERROR("failed while reading from TCP clients");
+    // Non-threaded drivers only get to see their messages when the server
+    // thread updates them, so let it know that there are some.
+    if(this->delivered && fileWatcher)
+      fileWatcher->Wake();
+
+    if(this->Write(false) < 0)
+      PLAYER_ERROR("failed while writing to TCP clients");
+  }
+}
+
+// Clients go to the I/O thread with the fewest (without locking, so the
+// count may be slightly stale), or to this object if there are no I/O
+// threads.
+PlayerTCP*
+PlayerTCP::PickShard()
+{
+  PlayerTCP* best = this;
+  for(int i=0;i<this->num_shards;i++)
+  {
+    if((best == this) || (this->shards[i]->num_clients < best->num_clients))
+      best = this->shards[i];
+  }
+  return(best);
+}
+
 int
 PlayerTCP::Listen(int* ports, int num_ports, int* new_ports)
 {
@@ -213,6 +384,7 @@ PlayerTCP::Listen(int* ports, int num_ports, int* new_ports)
     if(new_ports)
       new_ports[i] = p;
     this->listeners[i].port = p;
+    this->listeners[i].local = 0;
 
     // set up for later use of poll() to accept() connections on this port
     this->listen_ufds[i].fd = this->listeners[i].fd;
@@ -232,6 +404,56 @@ PlayerTCP::Listen(int port)
   return(this->Listen(&p,1));
 }
 
+int
+PlayerTCP::ListenLocal(int* ports, int num_ports, size_t ring_size)
+{
+#if defined (WIN32)
+  PLAYER_ERROR("local connections are not supported on this platform");
+  return(-1);
+#else
+  if(!player_shmring_supported())
+  {
+    PLAYER_ERROR("local connections are not supported on this platform");
+    return(-1);
+  }
+  this->local_ring_size = ring_size;
+
+  int tmp = this->num_listeners;
+  this->listeners = (playertcp_listener_t*)realloc(this->listeners,
+                                                   (tmp + num_ports) *
+                                                   sizeof(playertcp_listener_t));
+  this->listen_ufds = (struct pollfd*)realloc(this->listen_ufds,
+                                              (tmp + num_ports) *
+                                              sizeof(struct pollfd));
+  assert(this->listeners);
+  assert(this->listen_ufds);
+
+  for(int i=0;i<num_ports;i++)
+  {
+    int fd;
+
+    if((fd = player_shmring_listen(ports[i])) < 0)
+      return(-1);
+    if(fcntl(fd, F_SETFL, O_NONBLOCK) == -1)
+    {
+      STRERROR (PLAYER_ERROR1, "fcntl() failed: %s");
+      close(fd);
+      return(-1);
+    }
+
+    int j = this->num_listeners++;
+    this->listeners[j].fd = fd;
+    this->listeners[j].port = ports[i];
+    this->listeners[j].local = 1;
+    this->listen_ufds[j].fd = fd;
+    this->listen_ufds[j].events = POLLIN;
+    fileWatcher->AddFileWatch(fd);
+  }
+
+  return(0);
+#endif
+}
+
 
 QueuePointer
 PlayerTCP::AddClient(struct sockaddr_in* cliaddr,
@@ -254,7 +476,8 @@ PlayerTCP::AddClient(struct sockaddr_in* cliaddr,
                      bool send_banner,
                      int* kill_flag,
                      bool have_lock,
-                     QueuePointer queue)
+                     QueuePointer queue,
+                     player_shmring_t* ring)
 {
   if(!have_lock)
   {
@@ -291,16 +514,21 @@ PlayerTCP::AddClient(struct sockaddr_in* cliaddr,
   this->clients[j].dev_subs = NULL;
   this->clients[j].num_dev_subs = 0;
   this->clients[j].kill_flag = kill_flag;
+  this->clients[j].ring = ring;
 
   // Set up for later use of poll
   this->client_ufds[j].fd = this->clients[j].fd;
   this->client_ufds[j].events = POLLIN;
 
-  // set up for later use by global file watcher
-  fileWatcher->AddFileWatch(this->client_ufds[j].fd);
+  // set up for later use by the file watcher of the thread that serves
+  // this client
+  this->watcher->AddFileWatch(this->client_ufds[j].fd);
 
   // Create an outgoing queue for this client
   this->clients[j].queue = queue;
+  this->clients[j].queue->SetWakeFileWatcher(this->watcher);
+  if(player_lockfree_queues)
+    this->clients[j].queue->SetLockFree(true);
 
   // Create a buffer to hold incoming messages
   this->clients[j].readbuffersize = PLAYERTCP_READBUFFER_SIZE;
@@ -309,12 +537,10 @@ PlayerTCP::AddClient(struct sockaddr_in* cliaddr,
   assert(this->clients[j].readbuffer);
   this->clients[j].readbufferlen = 0;
 
-  // Create a buffer to hold outgoing messages
-  this->clients[j].writebuffersize = PLAYERTCP_WRITEBUFFER_SIZE;
-  this->clients[j].writebuffer =
-          (char*)calloc(1,this->clients[j].writebuffersize);
-  assert(this->clients[j].writebuffer);
-  this->clients[j].writebufferlen = 0;
+  // Nothing waiting to go out yet
+  this->clients[j].num_pending = 0;
+  this->clients[j].pending_offset = 0;
+  this->clients[j].pending_bytes = 0;
 
   this->num_clients++;
 
@@ -323,10 +549,13 @@ PlayerTCP::AddClient(struct sockaddr_in* cliaddr,
     memset(data,0,sizeof(data));
     snprintf((char*)data, sizeof(data)-1, "%s%s",
              PLAYER_IDENT_STRING, playerversion);
+    // A local client gets its ring along with the banner
 #if defined (WIN32)
     if(send(this->clients[j].fd, (const char*)data, PLAYER_IDENT_STRLEN, 0) < 0)
 #else
-    if(send(this->clients[j].fd, (void*)data, PLAYER_IDENT_STRLEN, 0) < 0)
+    if((ring ? player_shmring_send(this->clients[j].fd, data,
+                                   PLAYER_IDENT_STRLEN, ring) :
+               send(this->clients[j].fd, (void*)data, PLAYER_IDENT_STRLEN, 0)) < 0)
 #endif
     {
       PLAYER_ERROR("failed to send ident string");
@@ -407,8 +636,9 @@ PlayerTCP::Accept(int timeout)
 #if ENABLE_TCP_NODELAY
       // Disable Nagel's algorithm for lower latency
       int yes = 1;
-      if( setsockopt(newsock, IPPROTO_TCP, TCP_NODELAY, &yes,
-                     sizeof(int)) == -1 )
+      if(!this->listeners[i].local &&
+         setsockopt(newsock, IPPROTO_TCP, TCP_NODELAY, &yes,
+                    sizeof(int)) == -1 )
       {
         PLAYER_ERROR("failed to enable TCP_NODELAY - setsockopt failed");
         return(-1);
@@ -433,10 +663,30 @@ PlayerTCP::Accept(int timeout)
       }
 #endif
 
-      this->AddClient(&cliaddr,
-                      this->host,
-                      this->listeners[i].port,
-                      newsock, true, NULL, false);
+      if(this->listeners[i].local)
+      {
+        // Local clients get a shared-memory ring for their messages
+        player_shmring_t* ring = (player_shmring_t*)malloc(sizeof(player_shmring_t));
+        assert(ring);
+        if(player_shmring_create(ring, this->local_ring_size) < 0)
+        {
+          PLAYER_ERROR("failed to set up local client; closing connection");
+          free(ring);
+          close(newsock);
+        }
+        else
+          this->PickShard()->AddClient(NULL,
+                                       this->host,
+                                       this->listeners[i].port,
+                                       newsock, true, NULL, false,
+                                       QueuePointer(false,PLAYER_MSGQUEUE_DEFAULT_MAXLEN),
+                                       ring);
+      }
+      else
+        this->PickShard()->AddClient(&cliaddr,
+                                     this->host,
+                                     this->listeners[i].port,
+                                     newsock, true, NULL, false);
 
       num_accepts--;
     }
@@ -453,6 +703,8 @@ PlayerTCP::Close(int cli)
   PLAYER_MSG2(1, "closing TCP connection to client %d on port %d",
               cli, this->clients[cli].port);
 
+  if(this->owner)
+    this->owner->LockDevices();
   for(size_t i=0;i<this->clients[cli].num_dev_subs;i++)
   {
     Device* dev = this->clients[cli].dev_subs[i];
@@ -461,8 +713,10 @@ PlayerTCP::Close(int cli)
         dev->Unsubscribe(this->clients[cli].queue);
     }
   }
+  if(this->owner)
+    this->owner->UnlockDevices();
   free(this->clients[cli].dev_subs);
-  fileWatcher->RemoveFileWatch(this->clients[cli].fd);
+  this->watcher->RemoveFileWatch(this->clients[cli].fd);
 #if defined (WIN32)
   if (closesocket (this->clients[cli].fd) != 0)
     STRERROR (PLAYER_WARN1, "closesocket() failed: %s");
@@ -475,7 +729,17 @@ PlayerTCP::Close(int cli)
   this->clients[cli].valid = 0;
   this->clients[cli].queue = QueuePointer();
   free(this->clients[cli].readbuffer);
-  free(this->clients[cli].writebuffer);
+  if(this->clients[cli].ring)
+  {
+    player_shmring_destroy(this->clients[cli].ring);
+    free(this->clients[cli].ring);
+    this->clients[cli].ring = NULL;
+  }
+  for(int i=0;i<this->clients[cli].num_pending;i++)
+    delete this->clients[cli].pending[i].msg;
+  this->clients[cli].num_pending = 0;
+  this->clients[cli].pending_offset = 0;
+  this->clients[cli].pending_bytes = 0;
   if(this->clients[cli].kill_flag)
     *(this->clients[cli].kill_flag) = 1;
 }
@@ -629,205 +893,310 @@ PlayerTCP::Listening(int port)
   return(false);
 }
 
+// Encode the payload of a message, or fetch the encoding that was cached
+// when the same message was written to another client.  Returns the length
+// of the encoded body, or -1 on failure.
 int
-PlayerTCP::WriteClient(int cli)
+PlayerTCP::EncodeBody(Message* msg, const char** body)
 {
-  int numwritten;
-  playertcp_conn_t* client;
-  Message* msg;
   player_pack_fn_t packfunc;
-  player_msghdr_t hdr;
+  player_msghdr_t* hdr;
   void* payload;
-  int encode_msglen;
+  char* buf;
+  int len;
 
 #if HAVE_Z
   player_map_data_t* zipped_data=NULL;
 #endif
 
-  client = this->clients + cli;
-  for(;;)
+  if((len = msg->GetEncoded(body)) >= 0)
+    return(len);
+
+  hdr = msg->GetHeader();
+  payload = msg->GetPayload();
+
+  // Locate the appropriate packing function
+  if(!(packfunc = playerxdr_get_packfunc(hdr->addr.interf,
+                                         hdr->type, hdr->subtype)))
   {
-    // try to send any bytes leftover from last time.
-    if(client->writebufferlen)
+    // TODO: Allow the user to register a callback to handle unsupported messages
+    PLAYER_WARN4("skipping message from %s:%u with unsupported type %s:%u",
+                 interf_to_str(hdr->addr.interf), hdr->addr.index, msgtype_to_str(hdr->type), hdr->subtype);
+    return(-1);
+  }
+
+  // HACK: special handling for map data to compress it before sending
+  // them out over the network.
+  if((hdr->addr.interf == PLAYER_MAP_CODE) &&
+     (hdr->type == PLAYER_MSGTYPE_RESP_ACK) &&
+     (hdr->subtype == PLAYER_MAP_REQ_GET_DATA))
+  {
+#if HAVE_Z
+    player_map_data_t* raw_data = (player_map_data_t*)payload;
+    zipped_data = (player_map_data_t*)calloc(1,sizeof(player_map_data_t));
+    assert(zipped_data);
+
+    // copy the metadata
+    *zipped_data = *raw_data;
+    uLongf count = compressBound(raw_data->data_count);
+    zipped_data->data = (int8_t*)malloc(count);
+
+    // compress the tile
+    int ret;
+    ret = compress((Bytef*)zipped_data->data,&count,
+                     (const Bytef*)raw_data->data, raw_data->data_count);
+    if((ret != Z_OK) && (ret != Z_STREAM_END))
     {
-      numwritten = send(client->fd,
-                         client->writebuffer,
-                         MIN(client->writebufferlen,
-                             PLAYERTCP_WRITEBUFFER_SIZE), 0);
+      PLAYER_ERROR("failed to compress map data");
+      free(zipped_data->data);
+      free(zipped_data);
+      return(-1);
+    }
 
+    zipped_data->data_count = count;
 
-      if(numwritten < 0)
-      {
-        if(ErrNo == ERRNO_EAGAIN)
-        {
-          // buffers are full
-          return(0);
-        }
-        else
-        {
-#if defined (WIN32)
-          LPVOID buffer = NULL;
-          FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM, NULL,
-                        ErrNo, 0, reinterpret_cast<LPTSTR> (&buffer), 0, NULL);
-          PLAYER_MSG1(2, "send() failed: %s", reinterpret_cast<LPTSTR> (buffer));
-          LocalFree(buffer);
+    // swap the payload pointer to point at the zipped version
+    payload = (void*)zipped_data;
 #else
-          PLAYER_MSG1(2,"send() failed: %s", strerror(ErrNo));
+    PLAYER_WARN("not compressing map data, because zlib was not found at compile time");
 #endif
-          return(-1);
-        }
-      }
-      else if(numwritten == 0)
-      {
-        PLAYER_MSG0(2,"wrote zero bytes");
-        return(-1);
-      }
+  }
 
-      memmove(client->writebuffer, client->writebuffer + numwritten,
-              client->writebufferlen - numwritten);
-      client->writebufferlen -= numwritten;
-    }
-    // try to pop a pending message
-    else if((msg = client->queue->Pop()))
+  // 4 times the message (including dynamic data) is a safe upper bound
+  size_t maxsize = 4 * msg->GetDataSize();
+  if(maxsize > (size_t)(PLAYERXDR_MAX_MESSAGE_SIZE - PLAYERXDR_MSGHDR_SIZE))
+    maxsize = PLAYERXDR_MAX_MESSAGE_SIZE - PLAYERXDR_MSGHDR_SIZE;
+  buf = (char*)malloc(MAX(maxsize,(size_t)1));
+  assert(buf);
+
+  if((len = (*packfunc)(buf, maxsize, payload, PLAYERXDR_ENCODE)) < 0)
+  {
+    PLAYER_WARN4("encoding failed on message from %s:%u with type %s:%u",
+                 interf_to_str(hdr->addr.interf), hdr->addr.index, msgtype_to_str(hdr->type), hdr->subtype);
+    free(buf);
+  }
+  else
+  {
+    // Shrink to fit, then hand the buffer over to the message
+    buf = (char*)realloc(buf, MAX(len,1));
+    assert(buf);
+    len = msg->SetEncoded(buf, len, body);
+  }
+
+#if HAVE_Z
+  if(zipped_data)
+  {
+    free(zipped_data->data);
+    free(zipped_data);
+  }
+#endif
+  return(len);
+}
+
+int
+PlayerTCP::WriteClient(int cli)
+{
+  int numwritten;
+  playertcp_conn_t* client;
+  Message* msg;
+  player_msghdr_t hdr;
+  const char* body;
+  int encode_msglen;
+
+  client = this->clients + cli;
+  for(;;)
+  {
+    // Gather up messages until there is a decent amount to write, but
+    // only once the last lot has gone out entirely.  While the socket (or
+    // ring) is full, everything else stays on the queue, where replacement
+    // can still act on it.
+    bool refill = (client->num_pending == 0);
+    while(refill &&
+          (client->num_pending < PLAYERTCP_MAX_PENDING) &&
+          (client->pending_bytes < PLAYERTCP_WRITEBUFFER_SIZE) &&
+          (msg = client->queue->Pop()))
     {
       // Note that we make a COPY of the header.  This is so that we can
       // edit the size field before sending it out, without affecting other
       // instances of the message on other queues.
       hdr = *msg->GetHeader();
-      payload = msg->GetPayload();
-
-      // Make sure there's room in the buffer for the encoded messsage.
-      // 4 times the message (including dynamic data) is a safe upper bound
-      size_t maxsize = PLAYERXDR_MSGHDR_SIZE + (4 * msg->GetDataSize());
-      if(maxsize > (size_t)(client->writebuffersize))
-      {
-        // Get at least twice as much space
-        client->writebuffersize = MAX((size_t)(client->writebuffersize * 2),
-                                        maxsize);
-        // Did we hit the limit (or overflow and become negative)?
-        if((client->writebuffersize >= PLAYERXDR_MAX_MESSAGE_SIZE) ||
-           (client->writebuffersize < 0))
-        {
-          PLAYER_WARN1("allocating maximum %d bytes to outgoing message buffer",
-                         PLAYERXDR_MAX_MESSAGE_SIZE);
-          client->writebuffersize = PLAYERXDR_MAX_MESSAGE_SIZE;
-        }
-        client->writebuffer = (char*)realloc(client->writebuffer,
-                                               client->writebuffersize);
-        assert(client->writebuffer);
-        memset(client->writebuffer, 0, client->writebuffersize);
-      }
 
-      // HACK: special handling for map data to compress it before sending
-      // them out over the network.
-      if((hdr.addr.interf == PLAYER_MAP_CODE) &&
-         (hdr.type == PLAYER_MSGTYPE_RESP_ACK) &&
-         (hdr.subtype == PLAYER_MAP_REQ_GET_DATA))
+      // The body is encoded once per message and shared by every client
+      // that receives it.
+      if(msg->GetPayload())
       {
-#if HAVE_Z
-        player_map_data_t* raw_data = (player_map_data_t*)payload;
-        zipped_data = (player_map_data_t*)calloc(1,sizeof(player_map_data_t));
-        assert(zipped_data);
-
-        // copy the metadata
-        *zipped_data = *raw_data;
-        uLongf count = compressBound(raw_data->data_count);
-        zipped_data->data = (int8_t*)malloc(count);
-
-        // compress the tile
-        int ret;
-        ret = compress((Bytef*)zipped_data->data,&count,
-                         (const Bytef*)raw_data->data, raw_data->data_count);
-        if((ret != Z_OK) && (ret != Z_STREAM_END))
+        if((encode_msglen = this->EncodeBody(msg, &body)) < 0)
         {
-          PLAYER_ERROR("failed to compress map data");
-          free(zipped_data);
-          client->writebufferlen = 0;
           delete msg;
-          return(0);
-        }
-
-        zipped_data->data_count = count;
-
-        // swap the payload pointer to point at the zipped version
-        payload = (void*)zipped_data;
-#else
-        PLAYER_WARN("not compressing map data, because zlib was not found at compile time");
-#endif
-      }
-
-      if (payload)
-      {
-        // Locate the appropriate packing function
-        if(!(packfunc = playerxdr_get_packfunc(hdr.addr.interf,
-                                               hdr.type, hdr.subtype)))
-        {
-          // TODO: Allow the user to register a callback to handle unsupported messages
-          PLAYER_WARN4("skipping message from %s:%u with unsupported type %s:%u",
-                           interf_to_str(hdr.addr.interf), hdr.addr.index, msgtype_to_str(hdr.type), hdr.subtype);
-        }
-        else
-        {
-          // Encode the body first
-          if((encode_msglen =
-              (*packfunc)(client->writebuffer + PLAYERXDR_MSGHDR_SIZE,
-                        maxsize - PLAYERXDR_MSGHDR_SIZE,
-                        payload, PLAYERXDR_ENCODE)) < 0)
-          {
-            PLAYER_WARN4("encoding failed on message from %s:%u with type %s:%u",
-                       interf_to_str(hdr.addr.interf), hdr.addr.index, msgtype_to_str(hdr.type), hdr.subtype);
-#if HAVE_Z
-            if(zipped_data)
-            {
-              free(zipped_data->data);
-              free(zipped_data);
-              zipped_data=NULL;
-            }
-#endif
-            client->writebufferlen = 0;
-            delete msg;
-            return(0);
-          }
+          continue;
         }
       }
       else
       {
+        body = NULL;
         encode_msglen = 0;
       }
+
+      if((PLAYERXDR_MSGHDR_SIZE + encode_msglen > PLAYERXDR_MAX_MESSAGE_SIZE) ||
+         (client->ring && ((size_t)(PLAYERXDR_MSGHDR_SIZE + encode_msglen) >
+                           player_shmring_max_record(client->ring))))
+      {
+        PLAYER_WARN4("skipping oversized message from %s:%u with type %s:%u",
+                     interf_to_str(hdr.addr.interf), hdr.addr.index, msgtype_to_str(hdr.type), hdr.subtype);
+        delete msg;
+        continue;
+      }
+
       // Rewrite the size in the header with the length of the encoded
       // body, then encode the header.
+      playertcp_outmsg_t* out = client->pending + client->num_pending;
       hdr.size = encode_msglen;
-      if((encode_msglen = player_msghdr_pack(client->writebuffer,
+      if(player_msghdr_pack(out->hdr,
                    PLAYERXDR_MSGHDR_SIZE, &hdr,
-                   PLAYERXDR_ENCODE)) < 0)
+                   PLAYERXDR_ENCODE) < 0)
       {
         PLAYER_ERROR("failed to encode msg header");
-#if HAVE_Z
-        if(zipped_data)
+        delete msg;
+        continue;
+      }
+      // Hold on to the message until it has been written; the body is
+      // sent from where it is.
+      out->msg = msg;
+      out->body = body;
+      out->bodylen = encode_msglen;
+      client->num_pending++;
+      client->pending_bytes += PLAYERXDR_MSGHDR_SIZE + encode_msglen;
+    }
+
+    if(!client->num_pending)
+      return(0);
+
+    if(client->ring)
+    {
+      // Copy whole messages into the ring, as far as there is room
+      int i;
+      for(i=0;i<client->num_pending;i++)
+      {
+        playertcp_outmsg_t* out = client->pending + i;
+        size_t len = PLAYERXDR_MSGHDR_SIZE + out->bodylen;
+        char* rec;
+        if(!(rec = player_shmring_reserve(client->ring, len)))
         {
-          free(zipped_data->data);
-          free(zipped_data);
-          zipped_data=NULL;
+          if(client->ring->broken)
+          {
+            PLAYER_WARN("local client corrupted its message ring; closing connection");
+            return(-1);
+          }
+          break;
         }
-#endif
-        client->writebufferlen = 0;
-        delete msg;
+        memcpy(rec, out->hdr, PLAYERXDR_MSGHDR_SIZE);
+        if(out->bodylen)
+          memcpy(rec + PLAYERXDR_MSGHDR_SIZE, out->body, out->bodylen);
+        player_shmring_commit(client->ring, len);
+        client->pending_bytes -= len;
+        delete out->msg;
+      }
+      if(i)
+        player_shmring_signal(client->ring);
+      client->num_pending -= i;
+      memmove(client->pending, client->pending + i,
+              client->num_pending * sizeof(playertcp_outmsg_t));
+
+      // The ring is full
+      if(client->num_pending)
         return(0);
+      continue;
+    }
+
+    // Write out as much as the socket will take, skipping what went out
+    // last time.
+    size_t skip = client->pending_offset;
+#if defined (WIN32)
+    WSABUF iov[2 * PLAYERTCP_MAX_PENDING];
+    #define PLAYERTCP_IOV_SET(v,p,l) { (v).buf = (char*)(p); (v).len = (l); }
+#else
+    struct iovec iov[2 * PLAYERTCP_MAX_PENDING];
+    #define PLAYERTCP_IOV_SET(v,p,l) { (v).iov_base = (void*)(p); (v).iov_len = (l); }
+#endif
+    int niov = 0;
+    for(int i=0;i<client->num_pending;i++)
+    {
+      playertcp_outmsg_t* out = client->pending + i;
+      if(skip < PLAYERXDR_MSGHDR_SIZE)
+      {
+        PLAYERTCP_IOV_SET(iov[niov], out->hdr + skip,
+                          PLAYERXDR_MSGHDR_SIZE - skip);
+        niov++;
+        skip = 0;
       }
+      else
+        skip -= PLAYERXDR_MSGHDR_SIZE;
+      if(out->bodylen > skip)
+      {
+        PLAYERTCP_IOV_SET(iov[niov], out->body + skip, out->bodylen - skip);
+        niov++;
+      }
+      skip = 0;
+    }
+#undef PLAYERTCP_IOV_SET
 
-      client->writebufferlen = PLAYERXDR_MSGHDR_SIZE + hdr.size;
+#if defined (WIN32)
+    DWORD numsent;
+    if(WSASend(client->fd, iov, niov, &numsent, 0, NULL, NULL) == SOCKET_ERROR)
+      numwritten = -1;
+    else
+      numwritten = numsent;
+#else
+    numwritten = writev(client->fd, iov, niov);
+#endif
 
-      delete msg;
-#if HAVE_Z
-      if(zipped_data)
+    if(numwritten < 0)
+    {
+      if(ErrNo == ERRNO_EAGAIN)
       {
-        free(zipped_data->data);
-        free(zipped_data);
-        zipped_data=NULL;
+        // buffers are full
+        return(0);
       }
+      else
+      {
+#if defined (WIN32)
+        LPVOID buffer = NULL;
+        FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM, NULL,
+                      ErrNo, 0, reinterpret_cast<LPTSTR> (&buffer), 0, NULL);
+        PLAYER_MSG1(2, "send() failed: %s", reinterpret_cast<LPTSTR> (buffer));
+        LocalFree(buffer);
+#else
+        PLAYER_MSG1(2,"send() failed: %s", strerror(ErrNo));
 #endif
+        return(-1);
+      }
     }
-    else
+    else if(numwritten == 0)
+    {
+      PLAYER_MSG0(2,"wrote zero bytes");
+      return(-1);
+    }
+
+    // Release the messages that have gone out completely, and remember how
+    // far we got with the next one.
+    size_t done = client->pending_offset + numwritten;
+    int i;
+    for(i=0;i<client->num_pending;i++)
+    {
+      size_t len = PLAYERXDR_MSGHDR_SIZE + client->pending[i].bodylen;
+      if(done < len)
+        break;
+      done -= len;
+      delete client->pending[i].msg;
+    }
+    client->num_pending -= i;
+    memmove(client->pending, client->pending + i,
+            client->num_pending * sizeof(playertcp_outmsg_t));
+    client->pending_offset = done;
+    client->pending_bytes -= numwritten;
+
+    // The socket took less than we offered; it is full
+    if(client->num_pending)
       return(0);
   }
 }
@@ -845,6 +1214,7 @@ PlayerTCP::Write(bool have_lock)
   if(!have_lock)
     Lock();
 
+  this->backlog = false;
   for(int i=0;i<this->num_clients;i++)
   {
     if(this->WriteClient(i) < 0)
@@ -852,6 +1222,8 @@ PlayerTCP::Write(bool have_lock)
       PLAYER_WARN1("failed to write to client %d\n", i);
       this->clients[i].del = 1;
     }
+    else if(this->clients[i].num_pending)
+      this->backlog = true;
   }
 
   this->DeleteClients();
@@ -1055,7 +1427,11 @@ PlayerTCP::ParseBuffer(int cli)
           {
             Message* msg = new Message(hdr, msg_data, client->queue);
             assert(msg);
+            if(this->owner)
+              this->owner->LockDevices();
             this->HandlePlayerMessage(cli, msg);
+            if(this->owner)
+              this->owner->UnlockDevices();
             delete msg;
 
             // Non-obvious thing: as a result of HandlePlayerMessage(), the
@@ -1107,6 +1483,7 @@ PlayerTCP::ParseBuffer(int cli)
             }
             else
               device->PutMsg(client->queue, &hdr, msg_data);
+            this->delivered = true;
           }
           // Need to ensure that the copy of any dynamic data made during unpacking
           // is cleaned up (putting message bodies into a Message class, as with PutMsg,
@@ -1443,3 +1820,15 @@ PlayerTCP::Unlock()
 {
   pthread_mutex_unlock(&clients_mutex);
 }
+
+void
+PlayerTCP::LockDevices()
+{
+  pthread_mutex_lock(&devices_mutex);
+}
+
+void
+PlayerTCP::UnlockDevices()
+{
+  pthread_mutex_unlock(&devices_mutex);
+}
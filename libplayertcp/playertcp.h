@@ -47,6 +47,9 @@
  * @brief Player TCP library
 
 This library moves messages between Player message queues and TCP sockets.
+Clients on the same host can instead connect through a Unix domain socket,
+and receive their messages through shared memory (see
+PlayerTCP::ListenLocal()).
 
 @section datamode_protocol Data modes
 
@@ -84,6 +87,24 @@ messages when waiting for a PLAYER_MSGTYPE_RESP_ACK, then process them at
 the beginning of their read function after sending the PLAYER_PLAYER_REQ_DATA
 message.
 
+@section io_threads I/O threads
+
+By default all clients are read from and written to by the thread that
+calls PlayerTCP::Read() and PlayerTCP::Write() (the server thread).  After
+PlayerTCP::StartIOThreads(), newly accepted clients are instead shared out
+among a number of I/O threads, each of which reads, decodes, encodes and
+writes for its own clients, and sleeps on its own FileWatcher until one of
+them sends something or has new data queued.  Connections made by the
+remote driver stay with the server thread.
+
+Subscriptions and other requests to the player interface change the state
+of devices and drivers, which non-threaded drivers assume only the server
+thread touches.  The I/O threads handle them (and unsubscribe clients that
+disconnect) while holding PlayerTCP::LockDevices(), which the server
+thread also holds around DeviceTable::UpdateDevices(), so they never
+overlap with device updates, and each client's messages are still
+delivered in the order they were sent.
+
 @todo More verbose documentation on this library, including the protocol
 */
 /** @ingroup libplayertcp
@@ -117,6 +138,7 @@ message.
 #include <pthread.h>
 
 #include <libplayercore/playercore.h>
+#include <libplayercommon/shmring.h>
 
 /** Default TCP port */
 #define PLAYERTCP_DEFAULT_PORT 6665
@@ -125,12 +147,21 @@ message.
     calloc() and realloc() read buffers in multiples of this size. */
 #define PLAYERTCP_READBUFFER_SIZE 65536
 
-/** We try to write() outgoing messages in chunks of this size.  We also
-    calloc() and realloc() write buffers in multiples of this size. */
+/** Small outgoing messages are gathered into writes of about this size. */
 #define PLAYERTCP_WRITEBUFFER_SIZE 65536
 
+/** Most outgoing messages that are held for a client, waiting to be
+    written, at any one time.  Each takes two entries in the iovec passed
+    to writev(). */
+#define PLAYERTCP_MAX_PENDING 32
+
+/** How often (s) an I/O thread retries writing to clients whose sockets
+    were full. */
+#define PLAYERTCP_WRITE_RETRY 0.01
+
 // Forward declarations
 struct pollfd;
+class FileWatcher;
 
 struct playertcp_listener;
 struct playertcp_conn;
@@ -142,6 +173,8 @@ class PLAYERTCP_EXPORT PlayerTCP
     int num_listeners;
     playertcp_listener* listeners;
     struct pollfd* listen_ufds;
+    /** Size of the shared-memory ring given to each local client */
+    size_t local_ring_size;
 
     pthread_mutex_t clients_mutex;
     int size_clients;
@@ -154,6 +187,33 @@ class PLAYERTCP_EXPORT PlayerTCP
     /** Total size of @p decode_readbuffer */
     int decode_readbuffersize;
 
+    /** Watcher that is woken by our clients' sockets and queues */
+    FileWatcher* watcher;
+
+    /** Held while devices are updated, and while I/O threads change
+        subscriptions (see LockDevices()) */
+    pthread_mutex_t devices_mutex;
+    /** For an I/O thread's share of the clients, the object that accepted
+        them; otherwise NULL */
+    PlayerTCP* owner;
+    /** Shares of the clients served by I/O threads */
+    PlayerTCP** shards;
+    int num_shards;
+    /** Tells an I/O thread to exit */
+    volatile bool quit;
+    /** Set when a message is passed to a device in Read() */
+    bool delivered;
+    /** Set when a client has messages that its socket would not take */
+    bool backlog;
+
+    /** Create an I/O thread's share of the clients */
+    PlayerTCP(PlayerTCP* owner);
+    void InitClients();
+    /** Pick the object (this one or a shard) to serve a new client */
+    PlayerTCP* PickShard();
+    static void* IOThread(void* arg);
+    void IOLoop();
+
   public:
     PlayerTCP();
     ~PlayerTCP();
@@ -161,12 +221,29 @@ class PLAYERTCP_EXPORT PlayerTCP
     void Lock();
     void Unlock();
 
+    /** Start num_threads I/O threads, among which clients accepted from
+        now on are shared out.  Returns 0 on success. */
+    int StartIOThreads(int num_threads);
+    /** Stop the I/O threads, closing their clients */
+    void StopIOThreads();
+    /** Lock out subscription changes by the I/O threads.  Call around
+        DeviceTable::UpdateDevices(). */
+    void LockDevices();
+    void UnlockDevices();
+
     static void InitGlobals(void);
 
     pthread_t thread;
 
     int Listen(int* ports, int num_ports, int* new_ports=NULL);
     int Listen(int port);
+    /** Also accept clients on this host through a Unix domain socket for
+        each port (see libplayercommon/shmring.h).  They send messages
+        down the socket and receive them through a shared-memory ring of
+        ring_size bytes each, which is how much shared memory every local
+        client ends up using. */
+    int ListenLocal(int* ports, int num_ports,
+                    size_t ring_size=PLAYER_SHMRING_DEFAULT_SIZE);
     QueuePointer AddClient(struct sockaddr_in* cliaddr,
                             unsigned int local_host,
                             unsigned int local_port,
@@ -181,7 +258,8 @@ class PLAYERTCP_EXPORT PlayerTCP
                             bool send_banner,
                             int* kill_flag,
                             bool have_lock,
-                            QueuePointer queue);
+                            QueuePointer queue,
+                            struct player_shmring* ring=NULL);
     int Update(int timeout);
     int Accept(int timeout);
     void Close(int cli);
@@ -190,12 +268,16 @@ class PLAYERTCP_EXPORT PlayerTCP
     int Read(int timeout, bool have_lock);
     int Write(bool have_lock);
     int WriteClient(int cli);
+    int EncodeBody(Message* msg, const char** body);
     void DeleteClients();
     void ParseBuffer(int cli);
     int HandlePlayerMessage(int cli, Message* msg);
     void DeleteClient(QueuePointer &q, bool have_lock);
     bool Listening(int port);
     uint32_t GetHost() {return host;};
+    /** Did the last Write() leave messages that a client's socket would
+        not take?  If so, Write() should be called again soon. */
+    bool HasBacklog() {return backlog;};
 };
 
 /** @} */
@@ -42,6 +42,7 @@
 #if !defined (WIN32)
   #include <unistd.h>
   #include <errno.h>
+  #include <arpa/inet.h>
 #endif
 #include <stdlib.h>
 #include <assert.h>
@@ -53,6 +54,7 @@
 #endif
 
 #include <replace/replace.h>
+#include <libplayercommon/udpframe.h>
 #include <libplayercore/playercore.h>
 #include <libplayerinterface/playerxdr.h>
 
@@ -97,13 +99,21 @@ typedef struct playerudp_conn
   /** How much of @p readbuffer is currently in use (i.e., holding a
     partial message) */
   int readbufferlen;
-  /** Buffer in which to store partial outgoint messages */
-  char* writebuffer;
-  /** Total size of @p writebuffer */
-  int writebuffersize;
-  /** How much of @p writebuffer is currently in use (i.e., holding a
-    partial message) */
-  int writebufferlen;
+  /** Reassembly of incoming messages from their datagrams */
+  player_udpframe_reasm_t reasm;
+  /** Sequence number of the message being sent */
+  uint32_t seq;
+  /** Message being sent, its encoded header and (shared) encoded body, and
+    how much of it has gone out so far */
+  Message* txmsg;
+  char txhdr[PLAYERXDR_MSGHDR_SIZE];
+  const char* txbody;
+  size_t txbodylen;
+  size_t txoffset;
+  /** Did the client ask for DATA messages through the multicast group? */
+  int multicast;
+  /** Is the client in PULL mode? */
+  int pull;
   /** Linked list of devices to which we are subscribed */
   Device** dev_subs;
   size_t num_dev_subs;
@@ -144,6 +154,16 @@ PlayerUDP::PlayerUDP()
   assert(this->decode_readbuffer);
   this->decode_readbufferlen = 0;
 
+  this->dgram = (char*)malloc(PLAYER_UDPFRAME_MAX_DATAGRAM);
+  assert(this->dgram);
+
+  this->mcast_fd = -1;
+  memset(&this->mcast_addr, 0, sizeof(this->mcast_addr));
+  this->mcast_seq = 0;
+  memset(this->mcast_sent, 0, sizeof(this->mcast_sent));
+  this->mcast_next = 0;
+  this->backlog = false;
+
   if(hostname_to_packedaddr(&this->host,"localhost") < 0)
   {
     PLAYER_WARN("address lookup failed for localhost");
@@ -162,6 +182,20 @@ PlayerUDP::~PlayerUDP()
   free(this->listeners);
   free(this->listen_ufds);
   free(this->decode_readbuffer);
+  free(this->dgram);
+  for(int i=0;i<PLAYERUDP_MULTICAST_HISTORY;i++)
+  {
+    if(this->mcast_sent[i])
+      delete this->mcast_sent[i];
+  }
+  if(this->mcast_fd >= 0)
+  {
+#if defined (WIN32)
+    closesocket(this->mcast_fd);
+#else
+    close(this->mcast_fd);
+#endif
+  }
 
 #if defined (WIN32)
   // Clean up the Windows sockets API (this can safely be done as many times as we like)
@@ -206,6 +240,40 @@ PlayerUDP::Listen(int* ports, int num_ports)
   return(0);
 }
 
+int
+PlayerUDP::Multicast(const char* group, int port)
+{
+  int ttl = 1;
+  int loop = 1;
+
+  memset(&this->mcast_addr, 0, sizeof(this->mcast_addr));
+  this->mcast_addr.sin_family = AF_INET;
+  this->mcast_addr.sin_port = htons(port);
+  this->mcast_addr.sin_addr.s_addr = inet_addr(group);
+  if(!IN_MULTICAST(ntohl(this->mcast_addr.sin_addr.s_addr)))
+  {
+    PLAYER_ERROR1("%s is not a multicast address", group);
+    return(-1);
+  }
+
+  if((this->mcast_fd = _create_and_bind_udp_socket(0,this->host,0)) < 0)
+  {
+    PLAYER_ERROR("_create_and_bind_udp_socket() failed");
+    return(-1);
+  }
+
+  // Keep the group on the local network, but let clients on this host
+  // hear it too
+  if((setsockopt(this->mcast_fd, IPPROTO_IP, IP_MULTICAST_TTL,
+                 (const char*)&ttl, sizeof(ttl)) < 0) ||
+     (setsockopt(this->mcast_fd, IPPROTO_IP, IP_MULTICAST_LOOP,
+                 (const char*)&loop, sizeof(loop)) < 0))
+    STRERROR (PLAYER_WARN1, "failed to set multicast options: %s");
+
+  PLAYER_MSG2(1, "multicasting UDP data to %s:%d", group, port);
+  return(0);
+}
+
 // Should be called with client_mutex locked
 QueuePointer
 PlayerUDP::AddClient(struct sockaddr_in* cliaddr,
@@ -241,10 +309,17 @@ PlayerUDP::AddClient(struct sockaddr_in* cliaddr,
   this->clients[j].dev_subs = NULL;
   this->clients[j].num_dev_subs = 0;
   this->clients[j].kill_flag = kill_flag;
+  player_udpframe_reasm_init(&this->clients[j].reasm,
+                             PLAYERXDR_MAX_MESSAGE_SIZE);
+  this->clients[j].seq = 0;
+  this->clients[j].txmsg = NULL;
+  this->clients[j].multicast = 0;
+  this->clients[j].pull = 0;
 
   // Create an outgoing queue for this client
   this->clients[j].queue =
           QueuePointer(0,PLAYER_MSGQUEUE_DEFAULT_MAXLEN);
+  this->clients[j].queue->SetWakeFileWatcher(true);
 
   // Create a buffer to hold incoming messages
   this->clients[j].readbuffersize = PLAYERUDP_READBUFFER_SIZE;
@@ -253,13 +328,6 @@ PlayerUDP::AddClient(struct sockaddr_in* cliaddr,
   assert(this->clients[j].readbuffer);
   this->clients[j].readbufferlen = 0;
 
-  // Create a buffer to hold outgoing messages
-  this->clients[j].writebuffersize = PLAYERUDP_WRITEBUFFER_SIZE;
-  this->clients[j].writebuffer =
-          (char*)calloc(1,this->clients[j].writebuffersize);
-  assert(this->clients[j].writebuffer);
-  this->clients[j].writebufferlen = 0;
-
   this->num_clients++;
 
   if(send_banner)
@@ -322,7 +390,12 @@ PlayerUDP::Close(int cli)
   while((msg = this->clients[cli].queue->Pop()))
     delete msg;
   free(this->clients[cli].readbuffer);
-  free(this->clients[cli].writebuffer);
+  player_udpframe_reasm_free(&this->clients[cli].reasm);
+  if(this->clients[cli].txmsg)
+  {
+    delete this->clients[cli].txmsg;
+    this->clients[cli].txmsg = NULL;
+  }
   if(this->clients[cli].kill_flag)
     *(this->clients[cli].kill_flag) = 1;
 }
@@ -335,6 +408,10 @@ PlayerUDP::Read(int timeout)
   int num_available;
   playerudp_conn_t* client;
   int cli;
+  player_udpframe_hdr_t frame;
+  int hello;
+  const char* msg;
+  int msglen;
 
   // Poll for incoming messages
   if((num_available = poll(this->listen_ufds, num_listeners, timeout)) < 0)
@@ -376,6 +453,13 @@ PlayerUDP::Read(int timeout)
       }
       else
       {
+        // A hello (or, from an older client, an empty datagram) starts a
+        // new connection
+        hello = !this->decode_readbufferlen ||
+                ((player_udpframe_unpack(this->decode_readbuffer,
+                                         this->decode_readbufferlen,
+                                         &frame) == 0) && !frame.count);
+
         pthread_mutex_lock(&this->clients_mutex);
 
         // Do we know about this one already?
@@ -387,18 +471,31 @@ PlayerUDP::Read(int timeout)
           {
             // Matched.
 
-            // An empty datagram signals a new client, even if he's
-            // using an old port
-            if(!this->decode_readbufferlen)
+            // A hello signals a new client, even if he's using an old
+            // port
+            if(hello)
             {
               client->del = 1;
               cli = this->num_clients;
               break;
             }
 
+            // Add the datagram to the message being put together, and
+            // carry on once it is whole
+            if((msglen = player_udpframe_reasm_add(&client->reasm,
+                                                   this->decode_readbuffer,
+                                                   this->decode_readbufferlen,
+                                                   &msg)) < 0)
+            {
+              PLAYER_WARN2("skipping malformed datagram (%d bytes) from client %d",
+                           this->decode_readbufferlen, cli);
+              break;
+            }
+            else if(!msglen)
+              break;
+
             // Might we need more room to assemble the current partial message?
-            if((client->readbuffersize - client->readbufferlen) <
-               this->decode_readbufferlen)
+            if((client->readbuffersize - client->readbufferlen) < msglen)
             {
               // Get twice as much space.
               client->readbuffersize *= 2;
@@ -418,18 +515,17 @@ PlayerUDP::Read(int timeout)
             }
 
             // Having allocated more space, are we full?
-            if((client->readbuffersize - client->readbufferlen) <
-               this->decode_readbufferlen)
+            if((client->readbuffersize - client->readbufferlen) < msglen)
             {
               PLAYER_WARN2("client %d's buffer is full (%d bytes)",
                            cli, client->readbufferlen);
             }
             else
             {
-              // Copy the new datagram into the client's buffer
+              // Copy the new message into the client's buffer
               memcpy(client->readbuffer + client->readbufferlen,
-                     this->decode_readbuffer, this->decode_readbufferlen);
-              client->readbufferlen += this->decode_readbufferlen;
+                     msg, msglen);
+              client->readbufferlen += msglen;
 
               // Try to parse the data received so far
               this->ParseBuffer(cli);
@@ -450,11 +546,19 @@ PlayerUDP::Read(int timeout)
                           this->listeners[i].fd,
                           true, NULL);
 
-          if(this->decode_readbufferlen > 0)
+          if(!hello)
           {
-            PLAYER_WARN1("non-empty (%u bytes) initial message from UDP client",
+            PLAYER_WARN1("initial message (%u bytes) from UDP client is not a hello",
                          this->decode_readbufferlen);
           }
+          else if(this->decode_readbufferlen &&
+                  (frame.flags & PLAYER_UDPFRAME_MULTICAST))
+          {
+            if(this->mcast_fd < 0)
+              PLAYER_WARN("UDP client asked for multicast data, but there is no multicast group");
+            else
+              this->clients[this->num_clients-1].multicast = 1;
+          }
         }
 
         num_available--;
@@ -543,63 +647,195 @@ PlayerUDP::Listening(int port)
   return(false);
 }
 
+// Encode the payload of a message, or fetch the encoding that was cached
+// when the same message was written to another client.  Returns the length
+// of the encoded body, or -1 on failure.
 int
-PlayerUDP::WriteClient(int cli)
+PlayerUDP::EncodeBody(Message* msg, const char** body)
 {
-  int numwritten;
-  playerudp_conn_t* client;
-  Message* msg;
   player_pack_fn_t packfunc;
-  player_msghdr_t hdr;
+  player_msghdr_t* hdr;
   void* payload;
-  int encode_msglen;
-  socklen_t addrlen = sizeof(struct sockaddr_in);
+  char* buf;
+  int len;
+
 #if HAVE_Z
   player_map_data_t* zipped_data=NULL;
 #endif
 
-  client = this->clients + cli;
-  for(;;)
+  if((len = msg->GetEncoded(body)) >= 0)
+    return(len);
+
+  hdr = msg->GetHeader();
+  payload = msg->GetPayload();
+
+  // Locate the appropriate packing function
+  if(!(packfunc = playerxdr_get_packfunc(hdr->addr.interf,
+                                         hdr->type, hdr->subtype)))
   {
-    // try to send any bytes leftover from last time.
-    if(client->writebufferlen)
+    // TODO: Allow the user to register a callback to handle unsupported messages
+    PLAYER_WARN4("skipping message from %s:%u with unsupported type %s:%u",
+                 interf_to_str(hdr->addr.interf), hdr->addr.index, msgtype_to_str(hdr->type), hdr->subtype);
+    return(-1);
+  }
+
+  // HACK: special handling for map data to compress it before sending
+  // them out over the network.
+  if((hdr->addr.interf == PLAYER_MAP_CODE) &&
+     (hdr->type == PLAYER_MSGTYPE_RESP_ACK) &&
+     (hdr->subtype == PLAYER_MAP_REQ_GET_DATA))
+  {
+#if HAVE_Z
+    player_map_data_t* raw_data = (player_map_data_t*)payload;
+    zipped_data = (player_map_data_t*)calloc(1,sizeof(player_map_data_t));
+    assert(zipped_data);
+
+    // copy the metadata
+    *zipped_data = *raw_data;
+    uLongf count = compressBound(raw_data->data_count);
+    zipped_data->data = (int8_t*)malloc(count);
+
+    // compress the tile
+    int ret;
+    ret = compress((Bytef*)zipped_data->data,&count,
+                     (const Bytef*)raw_data->data, raw_data->data_count);
+    if((ret != Z_OK) && (ret != Z_STREAM_END))
     {
-      numwritten = sendto(client->fd,
-                          client->writebuffer,
-                          MIN(client->writebufferlen,
-                              PLAYERUDP_WRITEBUFFER_SIZE), 0,
-                          (struct sockaddr*)&client->addr, addrlen);
+      PLAYER_ERROR("failed to compress map data");
+      free(zipped_data->data);
+      free(zipped_data);
+      return(-1);
+    }
 
-      if(numwritten < 0)
-      {
-        if(ErrNo == ERRNO_EAGAIN)
-        {
-          // buffers are full
-          return(0);
-        }
-        else
-        {
-#if defined (WIN32)
-          LPVOID buffer = NULL;
-          FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM, NULL,
-                        ErrNo, 0, reinterpret_cast<LPTSTR> (&buffer), 0, NULL);
-          PLAYER_MSG1(2, "sendto() failed: %s", reinterpret_cast<LPTSTR> (buffer));
-          LocalFree(buffer);
+    zipped_data->data_count = count;
+
+    // swap the payload pointer to point at the zipped version
+    payload = (void*)zipped_data;
 #else
-          PLAYER_MSG1(2,"sendto() failed: %s", strerror(ErrNo));
+    PLAYER_WARN("not compressing map data, because zlib was not found at compile time");
 #endif
-          return(-1);
-        }
-      }
-      else if(numwritten == 0)
+  }
+
+  // 4 times the message (including dynamic data) is a safe upper bound
+  size_t maxsize = 4 * msg->GetDataSize();
+  if(maxsize > (size_t)(PLAYERXDR_MAX_MESSAGE_SIZE - PLAYERXDR_MSGHDR_SIZE))
+    maxsize = PLAYERXDR_MAX_MESSAGE_SIZE - PLAYERXDR_MSGHDR_SIZE;
+  buf = (char*)malloc(MAX(maxsize,(size_t)1));
+  assert(buf);
+
+  if((len = (*packfunc)(buf, maxsize, payload, PLAYERXDR_ENCODE)) < 0)
+  {
+    PLAYER_WARN4("encoding failed on message from %s:%u with type %s:%u",
+                 interf_to_str(hdr->addr.interf), hdr->addr.index, msgtype_to_str(hdr->type), hdr->subtype);
+    free(buf);
+  }
+  else
+  {
+    // Shrink to fit, then hand the buffer over to the message
+    buf = (char*)realloc(buf, MAX(len,1));
+    assert(buf);
+    len = msg->SetEncoded(buf, len, body);
+  }
+
+#if HAVE_Z
+  if(zipped_data)
+  {
+    free(zipped_data->data);
+    free(zipped_data);
+  }
+#endif
+  return(len);
+}
+
+// Send an encoded message as a series of datagrams, starting with the one
+// at @p offset.  Returns 1 once it has all gone, 0 if the socket filled up
+// first (@p offset then says where to carry on), or -1 on error.
+int
+PlayerUDP::SendFrames(int fd, struct sockaddr_in* addr, uint32_t seq,
+                      const char* head, const char* body, size_t bodylen,
+                      size_t* offset)
+{
+  socklen_t addrlen = sizeof(struct sockaddr_in);
+  size_t len;
+
+  while(*offset < PLAYERXDR_MSGHDR_SIZE + bodylen)
+  {
+    len = player_udpframe_build(this->dgram, seq, head, PLAYERXDR_MSGHDR_SIZE,
+                                body, bodylen, *offset);
+    if(sendto(fd, this->dgram, len, 0, (struct sockaddr*)addr, addrlen) < 0)
+    {
+      if(ErrNo == ERRNO_EAGAIN)
       {
-        PLAYER_MSG0(2,"wrote zero bytes");
-        return(-1);
+        // buffers are full
+        return(0);
       }
+#if defined (WIN32)
+      LPVOID buffer = NULL;
+      FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM, NULL,
+                    ErrNo, 0, reinterpret_cast<LPTSTR> (&buffer), 0, NULL);
+      PLAYER_MSG1(2, "sendto() failed: %s", reinterpret_cast<LPTSTR> (buffer));
+      LocalFree(buffer);
+#else
+      PLAYER_MSG1(2,"sendto() failed: %s", strerror(ErrNo));
+#endif
+      return(-1);
+    }
+    *offset += len - PLAYER_UDPFRAME_HDR_SIZE;
+  }
+  return(1);
+}
 
-      memmove(client->writebuffer, client->writebuffer + numwritten,
-              client->writebufferlen - numwritten);
-      client->writebufferlen -= numwritten;
+// Send a DATA message to the multicast group, unless it already went there
+// from another client's queue
+void
+PlayerUDP::MulticastMessage(Message* msg, const char* head,
+                            const char* body, size_t bodylen)
+{
+  size_t offset = 0;
+
+  // Copies of a message share their reference count, which identifies them
+  for(int i=0;i<PLAYERUDP_MULTICAST_HISTORY;i++)
+  {
+    if(this->mcast_sent[i] && (this->mcast_sent[i]->RefCount == msg->RefCount))
+      return;
+  }
+
+  // Nobody waits for a multicast message, so whatever doesn't fit in the
+  // socket now is dropped; the next message will be fresher anyway.
+  if(this->SendFrames(this->mcast_fd, &this->mcast_addr, this->mcast_seq++,
+                      head, body, bodylen, &offset) == 0)
+    PLAYER_MSG0(2, "multicast socket is full; dropping message");
+
+  if(this->mcast_sent[this->mcast_next])
+    delete this->mcast_sent[this->mcast_next];
+  this->mcast_sent[this->mcast_next] = new Message(*msg);
+  assert(this->mcast_sent[this->mcast_next]);
+  this->mcast_next = (this->mcast_next + 1) % PLAYERUDP_MULTICAST_HISTORY;
+}
+
+int
+PlayerUDP::WriteClient(int cli)
+{
+  int ret;
+  playerudp_conn_t* client;
+  Message* msg;
+  player_msghdr_t hdr;
+  const char* body;
+  int encode_msglen;
+
+  client = this->clients + cli;
+  for(;;)
+  {
+    // try to send the rest of the message that was cut short last time.
+    if(client->txmsg)
+    {
+      if((ret = this->SendFrames(client->fd, &client->addr, client->seq,
+                                 client->txhdr, client->txbody,
+                                 client->txbodylen, &client->txoffset)) <= 0)
+        return(ret);
+      delete client->txmsg;
+      client->txmsg = NULL;
+      client->seq++;
     }
     // try to pop a pending message
     else if((msg = client->queue->Pop()))
@@ -608,138 +844,58 @@ PlayerUDP::WriteClient(int cli)
       // edit the size field before sending it out, without affecting other
       // instances of the message on other queues.
       hdr = *msg->GetHeader();
-      payload = msg->GetPayload();
 
-      // Make sure there's room in the buffer for the encoded messsage.
-      // 4 times the message (including dynamic data) is a safe upper bound
-      size_t maxsize = PLAYERXDR_MSGHDR_SIZE + (4 * msg->GetDataSize());
-      if(maxsize > (size_t)(client->writebuffersize))
+      // The body is encoded once per message and shared by every client
+      // that receives it.
+      if(msg->GetPayload())
       {
-        // Get at least twice as much space
-        client->writebuffersize = MAX((size_t)(client->writebuffersize * 2),
-                                        maxsize);
-        // Did we hit the limit (or overflow and become negative)?
-        if((client->writebuffersize >= PLAYERXDR_MAX_MESSAGE_SIZE) ||
-           (client->writebuffersize < 0))
+        if((encode_msglen = this->EncodeBody(msg, &body)) < 0)
         {
-          PLAYER_WARN1("allocating maximum %d bytes to outgoing message buffer",
-                         PLAYERXDR_MAX_MESSAGE_SIZE);
-          client->writebuffersize = PLAYERXDR_MAX_MESSAGE_SIZE;
-        }
-        client->writebuffer = (char*)realloc(client->writebuffer,
-                                               client->writebuffersize);
-        assert(client->writebuffer);
-        memset(client->writebuffer, 0, client->writebuffersize);
-      }
-
-      // HACK: special handling for map data to compress it before sending
-      // them out over the network.
-      if((hdr.addr.interf == PLAYER_MAP_CODE) &&
-         (hdr.type == PLAYER_MSGTYPE_RESP_ACK) &&
-         (hdr.subtype == PLAYER_MAP_REQ_GET_DATA))
-      {
-#if HAVE_Z
-        player_map_data_t* raw_data = (player_map_data_t*)payload;
-        zipped_data = (player_map_data_t*)calloc(1,sizeof(player_map_data_t));
-        assert(zipped_data);
-
-        // copy the metadata
-        *zipped_data = *raw_data;
-        uLongf count = compressBound(raw_data->data_count);
-        zipped_data->data = (int8_t*)malloc(count);
-
-        // compress the tile
-        int ret;
-        ret = compress((Bytef*)zipped_data->data,&count,
-                         (const Bytef*)raw_data->data, raw_data->data_count);
-        if((ret != Z_OK) && (ret != Z_STREAM_END))
-        {
-          PLAYER_ERROR("failed to compress map data");
-          free(zipped_data);
-          client->writebufferlen = 0;
           delete msg;
-          return(0);
-        }
-
-        zipped_data->data_count = count;
-
-        // swap the payload pointer to point at the zipped version
-        payload = (void*)zipped_data;
-#else
-        PLAYER_WARN("not compressing map data, because zlib was not found at compile time");
-#endif
-      }
-
-      if (payload)
-      {
-        // Locate the appropriate packing function
-        if(!(packfunc = playerxdr_get_packfunc(hdr.addr.interf,
-                                               hdr.type, hdr.subtype)))
-        {
-          // TODO: Allow the user to register a callback to handle unsupported messages
-          PLAYER_WARN4("skipping message from %s:%u with unsupported type %s:%u",
-                           interf_to_str(hdr.addr.interf), hdr.addr.index, msgtype_to_str(hdr.type), hdr.subtype);
-        }
-        else
-        {
-          // Encode the body first
-          if((encode_msglen =
-              (*packfunc)(client->writebuffer + PLAYERXDR_MSGHDR_SIZE,
-                        maxsize - PLAYERXDR_MSGHDR_SIZE,
-                        payload, PLAYERXDR_ENCODE)) < 0)
-          {
-            PLAYER_WARN4("encoding failed on message from %s:%u with type %s:%u",
-                       interf_to_str(hdr.addr.interf), hdr.addr.index, msgtype_to_str(hdr.type), hdr.subtype);
-#if HAVE_Z
-            if(zipped_data)
-            {
-              free(zipped_data->data);
-              free(zipped_data);
-              zipped_data=NULL;
-            }
-#endif
-            client->writebufferlen = 0;
-            delete msg;
-            return(0);
-          }
+          continue;
         }
       }
       else
       {
+        body = NULL;
         encode_msglen = 0;
       }
+
+      if(PLAYERXDR_MSGHDR_SIZE + encode_msglen > PLAYERXDR_MAX_MESSAGE_SIZE)
+      {
+        PLAYER_WARN4("skipping oversized message from %s:%u with type %s:%u",
+                     interf_to_str(hdr.addr.interf), hdr.addr.index, msgtype_to_str(hdr.type), hdr.subtype);
+        delete msg;
+        continue;
+      }
+
       // Rewrite the size in the header with the length of the encoded
       // body, then encode the header.
       hdr.size = encode_msglen;
-      if((encode_msglen = player_msghdr_pack(client->writebuffer,
+      if(player_msghdr_pack(client->txhdr,
                    PLAYERXDR_MSGHDR_SIZE, &hdr,
-                   PLAYERXDR_ENCODE)) < 0)
+                   PLAYERXDR_ENCODE) < 0)
       {
         PLAYER_ERROR("failed to encode msg header");
-#if HAVE_Z
-        if(zipped_data)
-        {
-          free(zipped_data->data);
-          free(zipped_data);
-          zipped_data=NULL;
-        }
-#endif
-        client->writebufferlen = 0;
         delete msg;
-        return(0);
+        continue;
       }
 
-      client->writebufferlen = PLAYERXDR_MSGHDR_SIZE + hdr.size;
-
-      delete msg;
-#if HAVE_Z
-      if(zipped_data)
+      // Data for a client that listens to the multicast group goes there
+      // instead.  In PULL mode, it has to come in order with the SYNCH
+      // that follows it, so it is sent directly.
+      if(client->multicast && !client->pull && (this->mcast_fd >= 0) &&
+         (hdr.type == PLAYER_MSGTYPE_DATA))
       {
-        free(zipped_data->data);
-        free(zipped_data);
-        zipped_data=NULL;
+        this->MulticastMessage(msg, client->txhdr, body, encode_msglen);
+        delete msg;
+        continue;
       }
-#endif
+
+      client->txmsg = msg;
+      client->txbody = body;
+      client->txbodylen = encode_msglen;
+      client->txoffset = 0;
     }
     else
       return(0);
@@ -751,6 +907,7 @@ PlayerUDP::Write()
 {
   pthread_mutex_lock(&this->clients_mutex);
 
+  this->backlog = false;
   for(int i=0;i<this->num_clients;i++)
   {
     if(this->WriteClient(i) < 0)
@@ -758,6 +915,8 @@ PlayerUDP::Write()
       PLAYER_WARN1("failed to write to client %d\n", i);
       this->clients[i].del = 1;
     }
+    else if(this->clients[i].txmsg)
+      this->backlog = true;
   }
 
 
@@ -1186,9 +1345,15 @@ PlayerUDP::HandlePlayerMessage(int cli, Message* msg)
         {
           player_device_datamode_req_t * req = reinterpret_cast<player_device_datamode_req_t *> (payload);
           if (req->mode == PLAYER_DATAMODE_PUSH)
+          {
             client->queue->SetPull (false);
+            client->pull = 0;
+          }
           else if (req->mode == PLAYER_DATAMODE_PULL)
+          {
             client->queue->SetPull (true);
+            client->pull = 1;
+          }
           else
             PLAYER_WARN1 ("unknown data mode requsted: %d", req->mode);
           // Make up and push out the reply
@@ -48,8 +48,24 @@
 
 This library moves messages between Player message queues and UDP sockets.
 
+Messages are encoded as for TCP, then split into datagrams of at most
+PLAYER_UDPFRAME_MAX_DATAGRAM bytes, so that messages of any size (camera
+frames, large scans) can be carried.  Each datagram has a small frame
+header with the message's sequence number (see libplayercommon/udpframe.h).
+Lost datagrams are not sent again; the receiver puts together one message
+at a time, and drops an incomplete one as soon as a newer one starts to
+arrive, so that fresh data is never held up behind stale data.
+
+A client starts by sending a hello datagram from the socket that it will
+use.  If the server has been given a multicast group (see Multicast()), a
+client in PUSH mode can ask in its hello to receive DATA messages through
+that group: each such message is then sent to the group once, however
+many clients are subscribed to it, and each client picks out the data for
+its own devices.  Replies and other messages still go to each client
+directly.
+
 @todo
- - More verbose documentation on this library, including the protocol
+ - More verbose documentation on this library
 
 */
 /** @ingroup libplayerudp
@@ -89,9 +105,12 @@ This library moves messages between Player message queues and UDP sockets.
     calloc() and realloc() read buffers in multiples of this size. */
 #define PLAYERUDP_READBUFFER_SIZE 65536
 
-/** We try to write() outgoing messages in chunks of this size.  We also
-    calloc() and realloc() write buffers in multiples of this size. */
-#define PLAYERUDP_WRITEBUFFER_SIZE 65536
+/** Default port for the multicast group */
+#define PLAYERUDP_DEFAULT_MULTICAST_PORT 6660
+
+/** Number of recently multicast messages to remember, so that a message
+    that is queued for several clients goes to the group only once */
+#define PLAYERUDP_MULTICAST_HISTORY 64
 
 // Forward declarations
 struct pollfd;
@@ -122,6 +141,31 @@ class PLAYERUDP_EXPORT PlayerUDP
     /** Currently-used length of @p decode_readbuffersize */
     int decode_readbufferlen;
 
+    /** Datagram being sent */
+    char* dgram;
+
+    /** Socket and address for multicast DATA messages (fd is -1 if
+     * there is no group) */
+    int mcast_fd;
+    struct sockaddr_in mcast_addr;
+    /** Sequence number for the next multicast message */
+    uint32_t mcast_seq;
+    /** Messages recently sent to the group, oldest first from
+     * @p mcast_next; we hold a reference to each so that their cached
+     * encodings stay put and identify them */
+    Message* mcast_sent[PLAYERUDP_MULTICAST_HISTORY];
+    int mcast_next;
+
+    /** Set when a client has a message that its socket would not take */
+    bool backlog;
+
+    int EncodeBody(Message* msg, const char** body);
+    int SendFrames(int fd, struct sockaddr_in* addr, uint32_t seq,
+                   const char* head, const char* body, size_t bodylen,
+                   size_t* offset);
+    void MulticastMessage(Message* msg, const char* head,
+                          const char* body, size_t bodylen);
+
   public:
     PlayerUDP();
     ~PlayerUDP();
@@ -129,6 +173,10 @@ class PLAYERUDP_EXPORT PlayerUDP
     pthread_t thread;
 
     int Listen(int* ports, int num_ports);
+    /** Send DATA messages to the multicast group @p group (dotted
+        quad) on @p port, for clients that ask for it.  Returns 0 on
+        success. */
+    int Multicast(const char* group, int port);
     QueuePointer AddClient(struct sockaddr_in* cliaddr,
                             unsigned int local_host,
                             unsigned int local_port,
@@ -145,6 +193,9 @@ class PLAYERUDP_EXPORT PlayerUDP
     void DeleteClient(MessageQueue* q);
     bool Listening(int port);
     uint32_t GetHost() {return host;};
+    /** Did the last Write() leave a message only partly sent?  If so,
+        Write() should be called again soon. */
+    bool HasBacklog() {return backlog;};
 };
 
 /** @} */
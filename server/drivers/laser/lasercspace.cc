@@ -105,16 +105,33 @@ driver
 #include <math.h>
 #include <stdlib.h>       // for atoi(3)
 
+#if defined (__SSE2__)
+  #include <emmintrin.h>
+  #define LASERCSPACE_SSE2 1
+#endif
+
 #include <libplayercore/playercore.h>
 
 #include "lasertransform.h"
 
+// Number of obstacle points in each angular sector
+#define LASERCSPACE_SECTOR_SIZE 16
+
 // Driver for computing the free c-space from a laser scan.
+//
+// The obstacle points (every step'th reading) are grouped into sectors of
+// consecutive bearings.  An obstacle at range r_ can only shorten beams
+// within asin(radius / r_) of its own bearing, so each sector is tested
+// against just the beams in the window given by its nearest point, rather
+// than every obstacle against every beam.
 class LaserCSpace : public LaserTransform
 {
   // Constructor
   public: LaserCSpace( ConfigFile* cf, int section);
 
+  // Destructor
+  public: virtual ~LaserCSpace();
+
   // Process laser data.  Returns non-zero if the laser data has been
   // updated.
   private: int UpdateLaser(player_laser_data_t * data);
@@ -122,8 +139,13 @@ class LaserCSpace : public LaserTransform
   // Pre-compute a bunch of stuff
   private: void Precompute(player_laser_data_t* data);
 
-  // Compute the maximum free-space range for sample n.
-  private: double FreeRange(player_laser_data_t* data, int n);
+  // Shorten the range of each beam that the obstacles in sector k could
+  // be in the way of.
+  private: void UpdateSector(player_laser_data_t* data, int k);
+
+  // Compute the maximum free-space range for sample n, given obstacle
+  // points first to first + count - 1 and the range so far.
+  private: double FreeRange(int n, int first, int count, double max_r);
 
 
   // Step size for subsampling the scan (saves CPU cycles)
@@ -132,9 +154,19 @@ class LaserCSpace : public LaserTransform
   // Robot radius.
   private: double radius;
 
-  // Lookup table for precomputations
-  private: double (*lu)[4];
+  // Cartesian position and range of each reading
+  private: double *beam_x, *beam_y, *beam_r;
+
+  // Cartesian position of each obstacle point (every step'th reading)
+  private: double *obs_x, *obs_y;
+  private: int obs_count;
 
+  // Nearest obstacle range in each sector
+  private: double *sector_r;
+  private: int sector_count;
+
+  // Number of readings the buffers have room for
+  private: unsigned int buffer_size;
 };
 
 
@@ -160,15 +192,38 @@ LaserCSpace::LaserCSpace( ConfigFile* cf, int section)
   // Settings.
   this->radius = cf->ReadLength(section, "radius", 0.50);
   this->sample_step = cf->ReadInt(section, "step", 1);
+  if (this->sample_step < 1)
+    this->sample_step = 1;
+
+  this->beam_x = this->beam_y = this->beam_r = NULL;
+  this->obs_x = this->obs_y = NULL;
+  this->sector_r = NULL;
+  this->obs_count = this->sector_count = 0;
+  this->buffer_size = 0;
 
   return;
 }
 
+
+////////////////////////////////////////////////////////////////////////////////
+// Destructor
+LaserCSpace::~LaserCSpace()
+{
+  delete [] this->beam_x;
+  delete [] this->beam_y;
+  delete [] this->beam_r;
+  delete [] this->obs_x;
+  delete [] this->obs_y;
+  delete [] this->sector_r;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // Process laser data.
 int LaserCSpace::UpdateLaser(player_laser_data_t * data)
 {
   unsigned int i;
+  int k;
 
   // Construct the outgoing laser packet
   this->data.resolution = data->resolution;
@@ -177,20 +232,28 @@ int LaserCSpace::UpdateLaser(player_laser_data_t * data)
   this->data.max_range = data->max_range;
   this->data.ranges_count = data->ranges_count;
   this->data.ranges = new float [data->ranges_count];
-  this->lu = new double[data->ranges_count][4];
 
   // Do some precomputations to save time
   this->Precompute(data);
 
-  // Generate the range estimate for each bearing.
+  // Start from each reading, less the radius, and let each sector shorten
+  // the beams it could be in the way of.
   for (i = 0; i < data->ranges_count; i++)
-    this->data.ranges[i]  = this->FreeRange(data,i);
+    this->data.ranges[i] = this->beam_r[i] - this->radius;
+  for (k = 0; k < this->sector_count; k++)
+    this->UpdateSector(data, k);
+
+  // Clip negative ranges.
+  for (i = 0; i < data->ranges_count; i++)
+  {
+    if (this->data.ranges[i] < 0)
+      this->data.ranges[i] = 0;
+  }
 
   this->Publish(this->device_addr,
                 PLAYER_MSGTYPE_DATA, PLAYER_LASER_DATA_SCAN,
                 (void*)&this->data);
   delete [] this->data.ranges;
-  delete [] this->lu;
 
   return 1;
 }
@@ -201,84 +264,209 @@ int LaserCSpace::UpdateLaser(player_laser_data_t * data)
 void LaserCSpace::Precompute(player_laser_data_t* data)
 {
   unsigned int i;
-  double r, b, x, y;
+  int j, k, end;
+  double r, b;
+
+  // Grow the buffers to fit the scan
+  if (data->ranges_count > this->buffer_size)
+  {
+    delete [] this->beam_x;
+    delete [] this->beam_y;
+    delete [] this->beam_r;
+    delete [] this->obs_x;
+    delete [] this->obs_y;
+    delete [] this->sector_r;
+    this->buffer_size = data->ranges_count;
+    this->beam_x = new double[this->buffer_size];
+    this->beam_y = new double[this->buffer_size];
+    this->beam_r = new double[this->buffer_size];
+    this->obs_x = new double[this->buffer_size];
+    this->obs_y = new double[this->buffer_size];
+    this->sector_r = new double[this->buffer_size / LASERCSPACE_SECTOR_SIZE + 1];
+  }
 
   for (i = 0; i < data->ranges_count; i++)
   {
     r = data->ranges[i];
     b = data->min_angle + data->resolution * i;
-    x = r * cos(b);
-    y = r * sin(b);
+    this->beam_x[i] = r * cos(b);
+    this->beam_y[i] = r * sin(b);
+    this->beam_r[i] = r;
+  }
 
-    this->lu[i][0] = r;
-    this->lu[i][1] = b;
-    this->lu[i][2] = x;
-    this->lu[i][3] = y;
+  // Obstacle points, packed so that the inner loop runs over contiguous
+  // memory
+  this->obs_count = 0;
+  for (i = 0; i < data->ranges_count; i += this->sample_step)
+  {
+    this->obs_x[this->obs_count] = this->beam_x[i];
+    this->obs_y[this->obs_count] = this->beam_y[i];
+    this->obs_count++;
+  }
+
+  // Nearest point in each sector, which sets the sector's window
+  this->sector_count = (this->obs_count + LASERCSPACE_SECTOR_SIZE - 1) /
+    LASERCSPACE_SECTOR_SIZE;
+  for (k = 0; k < this->sector_count; k++)
+  {
+    end = (k + 1) * LASERCSPACE_SECTOR_SIZE;
+    if (end > this->obs_count)
+      end = this->obs_count;
+    this->sector_r[k] = HUGE_VAL;
+    for (j = k * LASERCSPACE_SECTOR_SIZE; j < end; j++)
+    {
+      r = this->beam_r[j * this->sample_step];
+      if (r < this->sector_r[k])
+        this->sector_r[k] = r;
+    }
   }
   return;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-// Compute the maximum free-space range for sample n.
-double LaserCSpace::FreeRange(player_laser_data_t* data, int n)
+// Shorten the range of each beam that the obstacles in sector k could be in
+// the way of.
+void LaserCSpace::UpdateSector(player_laser_data_t* data, int k)
 {
-  unsigned int i;
-  int step;
-  double r, b, x, y;
-  double r_, b_, x_, y_;
-  double s, nr, nx, ny, dx, dy;
-  double d, h;
-  double max_r;
+  int first, count, n, lo, hi, shift, last_beam;
+  double window, a0, a1, res;
+
+  first = k * LASERCSPACE_SECTOR_SIZE;
+  count = this->obs_count - first;
+  if (count > LASERCSPACE_SECTOR_SIZE)
+    count = LASERCSPACE_SECTOR_SIZE;
+  last_beam = (int) data->ranges_count - 1;
+
+  // An obstacle at range r_ is within the radius of a beam at most
+  // asin(radius / r_) away; one inside the radius can touch any beam
+  // within a right angle (beyond that, it is behind the robot).
+  if (this->sector_r[k] > this->radius)
+    window = asin(this->radius / this->sector_r[k]);
+  else
+    window = M_PI / 2;
+
+  // A point at the origin (a zero reading) is in the way of every beam,
+  // and without a resolution there's no telling which beams are which;
+  // test them all.
+  res = data->resolution;
+  if (res <= 0 || this->sector_r[k] <= 0)
+  {
+    for (n = 0; n <= last_beam; n++)
+    {
+      if (this->sector_r[k] - this->radius <= this->data.ranges[n])
+        this->data.ranges[n] = this->FreeRange(n, first, count,
+                                               this->data.ranges[n]);
+    }
+    return;
+  }
 
-  // Step size for subsampling the scan (saves CPU cycles)
-  step = this->sample_step;
+  // Bearings covered by the window, tried a turn either way so that scans
+  // of (nearly) a full circle wrap around.  Beams visited twice are
+  // harmless.
+  a0 = data->min_angle + res * (first * this->sample_step) - window;
+  a1 = data->min_angle + res * ((first + count - 1) * this->sample_step) + window;
+  for (shift = -1; shift <= 1; shift++)
+  {
+    lo = (int) ceil((a0 + shift * 2 * M_PI - data->min_angle) / res) - 1;
+    hi = (int) floor((a1 + shift * 2 * M_PI - data->min_angle) / res) + 1;
+    if (lo < 0)
+      lo = 0;
+    if (hi > last_beam)
+      hi = last_beam;
+
+    for (n = lo; n <= hi; n++)
+    {
+      // No point in the sector can bring this beam in any further than
+      // the nearest one less the radius
+      if (this->sector_r[k] - this->radius > this->data.ranges[n])
+        continue;
+      this->data.ranges[n] = this->FreeRange(n, first, count,
+                                             this->data.ranges[n]);
+    }
+  }
+  return;
+}
 
-  // Range and bearing of this reading.
-  r = this->lu[n][0];
-  b = this->lu[n][1];
-  x = this->lu[n][2];
-  y = this->lu[n][3];
 
-  max_r = r - this->radius;
+////////////////////////////////////////////////////////////////////////////////
+// Compute the maximum free-space range for sample n, given obstacle points
+// first to first + count - 1 and the range so far.
+double LaserCSpace::FreeRange(int n, int first, int count, double max_r)
+{
+  int i;
+  double r, x, y, rr, rad2;
+  double s, dx, dy, d2, h;
+  const double *ox, *oy;
+
+  // Range and position of this reading.
+  r = this->beam_r[n];
+  x = this->beam_x[n];
+  y = this->beam_y[n];
+  rr = x * x + y * y;
+  if (rr <= 0)
+    return max_r;
+  rad2 = this->radius * this->radius;
+
+  ox = this->obs_x + first;
+  oy = this->obs_y + first;
+  i = 0;
+
+#if LASERCSPACE_SSE2
+  // Two obstacle points at a time.  Points that miss the beam get an
+  // infinite range instead of a branch.
+  {
+    __m128d vx = _mm_set1_pd(x), vy = _mm_set1_pd(y), vr = _mm_set1_pd(r);
+    __m128d vrr = _mm_set1_pd(rr), vrad2 = _mm_set1_pd(rad2);
+    __m128d zero = _mm_setzero_pd(), one = _mm_set1_pd(1.0);
+    __m128d inf = _mm_set1_pd(HUGE_VAL), vmin = _mm_set1_pd(max_r);
+    __m128d vox, voy, vs, vdx, vdy, vq, vh, hit;
+    double out[2];
+
+    for (; i + 1 < count; i += 2)
+    {
+      vox = _mm_loadu_pd(ox + i);
+      voy = _mm_loadu_pd(oy + i);
+
+      // Parametric point on the ray nearest the obstacle, and the squared
+      // distance between them
+      vs = _mm_div_pd(_mm_add_pd(_mm_mul_pd(vx, vox), _mm_mul_pd(vy, voy)), vrr);
+      vdx = _mm_sub_pd(_mm_mul_pd(vs, vx), vox);
+      vdy = _mm_sub_pd(_mm_mul_pd(vs, vy), voy);
+      vq = _mm_sub_pd(vrad2, _mm_add_pd(_mm_mul_pd(vdx, vdx),
+                                        _mm_mul_pd(vdy, vdy)));
+
+      hit = _mm_and_pd(_mm_and_pd(_mm_cmpge_pd(vs, zero), _mm_cmple_pd(vs, one)),
+                       _mm_cmpge_pd(vq, zero));
+      vh = _mm_sub_pd(_mm_mul_pd(vs, vr), _mm_sqrt_pd(_mm_max_pd(vq, zero)));
+      vh = _mm_or_pd(_mm_and_pd(hit, vh), _mm_andnot_pd(hit, inf));
+      vmin = _mm_min_pd(vmin, vh);
+    }
+    _mm_storeu_pd(out, vmin);
+    max_r = (out[0] < out[1]) ? out[0] : out[1];
+  }
+#endif
 
   // Look for intersections with obstacles.
-  for (i = 0; i < data->ranges_count; i += step)
+  for (; i < count; i++)
   {
-    r_ = this->lu[i][0];
-    if (r_ - this->radius > max_r)
-      continue;
-    b_ = this->lu[i][1];
-    x_ = this->lu[i][2];
-    y_ = this->lu[i][3];
-
     // Compute parametric point on ray that is nearest the obstacle.
-    s = (x * x_ + y * y_) / (x * x + y * y);
+    s = (x * ox[i] + y * oy[i]) / rr;
     if (s < 0 || s > 1)
       continue;
 
-    // Compute the nearest point.
-    nr = s * r;
-    nx = s * x;
-    ny = s * y;
-
-    // Compute distance from nearest point to obstacle.
-    dx = nx - x_;
-    dy = ny - y_;
-    d = sqrt(dx * dx + dy * dy);
-
-    if (d > this->radius)
+    // Compute squared distance from nearest point to obstacle.
+    dx = s * x - ox[i];
+    dy = s * y - oy[i];
+    d2 = dx * dx + dy * dy;
+    if (d2 > rad2)
       continue;
 
     // Compute the shortened range.
-    h = nr - sqrt(this->radius * this->radius - d * d);
+    h = s * r - sqrt(rad2 - d2);
     if (h < max_r)
       max_r = h;
   }
 
-  // Clip negative ranges.
-  if (max_r < 0)
-    max_r = 0;
-
   return max_r;
 }
@@ -154,6 +154,10 @@ The @p amcl driver requires the following interfaces, some of them named:
   - pf_z (float)
     - Default: 3
     - Control parameter for the particle set size.  See notes below.
+  - update_threads (integer)
+    - Default: 1
+    - Number of threads used to apply the sensor model to the particle
+      set.  The filter output does not depend on this setting.
   - init_pose (tuple: [length length angle])
     - Default: [0 0 0] (m m rad)
     - Initial pose estimate (mean value) for the robot.
@@ -186,6 +190,25 @@ The @p amcl driver requires the following interfaces, some of them named:
   - laser_range_bad (float)
     - Default 0.1
     - ???
+  - laser_model_type (string)
+    - Default: "beam"
+    - Laser sensor model: "beam" ray-casts each beam through the map;
+      "likelihood_field" scores each beam end-point by its distance to
+      the nearest obstacle.  The likelihood field model costs one map
+      lookup per beam, so @p laser_max_beams can be much larger.
+  - laser_z_hit (float)
+    - Default: 0.95
+    - Likelihood field model: weight of the obstacle-hit component.
+  - laser_z_rand (float)
+    - Default: 0.05
+    - Likelihood field model: weight of the random-reading component.
+  - laser_sigma_hit (length)
+    - Default: 0.2 m
+    - Likelihood field model: standard deviation of the obstacle-hit
+      component.
+  - laser_likelihood_max_dist (length)
+    - Default: 2.0 m
+    - Likelihood field model: maximum obstacle distance stored in the map.
 - Debugging:
   - enable_gui (integer)
     - Default: 0
@@ -444,6 +467,7 @@ AdaptiveMCL::AdaptiveMCL( ConfigFile* cf, int section)
   // Adaptive filter parameters
   this->pf_err = cf->ReadFloat(section, "pf_err", 0.01);
   this->pf_z = cf->ReadFloat(section, "pf_z", 3);
+  this->pf_update_threads = cf->ReadInt(section, "update_threads", 1);
 
   // Initial pose estimate
   this->pf_init_pose_mean = pf_vector_zero();
@@ -514,6 +538,7 @@ int AdaptiveMCL::MainSetup(void)
   this->pf = pf_alloc(this->pf_min_samples, this->pf_max_samples);
   this->pf->pop_err = this->pf_err;
   this->pf->pop_z = this->pf_z;
+  pf_set_update_threads(this->pf, this->pf_update_threads);
 
   // Start sensors
   for (int i = 0; i < this->sensor_count; i++)
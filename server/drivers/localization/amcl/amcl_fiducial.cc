@@ -218,9 +218,11 @@ AMCLFiducial::SetupMap(void)
   this->map->data_range = 1;
 
   // allocate space for map cells
-  assert(this->map->cells = (map_cell_t*)malloc(sizeof(map_cell_t) *
-                                                this->map->size_x *
-                                                this->map->size_y));
+  if(map_alloc_cells(this->map) != 0)
+  {
+    PLAYER_ERROR("out of memory allocating map");
+    return(-1);
+  }
 
   // now, get the map data
   player_map_data_t data_req;
@@ -268,9 +270,8 @@ AMCLFiducial::SetupMap(void)
     {
       for(i=0;i<si;i++)
       {
-        this->map->cells[MAP_INDEX(this->map,oi+i,oj+j)].occ_state =
+        this->map->occ_state[MAP_INDEX(this->map,oi+i,oj+j)] =
                 data_req.data[j*si + i];
-        this->map->cells[MAP_INDEX(this->map,oi+i,oj+j)].occ_dist = 0;
       }
     }
 
@@ -34,6 +34,7 @@
 #include <sys/types.h> // required by Darwin
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #if !defined (WIN32)
   #include <unistd.h>
 #endif
@@ -47,6 +48,7 @@ AMCLLaser::AMCLLaser(AdaptiveMCL & aAMCL, player_devaddr_t addr) : AMCLSensor(aA
 {
   this->laser_dev = NULL;
   this->laser_addr = addr;
+  this->model = NULL;
 
   return;
 }
@@ -65,6 +67,20 @@ int AMCLLaser::Load(ConfigFile* cf, int section)
   this->range_var = cf->ReadLength(section, "laser_range_var", 0.10);
   this->range_bad = cf->ReadFloat(section, "laser_range_bad", 0.10);
 
+  const char *model_type = cf->ReadString(section, "laser_model_type", "beam");
+  if (strcmp(model_type, "likelihood_field") == 0)
+    this->model_type = LASER_MODEL_LIKELIHOOD_FIELD;
+  else
+  {
+    if (strcmp(model_type, "beam") != 0)
+      PLAYER_WARN1("unknown laser model type \"%s\"; using beam model", model_type);
+    this->model_type = LASER_MODEL_BEAM;
+  }
+  this->z_hit = cf->ReadFloat(section, "laser_z_hit", 0.95);
+  this->z_rand = cf->ReadFloat(section, "laser_z_rand", 0.05);
+  this->sigma_hit = cf->ReadLength(section, "laser_sigma_hit", 0.2);
+  this->likelihood_max_dist = cf->ReadLength(section, "laser_likelihood_max_dist", 2.0);
+
   this->time = 0.0;
 
   return 0;
@@ -130,6 +146,21 @@ int AMCLLaser::Setup(void)
                 RTOD(this->laser_pose.v[2]));
     delete msg;
   }
+
+  // Create the sensor model
+  this->model = laser_alloc(this->map, this->laser_pose);
+  if (this->model_type == LASER_MODEL_LIKELIHOOD_FIELD)
+  {
+    PLAYER_MSG0(2, "computing likelihood field");
+    laser_set_model_likelihood_field(this->model, this->max_beams,
+                                     this->z_hit, this->z_rand,
+                                     this->sigma_hit,
+                                     this->likelihood_max_dist);
+  }
+  else
+    laser_set_model_beam(this->model, this->max_beams,
+                         this->range_var, this->range_bad);
+
   return 0;
 }
 
@@ -185,10 +216,11 @@ AMCLLaser::SetupMap(void)
   delete msg;
 
   // allocate space for map cells
-  this->map->cells = (map_cell_t*)malloc(sizeof(map_cell_t) *
-                                                  this->map->size_x *
-                                                  this->map->size_y);
-  assert(this->map->cells);
+  if(map_alloc_cells(this->map) != 0)
+  {
+    PLAYER_ERROR("out of memory allocating map");
+    return(-1);
+  }
 
   // now, get the map data
   player_map_data_t* data_req;
@@ -221,7 +253,8 @@ AMCLLaser::SetupMap(void)
     {
       PLAYER_ERROR("failed to get map info");
       free(data_req);
-      free(this->map->cells);
+      free(this->map->occ_state);
+      this->map->occ_state = NULL;
       return(-1);
     }
 
@@ -232,9 +265,8 @@ AMCLLaser::SetupMap(void)
     {
       for(i=0;i<si;i++)
       {
-        this->map->cells[MAP_INDEX(this->map,oi+i,oj+j)].occ_state =
+        this->map->occ_state[MAP_INDEX(this->map,oi+i,oj+j)] =
                 mapdata->data[j*si + i];
-        this->map->cells[MAP_INDEX(this->map,oi+i,oj+j)].occ_dist = 0;
       }
     }
 
@@ -266,6 +298,8 @@ int AMCLLaser::Shutdown(void)
 {
   this->laser_dev->Unsubscribe(AMCL.InQueue);
   this->laser_dev = NULL;
+  laser_free(this->model);
+  this->model = NULL;
   map_free(this->map);
 
   return 0;
@@ -323,95 +357,24 @@ int AMCLLaser::ProcessMessage(QueuePointer &resp_queue,
 bool AMCLLaser::UpdateSensor(pf_t *pf, AMCLSensorData *data)
 {
   AMCLLaserData *ndata;
+  laser_data_t ldata;
 
   ndata = (AMCLLaserData*) data;
   if (this->max_beams < 2)
     return false;
 
+  ldata.laser = this->model;
+  ldata.range_count = ndata->range_count;
+  ldata.range_max = ndata->range_max;
+  ldata.ranges = ndata->ranges;
+
   // Apply the laser sensor model
-  pf_update_sensor(pf, (pf_sensor_model_fn_t) SensorModel, data);
+  pf_update_sensor(pf, (pf_sensor_model_fn_t) laser_sensor_model, &ldata);
 
   return true;
 }
 
 
-////////////////////////////////////////////////////////////////////////////////
-// Determine the probability for the given pose
-double AMCLLaser::SensorModel(AMCLLaserData *data, pf_sample_set_t* set)
-{
-  AMCLLaser *self;
-  int i, j, step;
-  double z, c, pz;
-  double p;
-  double map_range;
-  double obs_range, obs_bearing;
-  double total_weight;
-  pf_sample_t *sample;
-  pf_vector_t pose;
-
-  self = (AMCLLaser*) data->sensor;
-
-  total_weight = 0.0;
-
-  // Compute the sample weights
-  for (j = 0; j < set->sample_count; j++)
-  {
-    sample = set->samples + j;
-    pose = sample->pose;
-
-    // Take account of the laser pose relative to the robot
-    pose = pf_vector_coord_add(self->laser_pose, pose);
-
-    p = 1.0;
-
-    step = (data->range_count - 1) / (self->max_beams - 1);
-    for (i = 0; i < data->range_count; i += step)
-    {
-      obs_range = data->ranges[i][0];
-      obs_bearing = data->ranges[i][1];
-
-      // Compute the range according to the map
-      map_range = map_calc_range(self->map, pose.v[0], pose.v[1],
-                                 pose.v[2] + obs_bearing, data->range_max + 1.0);
-
-      if (obs_range >= data->range_max && map_range >= data->range_max)
-      {
-        pz = 1.0;
-      }
-      else
-      {
-        // TODO: proper sensor model (using Kolmagorov?)
-        // Simple gaussian model
-        c = self->range_var;
-        z = obs_range - map_range;
-        pz = self->range_bad + (1 - self->range_bad) * exp(-(z * z) / (2 * c * c));
-      }
-
-      /*
-         if (obs->range >= 8.0 && map_range >= 8.0)
-         p *= 1.0;
-         else if (obs->range >= 8.0 && map_range < 8.0)
-         p *= self->range_bad;
-         else if (obs->range < 8.0 && map_range >= 8.0)
-         p *= self->range_bad;
-         else
-         p *= laser_sensor_prob(self, obs->range, map_range);
-       */
-
-      p *= pz;
-    }
-
-    //printf("%e\n", p);
-    //assert(p >= 0);
-
-    sample->weight *= p;
-    total_weight += sample->weight;
-  }
-
-  return(total_weight);
-}
-
-
 
 #ifdef INCLUDE_RTKGUI
 
@@ -75,10 +75,6 @@ class AMCLLaser : public AMCLSensor
   // filter has been updated.
   public: virtual bool UpdateSensor(pf_t *pf, AMCLSensorData *data);
 
-  // Determine the probability for the given pose
-  private: static double SensorModel(AMCLLaserData *data, 
-                                     pf_sample_set_t* set);
-
   // retrieve the map
   private: int SetupMap(void);
 
@@ -105,6 +101,16 @@ class AMCLLaser : public AMCLSensor
   // Probability of bad range readings
   private: double range_bad;
 
+  // Sensor model to use
+  private: laser_model_type_t model_type;
+
+  // Likelihood field model parameters
+  private: double z_hit, z_rand, sigma_hit;
+  private: double likelihood_max_dist;
+
+  // The sensor model
+  private: laser_t *model;
+
 #ifdef INCLUDE_RTKGUI
   // Setup the GUI
   private: virtual void SetupGUI(rtk_canvas_t *canvas, rtk_fig_t *robot_fig);
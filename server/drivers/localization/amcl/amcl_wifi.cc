@@ -185,7 +185,7 @@ void AdaptiveMCL::DrawWifiData(amcl_sensor_data_t *data)
   int i;
   const char *hostname;
   pf_vector_t pose;
-  map_cell_t *cell;
+  int index;
   int olevel, mlevel;
   char ntext[128], text[1024];
 
@@ -197,14 +197,15 @@ void AdaptiveMCL::DrawWifiData(amcl_sensor_data_t *data)
   rtk_fig_get_origin(this->robot_fig, pose.v + 0, pose.v + 1, pose.v + 2);
 
   // Get the cell at this pose
-  cell = map_get_cell(this->map, pose.v[0], pose.v[1], pose.v[2]);
+  index = map_get_index(this->map, pose.v[0], pose.v[1], pose.v[2]);
 
   text[0] = 0;
   for (i = 0; i < data->wifi_level_count; i++)
   {
     hostname = this->wifi_beacons[i].hostname;
     olevel = data->wifi_levels[i];
-    mlevel = cell->wifi_levels[i];
+    mlevel = (index >= 0 && this->map->wifi_levels[i]) ?
+      this->map->wifi_levels[i][index] : 0;
 
     snprintf(ntext, sizeof(ntext), "%s %02d [%02d]\n", hostname, olevel, mlevel);
     strcat(text, ntext);
@@ -0,0 +1,447 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2003
+ *     Andrew Howard
+ *     Brian Gerkey
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+/**************************************************************************
+ * Desc: Offline comparison of the AMCL laser models.
+ * CVS: $Id$
+ *
+ * Replays the odometry and laser scans from a Player logfile through the
+ * particle filter, once with the beam model and once with the likelihood
+ * field model, and reports the time spent in the sensor update and the
+ * error of the most likely pose.  The error is measured against a ground
+ * truth position2d device in the log (e.g. Stage's simulation pose) when
+ * one is given, and otherwise between the two models.
+ *
+ * Usage: amcl_laser_bench [options] <map.pgm> <map scale> <logfile>
+ *   -odom <index>     position2d index providing odometry (default 0)
+ *   -truth <index>    position2d index providing ground truth (default none)
+ *   -laser <index>    laser index (default 0)
+ *   -init <x> <y> <a> initial pose, if there is no ground truth
+ *   -samples <n>      number of particles (default 5000)
+ *   -beams <n>        beams used by the beam model (default 30)
+ *   -lfbeams <n>      beams used by the likelihood field model (default 541)
+ *   -threads <n>      sensor update threads (default 1)
+ *************************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "map/map.h"
+#include "pf/pf.h"
+#include "pf/pf_vector.h"
+#include "models/laser.h"
+#include "models/odometry.h"
+
+#define MAX_TOKENS 4096
+#define MAX_LINE 65536
+
+// A pose at some time
+typedef struct
+{
+  double time;
+  pf_vector_t pose;
+
+} bench_pose_t;
+
+// A laser scan at some time
+typedef struct
+{
+  double time;
+  int range_count;
+  double range_max;
+  double (*ranges)[2];
+
+} bench_scan_t;
+
+// Everything read from the log, in time order
+typedef struct
+{
+  int odom_count, truth_count, scan_count;
+  bench_pose_t *odom, *truth;
+  bench_scan_t *scans;
+
+} bench_log_t;
+
+// Results of one run
+typedef struct
+{
+  int updates;
+  double sensor_time;
+  pf_vector_t *estimates;
+  double *estimate_times;
+
+} bench_run_t;
+
+
+static double bench_now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+// Append to a growable array
+static void *bench_grow(void *array, int count, size_t size)
+{
+  if ((count & (count - 1)) == 0)
+    array = realloc(array, (count ? 2 * count : 1) * size);
+  return array;
+}
+
+
+// Read the odometry, ground truth and laser scans from a logfile
+static int bench_read_log(bench_log_t *log, const char *filename,
+                          int odom_index, int truth_index, int laser_index)
+{
+  FILE *file;
+  char *line, *tokens[MAX_TOKENS];
+  int token_count, index, type, subtype, i, first;
+  bench_pose_t *pose;
+  bench_scan_t *scan;
+  double angle, resolution;
+
+  memset(log, 0, sizeof(*log));
+
+  if (!(file = fopen(filename, "r")))
+  {
+    perror(filename);
+    return -1;
+  }
+
+  line = malloc(MAX_LINE);
+  while (fgets(line, MAX_LINE, file))
+  {
+    if (line[0] == '#')
+      continue;
+
+    token_count = 0;
+    for (tokens[0] = strtok(line, " \t\r\n");
+         tokens[token_count] && token_count < MAX_TOKENS - 1;
+         tokens[++token_count] = strtok(NULL, " \t\r\n"));
+    if (token_count < 7)
+      continue;
+
+    index = atoi(tokens[4]);
+    type = atoi(tokens[5]);
+    subtype = atoi(tokens[6]);
+    if (type != 1)
+      continue;
+
+    // position2d state: px py pa vx vy va stall
+    if (strcmp(tokens[3], "position2d") == 0 && subtype == 1 && token_count >= 10 &&
+        (index == odom_index || index == truth_index))
+    {
+      if (index == odom_index)
+      {
+        log->odom = bench_grow(log->odom, log->odom_count, sizeof(bench_pose_t));
+        pose = log->odom + log->odom_count++;
+      }
+      else
+      {
+        log->truth = bench_grow(log->truth, log->truth_count, sizeof(bench_pose_t));
+        pose = log->truth + log->truth_count++;
+      }
+      pose->time = atof(tokens[0]);
+      pose->pose.v[0] = atof(tokens[7]);
+      pose->pose.v[1] = atof(tokens[8]);
+      pose->pose.v[2] = atof(tokens[9]);
+    }
+
+    // laser scan: id min_angle max_angle resolution max_range count
+    // (range intensity)*; scanpose has px py pa after the id
+    else if (strcmp(tokens[3], "laser") == 0 && index == laser_index &&
+             (subtype == 1 || subtype == 2))
+    {
+      first = (subtype == 1) ? 8 : 11;
+      if (token_count < first + 5)
+        continue;
+
+      log->scans = bench_grow(log->scans, log->scan_count, sizeof(bench_scan_t));
+      scan = log->scans + log->scan_count++;
+      scan->time = atof(tokens[0]);
+      angle = atof(tokens[first + 0]);
+      resolution = atof(tokens[first + 2]);
+      scan->range_max = atof(tokens[first + 3]);
+      scan->range_count = atoi(tokens[first + 4]);
+      if (scan->range_count > (token_count - first - 5) / 2)
+        scan->range_count = (token_count - first - 5) / 2;
+      scan->ranges = calloc(scan->range_count, sizeof(scan->ranges[0]));
+      for (i = 0; i < scan->range_count; i++)
+      {
+        scan->ranges[i][0] = atof(tokens[first + 5 + 2 * i]);
+        scan->ranges[i][1] = angle + i * resolution;
+      }
+    }
+  }
+
+  free(line);
+  fclose(file);
+  return 0;
+}
+
+
+// Apply the odometry model to every sample
+static void bench_action_model(odometry_t *odom, pf_sample_set_t *set)
+{
+  int i;
+
+  for (i = 0; i < set->sample_count; i++)
+    set->samples[i].pose = odometry_action_model(odom, set->samples[i].pose);
+
+  return;
+}
+
+
+// Run the filter over the log with the given laser model
+static void bench_run(bench_run_t *run, bench_log_t *log, laser_t *laser,
+                      int samples, int threads, pf_vector_t init_pose)
+{
+  pf_t *pf;
+  odometry_t *odom;
+  laser_data_t ldata;
+  pf_matrix_t cov;
+  pf_vector_t odom_pose, delta, mean, best;
+  double weight, best_weight, t;
+  int o, s, c, update;
+
+  memset(run, 0, sizeof(*run));
+  run->estimates = calloc(log->scan_count, sizeof(pf_vector_t));
+  run->estimate_times = calloc(log->scan_count, sizeof(double));
+
+  pf = pf_alloc(samples / 10 + 1, samples);
+  pf_set_update_threads(pf, threads);
+  cov = pf_matrix_zero();
+  cov.m[0][0] = 0.1 * 0.1;
+  cov.m[1][1] = 0.1 * 0.1;
+  cov.m[2][2] = 0.1 * 0.1;
+  pf_init(pf, init_pose, cov);
+
+  odom = odometry_alloc();
+  odom_pose = log->odom_count ? log->odom[0].pose : pf_vector_zero();
+  update = 0;
+
+  for (o = 0, s = 0; s < log->scan_count; s++)
+  {
+    // Apply the odometry up to this scan, as the driver does: only
+    // once the robot has moved far enough
+    for (; o < log->odom_count && log->odom[o].time <= log->scans[s].time; o++)
+    {
+      delta = pf_vector_coord_sub(log->odom[o].pose, odom_pose);
+      if (fabs(delta.v[0]) > 0.2 || fabs(delta.v[1]) > 0.2 ||
+          fabs(delta.v[2]) > M_PI / 6)
+      {
+        odometry_action_init(odom, odom_pose, log->odom[o].pose);
+        pf_update_action(pf, (pf_action_model_fn_t) bench_action_model, odom);
+        odometry_action_term(odom);
+        odom_pose = log->odom[o].pose;
+        update = 1;
+      }
+    }
+    if (!update)
+      continue;
+    update = 0;
+
+    ldata.laser = laser;
+    ldata.range_count = log->scans[s].range_count;
+    ldata.range_max = log->scans[s].range_max;
+    ldata.ranges = log->scans[s].ranges;
+
+    t = bench_now();
+    pf_update_sensor(pf, (pf_sensor_model_fn_t) laser_sensor_model, &ldata);
+    run->sensor_time += bench_now() - t;
+
+    pf_update_resample(pf);
+
+    // Take the heaviest cluster as the estimate
+    best = pf_vector_zero();
+    best_weight = 0.0;
+    for (c = 0; pf_get_cluster_stats(pf, c, &weight, &mean, &cov); c++)
+    {
+      if (weight > best_weight)
+      {
+        best_weight = weight;
+        best = mean;
+      }
+    }
+    run->estimates[run->updates] = best;
+    run->estimate_times[run->updates] = log->scans[s].time;
+    run->updates++;
+  }
+
+  odometry_free(odom);
+  pf_free(pf);
+  return;
+}
+
+
+// Find the reference pose at the given time
+static int bench_find_pose(bench_pose_t *poses, int count, double time, pf_vector_t *pose)
+{
+  int i;
+
+  for (i = 0; i < count && poses[i].time <= time; i++);
+  if (i == 0)
+    return 0;
+  *pose = poses[i - 1].pose;
+  return 1;
+}
+
+
+// Print the timing and the error relative to the reference
+static void bench_report(const char *name, int beams, bench_run_t *run,
+                         bench_log_t *log, bench_run_t *ref)
+{
+  int i, n;
+  double dist, sum_dist, max_dist, sum_angle;
+  pf_vector_t truth, diff;
+
+  n = 0;
+  sum_dist = max_dist = sum_angle = 0.0;
+  for (i = 0; i < run->updates; i++)
+  {
+    if (ref)
+    {
+      if (i >= ref->updates)
+        break;
+      truth = ref->estimates[i];
+    }
+    else if (!bench_find_pose(log->truth, log->truth_count,
+                              run->estimate_times[i], &truth))
+      continue;
+
+    diff = pf_vector_sub(run->estimates[i], truth);
+    dist = sqrt(diff.v[0] * diff.v[0] + diff.v[1] * diff.v[1]);
+    sum_dist += dist;
+    if (dist > max_dist)
+      max_dist = dist;
+    sum_angle += fabs(atan2(sin(diff.v[2]), cos(diff.v[2])));
+    n++;
+  }
+
+  printf("%-17s %4d beams  %5d updates  %9.3f ms/update", name, beams,
+         run->updates, run->updates ? 1e3 * run->sensor_time / run->updates : 0.0);
+  if (n > 0)
+    printf("  error %s: mean %.3f m, max %.3f m, mean %.3f rad",
+           ref ? "vs beam" : "vs truth", sum_dist / n, max_dist, sum_angle / n);
+  printf("\n");
+
+  return;
+}
+
+
+int main(int argc, char *argv[])
+{
+  int i, odom_index, truth_index, laser_index;
+  int samples, beams, lfbeams, threads;
+  int have_init;
+  pf_vector_t init_pose;
+  map_t *map;
+  laser_t *laser;
+  bench_log_t log;
+  bench_run_t beam_run, lf_run;
+  double t;
+
+  odom_index = 0;
+  truth_index = -1;
+  laser_index = 0;
+  samples = 5000;
+  beams = 30;
+  lfbeams = 541;
+  threads = 1;
+  have_init = 0;
+  init_pose = pf_vector_zero();
+
+  for (i = 1; i < argc && argv[i][0] == '-'; i++)
+  {
+    if (strcmp(argv[i], "-odom") == 0 && i + 1 < argc)
+      odom_index = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-truth") == 0 && i + 1 < argc)
+      truth_index = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-laser") == 0 && i + 1 < argc)
+      laser_index = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-init") == 0 && i + 3 < argc)
+    {
+      init_pose.v[0] = atof(argv[++i]);
+      init_pose.v[1] = atof(argv[++i]);
+      init_pose.v[2] = atof(argv[++i]);
+      have_init = 1;
+    }
+    else if (strcmp(argv[i], "-samples") == 0 && i + 1 < argc)
+      samples = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-beams") == 0 && i + 1 < argc)
+      beams = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-lfbeams") == 0 && i + 1 < argc)
+      lfbeams = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc)
+      threads = atoi(argv[++i]);
+    else
+      break;
+  }
+  if (argc - i != 3)
+  {
+    fprintf(stderr, "usage: %s [-odom N] [-truth N] [-laser N] [-init X Y A] "
+            "[-samples N] [-beams N] [-lfbeams N] [-threads N] "
+            "<map.pgm> <scale> <logfile>\n", argv[0]);
+    return 1;
+  }
+
+  map = map_alloc();
+  if (map_load_occ(map, argv[i], atof(argv[i + 1]), 0) != 0)
+    return 1;
+
+  if (bench_read_log(&log, argv[i + 2], odom_index, truth_index, laser_index) != 0)
+    return 1;
+  printf("%d odometry, %d ground truth and %d laser readings\n",
+         log.odom_count, log.truth_count, log.scan_count);
+  if (log.scan_count == 0)
+    return 1;
+
+  // Start from the ground truth if we have it, otherwise from odometry
+  if (!have_init)
+  {
+    if (log.truth_count > 0)
+      init_pose = log.truth[0].pose;
+    else if (log.odom_count > 0)
+      init_pose = log.odom[0].pose;
+  }
+
+  laser = laser_alloc(map, pf_vector_zero());
+
+  laser_set_model_beam(laser, beams, 0.10, 0.10);
+  bench_run(&beam_run, &log, laser, samples, threads, init_pose);
+
+  t = bench_now();
+  laser_set_model_likelihood_field(laser, lfbeams, 0.95, 0.05, 0.2, 2.0);
+  printf("likelihood field computed in %.3f s\n", bench_now() - t);
+  bench_run(&lf_run, &log, laser, samples, threads, init_pose);
+
+  bench_report("beam", beams, &beam_run, &log, NULL);
+  bench_report("likelihood_field", lfbeams, &lf_run, &log,
+               log.truth_count ? NULL : &beam_run);
+
+  laser_free(laser);
+  map_free(map);
+  return 0;
+}
@@ -41,7 +41,7 @@ map_t *map_alloc(void)
 {
   map_t *map;
 
-  map = (map_t*) malloc(sizeof(map_t));
+  map = (map_t*) calloc(1, sizeof(map_t));
 
   // Assume we start at (0, 0)
   map->origin_x = 0;
@@ -53,8 +53,9 @@ map_t *map_alloc(void)
   map->scale = 0;
   map->max_occ_dist = 0;
   
-  // Allocate storage for main map
-  map->cells = (map_cell_t*) NULL;
+  // Storage for the map planes is allocated once the size is known
+  map->occ_state = NULL;
+  map->occ_dist = NULL;
   
   return map;
 }
@@ -63,79 +64,175 @@ map_t *map_alloc(void)
 // Destroy a map
 void map_free(map_t *map)
 {
-  free(map->cells);
+  int i;
+
+  for (i = 0; i < MAP_WIFI_MAX_LEVELS; i++)
+    free(map->wifi_levels[i]);
+  free(map->occ_dist);
+  free(map->occ_state);
   free(map);
   return;
 }
 
 
-// Get the cell at the given point
-map_cell_t *map_get_cell(map_t *map, double ox, double oy, double oa)
+// Allocate the occupancy plane
+int map_alloc_cells(map_t *map)
+{
+  free(map->occ_state);
+  map->occ_state = calloc((size_t) map->size_x * map->size_y,
+                          sizeof(map->occ_state[0]));
+  if (map->occ_state == NULL)
+    return -1;
+  return 0;
+}
+
+
+// Get the index of the cell at the given point
+int map_get_index(map_t *map, double ox, double oy, double oa)
 {
   int i, j;
-  map_cell_t *cell;
 
   i = (int) MAP_GXWX(map, ox);
   j = (int) MAP_GYWY(map, oy);
   
   if (!MAP_VALID(map, i, j))
-    return NULL;
+    return -1;
 
-  cell = map->cells + MAP_INDEX(map, i, j);
-  return cell;
+  return MAP_INDEX(map, i, j);
 }
 
 
-// Update the cspace distance values
+// Squared distance transform of a sampled function (Felzenszwalb and
+// Huttenlocher, "Distance Transforms of Sampled Functions").  Computes
+// d[q] = min_p ((q - p)^2 + f[p]) in O(n), using the lower envelope of
+// the parabolas rooted at each sample.  The f values must be finite.  v
+// and z are workspace of n and n + 1 elements.
+static void map_dt_1d(const double *f, double *d, int n, int *v, double *z)
+{
+  int k, q;
+  double s;
+
+  k = 0;
+  v[0] = 0;
+  z[0] = -HUGE_VAL;
+  z[1] = +HUGE_VAL;
+
+  for (q = 1; q < n; q++)
+  {
+    s = ((f[q] + (double) q * q) - (f[v[k]] + (double) v[k] * v[k])) /
+      (2.0 * q - 2.0 * v[k]);
+    while (s <= z[k])
+    {
+      k--;
+      s = ((f[q] + (double) q * q) - (f[v[k]] + (double) v[k] * v[k])) /
+        (2.0 * q - 2.0 * v[k]);
+    }
+    k++;
+    v[k] = q;
+    z[k] = s;
+    z[k + 1] = +HUGE_VAL;
+  }
+
+  k = 0;
+  for (q = 0; q < n; q++)
+  {
+    while (z[k + 1] < q)
+      k++;
+    d[q] = (double) (q - v[k]) * (q - v[k]) + f[v[k]];
+  }
+
+  return;
+}
+
+
+// Update the cspace distance values.  This is an exact Euclidean distance
+// transform done as two separable passes, so the cost is linear in the
+// size of the map and does not depend on max_occ_dist.
 void map_update_cspace(map_t *map, double max_occ_dist)
 {
-  int i, j;
-  int ni, nj;
-  int s;
-  double d;
-  map_cell_t *cell, *ncell;
+  int i, j, n;
+  int s, limit, run_length;
+  double d, *f, *g, *z;
+  int *v, *run;
+  float *dist;
 
   map->max_occ_dist = max_occ_dist;
   s = (int) ceil(map->max_occ_dist / map->scale);
-
-  // Reset the distance values
+  if (map->size_x <= 0 || map->size_y <= 0)
+    return;
+
+  if (map->occ_dist == NULL)
+    map->occ_dist = malloc((size_t) map->size_x * map->size_y *
+                           sizeof(map->occ_dist[0]));
+
+  // Distances beyond s cells all map to max_occ_dist, so we cap them
+  // there; this keeps the arithmetic below exact
+  limit = s + 1;
+
+  n = (map->size_x > map->size_y) ? map->size_x : map->size_y;
+  f = malloc(n * sizeof(f[0]));
+  g = malloc(n * sizeof(g[0]));
+  z = malloc((n + 1) * sizeof(z[0]));
+  v = malloc(n * sizeof(v[0]));
+  run = malloc(map->size_x * sizeof(run[0]));
+
+  // First pass: distance to the nearest occupied cell in the same column.
+  // We sweep up and then down the rows, keeping the run length for each
+  // column, and park the result in occ_dist.
+  for (i = 0; i < map->size_x; i++)
+    run[i] = limit;
   for (j = 0; j < map->size_y; j++)
   {
+    dist = map->occ_dist + MAP_INDEX(map, 0, j);
+    for (i = 0; i < map->size_x; i++)
+    {
+      if (map->occ_state[MAP_INDEX(map, i, j)] == +1)
+        run[i] = 0;
+      else if (run[i] < limit)
+        run[i]++;
+      dist[i] = (float) run[i];
+    }
+  }
+  for (i = 0; i < map->size_x; i++)
+    run[i] = limit;
+  for (j = map->size_y - 1; j >= 0; j--)
+  {
+    dist = map->occ_dist + MAP_INDEX(map, 0, j);
     for (i = 0; i < map->size_x; i++)
     {
-      cell = map->cells + MAP_INDEX(map, i, j);
-      cell->occ_dist = map->max_occ_dist;
+      if (map->occ_state[MAP_INDEX(map, i, j)] == +1)
+        run[i] = 0;
+      else if (run[i] < limit)
+        run[i]++;
+      if (run[i] < dist[i])
+        dist[i] = (float) run[i];
     }
   }
 
-  // Find all the occupied cells and update their neighbours
+  // Second pass: combine the columns along each row
   for (j = 0; j < map->size_y; j++)
   {
+    dist = map->occ_dist + MAP_INDEX(map, 0, j);
+    for (i = 0; i < map->size_x; i++)
+    {
+      run_length = (int) dist[i];
+      f[i] = (double) run_length * run_length;
+    }
+
+    map_dt_1d(f, g, map->size_x, v, z);
+
     for (i = 0; i < map->size_x; i++)
     {
-      cell = map->cells + MAP_INDEX(map, i, j);
-      if (cell->occ_state != +1)
-        continue;
-          
-      cell->occ_dist = 0;
-
-      // Update adjacent cells
-      for (nj = -s; nj <= +s; nj++)
-      {
-        for (ni = -s; ni <= +s; ni++)
-        {
-          if (!MAP_VALID(map, i + ni, j + nj))
-            continue;
-
-          ncell = map->cells + MAP_INDEX(map, i + ni, j + nj);
-          d = map->scale * sqrt(ni * ni + nj * nj);
-
-          if (d < ncell->occ_dist)
-            ncell->occ_dist = d;
-        }
-      }
+      d = map->scale * sqrt(g[i]);
+      dist[i] = (float) ((d < map->max_occ_dist) ? d : map->max_occ_dist);
     }
   }
+
+  free(run);
+  free(v);
+  free(z);
+  free(g);
+  free(f);
   
   return;
 }
@@ -47,22 +47,9 @@ struct _rtk_fig_t;
 #define MAP_WIFI_MAX_LEVELS 8
 
   
-// Description for a single map cell.
-typedef struct
-{
-  // Occupancy state (-1 = free, 0 = unknown, +1 = occ)
-  int occ_state;
-
-  // Distance to the nearest occupied cell
-  double occ_dist;
-
-  // Wifi levels
-  int wifi_levels[MAP_WIFI_MAX_LEVELS];
-
-} map_cell_t;
-
-
-// Description for a map
+// Description for a map.  Each per-cell quantity is kept in its own
+// plane, indexed by MAP_INDEX(), so that code which only needs the
+// occupancy (e.g. ray casting) touches one byte per cell.
 typedef struct
 {
   // Map origin; the map is a viewport onto a conceptual larger map.
@@ -79,8 +66,15 @@ typedef struct
   
   unsigned char data_range;
 
-  // The map data, stored as a grid
-  map_cell_t *cells;
+  // Occupancy state (-1 = free, 0 = unknown, +1 = occ)
+  signed char *occ_state;
+
+  // Distance to the nearest occupied cell; NULL until
+  // map_update_cspace() is called
+  float *occ_dist;
+
+  // Wifi levels; each plane is NULL until loaded by map_load_wifi()
+  signed char *wifi_levels[MAP_WIFI_MAX_LEVELS];
   
 } map_t;
 
@@ -96,8 +90,13 @@ map_t *map_alloc(void);
 // Destroy a map
 void map_free(map_t *map);
 
-// Get the cell at the given point
-map_cell_t *map_get_cell(map_t *map, double ox, double oy, double oa);
+// Allocate the occupancy plane for a map of size_x by size_y cells; all
+// cells start out unknown.  Returns -1 if there is not enough memory.
+int map_alloc_cells(map_t *map);
+
+// Get the index of the cell at the given point, or -1 if the point is
+// off the map
+int map_get_index(map_t *map, double ox, double oy, double oa);
 
 // Load an occupancy map
 int map_load_occ(map_t *map, const char *filename, double scale, int negate);
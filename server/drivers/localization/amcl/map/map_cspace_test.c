@@ -0,0 +1,189 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2003
+ *     Andrew Howard
+ *     Brian Gerkey
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+/**************************************************************************
+ * Desc: Test for the cspace distance transform.
+ * CVS: $Id$
+ *
+ * Checks map_update_cspace() against a brute force search of the
+ * neighbourhood of every occupied cell on a range of maps, then times it
+ * on a large map.  Exits with a non-zero status on any mismatch.
+ *
+ * Usage: amcl_cspace_test [size]
+ *************************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "map.h"
+
+
+// The brute force transform
+static void ref_update_cspace(map_t *map, double max_occ_dist, double *dist)
+{
+  int i, j, ni, nj, s;
+  double d;
+
+  s = (int) ceil(max_occ_dist / map->scale);
+  for (i = 0; i < map->size_x * map->size_y; i++)
+    dist[i] = max_occ_dist;
+
+  for (j = 0; j < map->size_y; j++)
+  {
+    for (i = 0; i < map->size_x; i++)
+    {
+      if (map->occ_state[MAP_INDEX(map, i, j)] != +1)
+        continue;
+      for (nj = -s; nj <= +s; nj++)
+      {
+        for (ni = -s; ni <= +s; ni++)
+        {
+          if (!MAP_VALID(map, i + ni, j + nj))
+            continue;
+          d = map->scale * sqrt(ni * ni + nj * nj);
+          if (d < dist[MAP_INDEX(map, i + ni, j + nj)])
+            dist[MAP_INDEX(map, i + ni, j + nj)] = d;
+        }
+      }
+    }
+  }
+
+  return;
+}
+
+
+// Make a map with the given fraction of occupied cells, scattered at
+// random, plus a few walls
+static map_t *make_map(int size_x, int size_y, double scale, double density)
+{
+  int i, j, k;
+  map_t *map;
+
+  map = map_alloc();
+  map->scale = scale;
+  map->size_x = size_x;
+  map->size_y = size_y;
+  map_alloc_cells(map);
+
+  for (i = 0; i < size_x * size_y; i++)
+    map->occ_state[i] = (drand48() < density) ? +1 : -1;
+
+  for (k = 0; k < 3 && size_x > 0 && size_y > 0; k++)
+  {
+    j = lrand48() % size_y;
+    for (i = 0; i < size_x / 2; i++)
+      map->occ_state[MAP_INDEX(map, i, j)] = +1;
+  }
+
+  return map;
+}
+
+
+// Compare the transform against brute force; returns the number of
+// mismatched cells
+static int check_map(map_t *map, double max_occ_dist)
+{
+  int i, bad;
+  double *dist, err, max_err;
+
+  dist = malloc((map->size_x * map->size_y + 1) * sizeof(dist[0]));
+  ref_update_cspace(map, max_occ_dist, dist);
+  map_update_cspace(map, max_occ_dist);
+
+  bad = 0;
+  max_err = 0.0;
+  // The map stores single precision distances, so they should match the
+  // brute force result exactly once that is rounded the same way
+  for (i = 0; i < map->size_x * map->size_y; i++)
+  {
+    err = fabs(map->occ_dist[i] - dist[i]);
+    if (err > max_err)
+      max_err = err;
+    if (map->occ_dist[i] != (float) dist[i])
+      bad++;
+  }
+
+  printf("%4d x %-4d scale %.3f max %.2f: %d cells differ, max error %g\n",
+         map->size_x, map->size_y, map->scale, max_occ_dist, bad, max_err);
+
+  free(dist);
+  return bad;
+}
+
+
+static double now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+int main(int argc, char *argv[])
+{
+  static const double densities[] = {0.0, 0.001, 0.02, 0.3, 1.0};
+  static const double dists[] = {0.05, 0.5, 2.0};
+  int size, bad, i, k;
+  map_t *map;
+  double t;
+
+  size = (argc > 1) ? atoi(argv[1]) : 2000;
+  bad = 0;
+  srand48(42);
+
+  // Odd shapes, empty and full maps, and distances smaller than a cell
+  for (i = 0; i < (int) (sizeof(densities) / sizeof(densities[0])); i++)
+  {
+    for (k = 0; k < (int) (sizeof(dists) / sizeof(dists[0])); k++)
+    {
+      map = make_map(1 + lrand48() % 150, 1 + lrand48() % 150, 0.05,
+                     densities[i]);
+      bad += check_map(map, dists[k]);
+      map_free(map);
+    }
+  }
+  map = make_map(1, 1, 0.1, 1.0);
+  bad += check_map(map, 1.0);
+  map_free(map);
+  map = make_map(300, 1, 0.1, 0.01);
+  bad += check_map(map, 1.0);
+  map_free(map);
+  map = make_map(1, 300, 0.1, 0.01);
+  bad += check_map(map, 1.0);
+  map_free(map);
+
+  // Timing on a large, sparse map
+  map = make_map(size, size, 0.05, 0.005);
+  t = now();
+  map_update_cspace(map, 2.0);
+  printf("%d x %d map, max 2.0 m: %.3f s\n", size, size, now() - t);
+  map_free(map);
+
+  if (bad)
+  {
+    printf("FAILED\n");
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
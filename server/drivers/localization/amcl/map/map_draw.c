@@ -49,7 +49,6 @@ void map_draw_occ(map_t *map, rtk_fig_t *fig)
 {
   int i, j;
   int col;
-  map_cell_t *cell;
   uint16_t *image;
   uint16_t *pixel;
 
@@ -60,10 +59,9 @@ void map_draw_occ(map_t *map, rtk_fig_t *fig)
   {
     for (i =  0; i < map->size_x; i++)
     {
-      cell = map->cells + MAP_INDEX(map, i, j);
       pixel = image + (j * map->size_x + i);
 
-      col = 127 - 127 * cell->occ_state;
+      col = 127 - 127 * map->occ_state[MAP_INDEX(map, i, j)];
       *pixel = RTK_RGB16(col, col, col);
     }
   }
@@ -84,10 +82,12 @@ void map_draw_cspace(map_t *map, rtk_fig_t *fig)
 {
   int i, j;
   int col;
-  map_cell_t *cell;
   uint16_t *image;
   uint16_t *pixel;
 
+  if (map->occ_dist == NULL)
+    return;
+
   image = malloc(map->size_x * map->size_y * sizeof(image[0]));
 
   // Draw occupancy
@@ -95,10 +95,9 @@ void map_draw_cspace(map_t *map, rtk_fig_t *fig)
   {
     for (i =  0; i < map->size_x; i++)
     {
-      cell = map->cells + MAP_INDEX(map, i, j);
       pixel = image + (j * map->size_x + i);
 
-      col = 255 * cell->occ_dist / map->max_occ_dist;
+      col = 255 * map->occ_dist[MAP_INDEX(map, i, j)] / map->max_occ_dist;
 
       *pixel = RTK_RGB16(col, col, col);
     }
@@ -120,10 +119,12 @@ void map_draw_wifi(map_t *map, rtk_fig_t *fig, int index)
 {
   int i, j;
   int level, col;
-  map_cell_t *cell;
   uint16_t *image, *mask;
   uint16_t *ipix, *mpix;
 
+  if (map->wifi_levels[index] == NULL)
+    return;
+
   image = malloc(map->size_x * map->size_y * sizeof(image[0]));
   mask = malloc(map->size_x * map->size_y * sizeof(mask[0]));
 
@@ -132,13 +133,12 @@ void map_draw_wifi(map_t *map, rtk_fig_t *fig, int index)
   {
     for (i =  0; i < map->size_x; i++)
     {
-      cell = map->cells + MAP_INDEX(map, i, j);
       ipix = image + (j * map->size_x + i);
       mpix = mask + (j * map->size_x + i);
 
-      level = cell->wifi_levels[index];
+      level = map->wifi_levels[index][MAP_INDEX(map, i, j)];
 
-      if (cell->occ_state == -1 && level != 0)
+      if (map->occ_state[MAP_INDEX(map, i, j)] == -1 && level != 0)
       {
         col = 255 * (100 + level) / 100;
         *ipix = RTK_RGB16(col, col, col);
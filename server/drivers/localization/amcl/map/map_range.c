@@ -44,7 +44,6 @@ double map_calc_range(map_t *map, double ox, double oy, double oa, double max_ra
   int i, j;
   int ai, aj, bi, bj;
   double dx, dy;
-  map_cell_t *cell;
   
   if (fabs(cos(oa)) > fabs(sin(oa)))
   {
@@ -61,8 +60,7 @@ double map_calc_range(map_t *map, double ox, double oy, double oa, double max_ra
         j = (int) MAP_GYWY(map, oy + (i - ai) * dy);
         if (MAP_VALID(map, i, j))
         {
-          cell = map->cells + MAP_INDEX(map, i, j);
-          if (cell->occ_state >= 0)
+          if (map->occ_state[MAP_INDEX(map, i, j)] >= 0)
             return sqrt((i - ai) * (i - ai) + (j - aj) * (j - aj)) * map->scale;
         }
         else
@@ -76,8 +74,7 @@ double map_calc_range(map_t *map, double ox, double oy, double oa, double max_ra
         j = (int) MAP_GYWY(map, oy + (i - ai) * dy);
         if (MAP_VALID(map, i, j))
         {
-          cell = map->cells + MAP_INDEX(map, i, j);
-          if (cell->occ_state >= 0)
+          if (map->occ_state[MAP_INDEX(map, i, j)] >= 0)
             return sqrt((i - ai) * (i - ai) + (j - aj) * (j - aj)) * map->scale;
         }
         else
@@ -100,8 +97,7 @@ double map_calc_range(map_t *map, double ox, double oy, double oa, double max_ra
         i = (int) MAP_GXWX(map, ox + (j - aj) * dx);
         if (MAP_VALID(map, i, j))
         {
-          cell = map->cells + MAP_INDEX(map, i, j);
-          if (cell->occ_state >= 0)
+          if (map->occ_state[MAP_INDEX(map, i, j)] >= 0)
             return sqrt((i - ai) * (i - ai) + (j - aj) * (j - aj)) * map->scale;
         }
         else
@@ -115,8 +111,7 @@ double map_calc_range(map_t *map, double ox, double oy, double oa, double max_ra
         i = (int) MAP_GXWX(map, ox + (j - aj) * dx);
         if (MAP_VALID(map, i, j))
         {
-          cell = map->cells + MAP_INDEX(map, i, j);
-          if (cell->occ_state >= 0)
+          if (map->occ_state[MAP_INDEX(map, i, j)] >= 0)
             return sqrt((i - ai) * (i - ai) + (j - aj) * (j - aj)) * map->scale;
         }
         else
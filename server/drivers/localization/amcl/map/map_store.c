@@ -48,7 +48,6 @@ int map_load_occ(map_t *map, const char *filename, double scale, int negate)
   int i, j;
   int ch, occ;
   int width, height, depth;
-  map_cell_t *cell;
 
   // Open file
   file = fopen(filename, "r");
@@ -75,12 +74,17 @@ int map_load_occ(map_t *map, const char *filename, double scale, int negate)
   fscanf(file, " %d %d \n %d \n", &width, &height, &depth);
 
   // Allocate space in the map
-  if (map->cells == NULL)
+  if (map->occ_state == NULL)
   {
     map->scale = scale;
     map->size_x = width;
     map->size_y = height;
-    map->cells = calloc(width * height, sizeof(map->cells[0]));
+    if (map_alloc_cells(map) != 0)
+    {
+      PLAYER_ERROR("out of memory allocating map");
+      fclose(file);
+      return -1;
+    }
   }
   else
   {
@@ -122,8 +126,7 @@ int map_load_occ(map_t *map, const char *filename, double scale, int negate)
 
       if (!MAP_VALID(map, i, j))
         continue;
-      cell = map->cells + MAP_INDEX(map, i, j);
-      cell->occ_state = occ;
+      map->occ_state[MAP_INDEX(map, i, j)] = occ;
     }
   }
   
@@ -142,7 +145,6 @@ int map_load_wifi(map_t *map, const char *filename, int index)
   int i, j;
   int ch, level;
   int width, height, depth;
-  map_cell_t *cell;
 
   // Open file
   file = fopen(filename, "r");
@@ -169,11 +171,16 @@ int map_load_wifi(map_t *map, const char *filename, int index)
   fscanf(file, " %d %d \n %d \n", &width, &height, &depth);
 
   // Allocate space in the map
-  if (map->cells == NULL)
+  if (map->occ_state == NULL)
   {
     map->size_x = width;
     map->size_y = height;
-    map->cells = calloc(width * height, sizeof(map->cells[0]));
+    if (map_alloc_cells(map) != 0)
+    {
+      PLAYER_ERROR("out of memory allocating map");
+      fclose(file);
+      return -1;
+    }
   }
   else
   {
@@ -184,6 +191,23 @@ int map_load_wifi(map_t *map, const char *filename, int index)
     }
   }
 
+  // Allocate the plane for this level
+  if (index < 0 || index >= MAP_WIFI_MAX_LEVELS)
+  {
+    PLAYER_ERROR1("invalid wifi map index %d", index);
+    fclose(file);
+    return -1;
+  }
+  if (map->wifi_levels[index] == NULL)
+    map->wifi_levels[index] = calloc((size_t) map->size_x * map->size_y,
+                                     sizeof(map->wifi_levels[index][0]));
+  if (map->wifi_levels[index] == NULL)
+  {
+    PLAYER_ERROR("out of memory allocating wifi map");
+    fclose(file);
+    return -1;
+  }
+
   // Read in the image
   for (j = height - 1; j >= 0; j--)
   {
@@ -199,8 +223,7 @@ int map_load_wifi(map_t *map, const char *filename, int index)
       else
         level = ch * 100 / 255 - 100;
 
-      cell = map->cells + MAP_INDEX(map, i, j);
-      cell->wifi_levels[index] = level;
+      map->wifi_levels[index][MAP_INDEX(map, i, j)] = level;
     }
   }
   
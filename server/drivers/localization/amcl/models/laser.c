@@ -31,30 +31,24 @@
 
 #include "laser.h"
 
-#define LASER_MAX_RANGES 401
+// Determine the weights using the beam model
+static double laser_beam_model(laser_data_t *data, pf_sample_set_t *set);
 
-// Pre-compute the range sensor probabilities
-void laser_precompute(laser_t *self);
+// Determine the weights using the likelihood field model
+static double laser_likelihood_field_model(laser_data_t *data, pf_sample_set_t *set);
 
 
 // Create an sensor model
-laser_t *laser_alloc(map_t *map)
+laser_t *laser_alloc(map_t *map, pf_vector_t laser_pose)
 {
   laser_t *self;
 
   self = calloc(1, sizeof(laser_t));
 
   self->map = map;
-  self->laser_pose = pf_vector_zero();
+  self->laser_pose = laser_pose;
+  laser_set_model_beam(self, 6, 0.10, 0.10);
 
-  self->range_cov = 0.10 * 0.10;
-  self->range_bad = 0.50;
-
-  laser_precompute(self);
-    
-  self->range_count = 0;
-  self->ranges = calloc(LASER_MAX_RANGES, sizeof(laser_range_t));
-  
   return self;
 }
 
@@ -62,140 +56,195 @@ laser_t *laser_alloc(map_t *map)
 // Free an sensor model
 void laser_free(laser_t *self)
 {
-  free(self->lut_probs);
-  free(self->ranges);
   free(self);
   return;
 }
 
 
-// Clear all existing range readings
-void laser_clear_ranges(laser_t *self)
+// Use the beam model
+void laser_set_model_beam(laser_t *self, int max_beams,
+                          double range_var, double range_bad)
 {
-  self->range_count = 0;
+  self->model_type = LASER_MODEL_BEAM;
+  self->max_beams = max_beams;
+  self->range_var = range_var;
+  self->range_bad = range_bad;
   return;
 }
 
 
-// Set the laser range readings that will be used.
-void laser_add_range(laser_t *self, double range, double bearing)
+// Use the likelihood field model
+void laser_set_model_likelihood_field(laser_t *self, int max_beams,
+                                      double z_hit, double z_rand,
+                                      double sigma_hit, double max_occ_dist)
 {
-  laser_range_t *beam;
-  
-  assert(self->range_count < LASER_MAX_RANGES);
-  beam = self->ranges + self->range_count++;
-  beam->range = range;
-  beam->bearing = bearing;
+  self->model_type = LASER_MODEL_LIKELIHOOD_FIELD;
+  self->max_beams = max_beams;
+  self->z_hit = z_hit;
+  self->z_rand = z_rand;
+  self->sigma_hit = sigma_hit;
+
+  map_update_cspace(self->map, max_occ_dist);
 
   return;
 }
 
 
-// Pre-compute the range sensor probabilities.
-// We use a two-dimensional array over (model_range, obs_range).
-// currently, only the difference (obs_range - model_range) is significant,
-// so this is somewhat inefficient.
-void laser_precompute(laser_t *self)
+// Determine the weights for the given set of samples
+double laser_sensor_model(laser_data_t *data, pf_sample_set_t *set)
 {
-  double max;
-  double c, z, p;
-  double mrange, orange;
-  int i, j;
-  
-  // Laser max range and resolution
-  max = 8.00;
-  self->lut_res = 0.01;
-  
-  self->lut_size = (int) ceil(max / self->lut_res);
-  self->lut_probs = malloc(self->lut_size * self->lut_size * sizeof(self->lut_probs[0]));
-
-  for (i = 0; i < self->lut_size; i++)
-  {
-    mrange = i * self->lut_res;
-    
-    for (j = 0; j < self->lut_size; j++)
-    {
-      orange = j * self->lut_res;
-
-      // TODO: proper sensor model (using Kolmagorov?)
-      // Simple gaussian model
-      c = self->range_cov;
-      z = orange - mrange;
-      p = self->range_bad + (1 - self->range_bad) * exp(-(z * z) / (2 * c));
-
-      //printf("%f %f %f\n", orange, mrange, p);
-      //assert(p >= 0 && p <= 1.0);
-      
-      self->lut_probs[i + j * self->lut_size] = p;
-    }
-    //printf("\n");
-  }
+  if (data->laser->model_type == LASER_MODEL_LIKELIHOOD_FIELD)
+    return laser_likelihood_field_model(data, set);
+  else
+    return laser_beam_model(data, set);
+}
 
-  // TODO
-  // Put beyond-max-range probabilities at the boundary of the LUT
 
-  return;
+// Spacing between the beams we use
+static int laser_beam_step(laser_data_t *data)
+{
+  int step;
+
+  if (data->laser->max_beams < 2)
+    return data->range_count;
+  step = (data->range_count - 1) / (data->laser->max_beams - 1);
+  if (step < 1)
+    step = 1;
+
+  return step;
 }
 
 
-// Determine the probability for the given range reading
-double laser_sensor_prob(laser_t *self, double obs_range, double map_range)
+// Determine the weights using the beam model
+double laser_beam_model(laser_data_t *data, pf_sample_set_t *set)
 {
-  int i, j;
+  laser_t *self;
+  int i, j, step;
+  double z, c, pz;
   double p;
+  double map_range;
+  double obs_range, obs_bearing;
+  double total_weight;
+  pf_sample_t *sample;
+  pf_vector_t pose;
+
+  self = data->laser;
+
+  total_weight = 0.0;
+  step = laser_beam_step(data);
+
+  // Compute the sample weights
+  for (j = 0; j < set->sample_count; j++)
+  {
+    sample = set->samples + j;
+    pose = sample->pose;
 
-  i = (int) (map_range / self->lut_res + 0.5);
-  j = (int) (obs_range / self->lut_res + 0.5);
+    // Take account of the laser pose relative to the robot
+    pose = pf_vector_coord_add(self->laser_pose, pose);
 
-  assert(i >= 0);
-  if (i >= self->lut_size)
-    i = self->lut_size - 1;
+    p = 1.0;
 
-  assert(j >= 0);
-  if (j >= self->lut_size)
-    j = self->lut_size - 1;
+    for (i = 0; i < data->range_count; i += step)
+    {
+      obs_range = data->ranges[i][0];
+      obs_bearing = data->ranges[i][1];
+
+      // Compute the range according to the map
+      map_range = map_calc_range(self->map, pose.v[0], pose.v[1],
+                                 pose.v[2] + obs_bearing, data->range_max + 1.0);
+
+      if (obs_range >= data->range_max && map_range >= data->range_max)
+      {
+        pz = 1.0;
+      }
+      else
+      {
+        // TODO: proper sensor model (using Kolmagorov?)
+        // Simple gaussian model
+        c = self->range_var;
+        z = obs_range - map_range;
+        pz = self->range_bad + (1 - self->range_bad) * exp(-(z * z) / (2 * c * c));
+      }
+
+      p *= pz;
+    }
 
-  p = self->lut_probs[i + j * self->lut_size];
+    sample->weight *= p;
+    total_weight += sample->weight;
+  }
 
-  //assert(p >= 0 && p <= 1.0);
-  
-  return p;
+  return(total_weight);
 }
 
 
-// Determine the probability for the given pose
-double laser_sensor_model(laser_t *self, pf_vector_t pose)
+// Determine the weights using the likelihood field model
+double laser_likelihood_field_model(laser_data_t *data, pf_sample_set_t *set)
 {
-  int i;
+  laser_t *self;
+  map_t *map;
+  int i, j, step;
+  int mi, mj;
+  double z, pz;
   double p;
-  double map_range;
-  laser_range_t *obs;
+  double obs_range, obs_bearing;
+  double z_hit_denom, z_rand_mult;
+  double total_weight;
+  pf_sample_t *sample;
+  pf_vector_t pose;
+  pf_vector_t hit;
+
+  self = data->laser;
+  map = self->map;
+
+  total_weight = 0.0;
+  step = laser_beam_step(data);
 
-  // Take account of the laser pose relative to the robot
-  pose = pf_vector_coord_add(self->laser_pose, pose);
+  z_hit_denom = 2 * self->sigma_hit * self->sigma_hit;
+  z_rand_mult = 1.0 / data->range_max;
 
-  p = 1.0;
-  
-  for (i = 0; i < self->range_count; i++)
+  // Compute the sample weights
+  for (j = 0; j < set->sample_count; j++)
   {
-    obs = self->ranges + i;
-
-    map_range = map_calc_range(self->map,
-                               pose.v[0], pose.v[1], pose.v[2] + obs->bearing, 8.0);
-
-    if (obs->range >= 8.0 && map_range >= 8.0)
-      p *= 1.0;
-    else if (obs->range >= 8.0 && map_range < 8.0)
-      p *= self->range_bad;
-    else if (obs->range < 8.0 && map_range >= 8.0)
-      p *= self->range_bad;
-    else
-      p *= laser_sensor_prob(self, obs->range, map_range);
-  }
+    sample = set->samples + j;
+    pose = sample->pose;
 
-  //printf("%e\n", p);
-  assert(p >= 0);
+    // Take account of the laser pose relative to the robot
+    pose = pf_vector_coord_add(self->laser_pose, pose);
 
-  return p;
-}
+    p = 1.0;
+
+    for (i = 0; i < data->range_count; i += step)
+    {
+      obs_range = data->ranges[i][0];
+      obs_bearing = data->ranges[i][1];
+
+      // Max range readings do not tell us where the obstacles are
+      if (obs_range >= data->range_max)
+        continue;
+
+      // Compute the end-point of the beam
+      hit.v[0] = pose.v[0] + obs_range * cos(pose.v[2] + obs_bearing);
+      hit.v[1] = pose.v[1] + obs_range * sin(pose.v[2] + obs_bearing);
+
+      // Distance from the end-point to the nearest obstacle; points off
+      // the map are as far away as we know about
+      mi = (int) MAP_GXWX(map, hit.v[0]);
+      mj = (int) MAP_GYWY(map, hit.v[1]);
+      if (!MAP_VALID(map, mi, mj))
+        z = map->max_occ_dist;
+      else
+        z = map->occ_dist[MAP_INDEX(map, mi, mj)];
+
+      // Mixture of a gaussian around the nearest obstacle and a uniform
+      // random reading
+      pz = self->z_hit * exp(-(z * z) / z_hit_denom) + self->z_rand * z_rand_mult;
+
+      p *= pz;
+    }
+
+    sample->weight *= p;
+    total_weight += sample->weight;
+  }
 
+  return(total_weight);
+}
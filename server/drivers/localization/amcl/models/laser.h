@@ -38,56 +38,82 @@
 extern "C" {
 #endif
 
-  
-// Info for a single range measurement
-typedef struct
+
+// Available sensor models
+typedef enum
 {
-  double range, bearing;
-  
-} laser_range_t;
+  // Ray-cast each beam through the map and compare ranges
+  LASER_MODEL_BEAM,
+
+  // Score each beam end-point against the distance to the nearest
+  // obstacle (see map_update_cspace())
+  LASER_MODEL_LIKELIHOOD_FIELD
+
+} laser_model_type_t;
 
 
 // Model information
 typedef struct
 {
+  // Which model to apply
+  laser_model_type_t model_type;
+
   // Pointer to the map
   map_t *map;
 
   // Laser pose relative to robot
   pf_vector_t laser_pose;
 
-  // Covariance in the range reading
-  double range_cov;
+  // Max beams to consider
+  int max_beams;
 
-  // Probability of spurious range readings
+  // Beam model: standard deviation of the range readings, and the
+  // probability of spurious range readings
+  double range_var;
   double range_bad;
 
-  // Pre-computed laser sensor model
-  int lut_size;
-  double lut_res;
-  double *lut_probs;
-  
-  // Laser (range, bearing) values
-  int range_count;
-  laser_range_t *ranges;
+  // Likelihood field model: mixture weights for the hit and random
+  // components, and standard deviation of the hit component
+  double z_hit;
+  double z_rand;
+  double sigma_hit;
 
 } laser_t;
 
 
+// A single laser scan, as passed to the sensor model
+typedef struct
+{
+  // The model to apply
+  laser_t *laser;
+
+  // Range data (range, bearing tuples)
+  int range_count;
+  double range_max;
+  double (*ranges)[2];
+
+} laser_data_t;
+
+
 // Create an sensor model
-laser_t *laser_alloc(map_t *map);
+laser_t *laser_alloc(map_t *map, pf_vector_t laser_pose);
 
 // Free an sensor model
-void laser_free(laser_t *sensor);
+void laser_free(laser_t *self);
 
-// Clear all existing range readings
-void laser_clear_ranges(laser_t *sensor);
+// Use the beam model
+void laser_set_model_beam(laser_t *self, int max_beams,
+                          double range_var, double range_bad);
 
-// Set the laser range readings that will be used.
-void laser_add_range(laser_t *sensor, double range, double bearing);
+// Use the likelihood field model.  This computes the obstacle distances
+// in the map out to max_occ_dist.
+void laser_set_model_likelihood_field(laser_t *self, int max_beams,
+                                      double z_hit, double z_rand,
+                                      double sigma_hit, double max_occ_dist);
 
-// The sensor model function
-double laser_sensor_model(laser_t *sensor, pf_vector_t pose);
+// The sensor model function; determines the weights for the given set of
+// samples and returns their total.
+double laser_sensor_model(laser_data_t *data, pf_sample_set_t *set);
 
 
 #ifdef __cplusplus
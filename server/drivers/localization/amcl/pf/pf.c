@@ -31,6 +31,7 @@
 #include <assert.h>
 #include <math.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #include <libplayercommon/playercommon.h>
 
@@ -46,6 +47,63 @@ static int pf_resample_limit(pf_t *pf, int k);
 // Re-compute the cluster statistics for a sample set
 static void pf_cluster_stats(pf_t *pf, pf_sample_set_t *set);
 
+// Smallest number of samples worth handing to an update thread
+#define PF_UPDATE_MIN_CHUNK 128
+
+// Work done by the update threads
+typedef enum
+{
+  PF_JOB_SENSOR,
+  PF_JOB_NORMALIZE
+} pf_job_type_t;
+
+// A single update thread
+typedef struct
+{
+  struct _pf_pool_t *pool;
+  int index;
+  pthread_t thread;
+
+} pf_worker_t;
+
+// Pool of update threads.  The calling thread always processes chunk 0;
+// worker i processes chunk i, if there is one.
+typedef struct _pf_pool_t
+{
+  pthread_mutex_t lock;
+  pthread_cond_t start_cond, done_cond;
+
+  int worker_count;
+  pf_worker_t *workers;
+
+  // Bumped for each job; workers wait for it to change
+  int generation;
+
+  // Workers that have not yet finished the current job
+  int pending;
+
+  int quit;
+
+  // The current job
+  pf_job_type_t type;
+  int chunk_count;
+  pf_sample_set_t *set;
+  pf_sensor_model_fn_t sensor_fn;
+  void *sensor_data;
+  double total;
+
+} pf_pool_t;
+
+// Create and destroy the update thread pool
+static pf_pool_t *pf_pool_alloc(int threads);
+static void pf_pool_free(pf_pool_t *pool);
+
+// Run the current job on the pool, split into the given number of chunks
+static void pf_pool_run(pf_pool_t *pool, int chunk_count);
+
+// Number of chunks to split a set of the given size into
+static int pf_update_chunks(pf_t *pf, int sample_count);
+
 
 // Create a new filter
 pf_t *pf_alloc(int min_samples, int max_samples)
@@ -67,6 +125,9 @@ pf_t *pf_alloc(int min_samples, int max_samples)
   // distrubition will be less than [err].
   pf->pop_err = 0.01;
   pf->pop_z = 3;
+
+  pf->update_threads = 1;
+  pf->pool = NULL;
   
   pf->current_set = 0;
   for (j = 0; j < 2; j++)
@@ -101,6 +162,9 @@ pf_t *pf_alloc(int min_samples, int max_samples)
 void pf_free(pf_t *pf)
 {
   int i;
+
+  if (pf->pool)
+    pf_pool_free(pf->pool);
   
   for (i = 0; i < 2; i++)
   {
@@ -114,6 +178,30 @@ void pf_free(pf_t *pf)
 }
 
 
+// Set the number of threads used to evaluate the sensor model
+void pf_set_update_threads(pf_t *pf, int threads)
+{
+  if (threads < 1)
+    threads = 1;
+
+  if (pf->pool)
+  {
+    pf_pool_free(pf->pool);
+    pf->pool = NULL;
+  }
+  pf->update_threads = 1;
+
+  if (threads > 1)
+  {
+    pf->pool = pf_pool_alloc(threads);
+    if (pf->pool)
+      pf->update_threads = pf->pool->worker_count + 1;
+  }
+
+  return;
+}
+
+
 // Initialize the filter using a guassian
 void pf_init(pf_t *pf, pf_vector_t mean, pf_matrix_t cov)
 {
@@ -200,22 +288,48 @@ void pf_update_action(pf_t *pf, pf_action_model_fn_t action_fn, void *action_dat
 void pf_update_sensor(pf_t *pf, pf_sensor_model_fn_t sensor_fn, void *sensor_data)
 {
   int i;
+  int chunks;
   pf_sample_set_t *set;
   pf_sample_t *sample;
   double total;
 
   set = pf->sets + pf->current_set;
+  chunks = pf_update_chunks(pf, set->sample_count);
 
   // Compute the sample weights
-  total = (*sensor_fn) (sensor_data, set);
+  if (chunks > 1)
+  {
+    pf->pool->type = PF_JOB_SENSOR;
+    pf->pool->set = set;
+    pf->pool->sensor_fn = sensor_fn;
+    pf->pool->sensor_data = sensor_data;
+    pf_pool_run(pf->pool, chunks);
+
+    // Sum the weights in sample order, so that the total (and hence the
+    // filter output) is the same however the set was split
+    total = 0.0;
+    for (i = 0; i < set->sample_count; i++)
+      total += set->samples[i].weight;
+  }
+  else
+    total = (*sensor_fn) (sensor_data, set);
   
   if (total > 0.0)
   {
     // Normalize weights
-    for (i = 0; i < set->sample_count; i++)
+    if (chunks > 1)
     {
-      sample = set->samples + i;
-      sample->weight /= total;
+      pf->pool->type = PF_JOB_NORMALIZE;
+      pf->pool->total = total;
+      pf_pool_run(pf->pool, chunks);
+    }
+    else
+    {
+      for (i = 0; i < set->sample_count; i++)
+      {
+        sample = set->samples + i;
+        sample->weight /= total;
+      }
     }
   }
   else
@@ -358,6 +472,169 @@ void pf_update_resample(pf_t *pf)
 }
 
 
+// Number of chunks to split a set of the given size into
+int pf_update_chunks(pf_t *pf, int sample_count)
+{
+  int chunks;
+
+  if (!pf->pool)
+    return 1;
+
+  chunks = (sample_count + PF_UPDATE_MIN_CHUNK - 1) / PF_UPDATE_MIN_CHUNK;
+  if (chunks > pf->update_threads)
+    chunks = pf->update_threads;
+  if (chunks < 1)
+    chunks = 1;
+
+  return chunks;
+}
+
+
+// Process one chunk of the current job
+static void pf_pool_run_chunk(pf_pool_t *pool, int chunk)
+{
+  int i, start, end;
+  pf_sample_set_t subset;
+
+  start = (int) ((long long) pool->set->sample_count * chunk / pool->chunk_count);
+  end = (int) ((long long) pool->set->sample_count * (chunk + 1) / pool->chunk_count);
+
+  switch (pool->type)
+  {
+    case PF_JOB_SENSOR:
+      // The model sees a set holding only this chunk's samples
+      subset = *pool->set;
+      subset.sample_count = end - start;
+      subset.samples = pool->set->samples + start;
+      (*pool->sensor_fn) (pool->sensor_data, &subset);
+      break;
+
+    case PF_JOB_NORMALIZE:
+      for (i = start; i < end; i++)
+        pool->set->samples[i].weight /= pool->total;
+      break;
+  }
+
+  return;
+}
+
+
+// Main loop for the update threads
+static void *pf_pool_main(void *arg)
+{
+  pf_worker_t *worker;
+  pf_pool_t *pool;
+  int generation, run;
+
+  worker = (pf_worker_t*) arg;
+  pool = worker->pool;
+  generation = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  while (1)
+  {
+    while (!pool->quit && pool->generation == generation)
+      pthread_cond_wait(&pool->start_cond, &pool->lock);
+    if (pool->quit)
+      break;
+    generation = pool->generation;
+    run = (worker->index < pool->chunk_count);
+    pthread_mutex_unlock(&pool->lock);
+
+    if (run)
+      pf_pool_run_chunk(pool, worker->index);
+
+    pthread_mutex_lock(&pool->lock);
+    if (run && --pool->pending == 0)
+      pthread_cond_signal(&pool->done_cond);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+
+// Create the update thread pool
+pf_pool_t *pf_pool_alloc(int threads)
+{
+  int i;
+  pf_pool_t *pool;
+
+  pool = calloc(1, sizeof(pf_pool_t));
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start_cond, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+
+  // The calling thread does its share of the work, so we need one
+  // fewer worker than threads
+  pool->workers = calloc(threads - 1, sizeof(pf_worker_t));
+  for (i = 0; i < threads - 1; i++)
+  {
+    pool->workers[i].pool = pool;
+    pool->workers[i].index = i + 1;
+    if (pthread_create(&pool->workers[i].thread, NULL,
+                       pf_pool_main, pool->workers + i) != 0)
+    {
+      PLAYER_WARN1("failed to start update thread; using %d threads", i + 1);
+      break;
+    }
+    pool->worker_count++;
+  }
+
+  if (pool->worker_count == 0)
+  {
+    pf_pool_free(pool);
+    return NULL;
+  }
+
+  return pool;
+}
+
+
+// Destroy the update thread pool
+void pf_pool_free(pf_pool_t *pool)
+{
+  int i;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = 1;
+  pthread_cond_broadcast(&pool->start_cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (i = 0; i < pool->worker_count; i++)
+    pthread_join(pool->workers[i].thread, NULL);
+
+  pthread_cond_destroy(&pool->done_cond);
+  pthread_cond_destroy(&pool->start_cond);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->workers);
+  free(pool);
+
+  return;
+}
+
+
+// Run the current job on the pool, split into the given number of chunks
+void pf_pool_run(pf_pool_t *pool, int chunk_count)
+{
+  pthread_mutex_lock(&pool->lock);
+  pool->chunk_count = chunk_count;
+  pool->pending = chunk_count - 1;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->start_cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  pf_pool_run_chunk(pool, 0);
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->pending > 0)
+    pthread_cond_wait(&pool->done_cond, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+
+  return;
+}
+
+
 // Compute the required number of samples, given that there are k bins
 // with samples in them.  This is taken directly from Fox et al.
 int pf_resample_limit(pf_t *pf, int k)
@@ -42,6 +42,7 @@ extern "C" {
 struct _pf_t;
 struct _rtk_fig_t;
 struct _pf_sample_set_t;
+struct _pf_pool_t;
 
 // Function prototype for the initialization model; generates a sample pose from
 // an appropriate distribution.
@@ -53,7 +54,9 @@ typedef void (*pf_action_model_fn_t) (void *action_data,
                                       struct _pf_sample_set_t* set);
 
 // Function prototype for the sensor model; determines the probability
-// for the given set of sample poses.
+// for the given set of sample poses.  When the filter uses more than one
+// update thread, the model is called concurrently on disjoint sub-ranges
+// of the sample set, so it must not modify shared state.
 typedef double (*pf_sensor_model_fn_t) (void *sensor_data, 
                                         struct _pf_sample_set_t* set);
 
@@ -120,6 +123,11 @@ typedef struct _pf_t
   int current_set;
   pf_sample_set_t sets[2];
 
+  // Number of threads used for the sensor update, and the worker pool
+  // that runs them (NULL when the update is single threaded).
+  int update_threads;
+  struct _pf_pool_t *pool;
+
 } pf_t;
 
 
@@ -129,6 +137,10 @@ pf_t *pf_alloc(int min_samples, int max_samples);
 // Free an existing filter
 void pf_free(pf_t *pf);
 
+// Set the number of threads used to evaluate the sensor model.  The
+// resulting weights do not depend on the thread count.
+void pf_set_update_threads(pf_t *pf, int threads);
+
 // Initialize the filter using a guassian
 void pf_init(pf_t *pf, pf_vector_t mean, pf_matrix_t cov);
 
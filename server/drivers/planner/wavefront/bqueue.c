@@ -0,0 +1,164 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2003
+ *     Andrew Howard
+ *     Brian Gerkey    
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/*
+ * Bucket queue; see bqueue.h.
+ */
+#include <stdlib.h>
+#include <math.h>
+#include <assert.h>
+
+#include "bqueue.h"
+
+bqueue_t*
+bqueue_alloc(void)
+{
+  bqueue_t* q;
+
+  q = calloc(1,sizeof(bqueue_t));
+  assert(q);
+  return(q);
+}
+
+void
+bqueue_free(bqueue_t* q)
+{
+  int i;
+
+  for(i=0;i<q->num_buckets;i++)
+  {
+    free(q->buckets[i].keys);
+    free(q->buckets[i].data);
+  }
+  free(q->buckets);
+  free(q);
+}
+
+void
+bqueue_reset(bqueue_t* q, double width, double max_step)
+{
+  int i, n;
+
+  assert(width > 0.0);
+
+  // Enough buckets that a key max_step above the current one does not
+  // wrap onto it
+  n = (int)ceil(max_step / width) + 2;
+  if(n > q->num_buckets)
+  {
+    q->buckets = realloc(q->buckets, n * sizeof(q->buckets[0]));
+    assert(q->buckets);
+    for(i=q->num_buckets;i<n;i++)
+    {
+      q->buckets[i].size = 0;
+      q->buckets[i].keys = NULL;
+      q->buckets[i].data = NULL;
+    }
+    q->num_buckets = n;
+  }
+
+  for(i=0;i<q->num_buckets;i++)
+    q->buckets[i].len = 0;
+  q->width = width;
+  q->cur = 0;
+  q->len = 0;
+}
+
+void
+bqueue_insert(bqueue_t* q, double key, int data)
+{
+  unsigned int k;
+  bqueue_bucket_t* b;
+  int i, p;
+
+  k = (unsigned int)(key / q->width);
+  // Rounding can put a key a hair under the bucket being drained
+  if(k < q->cur)
+    k = q->cur;
+  assert(k - q->cur < (unsigned int)q->num_buckets);
+
+  b = q->buckets + (k % q->num_buckets);
+  if(b->len == b->size)
+  {
+    b->size = b->size ? 2 * b->size : 64;
+    b->keys = realloc(b->keys, b->size * sizeof(b->keys[0]));
+    b->data = realloc(b->data, b->size * sizeof(b->data[0]));
+    assert(b->keys && b->data);
+  }
+
+  // Sift up
+  for(i = b->len++; i > 0; i = p)
+  {
+    p = (i - 1) / 2;
+    if(b->keys[p] <= (float)key)
+      break;
+    b->keys[i] = b->keys[p];
+    b->data[i] = b->data[p];
+  }
+  b->keys[i] = (float)key;
+  b->data[i] = data;
+  q->len++;
+}
+
+int
+bqueue_extract_min(bqueue_t* q)
+{
+  bqueue_bucket_t* b;
+  int data, i, c, n;
+  float key;
+
+  if(!q->len)
+    return(-1);
+
+  for(;;)
+  {
+    b = q->buckets + (q->cur % q->num_buckets);
+    if(b->len)
+      break;
+    q->cur++;
+  }
+
+  data = b->data[0];
+  q->len--;
+
+  // Sift the last entry down from the top
+  n = --b->len;
+  key = b->keys[n];
+  for(i = 0; (c = 2 * i + 1) < n; i = c)
+  {
+    if((c + 1 < n) && (b->keys[c + 1] < b->keys[c]))
+      c++;
+    if(key <= b->keys[c])
+      break;
+    b->keys[i] = b->keys[c];
+    b->data[i] = b->data[c];
+  }
+  b->keys[i] = key;
+  b->data[i] = b->data[n];
+  return(data);
+}
+
+int
+bqueue_empty(bqueue_t* q)
+{
+  return(q->len == 0);
+}
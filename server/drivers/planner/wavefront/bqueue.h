@@ -0,0 +1,71 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2003
+ *     Andrew Howard
+ *     Brian Gerkey    
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/*
+ * A bucket queue (Dial's algorithm) of integer ids, keyed on non-negative
+ * costs.  Keys are quantized into buckets of a fixed width, held in a ring
+ * that spans the largest single step a wavefront can take.  Each bucket is
+ * a small binary heap, so that ids come out in exact key order, as they
+ * would from one big heap; with narrow buckets, each holds only a few.
+ * Keys must never be smaller than the last one extracted, and never more
+ * than max_step above it.
+ */
+
+#ifndef _BQUEUE_H_
+#define _BQUEUE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct
+{
+  int len;
+  int size;
+  float* keys;
+  int* data;
+} bqueue_bucket_t;
+
+typedef struct bqueue
+{
+  int len;
+  double width;
+  // Bucket being drained, counted from key 0 (not wrapped)
+  unsigned int cur;
+  int num_buckets;
+  bqueue_bucket_t* buckets;
+} bqueue_t;
+
+bqueue_t* bqueue_alloc(void);
+void bqueue_free(bqueue_t* q);
+// Empty the queue, and set the bucket width and the largest key step
+void bqueue_reset(bqueue_t* q, double width, double max_step);
+void bqueue_insert(bqueue_t* q, double key, int data);
+// Returns -1 if the queue is empty
+int bqueue_extract_min(bqueue_t* q);
+int bqueue_empty(bqueue_t* q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -22,6 +22,9 @@
 /*
  * An implementation of a heap, as seen in "Introduction to Algorithms," by
  * Cormen, Leiserson, and Rivest, pages 140-152.
+ *
+ * Deprecated: the planner itself now uses the bucket queue in bqueue.h.
+ * This is still built into the standalone library for existing users.
  */
 
 #ifndef _HEAP_H_
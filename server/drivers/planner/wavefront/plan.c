@@ -30,16 +30,13 @@
 
 //#include <config.h>
 
-// This header MUST come before <openssl/md5.h>
 #include <sys/types.h>
-
-#if HAVE_OPENSSL_MD5_H && HAVE_LIBCRYPTO
-  #include <openssl/md5.h>
-#endif
+#include <sys/stat.h>
 
 #include <assert.h>
 #include <math.h>
 #include <float.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -49,18 +46,15 @@
 #include <libplayercommon/playercommon.h>
 
 #include "plan.h"
-//#include "heap.h"
-
-#if HAVE_OPENSSL_MD5_H && HAVE_LIBCRYPTO
-// length of the hash, in unsigned ints
-#define HASH_LEN (MD5_DIGEST_LENGTH / sizeof(unsigned int))
-#endif
 
 #if defined (WIN32)
   #include <replace/replace.h>
   #include <winsock2.h> // For struct timeval
 #else
   #include <sys/time.h>
+  #include <sys/mman.h>
+  #include <fcntl.h>
+  #include <unistd.h>
 #endif
 static double get_time(void);
 
@@ -84,8 +78,7 @@ plan_t *plan_alloc(double abs_min_radius, double des_min_radius,
   plan->dist_penalty = dist_penalty;
   plan->hysteresis_factor = hysteresis_factor;
   
-  plan->heap = heap_alloc(PLAN_DEFAULT_HEAP_SIZE, (heap_free_elt_fn_t)NULL);
-  assert(plan->heap);
+  plan->queue = bqueue_alloc();
 
   plan->path_size = 1000;
   plan->path = calloc(plan->path_size, sizeof(plan->path[0]));
@@ -105,20 +98,28 @@ plan_set_obstacles(plan_t* plan, double* obs, size_t num)
   size_t i;
   int j;
   int di,dj;
+  int half, min_i, max_i, min_j, max_j;
   float* p;
   plan_cell_t* cell, *ncell;
   double t0,t1;
 
   t0 = get_time();
 
-  // Start with static obstacle data
-  cell = plan->cells;
-  for(j=0;j<plan->size_y*plan->size_x;j++,cell++)
+  // Go back to the static obstacle data, in the region that the previous
+  // obstacles touched
+  for(j=plan->dyn_min_y;j<=plan->dyn_max_y;j++)
   {
-    cell->occ_state_dyn = cell->occ_state;
-    cell->occ_dist_dyn = cell->occ_dist;
-    cell->mark = 0;
+    cell = plan->cells + PLAN_INDEX(plan,plan->dyn_min_x,j);
+    for(di=plan->dyn_min_x;di<=plan->dyn_max_x;di++,cell++)
+    {
+      cell->occ_state_dyn = cell->occ_state;
+      cell->occ_dist_dyn = cell->occ_dist;
+    }
   }
+  plan->dyn_min_x = plan->dyn_min_y = INT_MAX;
+  plan->dyn_max_x = plan->dyn_max_y = INT_MIN;
+
+  half = plan->dist_kernel_width/2;
 
   // Expand around the dynamic obstacle pts
   for(i=0;i<num;i++)
@@ -133,30 +134,48 @@ plan_set_obstacles(plan_t* plan, double* obs, size_t num)
 
     cell = plan->cells + PLAN_INDEX(plan,gx,gy);
 
-    if(cell->mark)
+    // A cell at zero distance is an obstacle already (static, or an
+    // earlier point in this scan), so its kernel is already in place
+    if(cell->occ_dist_dyn == 0.0)
+    {
+      cell->occ_state_dyn = 1;
+      plan->dyn_min_x = MIN(plan->dyn_min_x, gx);
+      plan->dyn_max_x = MAX(plan->dyn_max_x, gx);
+      plan->dyn_min_y = MIN(plan->dyn_min_y, gy);
+      plan->dyn_max_y = MAX(plan->dyn_max_y, gy);
       continue;
+    }
 
-    cell->mark = 1;
     cell->occ_state_dyn = 1;
     cell->occ_dist_dyn = 0.0;
 
-    p = plan->dist_kernel;
-    for (dj = -plan->dist_kernel_width/2; 
-         dj <= plan->dist_kernel_width/2; 
-         dj++)
+    // Only visit the part of the kernel inside the planning bounds
+    min_i = MAX(-half, plan->min_x - gx);
+    max_i = MIN(half, plan->max_x - gx);
+    min_j = MAX(-half, plan->min_y - gy);
+    max_j = MIN(half, plan->max_y - gy);
+    if(min_i > max_i || min_j > max_j)
     {
-      ncell = cell + -plan->dist_kernel_width/2 + dj*plan->size_x;
-      for (di = -plan->dist_kernel_width/2;
-           di <= plan->dist_kernel_width/2; 
-           di++, p++, ncell++)
-      {
-        if(!PLAN_VALID_BOUNDS(plan,cell->ci+di,cell->cj+dj))            
-          continue;
+      // Outside the bounds; just the cell itself
+      min_i = max_i = min_j = max_j = 0;
+    }
 
+    for (dj = min_j; dj <= max_j; dj++)
+    {
+      p = plan->dist_kernel + (dj + half) * plan->dist_kernel_width + (min_i + half);
+      ncell = cell + min_i + dj*plan->size_x;
+      for (di = min_i; di <= max_i; di++, p++, ncell++)
+      {
         if(*p < ncell->occ_dist_dyn)
           ncell->occ_dist_dyn = *p;
       }
     }
+
+    // The cell itself may lie outside the clipped kernel
+    plan->dyn_min_x = MIN(plan->dyn_min_x, MIN(gx, gx + min_i));
+    plan->dyn_max_x = MAX(plan->dyn_max_x, MAX(gx, gx + max_i));
+    plan->dyn_min_y = MIN(plan->dyn_min_y, MIN(gy, gy + min_j));
+    plan->dyn_max_y = MAX(plan->dyn_max_y, MAX(gy, gy + max_j));
   }
 
   t1 = get_time();
@@ -203,7 +222,7 @@ void plan_free(plan_t *plan)
 {
   if (plan->cells)
     free(plan->cells);
-  heap_free(plan->heap);
+  bqueue_free(plan->queue);
   free(plan->waypoints);
   if(plan->dist_kernel)
     free(plan->dist_kernel);
@@ -253,6 +272,10 @@ plan_t *plan_copy(plan_t *plan)
     ret_plan->cells[i].occ_state_dyn = plan->cells[i].occ_state_dyn;
     ret_plan->cells[i].occ_dist_dyn = plan->cells[i].occ_dist_dyn;
   }
+  ret_plan->dyn_min_x = plan->dyn_min_x;
+  ret_plan->dyn_min_y = plan->dyn_min_y;
+  ret_plan->dyn_max_x = plan->dyn_max_x;
+  ret_plan->dyn_max_y = plan->dyn_max_y;
 
   return ret_plan;
 }
@@ -284,6 +307,10 @@ void plan_init(plan_t *plan)
   }
   plan->waypoint_count = 0;
 
+  // No dynamic obstacles yet
+  plan->dyn_min_x = plan->dyn_min_y = INT_MAX;
+  plan->dyn_max_x = plan->dyn_max_y = INT_MIN;
+
   plan_compute_dist_kernel(plan);
 
   plan_set_bounds(plan, 0, 0, plan->size_x - 1, plan->size_y - 1);
@@ -617,181 +644,254 @@ draw_path(plan_t* plan, double lx, double ly, const char* fname)
 }
 #endif
 
-// Construct the configuration space from the occupancy grid.
-// This treats both occupied and unknown cells as bad.
-// 
-// If cachefile is non-NULL, then we try to read the c-space from that
-// file.  If that fails, then we construct the c-space as per normal and
-// then write it out to cachefile.
-#if 0
-void 
+// Header of the c-space cache file; it is followed by size_x * size_y
+// floats, the occ_dist values in cell index order.
+typedef struct
+{
+  unsigned int magic;
+  unsigned int version;
+  int size_x, size_y;
+  double scale;
+  double max_radius;
+  unsigned long long hash;
+} plan_cspace_header_t;
+
+#define PLAN_CSPACE_MAGIC 0x53435057 // "WPCS", little-endian
+#define PLAN_CSPACE_VERSION 1
+
+// Load the c-space from cachefile if that holds the c-space for this map
+// and max_radius; otherwise compute it and write it to cachefile.  Covers
+// the whole grid, whatever the current bounds.
+void
 plan_update_cspace(plan_t *plan, const char* cachefile)
 {
-#if HAVE_OPENSSL_MD5_H && HAVE_LIBCRYPTO
-  unsigned int hash[HASH_LEN];
-  plan_md5(hash, plan);
+  unsigned long long hash;
+  int min_x, min_y, max_x, max_y;
+
+  hash = plan_hash(plan);
   if(cachefile && strlen(cachefile))
   {
-    PLAYER_MSG1(2,"Trying to read c-space from file %s", cachefile);
     if(plan_read_cspace(plan,cachefile,hash) == 0)
     {
-      // Reading from the cache file worked; we're done here.
-      PLAYER_MSG1(2,"Successfully read c-space from file %s", cachefile);
-#if 0
-      draw_cspace(plan,"plan_cspace.png");
-#endif
+      printf("Read c-space from %s\n", cachefile);
       return;
     }
-    PLAYER_MSG1(2, "Failed to read c-space from file %s", cachefile);
   }
-#endif
-
-  //plan_update_cspace_dp(plan);
-  plan_update_cspace_naive(plan);
 
-#if HAVE_OPENSSL_MD5_H && HAVE_LIBCRYPTO
-  if(cachefile)
-    plan_write_cspace(plan,cachefile, (unsigned int*)hash);
-#endif
-
-  PLAYER_MSG0(2,"Done.");
+  min_x = plan->min_x;
+  min_y = plan->min_y;
+  max_x = plan->max_x;
+  max_y = plan->max_y;
+  plan_set_bounds(plan, 0, 0, plan->size_x - 1, plan->size_y - 1);
+  plan_compute_cspace(plan);
+  plan_set_bounds(plan, min_x, min_y, max_x, max_y);
 
-#if 0
-  draw_cspace(plan,"plan_cspace.png");
-#endif
+  if(cachefile && strlen(cachefile))
+    plan_write_cspace(plan,cachefile,hash);
 }
 
-#if HAVE_OPENSSL_MD5_H && HAVE_LIBCRYPTO
-// Write the cspace occupancy distance values to a file, one per line.
-// Read them back in with plan_read_cspace().
+// Write the cspace occupancy distance values to a binary cache file.
+// Read them back in with plan_read_cspace().  The file is written under a
+// temporary name in the same directory and then renamed into place, so
+// that another process that has the old file mapped keeps a complete copy.
 // Returns non-zero on error.
 int 
-plan_write_cspace(plan_t *plan, const char* fname, unsigned int* hash)
+plan_write_cspace(plan_t *plan, const char* fname, unsigned long long hash)
 {
+  plan_cspace_header_t header;
   plan_cell_t* cell;
+  float* row;
   int i,j;
   FILE* fp;
+  char* tmpname;
+#if !defined (WIN32)
+  int fd;
+#endif
 
-  if(!(fp = fopen(fname,"w+")))
+  tmpname = (char*)malloc(strlen(fname) + 8);
+  assert(tmpname);
+  sprintf(tmpname, "%s.XXXXXX", fname);
+#if !defined (WIN32)
+  fp = NULL;
+  if((fd = mkstemp(tmpname)) >= 0)
   {
-    PLAYER_MSG2(2,"Failed to open file %s to write c-space: %s",
-                fname,strerror(errno));
+    fchmod(fd, 0644);
+    if(!(fp = fdopen(fd, "wb")))
+    {
+      close(fd);
+      remove(tmpname);
+    }
+  }
+#else
+  fp = _mktemp(tmpname) ? fopen(tmpname,"wb") : NULL;
+#endif
+  if(!fp)
+  {
+    printf("failed to open temporary file for %s to write c-space: %s\n",
+           fname,strerror(errno));
+    free(tmpname);
     return(-1);
   }
 
-  fprintf(fp,"%d\n%d\n", plan->size_x, plan->size_y);
-  fprintf(fp,"%.3lf\n%.3lf\n", plan->origin_x, plan->origin_y);
-  fprintf(fp,"%.3lf\n%.3lf\n", plan->scale,plan->max_radius);
-  for(i=0;i<HASH_LEN;i++)
-    fprintf(fp,"%08X", hash[i]);
-  fprintf(fp,"\n");
+  memset(&header,0,sizeof(header));
+  header.magic = PLAN_CSPACE_MAGIC;
+  header.version = PLAN_CSPACE_VERSION;
+  header.size_x = plan->size_x;
+  header.size_y = plan->size_y;
+  header.scale = plan->scale;
+  header.max_radius = plan->max_radius;
+  header.hash = hash;
+
+  row = (float*)malloc(plan->size_x * sizeof(float));
+  assert(row);
 
+  if(fwrite(&header,sizeof(header),1,fp) != 1)
+    goto fail;
   for(j = 0; j < plan->size_y; j++)
   {
-    for(i = 0; i < plan->size_x; i++)
-    {
-      cell = plan->cells + PLAN_INDEX(plan, i, j);
-      fprintf(fp,"%.3f\n", cell->occ_dist);
-    }
+    cell = plan->cells + PLAN_INDEX(plan, 0, j);
+    for(i = 0; i < plan->size_x; i++, cell++)
+      row[i] = cell->occ_dist;
+    if(fwrite(row,sizeof(float),plan->size_x,fp) != (size_t)plan->size_x)
+      goto fail;
   }
 
-  fclose(fp);
+  free(row);
+  row = NULL;
+  if(fflush(fp) != 0)
+    goto fail;
+#if !defined (WIN32)
+  // The data must be on disk before the name points at it
+  if(fsync(fileno(fp)) != 0)
+    goto fail;
+#endif
+  if(fclose(fp) != 0)
+  {
+    fp = NULL;
+    goto fail;
+  }
+  fp = NULL;
+#if defined (WIN32)
+  // rename() won't replace an existing file here
+  remove(fname);
+#endif
+  if(rename(tmpname, fname) != 0)
+    goto fail;
+  free(tmpname);
   return(0);
+
+fail:
+  printf("failed to write c-space to file %s: %s\n",
+         fname,strerror(errno));
+  free(row);
+  if(fp)
+    fclose(fp);
+  remove(tmpname);
+  free(tmpname);
+  return(-1);
 }
 
-// Read the cspace occupancy distance values from a file, one per line.
-// Write them in first with plan_read_cspace().
-// Returns non-zero on error.
+// Read the cspace occupancy distance values from a binary cache file
+// written by plan_write_cspace(), into both occ_dist and occ_dist_dyn.
+// The file is memory-mapped where that is available.
+// Returns non-zero on error, or if the file is for a different map.
 int 
-plan_read_cspace(plan_t *plan, const char* fname, unsigned int* hash)
+plan_read_cspace(plan_t *plan, const char* fname, unsigned long long hash)
 {
+  plan_cspace_header_t header;
   plan_cell_t* cell;
-  int i,j;
+  const float* dist;
+  size_t count, size, i;
+  int ret;
+#if !defined (WIN32)
+  int fd;
+  struct stat st;
+  void* map;
+#else
   FILE* fp;
-  int size_x, size_y;
-  double origin_x, origin_y;
-  double scale, max_radius;
-  unsigned int cached_hash[HASH_LEN];
+  float* buf;
+#endif
 
-  if(!(fp = fopen(fname,"r")))
-  {
-    PLAYER_MSG1(2,"Failed to open file %s", fname);
+  count = (size_t)plan->size_x * plan->size_y;
+  size = sizeof(header) + count * sizeof(float);
+
+#if !defined (WIN32)
+  if((fd = open(fname, O_RDONLY)) < 0)
     return(-1);
-  }
-  
-  /* Read out the metadata */
-  if((fscanf(fp,"%d", &size_x) < 1) ||
-     (fscanf(fp,"%d", &size_y) < 1) ||
-     (fscanf(fp,"%lf", &origin_x) < 1) ||
-     (fscanf(fp,"%lf", &origin_y) < 1) ||
-     (fscanf(fp,"%lf", &scale) < 1) ||
-     (fscanf(fp,"%lf", &max_radius) < 1))
+  if((fstat(fd, &st) < 0) || ((size_t)st.st_size != size))
   {
-    PLAYER_MSG1(2,"Failed to read c-space metadata from file %s", fname);
-    fclose(fp);
+    close(fd);
     return(-1);
   }
-
-  for(i=0;i<HASH_LEN;i++)
+  map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED)
   {
-    if(fscanf(fp,"%08X", cached_hash+i) < 1)
-    {
-      PLAYER_MSG1(2,"Failed to read c-space metadata from file %s", fname);
-      fclose(fp);
-      return(-1);
-    }
+    printf("failed to map c-space file %s: %s\n", fname, strerror(errno));
+    return(-1);
   }
-
-  /* Verify that metadata matches */
-  if((size_x != plan->size_x) ||
-     (size_y != plan->size_y) ||
-     (fabs(origin_x - plan->origin_x) > 1e-3) ||
-     (fabs(origin_y - plan->origin_y) > 1e-3) ||
-     (fabs(scale - plan->scale) > 1e-3) ||
-     (fabs(max_radius - plan->max_radius) > 1e-3) ||
-     memcmp(cached_hash, hash, sizeof(unsigned int) * HASH_LEN))
+  memcpy(&header, map, sizeof(header));
+  dist = (const float*)((const char*)map + sizeof(header));
+#else
+  if(!(fp = fopen(fname,"rb")))
+    return(-1);
+  buf = NULL;
+  if((fread(&header,sizeof(header),1,fp) != 1) ||
+     (header.size_x != plan->size_x) || (header.size_y != plan->size_y) ||
+     !(buf = (float*)malloc(count * sizeof(float))) ||
+     (fread(buf,sizeof(float),count,fp) != count))
   {
-    PLAYER_MSG1(2,"Mismatch in c-space metadata read from file %s", fname);
+    free(buf);
     fclose(fp);
     return(-1);
   }
+  fclose(fp);
+  dist = buf;
+#endif
 
-  for(j = 0; j < plan->size_y; j++)
+  // Verify that metadata matches
+  if((header.magic != PLAN_CSPACE_MAGIC) ||
+     (header.version != PLAN_CSPACE_VERSION) ||
+     (header.size_x != plan->size_x) ||
+     (header.size_y != plan->size_y) ||
+     (header.scale != plan->scale) ||
+     (header.max_radius != plan->max_radius) ||
+     (header.hash != hash))
+    ret = -1;
+  else
   {
-    for(i = 0; i < plan->size_x; i++)
-    {
-      cell = plan->cells + PLAN_INDEX(plan, i, j);
-      if(fscanf(fp,"%f", &(cell->occ_dist)) < 1)
-      {
-        PLAYER_MSG3(2,"Failed to read c-space data for cell (%d,%d) from file %s",
-                     i,j,fname);
-        fclose(fp);
-        return(-1);
-      }
-    }
+    cell = plan->cells;
+    for(i = 0; i < count; i++, cell++)
+      cell->occ_dist_dyn = cell->occ_dist = dist[i];
+    ret = 0;
   }
 
-  fclose(fp);
-  return(0);
+#if !defined (WIN32)
+  munmap(map, size);
+#else
+  free(buf);
+#endif
+  return(ret);
 }
 
-// Compute the 16-byte MD5 hash of the map data in the given plan
+// Compute a 64-bit FNV-1a hash of the occupancy states in the given plan
 // object.
-void
-plan_md5(unsigned int* digest, plan_t* plan)
+unsigned long long
+plan_hash(plan_t* plan)
 {
-  MD5_CTX c;
-
-  MD5_Init(&c);
-
-  MD5_Update(&c,(const unsigned char*)plan->cells,
-             (plan->size_x*plan->size_y)*sizeof(plan_cell_t));
+  unsigned long long hash = 14695981039346656037ULL;
+  plan_cell_t* cell;
+  int i, count;
 
-  MD5_Final((unsigned char*)digest,&c);
+  count = plan->size_x * plan->size_y;
+  cell = plan->cells;
+  for(i = 0; i < count; i++, cell++)
+  {
+    hash ^= (unsigned char)cell->occ_state;
+    hash *= 1099511628211ULL;
+  }
+  return(hash);
 }
-#endif // HAVE_OPENSSL_MD5_H && HAVE_LIBCRYPTO
-
-#endif // if 0
 
 double 
 static get_time(void)
@@ -31,13 +31,12 @@
 #ifndef PLAN_H
 #define PLAN_H
 
-#include "heap.h"
+#include "bqueue.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-#define PLAN_DEFAULT_HEAP_SIZE 1000
 #define PLAN_MAX_COST 1e9
 
 // Description for a grid single cell
@@ -99,13 +98,17 @@ typedef struct
   // The grid data
   plan_cell_t *cells;
 
+  // Region in which the dynamic obstacle values (occ_state_dyn,
+  // occ_dist_dyn) may differ from the static ones; empty when min > max.
+  int dyn_min_x, dyn_min_y, dyn_max_x, dyn_max_y;
+
   // Distance penalty kernel, pre-computed in plan_compute_dist_kernel();
   float* dist_kernel;
   int dist_kernel_width;
   float dist_kernel_3x3[9];
   
-  // Priority queue of cells to update
-  heap_t* heap;
+  // Priority queue of cells (by index) to update
+  bqueue_t* queue;
 
   // The global path
   int path_count, path_size;
@@ -155,9 +158,13 @@ void plan_set_bbox(plan_t* plan, double padding, double min_size,
 int plan_check_inbounds(plan_t* plan, double x, double y);
 
 // Construct the configuration space from the occupancy grid.
-//void plan_update_cspace(plan_t *plan, const char* cachefile);
 void plan_compute_cspace(plan_t *plan);
 
+// As plan_compute_cspace(), over the whole grid, but load the result from
+// cachefile when it matches this map, and write it there when it does not.
+// cachefile may be NULL or empty.
+void plan_update_cspace(plan_t *plan, const char* cachefile);
+
 int plan_do_global(plan_t *plan, double lx, double ly, double gx, double gy);
 
 int plan_do_local(plan_t *plan, double lx, double ly, double plan_halfwidth);
@@ -189,23 +196,23 @@ int plan_check_done(plan_t* plan,
                     double gx, double gy, double ga,
                     double goal_d, double goal_a);
 
+// Replace the dynamic obstacles with the given points (x, y pairs, in
+// world coords).  Only the cells around the previous and new points are
+// touched.
 void plan_set_obstacles(plan_t* plan, double* obs, size_t num);
 
-#if HAVE_OPENSSL_MD5_H && HAVE_LIBCRYPTO
-// Write the cspace occupancy distance values to a file, one per line.
-// Read them back in with plan_read_cspace().
-// Returns non-zero on error.
-int plan_write_cspace(plan_t *plan, const char* fname, unsigned int* hash);
-
-// Read the cspace occupancy distance values from a file, one per line.
-// Write them in first with plan_read_cspace().
-// Returns non-zero on error.
-int plan_read_cspace(plan_t *plan, const char* fname, unsigned int* hash);
-
-// Compute and return the 16-bit MD5 hash of the map data in the given plan
-// object.
-void plan_md5(unsigned int* digest, plan_t* plan);
-#endif // HAVE_OPENSSL_MD5_H && HAVE_LIBCRYPTO
+// Write the cspace occupancy distance values to a binary cache file,
+// tagged with the given map hash.  Read them back in with
+// plan_read_cspace().  Returns non-zero on error.
+int plan_write_cspace(plan_t *plan, const char* fname, unsigned long long hash);
+
+// Read the cspace occupancy distance values from a cache file written by
+// plan_write_cspace().  Returns non-zero on error, or if the file does not
+// match this plan's size, scale, max_radius and map hash.
+int plan_read_cspace(plan_t *plan, const char* fname, unsigned long long hash);
+
+// Compute the 64-bit hash of the map data in the given plan object.
+unsigned long long plan_hash(plan_t* plan);
 
 /**************************************************************************
  * Plan manipulation macros
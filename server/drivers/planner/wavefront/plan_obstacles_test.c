@@ -0,0 +1,303 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2003
+ *     Andrew Howard
+ *     Brian Gerkey
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+/**************************************************************************
+ * Desc: Test for the dynamic obstacle update.
+ * CVS: $Id$
+ *
+ * Checks plan_set_obstacles() against the original implementation, which
+ * reset the whole grid to the static obstacles and expanded the full
+ * kernel around every point, over sequences of random scans with the
+ * planning bounds changing in between.  Then times both on a large map.
+ * Exits with a non-zero status on any mismatch.
+ *
+ * Usage: wavefront_obstacles_test [size]
+ *************************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "plan.h"
+
+
+// The original update, into separate arrays: reset everything to the
+// static values, then expand the kernel (clipped to the planning bounds)
+// around each point.
+static void ref_set_obstacles(plan_t *plan, double *obs, size_t num,
+                              char *state, float *dist, char *mark)
+{
+  size_t i;
+  int j, di, dj, half, gx, gy, n;
+  float *p;
+
+  for (j = 0; j < plan->size_x * plan->size_y; j++)
+  {
+    state[j] = plan->cells[j].occ_state;
+    dist[j] = plan->cells[j].occ_dist;
+    mark[j] = 0;
+  }
+
+  half = plan->dist_kernel_width / 2;
+  for (i = 0; i < num; i++)
+  {
+    gx = PLAN_GXWX(plan, obs[2 * i]);
+    gy = PLAN_GYWY(plan, obs[2 * i + 1]);
+    if (!PLAN_VALID(plan, gx, gy))
+      continue;
+    if (mark[PLAN_INDEX(plan, gx, gy)])
+      continue;
+
+    mark[PLAN_INDEX(plan, gx, gy)] = 1;
+    state[PLAN_INDEX(plan, gx, gy)] = 1;
+    dist[PLAN_INDEX(plan, gx, gy)] = 0.0;
+
+    p = plan->dist_kernel;
+    for (dj = -half; dj <= half; dj++)
+    {
+      for (di = -half; di <= half; di++, p++)
+      {
+        if (!PLAN_VALID_BOUNDS(plan, gx + di, gy + dj))
+          continue;
+        n = PLAN_INDEX(plan, gx + di, gy + dj);
+        if (*p < dist[n])
+          dist[n] = *p;
+      }
+    }
+  }
+}
+
+
+// Make a planner over a map with the given fraction of occupied cells,
+// scattered at random, and some unknown ones
+static plan_t *make_plan(int size_x, int size_y, double density)
+{
+  int i;
+  double r;
+  plan_t *plan;
+
+  plan = plan_alloc(0.2, 0.3, 0.5 + drand48(), 5.0, 3.0);
+  plan->scale = 0.05;
+  plan->size_x = size_x;
+  plan->size_y = size_y;
+  plan->origin_x = -1.0;
+  plan->origin_y = -2.0;
+  plan->cells = calloc(size_x * size_y, sizeof(plan_cell_t));
+
+  for (i = 0; i < size_x * size_y; i++)
+  {
+    r = drand48();
+    plan->cells[i].occ_state = (r < density) ? +1 : (r < 1.5 * density) ? 0 : -1;
+  }
+
+  // As the driver does: the cspace over the whole grid
+  plan_init(plan);
+  plan_update_cspace(plan, NULL);
+  return plan;
+}
+
+
+// Make a scan: clumps of points, some repeated, some off the map and some
+// on static obstacles
+static size_t make_scan(plan_t *plan, double *obs, size_t max)
+{
+  size_t i, num;
+  double wx, wy, cx, cy;
+  int k, n;
+
+  num = lrand48() % (max + 1);
+  cx = cy = 0.0;
+  for (i = 0; i < num; i++)
+  {
+    if (i % 20 == 0)
+    {
+      cx = plan->origin_x + (drand48() * 1.2 - 0.1) * plan->size_x * plan->scale;
+      cy = plan->origin_y + (drand48() * 1.2 - 0.1) * plan->size_y * plan->scale;
+    }
+    if (i > 0 && drand48() < 0.1)
+    {
+      // The same point again
+      wx = obs[2 * (i - 1)];
+      wy = obs[2 * (i - 1) + 1];
+    }
+    else if (drand48() < 0.05)
+    {
+      // Right on a cell, occupied in the map if one turns up
+      for (n = 0; n < 20; n++)
+      {
+        k = lrand48() % (plan->size_x * plan->size_y);
+        if (plan->cells[k].occ_state == 1)
+          break;
+      }
+      wx = PLAN_WXGX(plan, plan->cells[k].ci);
+      wy = PLAN_WYGY(plan, plan->cells[k].cj);
+    }
+    else
+    {
+      wx = cx + (drand48() - 0.5) * 1.0;
+      wy = cy + (drand48() - 0.5) * 1.0;
+    }
+    obs[2 * i] = wx;
+    obs[2 * i + 1] = wy;
+  }
+  return num;
+}
+
+
+// Move the planning bounds somewhere at random, or back to the whole map
+static void move_bounds(plan_t *plan)
+{
+  int x0, y0, x1, y1;
+
+  if (drand48() < 0.3)
+  {
+    plan_set_bounds(plan, 0, 0, plan->size_x - 1, plan->size_y - 1);
+    return;
+  }
+  x0 = lrand48() % plan->size_x;
+  x1 = lrand48() % plan->size_x;
+  y0 = lrand48() % plan->size_y;
+  y1 = lrand48() % plan->size_y;
+  plan_set_bounds(plan, x0 < x1 ? x0 : x1, y0 < y1 ? y0 : y1,
+                  x0 < x1 ? x1 : x0, y0 < y1 ? y1 : y0);
+}
+
+
+// Run a sequence of scans through both updates; returns the number of
+// mismatched cells
+static int check_plan(plan_t *plan, int scans)
+{
+  int n, i, bad, cells;
+  size_t num;
+  double *obs;
+  char *state, *mark;
+  float *dist;
+
+  n = plan->size_x * plan->size_y;
+  obs = malloc(2 * 400 * sizeof(obs[0]));
+  state = malloc(n);
+  mark = malloc(n);
+  dist = malloc(n * sizeof(dist[0]));
+
+  bad = 0;
+  for (i = 0; i < scans; i++)
+  {
+    if (drand48() < 0.3)
+      move_bounds(plan);
+    num = make_scan(plan, obs, (i % 10 == 9) ? 0 : 400);
+
+    plan_set_obstacles(plan, obs, num);
+    ref_set_obstacles(plan, obs, num, state, dist, mark);
+
+    cells = 0;
+    for (n = 0; n < plan->size_x * plan->size_y; n++)
+    {
+      if (plan->cells[n].occ_state_dyn != state[n] ||
+          plan->cells[n].occ_dist_dyn != dist[n])
+        cells++;
+    }
+    bad += cells;
+  }
+
+  printf("%4d x %-4d max %.2f, %d scans: %d cells differ\n",
+         plan->size_x, plan->size_y, plan->max_radius, scans, bad);
+
+  free(obs);
+  free(state);
+  free(mark);
+  free(dist);
+  return bad;
+}
+
+
+static double now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+int main(int argc, char *argv[])
+{
+  static const double densities[] = {0.0, 0.01, 0.1, 0.5};
+  int size, bad, i, k;
+  size_t num;
+  plan_t *plan;
+  double *obs, t, t_ref;
+  char *state, *mark;
+  float *dist;
+
+  size = (argc > 1) ? atoi(argv[1]) : 2000;
+  bad = 0;
+  srand48(42);
+
+  // Odd shapes, empty and crowded maps
+  for (i = 0; i < (int) (sizeof(densities) / sizeof(densities[0])); i++)
+  {
+    for (k = 0; k < 3; k++)
+    {
+      plan = make_plan(1 + lrand48() % 200, 1 + lrand48() % 200, densities[i]);
+      bad += check_plan(plan, 50);
+      plan_free(plan);
+    }
+  }
+
+  // Timing on a large, sparse map, with the bounds the driver uses for
+  // local planning
+  plan = make_plan(size, size, 0.005);
+  plan_set_bounds(plan, size / 2 - 100, size / 2 - 100,
+                  size / 2 + 100, size / 2 + 100);
+  obs = malloc(2 * 300 * sizeof(obs[0]));
+  state = malloc(size * size);
+  mark = malloc(size * size);
+  dist = malloc(size * size * sizeof(dist[0]));
+  for (i = 0; i < 300; i++)
+  {
+    obs[2 * i] = PLAN_WXGX(plan, size / 2) + 3.0 * cos(i * M_PI / 300);
+    obs[2 * i + 1] = PLAN_WYGY(plan, size / 2) + 3.0 * sin(i * M_PI / 300);
+  }
+  num = 300;
+  t = now();
+  for (i = 0; i < 10; i++)
+    plan_set_obstacles(plan, obs, num);
+  t = (now() - t) / 10;
+  t_ref = now();
+  for (i = 0; i < 10; i++)
+    ref_set_obstacles(plan, obs, num, state, dist, mark);
+  t_ref = (now() - t_ref) / 10;
+  printf("%d x %d map, %d points: %.3f ms (was %.3f ms)\n",
+         size, size, (int) num, 1e3 * t, 1e3 * t_ref);
+  free(obs);
+  free(state);
+  free(mark);
+  free(dist);
+  plan_free(plan);
+
+  if (bad)
+  {
+    printf("FAILED\n");
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
@@ -44,9 +44,14 @@ static double get_time(void);
 
 #include "plan.h"
 
+// Queue buckets per grid cell of travel.  Cells come off the queue in
+// exact cost order either way; narrower buckets keep each one's heap
+// small.
+#define PLAN_QUEUE_RESOLUTION 16
+
 // Plan queue stuff
-void plan_push(plan_t *plan, plan_cell_t *cell);
-plan_cell_t *plan_pop(plan_t *plan);
+void plan_push(plan_t *plan, int index);
+int plan_pop(plan_t *plan);
 int _plan_update_plan(plan_t *plan, double lx, double ly, double gx, double gy);
 int _plan_find_local_goal(plan_t *plan, double* gx, double* gy, double lx, double ly);
 
@@ -171,15 +176,23 @@ plan_do_local(plan_t *plan, double lx, double ly, double plan_halfwidth)
 int 
 _plan_update_plan(plan_t *plan, double lx, double ly, double gx, double gy)
 {
-  int oi, oj, di, dj, ni, nj;
+  int oi, oj, k, o;
   int gi, gj, li,lj;
+  int interior;
+  int nbr[9];
   float cost;
+  double max_step;
   plan_cell_t *cell, *ncell;
   char old_occ_state;
   float old_occ_dist;
 
-  // Reset the queue
-  heap_reset(plan->heap);
+  // Reset the queue.  The largest step is a diagonal move on the previous
+  // path next to an obstacle.
+  max_step = plan->dist_kernel_3x3[0] +
+          plan->dist_penalty * plan->max_radius;
+  if(plan->hysteresis_factor > 1.0)
+    max_step += plan->dist_kernel_3x3[0] * (plan->hysteresis_factor - 1.0);
+  bqueue_reset(plan->queue, plan->scale / PLAN_QUEUE_RESOLUTION, max_step);
 
   // Initialize the goal cell
   gi = PLAN_GXWX(plan, gx);
@@ -217,59 +230,55 @@ _plan_update_plan(plan_t *plan, double lx, double ly, double gx, double gy)
   if((li == gi) && (lj == gj))
     return(0);
   
-  plan_push(plan, cell);
+  plan_push(plan, PLAN_INDEX(plan, gi, gj));
 
-  while (1)
-  {
-    float * p;
-    cell = plan_pop(plan);
-    if (cell == NULL)
-      break;
+  // Index offsets of the 3x3 neighbourhood, in dist_kernel_3x3 order
+  for (k = 0; k < 9; k++)
+    nbr[k] = PLAN_INDEX(plan, k % 3 - 1, k / 3 - 1);
 
+  while ((o = plan_pop(plan)) >= 0)
+  {
+    cell = plan->cells + o;
     oi = cell->ci;
     oj = cell->cj;
 
     //printf("pop %d %d %f\n", cell->ci, cell->cj, cell->plan_cost);
 
-    p = plan->dist_kernel_3x3;
-    for (dj = -1; dj <= +1; dj++)
+    // Only cells on the edge of the bounds need their neighbours checked
+    interior = ((oi > plan->min_x) && (oi < plan->max_x) &&
+                (oj > plan->min_y) && (oj < plan->max_y));
+
+    for (k = 0; k < 9; k++)
     {
-      ncell = plan->cells + PLAN_INDEX(plan,oi-1,oj+dj);
-      for (di = -1; di <= +1; di++, p++, ncell++)
+      if (k == 4)
+        continue;
+
+      if (!interior && !PLAN_VALID_BOUNDS(plan, oi + k % 3 - 1, oj + k / 3 - 1))
+        continue;
+
+      ncell = cell + nbr[k];
+
+      if(ncell->mark)
+        continue;
+
+      if (ncell->occ_dist_dyn < plan->abs_min_radius)
+        continue;
+
+      cost = cell->plan_cost;
+      if(ncell->lpathmark)
+        cost += (float) (plan->dist_kernel_3x3[k] * plan->hysteresis_factor);
+      else
+        cost += plan->dist_kernel_3x3[k];
+
+      if(ncell->occ_dist_dyn < plan->max_radius)
+        cost += (float) (plan->dist_penalty * (plan->max_radius - ncell->occ_dist_dyn));
+
+      if(cost < ncell->plan_cost)
       {
-        if (!di && !dj)
-          continue;
-        //if (di && dj)
-          //continue;
-        
-        ni = oi + di;
-        nj = oj + dj;
-
-        if (!PLAN_VALID_BOUNDS(plan, ni, nj))
-          continue;
-
-        if(ncell->mark)
-          continue;
-
-        if (ncell->occ_dist_dyn < plan->abs_min_radius)
-          continue;
-
-        cost = cell->plan_cost;
-        if(ncell->lpathmark)
-          cost += (float) ((*p) * plan->hysteresis_factor);
-        else
-          cost += *p;
-
-        if(ncell->occ_dist_dyn < plan->max_radius)
-          cost += (float) (plan->dist_penalty * (plan->max_radius - ncell->occ_dist_dyn));
-
-        if(cost < ncell->plan_cost)
-        {
-          ncell->plan_cost = cost;
-          ncell->plan_next = cell;
-
-          plan_push(plan, ncell);
-        }
+        ncell->plan_cost = cost;
+        ncell->plan_next = cell;
+
+        plan_push(plan, o + nbr[k]);
       }
     }
   }
@@ -363,26 +372,22 @@ _plan_find_local_goal(plan_t *plan, double* gx, double* gy,
 }
 
 // Push a plan location onto the queue
-void plan_push(plan_t *plan, plan_cell_t *cell)
+void plan_push(plan_t *plan, int index)
 {
-  // Substract from max cost because the heap is set up to return the max
-  // element.  This could of course be changed.
-  assert(PLAN_MAX_COST-cell->plan_cost > 0);
+  plan_cell_t *cell = plan->cells + index;
+
+  assert(cell->plan_cost < PLAN_MAX_COST);
   cell->mark = 1;
-  heap_insert(plan->heap, PLAN_MAX_COST - cell->plan_cost, cell);
+  bqueue_insert(plan->queue, cell->plan_cost, index);
 
   return;
 }
 
 
-// Pop a plan location from the queue
-plan_cell_t *plan_pop(plan_t *plan)
+// Pop a plan location from the queue; returns -1 when it is empty
+int plan_pop(plan_t *plan)
 {
-
-  if(heap_empty(plan->heap))
-    return(NULL);
-  else
-    return(heap_extract_max(plan->heap));
+  return(bqueue_extract_min(plan->queue));
 }
 
 double 
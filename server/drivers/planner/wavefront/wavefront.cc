@@ -130,7 +130,7 @@ thinks it has already achieved it.
   - Minimum time in seconds between replanning.  Set to -1 for no
     replanning.  See also replan_dist_thresh;
 - cspace_file (filename)
-  - Default: "player.cspace"
+  - Default: none (no caching)
   - Use this file to cache the configuration space (c-space) data.
     At startup, if this file can be read and if the metadata (e.g., size,
     scale) in it matches the current map, then the c-space data is
@@ -138,8 +138,9 @@ thinks it has already achieved it.
     In either case, the c-space data will be cached to this file for
     use next time.  C-space computation can be expensive and so caching
     can save a lot of time, especially when the planner is frequently
-    stopped and started.  This feature requires md5 hashing functions
-    in libcrypto.
+    stopped and started.  The file is binary, in host byte order, and
+    is keyed on a hash of the map and on max_radius.  Set to "" to
+    disable caching.
 - add_rotational_waypoints (integer)
   - Default: 1
   - If non-zero, add an in-place rotational waypoint before the next
@@ -316,6 +317,8 @@ class Wavefront : public ThreadedDriver
     int scans_size;
     // How far out do we insert obstacles?
     double scan_maxrange;
+    // Where to cache the c-space (empty for no cache)
+    char cspace_fname[MAX_FILENAME_SIZE];
     // The scan buffer
     player_laser_data_scanpose_t* scans;
     int scans_count;
@@ -453,6 +456,14 @@ Wavefront::Wavefront( ConfigFile* cf, int section)
           cf->ReadInt(section, "add_rotational_waypoints", 1);
   this->force_map_refresh = cf->ReadInt(section, "force_map_refresh", 0);
   this->cycletime = 1.0 / cf->ReadFloat(section, "update_rate", 10.0);
+  this->cspace_fname[0] = '\0';
+  if(strlen(cf->ReadString(section, "cspace_file", "")) > 0)
+  {
+    strncpy(this->cspace_fname,
+            cf->ReadFilename(section, "cspace_file", ""),
+            sizeof(this->cspace_fname));
+    this->cspace_fname[sizeof(this->cspace_fname)-1] = '\0';
+  }
 
   this->velocity_control = cf->ReadInt(section, "velocity_control", 0);
   if(this->velocity_control)
@@ -1627,7 +1638,7 @@ Wavefront::GetMap(bool threaded)
   }
 
   plan_init(this->plan);
-  plan_compute_cspace(this->plan);
+  plan_update_cspace(this->plan, this->cspace_fname);
   //draw_cspace(this->plan,"cspace.png");
 
   if (this->offline_plan) {
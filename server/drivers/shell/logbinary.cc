@@ -0,0 +1,579 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000
+ *     Brian Gerkey, Kasper Stoy, Richard Vaughan, & Andrew Howard
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/*
+ * Desc: Binary log file reading and writing
+ * CVS: $Id$
+ */
+
+#include <config.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#if !defined (WIN32)
+  #include <sys/types.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#include <libplayercore/playercore.h>
+#include <libplayerinterface/playerxdr.h>
+
+#include "logbinary.h"
+
+#if defined (WIN32)
+  #define LOGBINARY_FSEEK(f,o) _fseeki64(f, (__int64) (o), SEEK_SET)
+#else
+  #define LOGBINARY_FSEEK(f,o) fseeko(f, (off_t) (o), SEEK_SET)
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////
+// Big-endian packing of the fixed-size fields
+static void PutU32(char *buf, uint32_t v)
+{
+  buf[0] = (char) (v >> 24);
+  buf[1] = (char) (v >> 16);
+  buf[2] = (char) (v >> 8);
+  buf[3] = (char) v;
+}
+
+static uint32_t GetU32(const char *buf)
+{
+  const unsigned char *b = (const unsigned char*) buf;
+  return ((uint32_t) b[0] << 24) | ((uint32_t) b[1] << 16) |
+         ((uint32_t) b[2] << 8) | (uint32_t) b[3];
+}
+
+static void PutU64(char *buf, uint64_t v)
+{
+  PutU32(buf, (uint32_t) (v >> 32));
+  PutU32(buf + 4, (uint32_t) v);
+}
+
+static uint64_t GetU64(const char *buf)
+{
+  return ((uint64_t) GetU32(buf) << 32) | GetU32(buf + 4);
+}
+
+static void PutDouble(char *buf, double v)
+{
+  uint64_t u;
+  memcpy(&u, &v, sizeof(u));
+  PutU64(buf, u);
+}
+
+static double GetDouble(const char *buf)
+{
+  uint64_t u;
+  double v;
+  u = GetU64(buf);
+  memcpy(&v, &u, sizeof(v));
+  return v;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Constructor
+LogBinaryWriter::LogBinaryWriter()
+{
+  this->out = NULL;
+  this->offset = 0;
+  this->buffer = NULL;
+  this->buffer_size = 0;
+  this->index = NULL;
+  this->index_count = 0;
+  this->index_size = 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Destructor
+LogBinaryWriter::~LogBinaryWriter()
+{
+  this->Close();
+  free(this->buffer);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Start a log
+int LogBinaryWriter::Open(LogBuffer *out)
+{
+  char header[LOGBINARY_HEADER_SIZE];
+
+  this->Close();
+
+  if (!out->IsOpen())
+    return -1;
+  this->out = out;
+
+  memcpy(header, LOGBINARY_MAGIC, 8);
+  PutU32(header + 8, LOGBINARY_VERSION);
+  this->out->Write(header, sizeof(header));
+  this->offset = sizeof(header);
+  this->index_count = 0;
+
+  if (!this->buffer)
+  {
+    this->buffer_size = PLAYERXDR_MSGHDR_SIZE + PLAYERXDR_MAX_MESSAGE_SIZE;
+    this->buffer = (char*) malloc(this->buffer_size);
+    assert(this->buffer);
+  }
+
+  return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Write the index and trailer
+void LogBinaryWriter::Close()
+{
+  size_t i;
+  char entry[LOGBINARY_ENTRY_SIZE];
+  char trailer[LOGBINARY_TRAILER_SIZE];
+
+  if (!this->out)
+    return;
+
+  for (i = 0; i < this->index_count; i++)
+  {
+    PutDouble(entry, this->index[i].time);
+    PutU64(entry + 8, this->index[i].offset);
+    this->out->Write(entry, sizeof(entry));
+  }
+
+  PutU64(trailer, this->offset);
+  PutU32(trailer + 8, (uint32_t) this->index_count);
+  memcpy(trailer + 12, LOGBINARY_MAGIC, 8);
+  this->out->Write(trailer, sizeof(trailer));
+
+  this->out = NULL;
+
+  free(this->index);
+  this->index = NULL;
+  this->index_count = 0;
+  this->index_size = 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Encode and write a message
+int LogBinaryWriter::Write(player_msghdr_t *hdr, void *data)
+{
+  player_pack_fn_t packfunc;
+  player_msghdr_t out;
+  int len;
+
+  if (!this->out)
+    return -1;
+
+  out = *hdr;
+
+  // Encode the body after the space for the header, so the whole message
+  // goes out in one piece
+  len = 0;
+  if (data)
+  {
+    if (!(packfunc = playerxdr_get_packfunc(hdr->addr.interf, hdr->type, hdr->subtype)))
+    {
+      PLAYER_WARN4("no packing function for message %s:%u type %s:%u",
+                   interf_to_str(hdr->addr.interf), hdr->addr.index,
+                   msgtype_to_str(hdr->type), hdr->subtype);
+      return -1;
+    }
+    len = (*packfunc)(this->buffer + PLAYERXDR_MSGHDR_SIZE,
+                      this->buffer_size - PLAYERXDR_MSGHDR_SIZE,
+                      data, PLAYERXDR_ENCODE);
+    if (len < 0)
+    {
+      PLAYER_WARN4("failed to encode message %s:%u type %s:%u",
+                   interf_to_str(hdr->addr.interf), hdr->addr.index,
+                   msgtype_to_str(hdr->type), hdr->subtype);
+      return -1;
+    }
+  }
+
+  out.size = len;
+  if (player_msghdr_pack(this->buffer, PLAYERXDR_MSGHDR_SIZE, &out, PLAYERXDR_ENCODE) < 0)
+  {
+    PLAYER_WARN("failed to encode message header");
+    return -1;
+  }
+
+  // Index the message if enough time has passed since the last entry
+  if (this->index_count == 0 ||
+      hdr->timestamp >= this->index[this->index_count - 1].time + LOGBINARY_INDEX_INTERVAL)
+  {
+    if (this->index_count == this->index_size)
+    {
+      this->index_size = this->index_size ? 2 * this->index_size : 1024;
+      this->index = (logbinary_entry_t*) realloc(this->index,
+                                                  this->index_size * sizeof(this->index[0]));
+      assert(this->index);
+    }
+    this->index[this->index_count].time = hdr->timestamp;
+    this->index[this->index_count].offset = this->offset;
+    this->index_count++;
+  }
+
+  this->out->Write(this->buffer, PLAYERXDR_MSGHDR_SIZE + len);
+  this->offset += PLAYERXDR_MSGHDR_SIZE + len;
+
+  return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Constructor
+LogBinaryReader::LogBinaryReader()
+{
+  this->file = NULL;
+  this->map = NULL;
+  this->buffer = NULL;
+  this->buffer_size = 0;
+  this->start = this->end = this->offset = this->file_size = 0;
+  this->index = NULL;
+  this->index_count = 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Destructor
+LogBinaryReader::~LogBinaryReader()
+{
+  this->Close();
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Is the given file a binary log?
+bool LogBinaryReader::IsBinary(const char *filename)
+{
+  FILE *file;
+  char magic[8];
+  bool binary;
+
+  if (!(file = fopen(filename, "rb")))
+    return false;
+  binary = (fread(magic, sizeof(magic), 1, file) == 1 &&
+            memcmp(magic, LOGBINARY_MAGIC, sizeof(magic)) == 0);
+  fclose(file);
+  return binary;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Open a file
+int LogBinaryReader::Open(const char *filename)
+{
+  const char *header;
+
+  this->Close();
+
+  if (!(this->file = fopen(filename, "rb")))
+  {
+    PLAYER_ERROR2("unable to open [%s]: %s", filename, strerror(errno));
+    return -1;
+  }
+
+#if !defined (WIN32)
+  struct stat st;
+  if (fstat(fileno(this->file), &st) != 0)
+  {
+    PLAYER_ERROR2("unable to stat [%s]: %s", filename, strerror(errno));
+    this->Close();
+    return -1;
+  }
+  this->file_size = st.st_size;
+
+  // Map the file, so that messages can be decoded straight from the page
+  // cache; if that fails (e.g., a huge file in a 32 bit address space),
+  // fall back to reading each message
+  if (this->file_size > 0)
+  {
+    this->map = (char*) mmap(NULL, this->file_size, PROT_READ, MAP_SHARED,
+                             fileno(this->file), 0);
+    if (this->map == MAP_FAILED)
+      this->map = NULL;
+    else
+      madvise(this->map, this->file_size, MADV_SEQUENTIAL);
+  }
+#else
+  _fseeki64(this->file, 0, SEEK_END);
+  this->file_size = _ftelli64(this->file);
+#endif
+
+  if (!(header = this->GetBytes(0, LOGBINARY_HEADER_SIZE)) ||
+      memcmp(header, LOGBINARY_MAGIC, 8) != 0)
+  {
+    PLAYER_ERROR1("[%s] is not a binary log file", filename);
+    this->Close();
+    return -1;
+  }
+  if (GetU32(header + 8) != LOGBINARY_VERSION)
+  {
+    PLAYER_ERROR2("[%s] has unsupported binary log version %u",
+                  filename, GetU32(header + 8));
+    this->Close();
+    return -1;
+  }
+
+  this->start = LOGBINARY_HEADER_SIZE;
+  this->offset = this->start;
+
+  if (this->LoadIndex() != 0)
+  {
+    PLAYER_WARN1("[%s] has no index (incomplete log?); rebuilding it", filename);
+    this->RebuildIndex();
+  }
+
+  return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Close the file
+void LogBinaryReader::Close()
+{
+#if !defined (WIN32)
+  if (this->map)
+    munmap(this->map, this->file_size);
+#endif
+  this->map = NULL;
+  if (this->file)
+    fclose(this->file);
+  this->file = NULL;
+
+  free(this->buffer);
+  this->buffer = NULL;
+  this->buffer_size = 0;
+  free(this->index);
+  this->index = NULL;
+  this->index_count = 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Get a pointer to the bytes at the given offset
+const char *LogBinaryReader::GetBytes(uint64_t offset, size_t len)
+{
+  if (offset > this->file_size || len > this->file_size - offset)
+    return NULL;
+
+  if (this->map)
+    return this->map + offset;
+
+  if (len > this->buffer_size)
+  {
+    free(this->buffer);
+    this->buffer_size = len;
+    this->buffer = (char*) malloc(this->buffer_size);
+    assert(this->buffer);
+  }
+  if (LOGBINARY_FSEEK(this->file, offset) != 0 ||
+      fread(this->buffer, len, 1, this->file) != 1)
+    return NULL;
+  return this->buffer;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Load the index from the trailer
+int LogBinaryReader::LoadIndex()
+{
+  const char *trailer, *entries;
+  uint64_t index_offset;
+  size_t i, count;
+
+  if (this->file_size < this->start + LOGBINARY_TRAILER_SIZE)
+    return -1;
+  if (!(trailer = this->GetBytes(this->file_size - LOGBINARY_TRAILER_SIZE,
+                                 LOGBINARY_TRAILER_SIZE)))
+    return -1;
+  if (memcmp(trailer + 12, LOGBINARY_MAGIC, 8) != 0)
+    return -1;
+
+  index_offset = GetU64(trailer);
+  count = GetU32(trailer + 8);
+  if (index_offset < this->start ||
+      index_offset + (uint64_t) count * LOGBINARY_ENTRY_SIZE !=
+      this->file_size - LOGBINARY_TRAILER_SIZE)
+    return -1;
+  this->end = index_offset;
+
+  if (!(entries = this->GetBytes(index_offset, count * LOGBINARY_ENTRY_SIZE)))
+    return -1;
+
+  this->index = (logbinary_entry_t*) malloc((count + 1) * sizeof(this->index[0]));
+  assert(this->index);
+  for (i = 0; i < count; i++)
+  {
+    this->index[i].time = GetDouble(entries + i * LOGBINARY_ENTRY_SIZE);
+    this->index[i].offset = GetU64(entries + i * LOGBINARY_ENTRY_SIZE + 8);
+  }
+  this->index_count = count;
+
+  return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Rebuild the index by walking the message headers
+void LogBinaryReader::RebuildIndex()
+{
+  size_t index_size;
+  uint64_t offset;
+  player_msghdr_t hdr;
+
+  // Messages run to the end of the file, less any partly written one
+  this->end = this->file_size;
+
+  index_size = 0;
+  this->index_count = 0;
+  for (offset = this->start; this->PeekHeader(offset, &hdr) == 0;
+       offset += PLAYERXDR_MSGHDR_SIZE + hdr.size)
+  {
+    if (this->index_count > 0 &&
+        hdr.timestamp < this->index[this->index_count - 1].time + LOGBINARY_INDEX_INTERVAL)
+      continue;
+    if (this->index_count == index_size)
+    {
+      index_size = index_size ? 2 * index_size : 1024;
+      this->index = (logbinary_entry_t*) realloc(this->index,
+                                                  index_size * sizeof(this->index[0]));
+      assert(this->index);
+    }
+    this->index[this->index_count].time = hdr.timestamp;
+    this->index[this->index_count].offset = offset;
+    this->index_count++;
+  }
+  this->end = offset;
+
+  return;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Get the header of the message at the given offset
+int LogBinaryReader::PeekHeader(uint64_t offset, player_msghdr_t *hdr)
+{
+  const char *buf;
+
+  if (offset + PLAYERXDR_MSGHDR_SIZE > this->end)
+    return -1;
+  if (!(buf = this->GetBytes(offset, PLAYERXDR_MSGHDR_SIZE)))
+    return -1;
+  if (player_msghdr_pack((void*) buf, PLAYERXDR_MSGHDR_SIZE, hdr, PLAYERXDR_DECODE) < 0)
+    return -1;
+  if (offset + PLAYERXDR_MSGHDR_SIZE + hdr->size > this->end)
+    return -1;
+  return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Read and decode the next message
+int LogBinaryReader::Read(player_msghdr_t *hdr, void *data)
+{
+  player_pack_fn_t packfunc;
+  const char *body;
+  int len;
+
+  if (this->PeekHeader(this->offset, hdr) != 0)
+    return 1;
+  body = NULL;
+  if (hdr->size > 0)
+    body = this->GetBytes(this->offset + PLAYERXDR_MSGHDR_SIZE, hdr->size);
+  this->offset += PLAYERXDR_MSGHDR_SIZE + hdr->size;
+
+  if (hdr->size == 0)
+    return 0;
+  if (body == NULL)
+    return 1;
+
+  if (!(packfunc = playerxdr_get_packfunc(hdr->addr.interf, hdr->type, hdr->subtype)))
+  {
+    PLAYER_WARN4("skipping message %s:%u with unsupported type %s:%u",
+                 interf_to_str(hdr->addr.interf), hdr->addr.index,
+                 msgtype_to_str(hdr->type), hdr->subtype);
+    return -1;
+  }
+  len = (*packfunc)((void*) body, hdr->size, data, PLAYERXDR_DECODE);
+  if (len < 0)
+  {
+    PLAYER_WARN4("decoding failed on message %s:%u with type %s:%u",
+                 interf_to_str(hdr->addr.interf), hdr->addr.index,
+                 msgtype_to_str(hdr->type), hdr->subtype);
+    return -1;
+  }
+  hdr->size = len;
+
+  return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Go back to the first message
+void LogBinaryReader::Rewind()
+{
+  this->offset = this->start;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Move to the first message at or after the given time
+double LogBinaryReader::Seek(double time)
+{
+  size_t lo, hi, mid;
+  uint64_t offset;
+  player_msghdr_t hdr;
+
+  // Find the last index entry before the given time
+  lo = 0;
+  hi = this->index_count;
+  while (lo < hi)
+  {
+    mid = lo + (hi - lo) / 2;
+    if (this->index[mid].time < time)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  offset = (lo > 0) ? this->index[lo - 1].offset : this->start;
+
+  // Walk forward from there; that is less than one index interval's
+  // worth of messages
+  for (; this->PeekHeader(offset, &hdr) == 0; offset += PLAYERXDR_MSGHDR_SIZE + hdr.size)
+  {
+    if (hdr.timestamp >= time)
+    {
+      this->offset = offset;
+      return hdr.timestamp;
+    }
+  }
+
+  this->offset = this->end;
+  return -1;
+}
@@ -0,0 +1,184 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000
+ *     Brian Gerkey, Kasper Stoy, Richard Vaughan, & Andrew Howard
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/*
+ * Desc: Binary log file reading and writing
+ * CVS: $Id$
+ *
+ * A binary log file holds, in order:
+ *
+ * - A file header: the 8 byte magic string LOGBINARY_MAGIC followed by
+ *   the format version (32 bit unsigned).
+ * - The messages, each stored as it would be sent over TCP: the
+ *   XDR-encoded message header (PLAYERXDR_MSGHDR_SIZE bytes), whose
+ *   size field gives the length of the XDR-encoded payload that
+ *   follows.
+ * - A seek index: pairs of log time (IEEE double) and file offset of a
+ *   message (64 bit unsigned), in increasing time order.  A new entry is
+ *   made whenever the log time has advanced by LOGBINARY_INDEX_INTERVAL
+ *   seconds since the last one.
+ * - A trailer: the offset of the index (64 bit unsigned), the number of
+ *   entries in it (32 bit unsigned) and the magic string again.
+ *
+ * All numbers are big-endian.  The index and trailer are written when
+ * the file is closed; if they are missing (e.g., the logger crashed),
+ * the reader rebuilds the index by walking the message headers.
+ */
+
+#ifndef LOGBINARY_H_
+#define LOGBINARY_H_
+
+#include <stdio.h>
+#include <libplayercore/playercore.h>
+
+#include "logbuffer.h"
+
+/// Magic string at the start and end of binary log files
+#define LOGBINARY_MAGIC "PLAYERBL"
+
+/// Binary log format version
+#define LOGBINARY_VERSION 1
+
+/// Size of the file header
+#define LOGBINARY_HEADER_SIZE 12
+
+/// Size of an index entry
+#define LOGBINARY_ENTRY_SIZE 16
+
+/// Size of the trailer
+#define LOGBINARY_TRAILER_SIZE 20
+
+/// Minimum log time (s) between index entries
+#define LOGBINARY_INDEX_INTERVAL 0.1
+
+/// @brief Seek index entry
+typedef struct
+{
+  /// Log time of the message
+  double time;
+  /// File offset of the message header
+  uint64_t offset;
+
+} logbinary_entry_t;
+
+
+/// @brief Writes binary log files
+class LogBinaryWriter
+{
+  public: LogBinaryWriter();
+  public: ~LogBinaryWriter();
+
+  /// Start a log in the given (open) output buffer, and write the file
+  /// header.  Returns 0 on success.
+  public: int Open(LogBuffer *out);
+
+  /// Write the index and trailer.  The output buffer is left open.
+  public: void Close();
+
+  /// Is a log started?
+  public: bool IsOpen() { return this->out != NULL; }
+
+  /// Encode and write a message.  Returns 0 on success, or -1 if the
+  /// message could not be encoded (in which case nothing is written).
+  public: int Write(player_msghdr_t *hdr, void *data);
+
+  private: LogBuffer *out;
+
+  // Offset at which the next message will be written
+  private: uint64_t offset;
+
+  // Buffer for encoding messages
+  private: char *buffer;
+  private: size_t buffer_size;
+
+  // Seek index
+  private: logbinary_entry_t *index;
+  private: size_t index_count, index_size;
+};
+
+
+/// @brief Reads binary log files
+class LogBinaryReader
+{
+  public: LogBinaryReader();
+  public: ~LogBinaryReader();
+
+  /// Is the given file a binary log?
+  public: static bool IsBinary(const char *filename);
+
+  /// Open a file, and load (or rebuild) its index.  Returns 0 on success.
+  public: int Open(const char *filename);
+
+  /// Close the file
+  public: void Close();
+
+  /// Read and decode the next message into data, which must be at least
+  /// PLAYER_MAX_MESSAGE_SIZE bytes.  hdr->size is set to the decoded
+  /// size.  If hdr->size is non-zero, the caller must release the
+  /// message with playerxdr_cleanup_message().  Returns 0 on success,
+  /// 1 at the end of the log, or -1 if this message could not be
+  /// decoded (the next call moves on to the following message).
+  public: int Read(player_msghdr_t *hdr, void *data);
+
+  /// Go back to the first message
+  public: void Rewind();
+
+  /// Move to the first message whose time is not before the given log
+  /// time, using the index.  Returns the time of that message, or -1 if
+  /// there is no such message.
+  public: double Seek(double time);
+
+  /// Get the header of the message at the given offset.  Returns 0 on
+  /// success, or -1 if there is no complete message there.
+  private: int PeekHeader(uint64_t offset, player_msghdr_t *hdr);
+
+  /// Get a pointer to the bytes at the given offset.  Returns NULL if
+  /// they are not all in the file.
+  private: const char *GetBytes(uint64_t offset, size_t len);
+
+  // Load the index from the trailer, or rebuild it
+  private: int LoadIndex();
+  private: void RebuildIndex();
+
+  private: FILE *file;
+
+  // The file, mapped into memory (NULL if not mapped)
+  private: char *map;
+
+  // Buffer for reading from an unmapped file
+  private: char *buffer;
+  private: size_t buffer_size;
+
+  // Offset of the first message, and the end of the messages
+  private: uint64_t start, end;
+
+  // Offset of the next message to read
+  private: uint64_t offset;
+
+  // Size of the file
+  private: uint64_t file_size;
+
+  // Seek index
+  private: logbinary_entry_t *index;
+  private: size_t index_count;
+};
+
+#endif
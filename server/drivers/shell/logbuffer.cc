@@ -0,0 +1,468 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000
+ *     Brian Gerkey, Kasper Stoy, Richard Vaughan, & Andrew Howard
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/*
+ * Desc: Asynchronous, buffered log file output
+ * CVS: $Id$
+ */
+
+#if !defined (_GNU_SOURCE)
+  #define _GNU_SOURCE // For fopencookie()
+#endif
+
+#include <config.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#if !defined (WIN32) || defined (__MINGW32__)
+  #include <sys/time.h>
+#endif
+
+#include <libplayercore/playercore.h>
+
+#include "logbuffer.h"
+
+
+////////////////////////////////////////////////////////////////////////////
+// Get the wall time
+double LogBuffer::WallTime()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Constructor
+LogBuffer::LogBuffer()
+{
+  this->block_size = LOGBUFFER_DEFAULT_BLOCK_SIZE;
+  this->block_count = LOGBUFFER_DEFAULT_BLOCK_COUNT;
+  this->blocks = NULL;
+  this->fill = -1;
+  this->queue = NULL;
+  this->queue_head = this->queue_count = 0;
+  this->free_blocks = NULL;
+  this->free_count = 0;
+  this->open = false;
+  this->thread_running = false;
+  this->quit = false;
+  this->file = NULL;
+#if HAVE_Z
+  this->gzfile = NULL;
+#endif
+  this->stream = NULL;
+  this->bytes_written = this->stats_bytes = 0;
+  this->stats_time = 0;
+
+  pthread_mutex_init(&this->lock, NULL);
+  pthread_cond_init(&this->cond, NULL);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Destructor
+LogBuffer::~LogBuffer()
+{
+  this->Close();
+  pthread_cond_destroy(&this->cond);
+  pthread_mutex_destroy(&this->lock);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Set the size and number of buffer blocks
+void LogBuffer::SetBlocks(size_t block_size, int block_count)
+{
+  this->block_size = block_size > 0 ? block_size : LOGBUFFER_DEFAULT_BLOCK_SIZE;
+  this->block_count = block_count >= 2 ? block_count : 2;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Create the file and start the I/O thread
+int LogBuffer::Open(const char *filename, bool compress)
+{
+  int i;
+
+  this->Close();
+
+#if !HAVE_FOPENCOOKIE
+  // Without an asynchronous stream everything is written straight to
+  // the file, which leaves no opportunity to compress it
+  if (compress)
+  {
+    PLAYER_WARN("log compression is not supported on this platform");
+    compress = false;
+  }
+#endif
+
+  if (compress)
+  {
+#if HAVE_Z
+    if (!(this->gzfile = gzopen(filename, "wb")))
+    {
+      PLAYER_ERROR2("unable to open [%s]: %s", filename, strerror(errno));
+      return -1;
+    }
+#else
+    PLAYER_WARN("zlib not available; writing an uncompressed log");
+    compress = false;
+#endif
+  }
+  if (!compress)
+  {
+    if (!(this->file = fopen(filename, "wb")))
+    {
+      PLAYER_ERROR2("unable to open [%s]: %s", filename, strerror(errno));
+      return -1;
+    }
+  }
+
+  this->bytes_written = this->stats_bytes = 0;
+  this->stats_time = WallTime();
+  this->open = true;
+
+#if HAVE_FOPENCOOKIE
+  // Allocate the blocks; all but the first start out free
+  this->blocks = new block_t[this->block_count];
+  this->queue = new int[this->block_count];
+  this->free_blocks = new int[this->block_count];
+  for (i = 0; i < this->block_count; i++)
+  {
+    this->blocks[i].data = (char*) malloc(this->block_size);
+    assert(this->blocks[i].data);
+    this->blocks[i].len = 0;
+  }
+  this->fill = 0;
+  this->free_count = 0;
+  for (i = this->block_count - 1; i > 0; i--)
+    this->free_blocks[this->free_count++] = i;
+  this->queue_head = this->queue_count = 0;
+
+  // Formatted output is appended to the fill block
+  cookie_io_functions_t funcs;
+  memset(&funcs, 0, sizeof(funcs));
+  funcs.write = LogBuffer::StreamWrite;
+  if (!(this->stream = fopencookie(this, "w", funcs)))
+  {
+    PLAYER_ERROR1("unable to create log stream: %s", strerror(errno));
+    this->Close();
+    return -1;
+  }
+
+  this->quit = false;
+  if (pthread_create(&this->thread, NULL, LogBuffer::ThreadMain, this) != 0)
+  {
+    PLAYER_ERROR("unable to start log writer thread");
+    this->Close();
+    return -1;
+  }
+  this->thread_running = true;
+#else
+  (void) i;
+  this->stream = this->file;
+#endif
+
+  return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Write out everything and close the file
+void LogBuffer::Close()
+{
+  int i;
+
+  if (!this->open)
+    return;
+
+#if HAVE_FOPENCOOKIE
+  if (this->stream)
+  {
+    fclose(this->stream);
+    this->stream = NULL;
+  }
+
+  if (this->thread_running)
+  {
+    // The I/O thread drains the queue before quitting
+    this->Flush();
+    pthread_mutex_lock(&this->lock);
+    this->quit = true;
+    pthread_cond_broadcast(&this->cond);
+    pthread_mutex_unlock(&this->lock);
+    pthread_join(this->thread, NULL);
+    this->thread_running = false;
+  }
+
+  if (this->blocks)
+  {
+    for (i = 0; i < this->block_count; i++)
+      free(this->blocks[i].data);
+  }
+  delete [] this->blocks;
+  delete [] this->queue;
+  delete [] this->free_blocks;
+  this->blocks = NULL;
+  this->queue = NULL;
+  this->free_blocks = NULL;
+  this->fill = -1;
+  this->queue_count = this->free_count = 0;
+#else
+  (void) i;
+#endif
+  this->stream = NULL;
+
+  if (this->file)
+  {
+    fclose(this->file);
+    this->file = NULL;
+  }
+#if HAVE_Z
+  if (this->gzfile)
+  {
+    gzclose(this->gzfile);
+    this->gzfile = NULL;
+  }
+#endif
+
+  this->open = false;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Append data
+void LogBuffer::Write(const void *data, size_t len)
+{
+  if (!this->open)
+    return;
+
+#if HAVE_FOPENCOOKIE
+  // Keep formatted and raw output in order
+  fflush(this->stream);
+  this->Append((const char*) data, len);
+#else
+  if (fwrite(data, len, 1, this->file) != 1)
+    PLAYER_ERROR1("error writing log file: %s", strerror(errno));
+  this->bytes_written += len;
+#endif
+}
+
+
+#if HAVE_FOPENCOOKIE
+////////////////////////////////////////////////////////////////////////////
+// Copy data into the fill block
+void LogBuffer::Append(const char *data, size_t len)
+{
+  size_t n;
+  block_t *block;
+
+  while (len > 0)
+  {
+    // The fill block belongs to the logging driver; we only need the
+    // lock to exchange it for a free one
+    if (this->fill < 0 || this->blocks[this->fill].len == this->block_size)
+    {
+      pthread_mutex_lock(&this->lock);
+      this->SwapBlocks();
+      pthread_mutex_unlock(&this->lock);
+    }
+
+    block = this->blocks + this->fill;
+    n = this->block_size - block->len;
+    if (n > len)
+      n = len;
+    memcpy(block->data + block->len, data, n);
+    block->len += n;
+    data += n;
+    len -= n;
+  }
+}
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////
+// Hand the partly filled block to the I/O thread
+void LogBuffer::Flush()
+{
+  if (!this->open)
+    return;
+
+#if HAVE_FOPENCOOKIE
+  if (this->stream)
+    fflush(this->stream);
+
+  pthread_mutex_lock(&this->lock);
+  if (this->fill >= 0 && this->blocks[this->fill].len > 0)
+  {
+    this->queue[(this->queue_head + this->queue_count) % this->block_count] = this->fill;
+    this->queue_count++;
+    this->fill = -1;
+    pthread_cond_broadcast(&this->cond);
+  }
+  pthread_mutex_unlock(&this->lock);
+#else
+  fflush(this->file);
+#endif
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Is every spare block waiting for the disk?
+bool LogBuffer::Full()
+{
+  bool full = false;
+
+#if HAVE_FOPENCOOKIE
+  if (!this->open)
+    return false;
+
+  pthread_mutex_lock(&this->lock);
+  full = (this->free_count == 0);
+  pthread_mutex_unlock(&this->lock);
+#endif
+
+  return full;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Get the queue depth and write rate
+void LogBuffer::GetStats(int *queued, double *rate)
+{
+  double now;
+  uint64_t bytes;
+
+  pthread_mutex_lock(&this->lock);
+  *queued = this->queue_count;
+  bytes = this->bytes_written;
+  pthread_mutex_unlock(&this->lock);
+
+  now = WallTime();
+  *rate = 0;
+  if (now > this->stats_time)
+    *rate = (bytes - this->stats_bytes) / (now - this->stats_time);
+  this->stats_bytes = bytes;
+  this->stats_time = now;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Hand the fill block to the I/O thread and get a free one
+void LogBuffer::SwapBlocks()
+{
+  if (this->fill >= 0 && this->blocks[this->fill].len > 0)
+  {
+    this->queue[(this->queue_head + this->queue_count) % this->block_count] = this->fill;
+    this->queue_count++;
+    this->fill = -1;
+    pthread_cond_broadcast(&this->cond);
+  }
+
+  if (this->fill < 0)
+  {
+    // This is where a slow disk pushes back on the logging driver
+    while (this->free_count == 0)
+      pthread_cond_wait(&this->cond, &this->lock);
+    this->fill = this->free_blocks[--this->free_count];
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// I/O thread
+void *LogBuffer::ThreadMain(void *arg)
+{
+  ((LogBuffer*) arg)->Run();
+  return NULL;
+}
+
+void LogBuffer::Run()
+{
+  int b;
+  size_t len;
+
+  pthread_mutex_lock(&this->lock);
+  while (true)
+  {
+    while (this->queue_count == 0 && !this->quit)
+      pthread_cond_wait(&this->cond, &this->lock);
+    if (this->queue_count == 0)
+      break;
+
+    // The block stays at the head of the queue (and so counts towards
+    // the queue depth) while it is being written
+    b = this->queue[this->queue_head];
+    len = this->blocks[b].len;
+    pthread_mutex_unlock(&this->lock);
+
+    this->WriteBlock(this->blocks[b].data, len);
+
+    pthread_mutex_lock(&this->lock);
+    this->queue_head = (this->queue_head + 1) % this->block_count;
+    this->queue_count--;
+    this->blocks[b].len = 0;
+    this->free_blocks[this->free_count++] = b;
+    this->bytes_written += len;
+    pthread_cond_broadcast(&this->cond);
+  }
+  pthread_mutex_unlock(&this->lock);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Write a block to the file
+int LogBuffer::WriteBlock(const char *data, size_t len)
+{
+#if HAVE_Z
+  if (this->gzfile)
+  {
+    if (gzwrite(this->gzfile, data, (unsigned) len) != (int) len)
+    {
+      PLAYER_ERROR("error writing compressed log file");
+      return -1;
+    }
+    return 0;
+  }
+#endif
+  if (fwrite(data, len, 1, this->file) != 1)
+  {
+    PLAYER_ERROR1("error writing log file: %s", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+
+#if HAVE_FOPENCOOKIE
+////////////////////////////////////////////////////////////////////////////
+// Stream write callback
+ssize_t LogBuffer::StreamWrite(void *cookie, const char *data, size_t len)
+{
+  ((LogBuffer*) cookie)->Append(data, len);
+  return len;
+}
+#endif
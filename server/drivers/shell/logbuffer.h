@@ -0,0 +1,165 @@
+/*
+ *  Player - One Hell of a Robot Server
+ *  Copyright (C) 2000
+ *     Brian Gerkey, Kasper Stoy, Richard Vaughan, & Andrew Howard
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/*
+ * Desc: Asynchronous, buffered log file output
+ * CVS: $Id$
+ *
+ * Log data is appended to one of a pool of large memory blocks.  When a
+ * block fills up (or is flushed) it is handed to a dedicated I/O thread,
+ * which writes it to disk (optionally compressing it with zlib) while the
+ * logging driver carries on filling the next block.  The logging driver
+ * only has to wait for the disk if every block is waiting to be written.
+ *
+ * Formatted output goes through a stdio stream made with fopencookie();
+ * where that is not available, the buffer writes straight to the file.
+ */
+
+#ifndef LOGBUFFER_H_
+#define LOGBUFFER_H_
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include <libplayercore/playercore.h>
+
+#if HAVE_Z
+  #include <zlib.h>
+#endif
+
+/// Default size of each buffer block (bytes)
+#define LOGBUFFER_DEFAULT_BLOCK_SIZE (4 << 20)
+
+/// Default number of buffer blocks
+#define LOGBUFFER_DEFAULT_BLOCK_COUNT 4
+
+
+/// @brief Asynchronous, buffered log file output
+class LogBuffer
+{
+  public: LogBuffer();
+  public: ~LogBuffer();
+
+  /// Set the size and number of buffer blocks; takes effect when the
+  /// next file is opened.  At least two blocks are always used.
+  public: void SetBlocks(size_t block_size, int block_count);
+
+  /// Create the file and start the I/O thread.  If compress is set, the
+  /// file is written with zlib (if available).  Returns 0 on success.
+  public: int Open(const char *filename, bool compress);
+
+  /// Write out everything that is buffered, stop the I/O thread and
+  /// close the file.
+  public: void Close();
+
+  /// Is a file open?
+  public: bool IsOpen() { return this->open; }
+
+  /// Append data, waiting for the I/O thread if there is no free block.
+  public: void Write(const void *data, size_t len);
+
+  /// Get a stdio stream that appends to the buffer (for formatted
+  /// output).  Returns NULL if no file is open.
+  public: FILE *Stream() { return this->stream; }
+
+  /// Hand the partly filled block to the I/O thread
+  public: void Flush();
+
+  /// Is every spare block waiting for the disk?  Once the block being
+  /// filled runs out, writes will have to wait.
+  public: bool Full();
+
+  /// Get the number of blocks waiting to be written, and the rate at
+  /// which data has been written (bytes/sec) since the last call.
+  public: void GetStats(int *queued, double *rate);
+
+  /// Get the wall time (sec), the clock the write rate is measured on.
+  public: static double WallTime();
+
+  // Hand the fill block to the I/O thread and get a free one; called
+  // with the lock held.
+  private: void SwapBlocks();
+
+  // I/O thread
+  private: static void *ThreadMain(void *arg);
+  private: void Run();
+
+  // Write a block to the file (I/O thread)
+  private: int WriteBlock(const char *data, size_t len);
+
+#if HAVE_FOPENCOOKIE
+  // Copy data into the fill block
+  private: void Append(const char *data, size_t len);
+
+  // Stream write callback
+  private: static ssize_t StreamWrite(void *cookie, const char *data, size_t len);
+#endif
+
+  private: typedef struct
+  {
+    char *data;
+    size_t len;
+  } block_t;
+
+  // Configured block size and count
+  private: size_t block_size;
+  private: int block_count;
+
+  // Buffer blocks
+  private: block_t *blocks;
+
+  // Block being filled by the logging driver (-1 if none)
+  private: int fill;
+
+  // Blocks waiting to be written, oldest first (a ring of block
+  // indices), and blocks that are free
+  private: int *queue;
+  private: int queue_head, queue_count;
+  private: int *free_blocks;
+  private: int free_count;
+
+  // Guards the queue and free list
+  private: pthread_mutex_t lock;
+  private: pthread_cond_t cond;
+
+  // Is a file open?
+  private: bool open;
+
+  // I/O thread
+  private: pthread_t thread;
+  private: bool thread_running;
+  private: bool quit;
+
+  // Output file
+  private: FILE *file;
+#if HAVE_Z
+  private: gzFile gzfile;
+#endif
+
+  // Stream for formatted output
+  private: FILE *stream;
+
+  // Bytes written by the I/O thread, and when the stats were last read
+  private: uint64_t bytes_written, stats_bytes;
+  private: double stats_time;
+};
+
+#endif
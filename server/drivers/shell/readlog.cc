@@ -37,7 +37,12 @@ This is particularly useful for debugging client programs, since users
 may run their clients against the same data set over and over again.
 Suitable log files can be generated using the @ref driver_writelog driver.
 The format for the log file can be found in the
-@ref tutorial_datalog "data logging tutorial".
+@ref tutorial_datalog "data logging tutorial".  Binary log files (written
+by @ref driver_writelog with @p format "binary") are recognised
+automatically; they are mapped into memory rather than parsed, so can
+be played back many times faster than real time, and playback can be
+moved to any time in the log with a PLAYER_LOG_REQ_SET_READ_SEEK
+request.
 
 See below for an example configuration file; note that the device
 id's specified in the provides field must match those stored in the
@@ -91,6 +96,7 @@ The driver also provides an interface for controlling the playback:
 - PLAYER_LOG_SET_READ_STATE_REQ
 - PLAYER_LOG_GET_STATE_REQ
 - PLAYER_LOG_SET_READ_REWIND_REQ
+- PLAYER_LOG_SET_READ_SEEK_REQ (binary log files only)
 
 @par Configuration file options
 
@@ -99,7 +105,8 @@ The driver also provides an interface for controlling the playback:
   - The log file to play back.
 - speed (float)
   - Default: 1.0
-  - Playback speed; 1.0 is real-time
+  - Playback speed; 1.0 is real-time.  Binary log files can typically be
+    played back at 10-100 times real-time.
 - autoplay (integer)
   - Default: 1
   - Begin playing back log data when first client subscribes
@@ -153,6 +160,7 @@ driver
 #endif
 
 #include "encode.h"
+#include "logbinary.h"
 #include "readlog_time.h"
 
 #if defined (WIN32)
@@ -185,6 +193,22 @@ class ReadLog: public ThreadedDriver
   // Main loop
   public: virtual void Main();
 
+  // Main loop for binary log files
+  private: void MainBinary();
+
+  // Wait until it is time to publish a message with the given log time
+  private: void WaitForLogTime(double log_time);
+
+  // Set the global (log) time
+  private: void SetTime(double log_time);
+
+  // Wait at the end of the log until we are asked to rewind
+  private: void WaitAtEnd();
+
+  // Remember a logged response to a request (binary log files)
+  private: void StoreResponse(player_devaddr_t addr, player_msghdr_t *hdr,
+                              void *data);
+
   public: virtual int ProcessMessage(QueuePointer & resp_queue,
                                      player_msghdr_t * hdr,
                                      void * data);
@@ -406,6 +430,29 @@ class ReadLog: public ThreadedDriver
   // Playback speed (1 = real time, 2 = twice real time)
   private: double speed;
 
+  // Wall and log time at which the playback clock was last started;
+  // clock_wall is negative if it needs restarting
+  private: double clock_wall, clock_log;
+
+  // Reader for binary log files (NULL for ASCII files)
+  private: LogBinaryReader *binlog;
+
+  // Buffer for decoding binary messages
+  private: void *bindata;
+
+  // Logged responses to requests (binary log files)
+  private: typedef struct {
+    player_devaddr_t addr;
+    uint8_t subtype;
+    void *data;
+  } response_t;
+  private: int response_count;
+  private: response_t responses[1024];
+
+  // Has a client requested that we seek?
+  public: bool seek_requested;
+  public: double seek_time;
+
   // Playback enabled?
   public: bool enable;
 
@@ -524,6 +571,11 @@ ReadLog::ReadLog(ConfigFile* cf, int section)
   // Initialize other stuff
   this->format = strdup("unknown");
   this->file = NULL;
+  this->binlog = NULL;
+  this->bindata = NULL;
+  this->response_count = 0;
+  this->clock_wall = -1.0;
+  this->clock_log = 0.0;
 #if HAVE_Z
   this->gzfile = NULL;
 #endif
@@ -565,6 +617,29 @@ int ReadLog::MainSetup()
   ReadLogTime_time.tv_usec = 0;
   ReadLogTime_timeDouble = 0.0;
 
+  // Rewind or seek not requested by default
+  this->rewind_requested = false;
+  this->seek_requested = false;
+  this->clock_wall = -1.0;
+
+  // Binary log files are read directly, without a line buffer
+  if (LogBinaryReader::IsBinary(this->filename))
+  {
+    this->binlog = new LogBinaryReader();
+    if (this->binlog->Open(this->filename) != 0)
+    {
+      delete this->binlog;
+      this->binlog = NULL;
+      return -1;
+    }
+    free(this->format);
+    this->format = strdup("binary");
+    this->bindata = malloc(PLAYER_MAX_MESSAGE_SIZE);
+    assert(this->bindata);
+    this->line = NULL;
+    return 0;
+  }
+
   // Open the file (possibly compressed)
   if (strlen(this->filename) >= 3 &&
 #if defined (WIN32)
@@ -590,9 +665,6 @@ int ReadLog::MainSetup()
     return -1;
   }
 
-  // Rewind not requested by default
-  this->rewind_requested = false;
-
   // Make some space for parsing data from the file.  This size is not
   // an exact upper bound; it's just my best guess.
   this->line_size = PLAYER_MAX_MESSAGE_SIZE;
@@ -609,6 +681,25 @@ void ReadLog::MainQuit()
 {
   // Free allocated mem
   free(this->line);
+  this->line = NULL;
+
+  // Close binary files
+  if (this->binlog)
+  {
+    delete this->binlog;
+    this->binlog = NULL;
+  }
+  free(this->bindata);
+  this->bindata = NULL;
+  for (int i = 0; i < this->response_count; i++)
+  {
+    if (this->responses[i].data)
+      playerxdr_free_message(this->responses[i].data,
+                             this->responses[i].addr.interf,
+                             PLAYER_MSGTYPE_RESP_ACK,
+                             this->responses[i].subtype);
+  }
+  this->response_count = 0;
 
   // Close the file
 #if HAVE_Z
@@ -636,16 +727,17 @@ void ReadLog::Main()
   int token_count=0;
   char *tokens[4096];
   player_devaddr_t header_id, provide_id;
-  struct timeval tv;
-  double last_wall_time, curr_wall_time;
-  double curr_log_time, last_log_time;
+  double curr_log_time;
   unsigned short type, subtype;
   bool reading_configs;
 
-  linenum = 0;
+  if (this->binlog)
+  {
+    this->MainBinary();
+    return;
+  }
 
-  last_wall_time = -1.0;
-  last_log_time = -1.0;
+  linenum = 0;
 
   // First thing, we'll read all the configs from the front of the file
   reading_configs = true;
@@ -662,6 +754,7 @@ void ReadLog::Main()
     // If we're not supposed to playback data, sleep and loop
     if(!this->enable && !reading_configs)
     {
+      this->clock_wall = -1.0;
       usleep(10000);
       continue;
     }
@@ -706,6 +799,7 @@ void ReadLog::Main()
 
         // reset the flag
         this->rewind_requested = false;
+        this->clock_wall = -1.0;
 
         PLAYER_MSG0(2, "logfile rewound");
         continue;
@@ -727,30 +821,8 @@ void ReadLog::Main()
 
       if (ret != 0)
       {
-        PLAYER_MSG1(1, "reached end of log file %s", this->filename);
-        // File is done, so just loop forever, unless we're on auto-rewind,
-        // or until a client requests rewind.
         reading_configs = false;
-
-        // deactivate driver so clients subscribing to the log interface will notice
-        if(!this->autorewind && !this->rewind_requested)
-          this->enable=false;
-
-        while(!this->autorewind && !this->rewind_requested)
-        {
-          usleep(100000);
-          pthread_testcancel();
-
-          // Process requests
-          this->ProcessMessages();
-
-          ReadLogTime_timeDouble += 0.1;
-          ReadLogTime_time.tv_sec = (time_t)floor(ReadLogTime_timeDouble);
-          ReadLogTime_time.tv_sec = (time_t)fmod(ReadLogTime_timeDouble,1.0);
-        }
-
-        // request a rewind and start again
-        this->rewind_requested = true;
+        this->WaitAtEnd();
         continue;
       }
 
@@ -821,31 +893,11 @@ void ReadLog::Main()
     }
 
     // Set the global timestamp
-    ::ReadLogTime_timeDouble = curr_log_time;
-    ::ReadLogTime_time.tv_sec = (time_t)floor(curr_log_time);
-    ::ReadLogTime_time.tv_usec = (time_t)fmod(curr_log_time,1.0);
+    this->SetTime(curr_log_time);
 
-    gettimeofday(&tv,NULL);
-    curr_wall_time = tv.tv_sec + tv.tv_usec/1e6;
+    // Wait until it's time to publish this message
     if(!reading_configs)
-    {
-      // Have we published at least one message from this log?
-      if(last_wall_time >= 0)
-      {
-        // Wait until it's time to publish this message
-        while((curr_wall_time - last_wall_time) <
-              ((curr_log_time - last_log_time) / this->speed))
-        {
-          gettimeofday(&tv,NULL);
-          curr_wall_time = tv.tv_sec + tv.tv_usec/1e6;
-          this->ProcessMessages();
-          usleep(1000);
-        }
-      }
-
-      last_wall_time = curr_wall_time;
-      last_log_time = curr_log_time;
-    }
+      this->WaitForLogTime(curr_log_time);
 
     // Look for a matching read interface; data will be output on
     // the corresponding provides interface.
@@ -875,6 +927,234 @@ void ReadLog::Main()
 }
 
 
+////////////////////////////////////////////////////////////////////////////
+// Driver thread for binary log files
+void ReadLog::MainBinary()
+{
+  int i, ret;
+  double seek_to;
+  player_msghdr_t hdr;
+  player_devaddr_t provide_id;
+  bool reading_configs;
+
+  // First thing, we'll read all the configs from the front of the file
+  reading_configs = true;
+
+  while (true)
+  {
+    pthread_testcancel();
+
+    // Process requests
+    if(!reading_configs)
+      ProcessMessages();
+
+    // If we're not supposed to playback data, sleep and loop
+    if(!this->enable && !reading_configs)
+    {
+      this->clock_wall = -1.0;
+      usleep(10000);
+      continue;
+    }
+
+    // If a client has requested that we rewind or seek, then do so
+    if(!reading_configs && this->rewind_requested)
+    {
+      this->binlog->Rewind();
+      this->SetTime(0.0);
+      this->rewind_requested = false;
+      this->clock_wall = -1.0;
+      PLAYER_MSG0(2, "logfile rewound");
+      continue;
+    }
+    if(!reading_configs && this->seek_requested)
+    {
+      seek_to = this->seek_time;
+      this->seek_requested = false;
+      this->clock_wall = -1.0;
+      if(this->binlog->Seek(seek_to) < 0)
+        PLAYER_MSG1(1, "no messages at or after %.3f", seek_to);
+      else
+        PLAYER_MSG1(2, "logfile seeked to %.3f", seek_to);
+      continue;
+    }
+
+    ret = this->binlog->Read(&hdr, this->bindata);
+    if(ret > 0)
+    {
+      reading_configs = false;
+      this->WaitAtEnd();
+      continue;
+    }
+    if(ret < 0)
+      continue;
+
+    if(reading_configs && hdr.type != PLAYER_MSGTYPE_RESP_ACK)
+      reading_configs = false;
+
+    // Set the global timestamp
+    this->SetTime(hdr.timestamp);
+
+    // Wait until it's time to publish this message
+    if(!reading_configs)
+      this->WaitForLogTime(hdr.timestamp);
+
+    // Look for a matching read interface; data will be output on
+    // the corresponding provides interface.
+    for (i = 0; i < this->provide_count; i++)
+    {
+      provide_id = this->provide_ids[i];
+      if(Device::MatchDeviceAddress(hdr.addr, provide_id))
+      {
+        if(hdr.type == PLAYER_MSGTYPE_RESP_ACK)
+          this->StoreResponse(provide_id, &hdr, hdr.size ? this->bindata : NULL);
+        else if(hdr.type == PLAYER_MSGTYPE_DATA)
+          this->Publish(provide_id, PLAYER_MSGTYPE_DATA, hdr.subtype,
+                        hdr.size ? this->bindata : NULL, 0, &hdr.timestamp);
+        break;
+      }
+    }
+    if(i >= this->provide_count)
+    {
+      PLAYER_MSG6(2, "unhandled message from %d:%d:%d:%d %d:%d\n",
+                  hdr.addr.host,
+                  hdr.addr.robot,
+                  hdr.addr.interf,
+                  hdr.addr.index,
+                  hdr.type, hdr.subtype);
+    }
+
+    // Release anything allocated while decoding
+    if(hdr.size > 0)
+      playerxdr_cleanup_message(this->bindata, hdr.addr.interf,
+                                hdr.type, hdr.subtype);
+  }
+
+  return;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Wait until it is time to publish a message with the given log time.
+// Messages are scheduled against the wall time at which the playback
+// clock was started, rather than the previous message, so that waiting
+// and publishing overheads do not accumulate at high playback speeds.
+void ReadLog::WaitForLogTime(double log_time)
+{
+  struct timeval tv;
+  double wall_time, wait;
+
+  gettimeofday(&tv,NULL);
+  wall_time = tv.tv_sec + tv.tv_usec/1e6;
+
+  // (Re)start the clock after pauses, rewinds and seeks, when the log
+  // goes back in time, and when we have fallen well behind
+  wait = -1.0;
+  if(this->clock_wall >= 0 && log_time >= this->clock_log)
+    wait = this->clock_wall + (log_time - this->clock_log) / this->speed - wall_time;
+  if(this->clock_wall < 0 || log_time < this->clock_log || wait < -1.0)
+  {
+    this->clock_wall = wall_time;
+    this->clock_log = log_time;
+    return;
+  }
+
+  while(wait > 0)
+  {
+    this->ProcessMessages();
+    if(wait > 0.01)
+      usleep(10000);
+    else
+      usleep((int) (wait * 1e6));
+
+    gettimeofday(&tv,NULL);
+    wall_time = tv.tv_sec + tv.tv_usec/1e6;
+    wait = this->clock_wall + (log_time - this->clock_log) / this->speed - wall_time;
+  }
+
+  return;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Set the global (log) time
+void ReadLog::SetTime(double log_time)
+{
+  ::ReadLogTime_timeDouble = log_time;
+  ::ReadLogTime_time.tv_sec = (time_t)floor(log_time);
+  ::ReadLogTime_time.tv_usec = (long)(fmod(log_time,1.0) * 1e6);
+  return;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Wait at the end of the log until we are asked to rewind
+void ReadLog::WaitAtEnd()
+{
+  PLAYER_MSG1(1, "reached end of log file %s", this->filename);
+
+  // File is done, so just loop forever, unless we're on auto-rewind,
+  // or until a client requests rewind (or a seek).
+  // deactivate driver so clients subscribing to the log interface will notice
+  if(!this->autorewind && !this->rewind_requested && !this->seek_requested)
+    this->enable=false;
+
+  while(!this->autorewind && !this->rewind_requested && !this->seek_requested)
+  {
+    usleep(100000);
+    pthread_testcancel();
+
+    // Process requests
+    this->ProcessMessages();
+
+    this->SetTime(ReadLogTime_timeDouble + 0.1);
+  }
+
+  // request a rewind and start again
+  if(!this->seek_requested)
+    this->rewind_requested = true;
+  return;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Remember a logged response to a request
+void ReadLog::StoreResponse(player_devaddr_t addr, player_msghdr_t *hdr,
+                            void *data)
+{
+  int i;
+  response_t *resp;
+
+  // Replace any earlier response to the same request
+  for (i = 0; i < this->response_count; i++)
+  {
+    resp = this->responses + i;
+    if(Device::MatchDeviceAddress(resp->addr, addr) &&
+       resp->subtype == hdr->subtype)
+      break;
+  }
+  if(i == this->response_count)
+  {
+    if(this->response_count >= (int) (sizeof(this->responses) / sizeof(this->responses[0])))
+    {
+      PLAYER_WARN("too many logged responses; ignoring");
+      return;
+    }
+    this->response_count++;
+  }
+  else if(this->responses[i].data)
+    playerxdr_free_message(this->responses[i].data, addr.interf,
+                           PLAYER_MSGTYPE_RESP_ACK, hdr->subtype);
+
+  resp = this->responses + i;
+  resp->addr = addr;
+  resp->subtype = hdr->subtype;
+  resp->data = NULL;
+  if(data)
+    resp->data = playerxdr_clone_message(data, addr.interf,
+                                         PLAYER_MSGTYPE_RESP_ACK, hdr->subtype);
+  return;
+}
+
 
 ////////////////////////////////////////////////////////////////////////////
 // Process configuration requests
@@ -932,6 +1212,21 @@ int ReadLog::ProcessLogConfig(QueuePointer & resp_queue,
                     PLAYER_LOG_REQ_SET_READ_REWIND);
       return(0);
 
+    case PLAYER_LOG_REQ_SET_READ_SEEK:
+      // Only binary files have an index to seek with
+      if(!this->binlog)
+      {
+        PLAYER_WARN("seeking is only supported for binary log files");
+        return(-1);
+      }
+      this->seek_time = ((player_log_set_read_seek_t*)data)->time;
+      this->seek_requested = true;
+
+      this->Publish(this->log_id, resp_queue,
+                    PLAYER_MSGTYPE_RESP_ACK,
+                    PLAYER_LOG_REQ_SET_READ_SEEK);
+      return(0);
+
     default:
       return(-1);
   }
@@ -1268,6 +1563,24 @@ ReadLog::ProcessMessage(QueuePointer & resp_queue,
   {
     return(this->ProcessLogConfig(resp_queue, hdr, data));
   }
+  else if(this->binlog && (hdr->type == PLAYER_MSGTYPE_REQ))
+  {
+    // Binary logs hold the responses themselves; answer with the one
+    // logged for this request, if there is one
+    for(int i = 0; i < this->response_count; i++)
+    {
+      response_t *resp = this->responses + i;
+      if(Device::MatchDeviceAddress(resp->addr, hdr->addr) &&
+         resp->subtype == hdr->subtype)
+      {
+        this->Publish(resp->addr, resp_queue,
+                      PLAYER_MSGTYPE_RESP_ACK, resp->subtype,
+                      resp->data, 0, NULL);
+        return(0);
+      }
+    }
+    return(-1);
+  }
   else if((hdr->type == PLAYER_MSGTYPE_REQ) &&
           (hdr->addr.interf == PLAYER_FIDUCIAL_CODE))
   {
@@ -32,14 +32,30 @@
  * @brief Logging data
 
 The writelog driver will write data from another device to a log file.
-Each data message is written to a separate line.  The format for the
-file is given in the
+By default each data message is written to a separate line.  The format
+for the file is given in the
 @ref tutorial_datalog "data logging tutorial".
 
+With the @p format option set to "binary", messages are instead
+stored as they are sent over the network (the XDR-encoded message
+header and payload), followed by an index from log time to file
+offset.  Binary logs are much faster to write and to read back
+(particularly for camera data), and the @ref driver_readlog driver
+can seek within them, but they are not human-readable.
+
 The @ref driver_readlog driver can be used to replay the data
 (to client programs, the replayed data will appear to come from the
 real sensors).
 
+Messages are formatted into large memory buffers, which a separate
+thread writes to disk (optionally compressing them), so a slow disk
+does not hold up the processing of incoming messages unless all of the
+buffers are waiting to be written.  What happens then can be set for
+each device with the @p overflow option: either the driver waits for
+the disk (and its incoming queue backs up), or it holds on to only the
+newest message from that device, dropping older ones, until there is
+room again.
+
 The writelog driver logs data independently of any client connections to
 the devices that it is logging.  As long as it's enabled and recording,
 the writelog driver records data from the specified list of devices
@@ -124,6 +140,29 @@ The writelog driver can will log data from the following interfaces:
 - autorecord (integer)
   - Default: 0
   - Default log state; set to 1 for continous logging.
+- format (string)
+  - Default: "ascii"
+  - Log file format: "ascii" (one line of text per message) or "binary"
+    (XDR-encoded messages with a seek index).
+- compress (integer)
+  - Default: 0
+  - Set to 1 to compress ASCII log files with zlib (".gz" is appended to
+    the file name if it is not already there; @ref driver_readlog can
+    play these back directly).  Binary log files are never compressed,
+    since they are read back by seeking within them.
+- buffer_size (integer)
+  - Default: 4194304
+  - Size (bytes) of each of the memory buffers log data is formatted into.
+- buffer_count (integer)
+  - Default: 4
+  - Number of memory buffers (at least 2).
+- overflow (string tuple)
+  - Default: "block" for every device
+  - What to do with messages from each of the devices in the
+    @p requires list (in the same order) when every buffer is waiting to
+    be written to disk: "block" to wait for the disk, or "drop" to keep
+    only the newest message from that device (dropping the oldest) until
+    there is room.
 - camera_log_images (integer)
   - Default: 1
   - Save image data to the log file. If this is turned off, a log line is still
@@ -133,6 +172,16 @@ The writelog driver can will log data from the following interfaces:
   - Save image data to external files within the log directory.
     The image files are named "(basename)(timestamp)_camera_II_NNNNNNN.pnm",
     where II is the device index and NNNNNNN is the frame number.
+@par Properties
+
+- queue_depth (integer, read-only)
+  - Number of buffers waiting to be written to disk.
+- write_rate (float, read-only)
+  - Rate (bytes/sec) at which log data was written to disk over the last
+    second, before compression.
+- dropped (integer, read-only)
+  - Number of messages dropped by devices with the "drop" overflow policy.
+
 @par Example
 
 @verbatim
@@ -172,17 +221,29 @@ driver
 #include <libplayercore/playercore.h>
 
 #include "encode.h"
+#include "logbinary.h"
+#include "logbuffer.h"
 
 #if defined (WIN32)
   #define snprintf _snprintf
 #endif
 
+// Interval (s) at which buffered data is handed to the disk, and the
+// statistics properties are updated
+#define WRITELOG_FLUSH_INTERVAL 1.0
+
 // Utility class for storing per-device info
 struct WriteLogDevice
 {
   public: player_devaddr_t addr;
   public: Device *device;
   public: int cameraFrame;
+
+  // Drop (rather than wait) when the buffers are full?
+  public: bool drop;
+
+  // Newest message held back while the buffers are full (drop policy)
+  public: Message *pending;
 };
 
 
@@ -219,6 +280,12 @@ class WriteLog: public ThreadedDriver
   // Flush and close this->file
   private: void CloseFile();
 
+  // Write out messages held back while the buffers were full
+  private: void WritePending();
+
+  // Update the statistics properties
+  private: void UpdateStats();
+
   // Write localize particles to file
   private: void WriteLocalizeParticles();
 
@@ -226,6 +293,10 @@ class WriteLog: public ThreadedDriver
   private: void Write(WriteLogDevice *device,
                       player_msghdr_t* hdr, void *data);
 
+  // Write data to a binary file
+  private: void WriteBinary(WriteLogDevice *device,
+                            player_msghdr_t* hdr, void *data);
+
   // Write laser data to file
   private: int WriteLaser(player_msghdr_t* hdr, void *data);
 
@@ -285,6 +356,9 @@ class WriteLog: public ThreadedDriver
   // Write camera data to file
   private: int WriteCamera(WriteLogDevice *device, player_msghdr_t* hdr, void *data);
 
+  // Save a camera frame to its own image file
+  private: int SaveCameraImage(WriteLogDevice *device, player_camera_data_t *camera_data);
+
   // Write fiducial data to file
   private: int WriteFiducial(player_msghdr_t* hdr, void *data);
 
@@ -311,6 +385,20 @@ class WriteLog: public ThreadedDriver
   private: char filename[1024];
   private: FILE *file;
 
+  // Buffered output, written on another thread
+  private: LogBuffer out;
+  private: bool compress;
+
+  // Write a binary log (rather than ASCII)?
+  private: bool binary;
+  private: LogBinaryWriter binlog;
+
+  // Statistics
+  private: IntProperty queue_depth;
+  private: DoubleProperty write_rate;
+  private: IntProperty dropped;
+  private: double stats_time;
+
   // Subscribed device list
   private: int device_count;
   private: WriteLogDevice devices[1024];
@@ -357,7 +445,10 @@ void writelog_Register(DriverTable* table)
 ////////////////////////////////////////////////////////////////////////////
 // Constructor
 WriteLog::WriteLog(ConfigFile* cf, int section)
-    : ThreadedDriver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN, PLAYER_LOG_CODE)
+    : ThreadedDriver(cf, section, true, PLAYER_MSGQUEUE_DEFAULT_MAXLEN, PLAYER_LOG_CODE),
+      queue_depth("queue_depth", 0, true),
+      write_rate("write_rate", 0.0, true),
+      dropped("dropped", 0, true)
 {
   int i;
   player_devaddr_t addr;
@@ -372,6 +463,34 @@ WriteLog::WriteLog(ConfigFile* cf, int section)
   char complete_filename[1024];
 
   this->file = NULL;
+  this->stats_time = -1;
+
+  // Log file format
+  const char *format = cf->ReadString(section, "format", "ascii");
+  if (strcmp(format, "binary") == 0)
+    this->binary = true;
+  else if (strcmp(format, "ascii") == 0)
+    this->binary = false;
+  else
+  {
+    PLAYER_ERROR1("unknown log format [%s]", format);
+    this->SetError(-1);
+    return;
+  }
+
+  // Output buffering
+  this->compress = cf->ReadInt(section, "compress", 0) != 0;
+  if (this->compress && this->binary)
+  {
+    PLAYER_WARN("binary log files are not compressed");
+    this->compress = false;
+  }
+  this->out.SetBlocks(cf->ReadInt(section, "buffer_size", LOGBUFFER_DEFAULT_BLOCK_SIZE),
+                      cf->ReadInt(section, "buffer_count", LOGBUFFER_DEFAULT_BLOCK_COUNT));
+
+  this->RegisterProperty("queue_depth", &this->queue_depth, cf, section);
+  this->RegisterProperty("write_rate", &this->write_rate, cf, section);
+  this->RegisterProperty("dropped", &this->dropped, cf, section);
 
   // Construct timestamp from date and time.  Note that we use
   // the system time, *not* the Player time.  I think that this is the
@@ -439,6 +558,20 @@ WriteLog::WriteLog(ConfigFile* cf, int section)
     device->addr = addr;
     device->device = NULL;
     device->cameraFrame = 0;
+    device->pending = NULL;
+
+    // What to do when the buffers are full
+    const char *overflow = cf->ReadTupleString(section, "overflow", i, "block");
+    if (strcmp(overflow, "drop") == 0)
+      device->drop = true;
+    else if (strcmp(overflow, "block") == 0)
+      device->drop = false;
+    else
+    {
+      PLAYER_ERROR1("unknown overflow policy [%s]", overflow);
+      this->SetError(-1);
+      return;
+    }
   }
 
   // Camera specific settings
@@ -523,14 +656,29 @@ WriteLog::OpenFile()
   mkdir(this->log_directory, 0755);
 #endif
 
+  // Compressed files are recognised by their extension
+  size_t len = strlen(this->filename);
+  if(this->compress &&
+     (len < 3 || strcmp(this->filename + len - 3, ".gz") != 0) &&
+     len + 3 < sizeof(this->filename))
+    strcat(this->filename, ".gz");
+
   // Open the file
-  this->file = fopen(this->filename, "w+");
-  if(this->file == NULL)
-  {
-    PLAYER_ERROR2("unable to open [%s]: %s\n", this->filename, strerror(errno));
+  if(this->out.Open(this->filename, this->compress) < 0)
     return(-1);
+  this->stats_time = -1;
+
+  // Binary files have their own header, and no comments
+  if(this->binary)
+  {
+    this->binlog.Open(&this->out);
+    this->WriteGeometries();
+    return(0);
   }
 
+  // Formatted output goes to the buffer
+  this->file = this->out.Stream();
+
   // Write the file header
   fprintf(this->file, "## Player version %s \n", PLAYER_VERSION);
   fprintf(this->file, "## File version %s \n", "0.3.0");
@@ -718,12 +866,70 @@ void WriteLog::WriteGeometries()
 void
 WriteLog::CloseFile()
 {
-  if(this->file)
+  int i;
+
+  // Anything held back goes in ahead of the seek index
+  this->WritePending();
+  for (i = 0; i < this->device_count; i++)
+  {
+    delete this->devices[i].pending;
+    this->devices[i].pending = NULL;
+  }
+
+  // Writes the seek index
+  this->binlog.Close();
+
+  // Waits for the I/O thread to write everything out
+  this->out.Close();
+  this->file = NULL;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Write out messages held back while the buffers were full
+void
+WriteLog::WritePending()
+{
+  int i;
+  WriteLogDevice *device;
+
+  for (i = 0; i < this->device_count; i++)
+  {
+    device = this->devices + i;
+    if (!device->pending)
+      continue;
+    if (this->out.Full())
+      return;
+    this->Write(device, device->pending->GetHeader(), device->pending->GetPayload());
+    delete device->pending;
+    device->pending = NULL;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Hand buffered data to the disk, and update the statistics properties
+void
+WriteLog::UpdateStats()
+{
+  int queued;
+  double rate, now;
+
+  // Wall time, as the I/O thread measures the write rate on it
+  now = LogBuffer::WallTime();
+  if (this->stats_time >= 0 && now - this->stats_time < WRITELOG_FLUSH_INTERVAL)
+    return;
+
+  // Don't let a partly filled buffer sit in memory indefinitely
+  this->out.Flush();
+
+  this->out.GetStats(&queued, &rate);
+  if (this->stats_time >= 0)
   {
-    fflush(this->file);
-    fclose(this->file);
-    this->file = NULL;
+    this->queue_depth.SetValue(queued);
+    this->write_rate.SetValue(rate);
   }
+  this->stats_time = now;
 }
 
 int
@@ -819,7 +1025,27 @@ WriteLog::ProcessMessage(QueuePointer & resp_queue,
         continue;
 
 
-      // Write data to file
+      // If the buffers are full, keep only the newest message from
+      // devices that may drop data, rather than waiting for the disk
+      if(device->drop && this->out.Full())
+      {
+        if(device->pending)
+        {
+          delete device->pending;
+          this->dropped.SetValue(this->dropped.GetValue() + 1);
+        }
+        device->pending = new Message(*hdr, data);
+        return(0);
+      }
+
+      // Write data to file, after anything held back from this device
+      if(device->pending)
+      {
+        this->Write(device, device->pending->GetHeader(),
+                    device->pending->GetPayload());
+        delete device->pending;
+        device->pending = NULL;
+      }
       this->Write(device, hdr, data);
       return(0);
     }
@@ -843,8 +1069,8 @@ WriteLog::Main(void)
   {
     pthread_testcancel();
 
-    // Wait on my queue
-    this->Wait();
+    // Wait on my queue (but wake up to flush the buffers now and then)
+    this->Wait(WRITELOG_FLUSH_INTERVAL);
 
 
     if (write_particles_now){
@@ -854,6 +1080,10 @@ WriteLog::Main(void)
 
     // Process all new messages (calls ProcessMessage on each)
     this->ProcessMessages();
+
+    // Catch up on anything held back while the buffers were full
+    this->WritePending();
+    this->UpdateStats();
   }
 }
 
@@ -867,6 +1097,12 @@ void WriteLog::Write(WriteLogDevice *device,
   //char host[256];
   player_interface_t iface;
 
+  if (this->binary)
+  {
+    this->WriteBinary(device, hdr, data);
+    return;
+  }
+
   // Get interface name
   assert(device);
   ::lookup_interface_code(device->addr.interf, &iface);
@@ -980,10 +1216,44 @@ void WriteLog::Write(WriteLogDevice *device,
 
   fprintf(this->file, "\n");
 
-  // Flush the data (some drivers produce a lot of data; we dont want
-  // it to back up and slow us down later).
-  fflush(this->file);
+  return;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Write data to a binary file
+void WriteLog::WriteBinary(WriteLogDevice *device,
+                           player_msghdr_t* hdr,
+                           void *data)
+{
+  player_msghdr_t out;
+  player_camera_data_t camera_data;
+
+  assert(device);
+
+  // Log under the address we were configured with, as for ASCII logs
+  out = *hdr;
+  out.addr = device->addr;
+
+  // Camera frames may be saved separately, and left out of the log
+  if (device->addr.interf == PLAYER_CAMERA_CODE && data &&
+      hdr->type == PLAYER_MSGTYPE_DATA &&
+      hdr->subtype == PLAYER_CAMERA_DATA_STATE)
+  {
+    if (this->cameraSaveImages)
+      this->SaveCameraImage(device, (player_camera_data_t*) data);
+    if (!this->cameraLogImages)
+    {
+      camera_data = *(player_camera_data_t*) data;
+      camera_data.image_count = 0;
+      camera_data.image = NULL;
+      data = &camera_data;
+    }
+  }
 
+  if (this->binlog.Write(&out, data) < 0)
+    PLAYER_WARN2("not logging message to interface \"%s\" with subtype %d",
+                 ::lookup_interface_name(0, device->addr.interf), hdr->subtype);
   return;
 }
 
@@ -2835,51 +3105,7 @@ int WriteLog::WriteCamera(WriteLogDevice *device, player_msghdr_t* hdr, void *da
                         free(str);
                     }
                     if(this->cameraSaveImages)
-                    {
-                        FILE *file;
-                        char filename[1024];
-
-			
-			if (camera_data->compression == PLAYER_CAMERA_COMPRESS_RAW) {
-			  snprintf(filename, sizeof(filename), "%s/%s_camera_%02d_%06d.pnm",
-				   this->log_directory, this->filestem, device->addr.index, device->cameraFrame++);
-			} else if (camera_data->compression == PLAYER_CAMERA_COMPRESS_JPEG) {
-			  snprintf(filename, sizeof(filename), "%s/%s_camera_%02d_%06d.jpg",
-				   this->log_directory, this->filestem, device->addr.index, device->cameraFrame++);
-			} else {
-                          PLAYER_WARN("unsupported compression method");
-                          return -1;
-			}
-
-			file = fopen(filename, "w+");
-			if (file == NULL)
-			  return -1;
-			
-			if (camera_data->compression == PLAYER_CAMERA_COMPRESS_RAW) {
-			  
-			  if (camera_data->format == PLAYER_CAMERA_FORMAT_RGB888)
-			    {
-			      // Write ppm header
-			      fprintf(file, "P6\n%d %d\n%d\n", camera_data->width, camera_data->height, 255);
-			      fwrite(camera_data->image, 1, camera_data->image_count, file);
-			    }
-			  else if (camera_data->format == PLAYER_CAMERA_FORMAT_MONO8)
-			    {
-			      // Write pgm header
-			      fprintf(file, "P5\n%d %d\n%d\n", camera_data->width, camera_data->height, 255);
-			      fwrite(camera_data->image, 1, camera_data->image_count, file);
-			    }
-			  else
-			    {
-			      PLAYER_WARN("unsupported image format");
-			    }
-			  
-			} else if (camera_data->compression == PLAYER_CAMERA_COMPRESS_JPEG) {
-			  fwrite(camera_data->image, 1, camera_data->image_count, file);
-			}
-
-			fclose(file);
-		    }
+                      return this->SaveCameraImage(device, camera_data);
                     return 0;
                 default:
                     return -1;
@@ -2890,6 +3116,52 @@ int WriteLog::WriteCamera(WriteLogDevice *device, player_msghdr_t* hdr, void *da
     return -1;
 }
 
+// Save a camera frame to its own image file
+int WriteLog::SaveCameraImage(WriteLogDevice *device, player_camera_data_t *camera_data)
+{
+    FILE *file;
+    char filename[1024];
+
+    if (camera_data->compression == PLAYER_CAMERA_COMPRESS_RAW) {
+      snprintf(filename, sizeof(filename), "%s/%s_camera_%02d_%06d.pnm",
+               this->log_directory, this->filestem, device->addr.index, device->cameraFrame++);
+    } else if (camera_data->compression == PLAYER_CAMERA_COMPRESS_JPEG) {
+      snprintf(filename, sizeof(filename), "%s/%s_camera_%02d_%06d.jpg",
+               this->log_directory, this->filestem, device->addr.index, device->cameraFrame++);
+    } else {
+      PLAYER_WARN("unsupported compression method");
+      return -1;
+    }
+
+    file = fopen(filename, "w+");
+    if (file == NULL)
+      return -1;
+
+    if (camera_data->compression == PLAYER_CAMERA_COMPRESS_RAW) {
+      if (camera_data->format == PLAYER_CAMERA_FORMAT_RGB888)
+      {
+        // Write ppm header
+        fprintf(file, "P6\n%d %d\n%d\n", camera_data->width, camera_data->height, 255);
+        fwrite(camera_data->image, 1, camera_data->image_count, file);
+      }
+      else if (camera_data->format == PLAYER_CAMERA_FORMAT_MONO8)
+      {
+        // Write pgm header
+        fprintf(file, "P5\n%d %d\n%d\n", camera_data->width, camera_data->height, 255);
+        fwrite(camera_data->image, 1, camera_data->image_count, file);
+      }
+      else
+      {
+        PLAYER_WARN("unsupported image format");
+      }
+    } else if (camera_data->compression == PLAYER_CAMERA_COMPRESS_JPEG) {
+      fwrite(camera_data->image, 1, camera_data->image_count, file);
+    }
+
+    fclose(file);
+    return 0;
+}
+
 /** @ingroup tutorial_datalog
  * @defgroup player_driver_writelog_fiducial Fiducial format
 
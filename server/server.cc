@@ -51,7 +51,7 @@ The situation is essentially the same when running a simulation.
 @section Usage
 
 @code
-player [-q] [-d <level>] [-p <port>] [-h] <cfgfile>
+player [-q] [-d <level>] [-p <port>] [-f] [-j <threads>] [-m <group>[:<port>]] [-r <kbytes>] [-h] <cfgfile>
 @endcode
 Arguments:
 - -h : Give help info; also lists drivers that were compiled into the server.
@@ -63,6 +63,19 @@ more output.  Default: 1.
 any devices in the configuration file without an explicit port assignment.
 Default: 6665.
 - -l \<logfile\>: File to log messages to (default stdout only)
+- -f : Use lock-free message queues for client connections, so that
+threaded drivers can publish to clients without contending for the queue
+mutex with the server thread.
+- -j \<threads\> : Share TCP clients out among this many I/O threads, which
+read, decode, encode and write messages for their clients, instead of
+serving every client from the server thread.  Default: 0 (no I/O threads).
+- -m \<group\>[:\<port\>] : Send DATA messages to the multicast group
+\<group\> (on \<port\>, default 6660), once for all of the UDP clients in
+PUSH mode that ask for it, instead of to each of them in turn.
+- -r \<kbytes\> : Size of the shared-memory ring that each client on the
+same host gets when it connects through the local socket.  Every local
+client ends up using this much shared memory, and messages bigger than
+about half of it are dropped for local clients.  Default: 4096.
 - \<cfgfile\> : The configuration file to read.
 
 @section Example
@@ -110,6 +123,7 @@ using std::runtime_error;
 #include <string>
 using std::string;
 
+#include <libplayercommon/shmring.h>
 #include <libplayertcp/playertcp.h>
 #include <libplayertcp/playerudp.h>
 #include <libplayerinterface/functiontable.h>
@@ -129,7 +143,8 @@ void PrintCopyrightMsg();
 void PrintUsage();
 int ParseArgs(int* port, int* debuglevel,
               char** cfgfilename, int* gz_serverid, char** logfilename,
-              bool &shoud_daemonize,
+              bool &shoud_daemonize, int* io_threads,
+              char** mcast_group, int* mcast_port, int* ring_kbytes,
               int argc, char** argv);
 void Quit(int signum);
 void Cleanup();
@@ -156,6 +171,10 @@ main(int argc, char** argv)
   int debuglevel = 1;
   int port = PLAYERTCP_DEFAULT_PORT;
   int gz_serverid = -1;
+  int io_threads = 0;
+  char* mcast_group = NULL;
+  int mcast_port = PLAYERUDP_DEFAULT_MULTICAST_PORT;
+  int ring_kbytes = PLAYER_SHMRING_DEFAULT_SIZE >> 10;
   int* ports = NULL;
   int* new_ports = NULL;
   int num_ports = 0;
@@ -212,7 +231,8 @@ main(int argc, char** argv)
   char *cfgfilename_unres = NULL;
 
   if(ParseArgs(&port, &debuglevel, &cfgfilename_unres, &gz_serverid,
-               &logfilename_unres, should_daemonize, argc, argv) < 0)
+               &logfilename_unres, should_daemonize, &io_threads,
+               &mcast_group, &mcast_port, &ring_kbytes, argc, argv) < 0)
   {
     PrintUsage();
     exit(-1);
@@ -353,6 +373,25 @@ main(int argc, char** argv)
     exit(-1);
   }
 
+  if(mcast_group && (pudp->Multicast(mcast_group, mcast_port) < 0))
+  {
+    PLAYER_ERROR("failed to set up UDP multicast");
+    Cleanup();
+    exit(-1);
+  }
+
+  // Clients on this host can also connect through shared memory
+  if(player_shmring_supported() && (ptcp->ListenLocal(new_ports, num_ports,
+                                                          (size_t)ring_kbytes << 10) < 0))
+    PLAYER_WARN("failed to listen for local clients; only TCP is available");
+
+  if((io_threads > 0) && (ptcp->StartIOThreads(io_threads) < 0))
+  {
+    PLAYER_ERROR("failed to start TCP I/O threads");
+    Cleanup();
+    exit(-1);
+  }
+
   // Go back through and relabel the devices for which ports got
   // auto-assigned during Listen().
   // TODO: currently this only works for port=0.  Should add support to
@@ -416,10 +455,17 @@ main(int argc, char** argv)
     exit(-1);
   }
  
+  // Non-threaded drivers are only serviced from this loop, so while any are
+  // active it runs at a minimum of 100Hz.  So it does while a client's
+  // socket is full, since client sockets are only watched for reading, to
+  // retry the write.  Otherwise it sleeps until a client sends something
+  // or a client queue gets new data.
+  int polled = 1;
   while(!player_quit)
   {
     // wait until something other than driver requested watches happens
-    int numready = fileWatcher->Wait(0.01); // run at a minimum of 100Hz for other drivers
+    bool retry = polled || ptcp->HasBacklog() || pudp->HasBacklog();
+    int numready = fileWatcher->Wait(retry ? PLAYERTCP_WRITE_RETRY : -1);
     if (numready > 0)
     {
       if(ptcp->Accept(0) < 0)
@@ -440,7 +486,10 @@ main(int argc, char** argv)
         break;
       }
     }
-    deviceTable->UpdateDevices();
+    // Keep the I/O threads from changing subscriptions under the drivers
+    ptcp->LockDevices();
+    polled = deviceTable->UpdateDevices();
+    ptcp->UnlockDevices();
 
     if(ptcp->Write(false) < 0)
     {
@@ -533,6 +582,11 @@ PrintUsage()
   fprintf(stderr, "  -q             : quiet mode: minimizes the console output on startup.\n");
   fprintf(stderr, "  -l <logfile>   : log player output to the specified file\n");
   fprintf(stderr, "  -s             : fork to a daemon process as the current user.\n");
+  fprintf(stderr, "  -f             : use lock-free queues for client connections.\n");
+  fprintf(stderr, "  -j <threads>   : serve TCP clients from this many I/O threads.\n");
+  fprintf(stderr, "  -m <group>[:<port>] : multicast data to UDP clients that ask for it.\n");
+  fprintf(stderr, "  -r <kbytes>    : shared-memory ring size for each local client. "
+          "Default: %d\n", PLAYER_SHMRING_DEFAULT_SIZE >> 10);
   fprintf(stderr, "  <configfile>   : load the the indicated config file\n");
   fprintf(stderr, "\nThe following %d drivers were compiled into Player:\n\n    ",
           driverTable->Size());
@@ -553,11 +607,13 @@ PrintUsage()
 
 int
 ParseArgs(int* port, int* debuglevel, char** cfgfilename, int* gz_serverid,
-          char **logfilename, bool &should_daemonize,
+          char **logfilename, bool &should_daemonize, int* io_threads,
+          char** mcast_group, int* mcast_port, int* ring_kbytes,
           int argc, char** argv)
 {
   int ch;
-  const char* optflags = "d:p:l:hqs";
+  char* colon;
+  const char* optflags = "d:p:l:j:m:r:hqsf";
 
   // Get letter options
   while((ch = getopt(argc, argv, optflags)) != -1)
@@ -579,6 +635,27 @@ ParseArgs(int* port, int* debuglevel, char** cfgfilename, int* gz_serverid,
       case 's':
         should_daemonize = true;
         break;
+      case 'f':
+        player_lockfree_queues = true;
+        break;
+      case 'j':
+        *io_threads = atoi(optarg);
+        if(*io_threads < 0)
+          return(-1);
+        break;
+      case 'm':
+        *mcast_group = optarg;
+        if((colon = strchr(optarg, ':')))
+        {
+          *colon = '\0';
+          *mcast_port = atoi(colon + 1);
+        }
+        break;
+      case 'r':
+        *ring_kbytes = atoi(optarg);
+        if((*ring_kbytes <= 0) || (*ring_kbytes >= (1 << 21)))
+          return(-1);
+        break;
       case '?':
       case ':':
       case 'h':
@@ -31,6 +31,7 @@
 #if defined (WIN32)
   #define finite _finite
   #include <gsl/gsl_math.h>
+  #include <windows.h>
 #endif
 #include <stdlib.h>
 #include <stdio.h>
@@ -51,13 +52,68 @@
 #include "pmap.h"
 
 
+// Smallest number of samples worth handing to a thread
+#define PMAP_MIN_CHUNK 8
+
+// Arguments for the per-sample update jobs
+typedef struct
+{
+  pmap_t *self;
+  double *ranges;
+
+} pmap_job_t;
+
+// Run the sensor model / map update on one chunk of the samples
+static void pmap_apply_sensor_chunk(void *data, int chunk, int chunk_count);
+static void pmap_add_scan_chunk(void *data, int chunk, int chunk_count);
+
+// Get the number of references to a tile.  Samples are updated in
+// parallel, and may share tiles, so the count is read atomically.
+static inline int pmap_tile_refs(pmap_tile_t *tile)
+{
+#if defined (WIN32)
+  return (int) InterlockedCompareExchange((LONG volatile*) &tile->refs, 0, 0);
+#else
+  return __sync_fetch_and_add(&tile->refs, 0);
+#endif
+}
+
+// Drop a reference to a tile; returns the number of references left.
+static inline int pmap_tile_unref(pmap_tile_t *tile)
+{
+#if defined (WIN32)
+  return (int) InterlockedDecrement((LONG volatile*) &tile->refs);
+#else
+  return __sync_sub_and_fetch(&tile->refs, 1);
+#endif
+}
+
+// Drop a sample's references to its map tiles
+static void pmap_release_tiles(pmap_t *self, pmap_sample_t *sample);
+
+// Get a cell value from a sample map
+static inline signed char pmap_read_cell(pmap_t *self, pmap_sample_t *sample, int x, int y)
+{
+  pmap_tile_t *tile;
+
+  tile = sample->tiles[PMAP_TILE_INDEX(self, x, y)];
+  if (tile == NULL)
+    return 0;
+  return tile->cells[PMAP_TILE_CELL(x, y)];
+}
+
+// Get a writable pointer to a cell in a sample map, copying the
+// containing tile first if it is shared
+static signed char *pmap_write_cell(pmap_t *self, pmap_sample_t *sample, int x, int y);
+
+
 // Create object
 pmap_t *pmap_alloc(int num_ranges, double range_max,
                    double range_start, double range_step, int samples_len,
                    double grid_width, double grid_height, double grid_scale)
 {
   pmap_t *self;
-  int i, sample_size, scans_size, total_size;
+  int i, j, sample_size, scans_size, total_size;
   pmap_sample_t *sample;
   
   self = new pmap_t;
@@ -78,10 +134,13 @@ pmap_t *pmap_alloc(int num_ranges, double range_max,
   self->grid_sy = (int) ceil(grid_height / grid_scale);
   self->grid_res = grid_scale;
 
+  self->tiles_sx = (self->grid_sx + PMAP_TILE_WIDTH - 1) / PMAP_TILE_WIDTH;
+  self->tiles_sy = (self->grid_sy + PMAP_TILE_WIDTH - 1) / PMAP_TILE_WIDTH;
+
   self->traj_size = self->step_max_count * sizeof(pose2_t);
-  self->grid_size = self->grid_sx * self->grid_sy * sizeof(char);
 
-  sample_size = self->grid_size + self->traj_size;
+  // Map tiles are allocated as they are written, so are not counted here
+  sample_size = self->traj_size;
   total_size += self->samples_len * 2 * sample_size;
   
   self->samples = new pmap_sample_t[2 * self->samples_len];
@@ -89,8 +148,10 @@ pmap_t *pmap_alloc(int num_ranges, double range_max,
   {
     sample = self->samples + i;
     sample->global_points = new vector2_t[self->num_ranges];
-    sample->poses = new pose2_t[self->traj_size];
-    sample->cells = new signed char[self->grid_size];
+    sample->poses = new pose2_t[self->step_max_count];
+    sample->tiles = new pmap_tile_t*[self->tiles_sx * self->tiles_sy];
+    for (j = 0; j < self->tiles_sx * self->tiles_sy; j++)
+      sample->tiles[j] = NULL;
   }
 
   // Allocate space for stored range scans
@@ -125,6 +186,9 @@ pmap_t *pmap_alloc(int num_ranges, double range_max,
   
   self->rng = gsl_rng_alloc(gsl_rng_taus);
   assert(self->rng);
+
+  self->pool = NULL;
+  pmap_set_threads(self, tpool_default_threads());
   
   return self;
 }
@@ -135,6 +199,10 @@ void pmap_free(pmap_t *self)
 {
   int i;
   pmap_sample_t *sample;
+
+  if (self->pool)
+    tpool_free(self->pool);
+  self->pool = NULL;
   
   gsl_rng_free(self->rng);
   self->rng = NULL;
@@ -142,7 +210,8 @@ void pmap_free(pmap_t *self)
   for (i = 0; i < 2 * self->samples_len; i++)
   {
     sample = self->samples + i;
-    delete [] sample->cells;
+    pmap_release_tiles(self, sample);
+    delete [] sample->tiles;
     delete [] sample->poses;
     delete [] sample->global_points;
   }
@@ -153,6 +222,16 @@ void pmap_free(pmap_t *self)
 }
 
 
+// Set the number of threads used to update the samples
+void pmap_set_threads(pmap_t *self, int threads)
+{
+  if (self->pool)
+    tpool_free(self->pool);
+  self->pool = tpool_alloc(threads);
+  return;
+}
+
+
 // Sorting function for neighborhood cells
 int pmap_sort_nbors(pmap_nbor_t *a, pmap_nbor_t *b)
 {
@@ -191,6 +270,9 @@ void pmap_init_nbors(pmap_t *self)
     }
   }
 
+  // Only the entries inside max_err were kept
+  self->num_nbors = count;
+
   // Sort list from nearest to farthest
   qsort(self->nbors, count, sizeof(self->nbors[0]),
         (int(*) (const void*, const void*)) pmap_sort_nbors);
@@ -291,7 +373,9 @@ void pmap_update(pmap_t *self, pose2_t odom_pose, int num_ranges, double *ranges
 }
 
 
-// Apply the action model to the current sample set.
+// Apply the action model to the current sample set.  This is cheap next
+// to the sensor model, and is kept on one thread so that the random
+// draws are made in the same order however many threads are in use.
 void pmap_apply_action(pmap_t *self, pose2_t delta)
 {
   int i;
@@ -324,11 +408,31 @@ void pmap_apply_action(pmap_t *self, pose2_t delta)
 // Apply sensor model to the current sample set.
 void pmap_apply_sensor(pmap_t *self, double *ranges)
 {
-  int i;
+  pmap_job_t job;
+
+  job.self = self;
+  job.ranges = ranges;
     
   // Compute error value for each sample
-  for (i = 0; i < self->samples_len; i++)
-    pmap_apply_sensor_sample(self, i, ranges);
+  tpool_run(self->pool, pmap_apply_sensor_chunk, &job,
+            tpool_chunks(self->pool, self->samples_len, PMAP_MIN_CHUNK));
+
+  return;
+}
+
+
+// Apply sensor model to one chunk of the current sample set.
+static void pmap_apply_sensor_chunk(void *data, int chunk, int chunk_count)
+{
+  int i, start, end;
+  pmap_job_t *job;
+
+  job = (pmap_job_t*) data;
+  start = job->self->samples_len * chunk / chunk_count;
+  end = job->self->samples_len * (chunk + 1) / chunk_count;
+
+  for (i = start; i < end; i++)
+    pmap_apply_sensor_sample(job->self, i, job->ranges);
 
   return;
 }
@@ -337,7 +441,7 @@ void pmap_apply_sensor(pmap_t *self, double *ranges)
 // Apply sensor model to a particular sample.
 void pmap_apply_sensor_sample(pmap_t *self, int sample_index, double *ranges)
 {
-  int i, j;
+  int i, j, s;
   int nx, ny, mx, my;
   int min_d;
   int occ;
@@ -347,9 +451,13 @@ void pmap_apply_sensor_sample(pmap_t *self, int sample_index, double *ranges)
   vector3_t p;
   pmap_sample_t *sample;
   pmap_nbor_t *nbor;
+  pmap_tile_t *tile;
   
   // Set some pointers
   sample = PMAP_GET_SAMPLE(self, sample_index);  
+
+  // Neighborhood half-width (see pmap_init_nbors)
+  s = (int) ceil(self->max_err / self->grid_res);
   
   // Homogeneous from map scan local to global
   P = matrix33_set(cos(sample->pose.rot), -sin(sample->pose.rot), sample->pose.pos.x,
@@ -383,22 +491,46 @@ void pmap_apply_sensor_sample(pmap_t *self, int sample_index, double *ranges)
     
     min_d = 1000;
 
-    // Look for nearest neighbor
-    for (j = 0; j < self->num_nbors; j++)
+    // If the whole neighborhood lies in one tile, look it up just once
+    // (and skip the search if the tile is empty).  Cells in the tile
+    // beyond the grid edge are never written, so read as free.
+    if (nx - s >= 0 && ny - s >= 0 &&
+        ((nx - s) >> PMAP_TILE_SHIFT) == ((nx + s) >> PMAP_TILE_SHIFT) &&
+        ((ny - s) >> PMAP_TILE_SHIFT) == ((ny + s) >> PMAP_TILE_SHIFT) &&
+        ((nx + s) >> PMAP_TILE_SHIFT) < self->tiles_sx &&
+        ((ny + s) >> PMAP_TILE_SHIFT) < self->tiles_sy)
+    {
+      tile = sample->tiles[PMAP_TILE_INDEX(self, nx, ny)];
+      for (j = 0; tile && j < self->num_nbors; j++)
+      {
+        nbor = self->nbors + j;
+        occ = (int) tile->cells[PMAP_TILE_CELL(nx + nbor->dx, ny + nbor->dy)];
+        if (occ > 8) // HACK; threshold
+        {
+          min_d = static_cast<int> (nbor->dist);
+          break;
+        }
+      }
+    }
+    else
     {
-      nbor = self->nbors + j;
+      // Look for nearest neighbor
+      for (j = 0; j < self->num_nbors; j++)
+      {
+        nbor = self->nbors + j;
       
-      mx = nx + nbor->dx;
-      my = ny + nbor->dy;        
-      if (PMAP_GRID_VALID(self, mx, my))
-        occ = (int) sample->cells[PMAP_GRID_INDEX(self, mx, my)];
-      else
-        occ = 0;
+        mx = nx + nbor->dx;
+        my = ny + nbor->dy;        
+        if (PMAP_GRID_VALID(self, mx, my))
+          occ = (int) pmap_read_cell(self, sample, mx, my);
+        else
+          occ = 0;
         
-      if (occ > 8) // HACK; threshold
-      {
-        min_d = static_cast<int> (nbor->dist);
-        break;
+        if (occ > 8) // HACK; threshold
+        {
+          min_d = static_cast<int> (nbor->dist);
+          break;
+        }
       }
     }
 
@@ -457,7 +589,8 @@ double pmap_entropy(pmap_t *self, int scan_count)
 // Resample
 void pmap_resample(pmap_t *self, int scan_count)
 {
-  int i, n;
+  int i, j, n, num_poses;
+  pmap_tile_t *tile;
   double e, p, norm=0.0;
   gsl_ran_discrete_t *dist=NULL;
   pmap_sample_t *oldset=NULL, *newset=NULL;
@@ -493,6 +626,11 @@ void pmap_resample(pmap_t *self, int scan_count)
 
   dist = gsl_ran_discrete_preproc(self->samples_len, sample_probs);
   assert(dist);
+
+  // Number of trajectory entries in use
+  num_poses = self->step_count + 1;
+  if (num_poses > self->step_max_count)
+    num_poses = self->step_max_count;
     
   // Create discrete distribution
   for (i = 0; i < self->samples_len; i++)
@@ -507,10 +645,24 @@ void pmap_resample(pmap_t *self, int scan_count)
     newsample->w = 0.0;
     newsample->err = old->err;
     newsample->pose = old->pose;
-    memcpy(newsample->cells, old->cells, self->grid_size);
-    memcpy(newsample->poses, old->poses, self->traj_size);
+    memcpy(newsample->poses, old->poses, num_poses * sizeof(pose2_t));
+
+    // Share the map tiles; they are copied when next written
+    pmap_release_tiles(self, newsample);
+    for (j = 0; j < self->tiles_sx * self->tiles_sy; j++)
+    {
+      tile = old->tiles[j];
+      if (tile)
+        tile->refs++;
+      newsample->tiles[j] = tile;
+    }
   }  
 
+  // The old set is dead now; drop its references so that tiles held by a
+  // single new sample can be written in place
+  for (i = 0; i < self->samples_len; i++)
+    pmap_release_tiles(self, oldset + i);
+
   gsl_ran_discrete_free(dist);
   delete [] sample_probs;
 
@@ -524,9 +676,8 @@ void pmap_resample(pmap_t *self, int scan_count)
 // Add a scan to the map
 void pmap_add_scan(pmap_t *self, double *ranges)
 {
-  int i;
   pmap_scan_t *scan;
-  pmap_sample_t *sample;
+  pmap_job_t job;
 
   assert(self->step_count < self->step_max_count);
       
@@ -535,15 +686,35 @@ void pmap_add_scan(pmap_t *self, double *ranges)
   memcpy(scan->ranges, ranges, self->num_ranges * sizeof(ranges[0]));
 
   // Add to samples
-  for (i = 0; i < self->samples_len; i++)
+  job.self = self;
+  job.ranges = ranges;
+  tpool_run(self->pool, pmap_add_scan_chunk, &job,
+            tpool_chunks(self->pool, self->samples_len, PMAP_MIN_CHUNK));
+
+  return;
+}
+
+
+// Add a scan to one chunk of the current sample set
+static void pmap_add_scan_chunk(void *data, int chunk, int chunk_count)
+{
+  int i, start, end;
+  pmap_job_t *job;
+  pmap_sample_t *sample;
+
+  job = (pmap_job_t*) data;
+  start = job->self->samples_len * chunk / chunk_count;
+  end = job->self->samples_len * (chunk + 1) / chunk_count;
+
+  for (i = start; i < end; i++)
   {
-    sample = PMAP_GET_SAMPLE(self, i);
+    sample = PMAP_GET_SAMPLE(job->self, i);
 
     // Add to trajectory
-    sample->poses[self->step_count] = sample->pose;
+    sample->poses[job->self->step_count] = sample->pose;
 
     // Add to map
-    pmap_add_scan_sample(self, i, ranges);
+    pmap_add_scan_sample(job->self, i, job->ranges);
   }
   return;
 }
@@ -556,7 +727,8 @@ void pmap_add_scan_sample(pmap_t *self, int sample_index, double *ranges)
   double r;
   vector2_t p;
   pmap_sample_t *sample;
-  int nx, ny, nindex, occ;
+  int nx, ny, occ;
+  signed char *cell;
 
   // Set some pointers
   sample = PMAP_GET_SAMPLE(self, sample_index);
@@ -575,11 +747,11 @@ void pmap_add_scan_sample(pmap_t *self, int sample_index, double *ranges)
               
     if (PMAP_GRID_VALID(self, nx, ny))
     {
-      nindex = PMAP_GRID_INDEX(self, nx, ny);
-      occ = (int) sample->cells[nindex] + 1;
+      cell = pmap_write_cell(self, sample, nx, ny);
+      occ = (int) *cell + 1;
       if (occ > 127)
         occ = 127;
-      sample->cells[nindex] = occ;
+      *cell = occ;
     }
   }
 
@@ -587,6 +759,59 @@ void pmap_add_scan_sample(pmap_t *self, int sample_index, double *ranges)
 }
 
 
+// Get a cell value from a particular sample map.
+signed char pmap_get_cell(pmap_t *self, int sample_index, int x, int y)
+{
+  return pmap_read_cell(self, PMAP_GET_SAMPLE(self, sample_index), x, y);
+}
+
+
+// Get a writable pointer to a cell in a sample map
+static signed char *pmap_write_cell(pmap_t *self, pmap_sample_t *sample, int x, int y)
+{
+  pmap_tile_t **tile, *copy;
+
+  tile = sample->tiles + PMAP_TILE_INDEX(self, x, y);
+  if (*tile == NULL)
+  {
+    copy = new pmap_tile_t;
+    memset(copy->cells, 0, sizeof(copy->cells));
+    copy->refs = 1;
+    *tile = copy;
+  }
+  else if (pmap_tile_refs(*tile) > 1)
+  {
+    // Other samples may be copying the same tile at the same time.  Each
+    // copies before letting go, so a sample that sees a single reference
+    // can safely write in place, and whoever lets go last frees the tile.
+    copy = new pmap_tile_t;
+    memcpy(copy->cells, (*tile)->cells, sizeof(copy->cells));
+    copy->refs = 1;
+    if (pmap_tile_unref(*tile) == 0)
+      delete *tile;
+    *tile = copy;
+  }
+  return (*tile)->cells + PMAP_TILE_CELL(x, y);
+}
+
+
+// Drop a sample's references to its map tiles
+static void pmap_release_tiles(pmap_t *self, pmap_sample_t *sample)
+{
+  int i;
+  pmap_tile_t *tile;
+
+  for (i = 0; i < self->tiles_sx * self->tiles_sy; i++)
+  {
+    tile = sample->tiles[i];
+    if (tile && pmap_tile_unref(tile) == 0)
+      delete tile;
+    sample->tiles[i] = NULL;
+  }
+  return;
+}
+
+
 // Draw the current range scan
 void pmap_draw_scan(pmap_t *self, double *ranges)
 {
@@ -712,6 +937,8 @@ void pmap_draw_sample_map(pmap_t *self, double scale, int sample_index)
 #ifdef GLUT_FOUND
   int i, j;
   pmap_sample_t *sample;
+  pmap_tile_t *tile;
+  static signed char empty[PMAP_TILE_WIDTH * PMAP_TILE_WIDTH];
 
   sample = PMAP_GET_SAMPLE(self, sample_index);
 
@@ -725,18 +952,19 @@ void pmap_draw_sample_map(pmap_t *self, double scale, int sample_index)
   glPixelTransferf(GL_GREEN_BIAS, 0.5);
   glPixelTransferf(GL_BLUE_BIAS, 0.5);
 
-  // Draw the image in tiles to prevent the whole thing from being
-  // clipped
-  glPixelStorei(GL_UNPACK_ROW_LENGTH, self->grid_sx);
-  for (j = 0; j < self->grid_sy / 16; j++)
+  // Draw the image one map tile at a time (which also prevents the
+  // whole thing from being clipped)
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, PMAP_TILE_WIDTH);
+  for (j = 0; j < self->grid_sy / PMAP_TILE_WIDTH; j++)
   {
-    for (i = 0; i < self->grid_sx / 16; i++)
+    for (i = 0; i < self->grid_sx / PMAP_TILE_WIDTH; i++)
     {
-      glRasterPos2f(-self->grid_sx / 2 * self->grid_res + i * 16 * self->grid_res,
-                    -self->grid_sy / 2 * self->grid_res + j * 16 * self->grid_res);
-      glDrawPixels(16, 16,
+      tile = sample->tiles[i + j * self->tiles_sx];
+      glRasterPos2f(-self->grid_sx / 2 * self->grid_res + i * PMAP_TILE_WIDTH * self->grid_res,
+                    -self->grid_sy / 2 * self->grid_res + j * PMAP_TILE_WIDTH * self->grid_res);
+      glDrawPixels(PMAP_TILE_WIDTH, PMAP_TILE_WIDTH,
                    GL_LUMINANCE, GL_BYTE,
-                   sample->cells + i * 16 + j * 16 * self->grid_sx);
+                   tile ? tile->cells : empty);
     }
   }
 
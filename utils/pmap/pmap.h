@@ -40,16 +40,21 @@ represents a very sparse sampling of this space.  In practice, it
 therefore necessary to pre-process raw odometry data (using the lodo
 library, for example) to minimize the odometric drift rate.
 
-- Maintaining a PF over maps is very memory intensive (the pmap
-library stores a complete map for each particle).  For example, a 2500
-sq. m map with 10cm resolution requires 0.25 Mb of storage for each
-map, or 250 Mb of storage for 1000 particles.  When using this
+- Maintaining a PF over maps is memory intensive.  Each particle's map
+is stored as a grid of tiles (PMAP_TILE_WIDTH cells square); tiles that
+have never been written take no space, and tiles are shared between
+particles descended from a common ancestor, being copied only when a
+particle writes into them.  In the worst case (no sharing) a 2500
+sq. m map with 10cm resolution still requires 0.25 Mb of storage for
+each map, or 250 Mb of storage for 1000 particles.  When using this
 library, take care not to exceed the physical memory of the machine.
 
 - The algorithm has constant update time for each new sensor reading,
 but this value scales linearly with the number of particles in the
 filter.  With more than 1000 particles, the algorithm can be very
-slow.
+slow.  The per-particle sensor and map updates are spread across one
+thread per processor (see pmap_set_threads()); the output does not
+depend on the number of threads.
 
 */
 
@@ -58,6 +63,7 @@ slow.
 
 #include "gsl/gsl_rng.h"
 #include "slap.h"
+#include "tpool.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -66,6 +72,10 @@ extern "C"
 
 /// Limits
 #define PMAP_MAX_RANGES 1024
+
+/// Map tile dimensions (cells per side)
+#define PMAP_TILE_SHIFT 6
+#define PMAP_TILE_WIDTH (1 << PMAP_TILE_SHIFT)
   
   
 /// @brief Structure for neighborhood lookup table
@@ -89,6 +99,20 @@ typedef struct
 } pmap_scan_t;
 
 
+/// @brief Structure describing a square block of map cells, which may be
+/// shared by several samples
+typedef struct
+{
+  /// Number of samples using this tile (updated atomically, since
+  /// samples are updated in parallel)
+  int refs;
+
+  /// Cell values
+  signed char cells[PMAP_TILE_WIDTH * PMAP_TILE_WIDTH];
+
+} pmap_tile_t;
+
+
 /// @brief Structure describing a single sample
 typedef struct
 {
@@ -107,8 +131,9 @@ typedef struct
   /// Sample trajectory
   pose2_t *poses;
   
-  /// Grid map
-  signed char *cells;
+  /// Grid map, as tiles_sx * tiles_sy tiles.  NULL tiles are all zero;
+  /// shared tiles (refs > 1) must be copied before writing.
+  pmap_tile_t **tiles;
 
 } pmap_sample_t;
 
@@ -133,8 +158,11 @@ typedef struct
   double grid_res;
   int grid_sx, grid_sy;
 
-  /// Grid and trajectory dimensions (for copying samples)
-  int traj_size, grid_size;
+  /// Grid dimensions, in tiles
+  int tiles_sx, tiles_sy;
+
+  /// Trajectory dimensions (for copying samples)
+  int traj_size;
 
   /// Action model (coefficients for action distribution).
   matrix44_t action_model;
@@ -189,6 +217,9 @@ typedef struct
   /// Random number generator
   gsl_rng *rng;
 
+  /// Threads for the per-sample updates (NULL if single threaded)
+  tpool_t *pool;
+
 } pmap_t;
 
 
@@ -209,6 +240,10 @@ pmap_t *pmap_alloc(int num_ranges, double range_max,
 /// @brief Free object
 void pmap_free(pmap_t *self);
 
+/// @brief Set the number of threads used to update the samples.
+/// Defaults to the number of processors on the machine.
+void pmap_set_threads(pmap_t *self, int threads);
+
 /// @brief Create neighborhood LUT
 /// @internal
 void pmap_init_nbors(pmap_t *self);
@@ -248,6 +283,10 @@ double pmap_entropy(pmap_t *self, int scan_count);
 /// @internal
 void pmap_resample(pmap_t *self, int scan_count);
 
+/// @brief Get a cell value from a particular sample map.
+/// The cell must lie within the grid.
+signed char pmap_get_cell(pmap_t *self, int sample_index, int x, int y);
+
 /// @brief Draw the current range scan
 void pmap_draw_scan(pmap_t *self, double *ranges);
 
@@ -274,6 +313,11 @@ void pmap_draw_sample_map(pmap_t *self, double scale, int sample_index);
 #define PMAP_GRID_VALID(self, x, y) ((x) >= 0 && (x) < self->grid_sx && (y) >= 0 && (y) < self->grid_sy)
 #define PMAP_GRID_INDEX(self, x, y) ((x) + (y) * self->grid_sx)
 
+/// @brief Tile access macros: the tile holding a grid cell, and the
+/// cell's index within that tile
+#define PMAP_TILE_INDEX(self, x, y) (((x) >> PMAP_TILE_SHIFT) + ((y) >> PMAP_TILE_SHIFT) * self->tiles_sx)
+#define PMAP_TILE_CELL(x, y) (((x) & (PMAP_TILE_WIDTH - 1)) + ((y) & (PMAP_TILE_WIDTH - 1)) * PMAP_TILE_WIDTH)
+
   
 #ifdef __cplusplus
 }
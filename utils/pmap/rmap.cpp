@@ -52,6 +52,34 @@
                                      (y) >= 0 && (y) < self->grid_sy)
 #define RMAP_GRID_INDEX(self, x, y) ((x) + (y) * self->grid_sx)
 
+// Smallest number of key-scans worth handing to a thread
+#define RMAP_MIN_CHUNK 4
+
+// Constraints found by one chunk of key-scans
+typedef struct
+{
+  int num_cons, max_cons;
+  rmap_constraint_t *cons;
+
+} rmap_match_chunk_t;
+
+// Arguments for the scan matching job
+typedef struct
+{
+  rmap_t *self;
+
+  // Key-scans to match, in scan order
+  int num_keys;
+  rmap_scan_t **keys;
+
+  // Results for each chunk
+  rmap_match_chunk_t *chunks;
+
+} rmap_match_job_t;
+
+// Match one chunk of the key-scans
+static void rmap_match_chunk(void *data, int chunk, int chunk_count);
+
 // Error function for fitting
 void rmap_fit_fdf(const gsl_vector *x, rmap_t *self, double *f, gsl_vector *g);
 void rmap_fit_df(const gsl_vector *x, rmap_t *self, gsl_vector *g);
@@ -105,6 +133,9 @@ rmap_t *rmap_alloc(int num_ranges, double range_max,
   self->cons = new rmap_constraint_t[self->max_cons];
 
   self->match_count = 0;
+
+  self->pool = NULL;
+  rmap_set_threads(self, tpool_default_threads());
   
   return self;
 }
@@ -113,6 +144,8 @@ rmap_t *rmap_alloc(int num_ranges, double range_max,
 // Free object
 void rmap_free(rmap_t *self)
 {
+  if (self->pool)
+    tpool_free(self->pool);
   delete [] self->cons;
   delete [] self->items;
   delete [] self->grid;
@@ -122,6 +155,16 @@ void rmap_free(rmap_t *self)
 }
 
 
+// Set the number of threads used to match scans
+void rmap_set_threads(rmap_t *self, int threads)
+{
+  if (self->pool)
+    tpool_free(self->pool);
+  self->pool = tpool_alloc(threads);
+  return;
+}
+
+
 // Add a scan to the map
 void rmap_add(rmap_t *self, pose2_t pose, int num_ranges, double *ranges)
 {
@@ -167,8 +210,10 @@ void rmap_add(rmap_t *self, pose2_t pose, int num_ranges, double *ranges)
 // Match points across scans
 void rmap_match(rmap_t *self)
 {
-  int i;
+  int i, chunk_count;
   rmap_scan_t *scan;
+  rmap_match_job_t job;
+  rmap_match_chunk_t *chunk;
 
   // Reset constraint list
   self->num_cons = 0;
@@ -185,14 +230,36 @@ void rmap_match(rmap_t *self)
       rmap_match_prepare(self, scan);
   }
   
-  // Match each key scan
+  // Match each key scan.  The grid is only read from here on, so the
+  // scans can be matched in parallel; each chunk of scans collects its
+  // own constraints, which are then merged in scan order.
+  job.self = self;
+  job.num_keys = 0;
+  job.keys = new rmap_scan_t*[self->num_key_scans];
   for (i = 0; i < self->num_scans; i++)
   {
     scan = self->scans + i;
     if (scan->index >= 0)
-      rmap_match_scan(self, scan);
+      job.keys[job.num_keys++] = scan;
   }
 
+  chunk_count = tpool_chunks(self->pool, job.num_keys, RMAP_MIN_CHUNK);
+  job.chunks = new rmap_match_chunk_t[chunk_count];
+  tpool_run(self->pool, rmap_match_chunk, &job, chunk_count);
+
+  for (i = 0; i < chunk_count; i++)
+  {
+    chunk = job.chunks + i;
+    assert(self->num_cons + chunk->num_cons <= self->max_cons);
+    memcpy(self->cons + self->num_cons, chunk->cons,
+           chunk->num_cons * sizeof(chunk->cons[0]));
+    self->num_cons += chunk->num_cons;
+    delete [] chunk->cons;
+  }
+
+  delete [] job.chunks;
+  delete [] job.keys;
+
   self->match_count++;
       
   return;
@@ -240,24 +307,74 @@ void rmap_match_prepare(rmap_t *self, rmap_scan_t *scan)
 }
 
 
+// Match one chunk of the key-scans
+static void rmap_match_chunk(void *data, int chunk, int chunk_count)
+{
+  int i, start, end, need;
+  rmap_match_job_t *job;
+  rmap_match_chunk_t *out;
+  rmap_constraint_t *cons;
+  rmap_constraint_t **map;
+  rmap_scan_t *scan;
+  rmap_t *self;
+
+  job = (rmap_match_job_t*) data;
+  self = job->self;
+  start = job->num_keys * chunk / chunk_count;
+  end = job->num_keys * (chunk + 1) / chunk_count;
+
+  out = job->chunks + chunk;
+  out->num_cons = 0;
+  out->max_cons = 0;
+  out->cons = NULL;
+
+  // Workspace for constraint map
+  map = new rmap_constraint_t*[self->num_key_scans];
+
+  for (i = start; i < end; i++)
+  {
+    scan = job->keys[i];
+
+    // Each sampled hit makes at most one constraint per key-scan
+    need = out->num_cons + (scan->num_hits + self->range_interval - 1)
+      / self->range_interval * self->num_key_scans;
+    if (need > out->max_cons)
+    {
+      if (need < 2 * out->max_cons)
+        need = 2 * out->max_cons;
+      cons = new rmap_constraint_t[need];
+      if (out->num_cons > 0)
+        memcpy(cons, out->cons, out->num_cons * sizeof(cons[0]));
+      delete [] out->cons;
+      out->cons = cons;
+      out->max_cons = need;
+    }
+
+    out->num_cons = rmap_match_scan(self, scan, map, out->cons,
+                                    out->num_cons, out->max_cons);
+  }
+
+  delete [] map;
+
+  return;
+}
+
+
 // Match points for a single scan
-void rmap_match_scan(rmap_t *self, rmap_scan_t *scan_a)
+int rmap_match_scan(rmap_t *self, rmap_scan_t *scan_a,
+                    rmap_constraint_t **map, rmap_constraint_t *cons,
+                    int num_cons, int max_cons)
 {
   int i;
   int ni, nj, di, dj, mi, mj;
   double d;
   rmap_constraint_t *con;
-  rmap_constraint_t **cons;
   rmap_cell_t *cell;
   vector2_t pa, pb;
   vector2_t qa, qb;
   rmap_item_t *item;
   rmap_scan_t *scan_b;
 
-  // Workspace for constraint map
-  printf("num-scans = %d\n",self->num_scans);
-  cons = new rmap_constraint_t *[self->num_scans];
-  
   // Match hits to boundaries
   for (i = 0; i < scan_a->num_hits; i += self->range_interval)
   {
@@ -268,7 +385,7 @@ void rmap_match_scan(rmap_t *self, rmap_scan_t *scan_a)
     nj = RMAP_GRIDY(self, qa.y);
 
     // Reset the map from scan index to constraint pointer
-    memset(cons, 0, self->num_scans * sizeof(cons[0]));
+    memset(map, 0, self->num_key_scans * sizeof(map[0]));
 
     // Look in the grid for the nearest boundary point; we have to
     // check all the cells in the vicinity of the hit point.
@@ -293,12 +410,12 @@ void rmap_match_scan(rmap_t *self, rmap_scan_t *scan_a)
             
             d = vector2_mag(vector2_sub(qa, qb));
 
-            con = cons[scan_b->index];
+            con = map[scan_b->index];
             if (con == NULL)
             {
-              assert(self->num_cons < self->max_cons);
-              con = self->cons + self->num_cons++;
-              cons[scan_b->index] = con;              
+              assert(num_cons < max_cons);
+              con = cons + num_cons++;
+              map[scan_b->index] = con;
               con->scan_a = scan_a;
               con->scan_b = scan_b;
               con->local_a = pa;
@@ -317,9 +434,7 @@ void rmap_match_scan(rmap_t *self, rmap_scan_t *scan_a)
     }
   }
 
-  delete [] cons;
-    
-  return;
+  return num_cons;
 }
 
 
@@ -33,6 +33,7 @@ using it.
 #define RMAP_H
 
 #include "slap.h"
+#include "tpool.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -158,6 +159,9 @@ typedef struct
   int num_cons, max_cons;
   rmap_constraint_t *cons;
 
+  /// Threads for matching scans (NULL if single threaded)
+  tpool_t *pool;
+
   /// Useful counters for keeping stats
   int match_count;
   double relax_err;
@@ -173,6 +177,10 @@ rmap_t *rmap_alloc(int num_ranges, double range_max,
 /// @brief Free object
 void rmap_free(rmap_t *self);
 
+/// @brief Set the number of threads used to match scans.
+/// Defaults to the number of processors on the machine.
+void rmap_set_threads(rmap_t *self, int threads);
+
 /// @brief Add a scan to the map
 void rmap_add(rmap_t *self, pose2_t pose, int num_ranges, double *ranges);
 
@@ -184,8 +192,13 @@ void rmap_match(rmap_t *self);
 void rmap_match_prepare(rmap_t *self, rmap_scan_t *scan);
 
 /// @brief Match points for a single scan.
+/// New constraints are appended to cons (which has room for max_cons);
+/// map is workspace with room for one pointer per key-scan.
+/// @returns The new number of constraints in cons.
 /// @internal
-void rmap_match_scan(rmap_t *self, rmap_scan_t *scan_a);
+int rmap_match_scan(rmap_t *self, rmap_scan_t *scan_a,
+                    rmap_constraint_t **map, rmap_constraint_t *cons,
+                    int num_cons, int max_cons);
 
 /// @brief Relax key-scans
 /// @param num_cycles Number of optimization cycles.
@@ -0,0 +1,258 @@
+/*
+  pmap: simple mapping utilities
+  Copyright (C) 2004 Andrew Howard  ahoward@usc.edu
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA.
+*/
+/*
+  Desc: Worker thread pool
+  CVS: $Id$
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <pthread.h>
+#if defined (WIN32)
+  #include <windows.h>
+#else
+  #include <unistd.h>
+#endif
+
+#include "tpool.h"
+
+
+// A single worker thread
+typedef struct
+{
+  tpool_t *pool;
+  int index;
+  pthread_t thread;
+
+} tpool_worker_t;
+
+
+// Pool of worker threads.  The calling thread always runs chunk 0;
+// worker i runs chunk i, if there is one.
+struct tpool
+{
+  pthread_mutex_t lock;
+  pthread_cond_t start_cond, done_cond;
+
+  int worker_count;
+  tpool_worker_t *workers;
+
+  // Bumped for each job; workers wait for it to change
+  int generation;
+
+  // Workers that have not yet finished the current job
+  int pending;
+
+  int quit;
+
+  // The current job
+  tpool_fn_t fn;
+  void *data;
+  int chunk_count;
+};
+
+
+// Main loop for the worker threads
+static void *tpool_main(void *arg);
+
+
+// Number of processors on this machine
+int tpool_default_threads(void)
+{
+  int threads;
+
+#if defined (WIN32)
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  threads = (int) info.dwNumberOfProcessors;
+#elif defined (_SC_NPROCESSORS_ONLN)
+  threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#else
+  threads = 1;
+#endif
+
+  if (threads < 1)
+    threads = 1;
+  return threads;
+}
+
+
+// Create a pool
+tpool_t *tpool_alloc(int threads)
+{
+  int i;
+  tpool_t *self;
+
+  if (threads < 2)
+    return NULL;
+
+  self = new tpool_t;
+  pthread_mutex_init(&self->lock, NULL);
+  pthread_cond_init(&self->start_cond, NULL);
+  pthread_cond_init(&self->done_cond, NULL);
+  self->worker_count = 0;
+  self->generation = 0;
+  self->pending = 0;
+  self->quit = 0;
+  self->fn = NULL;
+  self->data = NULL;
+  self->chunk_count = 0;
+
+  // The calling thread does its share of the work, so we need one
+  // fewer worker than threads
+  self->workers = new tpool_worker_t[threads - 1];
+  for (i = 0; i < threads - 1; i++)
+  {
+    self->workers[i].pool = self;
+    self->workers[i].index = i + 1;
+    if (pthread_create(&self->workers[i].thread, NULL,
+                       tpool_main, self->workers + i) != 0)
+    {
+      fprintf(stderr, "failed to start worker thread; using %d threads\n", i + 1);
+      break;
+    }
+    self->worker_count++;
+  }
+
+  if (self->worker_count == 0)
+  {
+    tpool_free(self);
+    return NULL;
+  }
+
+  return self;
+}
+
+
+// Destroy a pool
+void tpool_free(tpool_t *self)
+{
+  int i;
+
+  pthread_mutex_lock(&self->lock);
+  self->quit = 1;
+  pthread_cond_broadcast(&self->start_cond);
+  pthread_mutex_unlock(&self->lock);
+
+  for (i = 0; i < self->worker_count; i++)
+    pthread_join(self->workers[i].thread, NULL);
+
+  pthread_cond_destroy(&self->done_cond);
+  pthread_cond_destroy(&self->start_cond);
+  pthread_mutex_destroy(&self->lock);
+  delete [] self->workers;
+  delete self;
+
+  return;
+}
+
+
+// Number of threads in the pool
+int tpool_threads(tpool_t *self)
+{
+  if (self == NULL)
+    return 1;
+  return self->worker_count + 1;
+}
+
+
+// Number of chunks to split the given number of items into
+int tpool_chunks(tpool_t *self, int items, int min_items)
+{
+  int chunks;
+
+  if (min_items < 1)
+    min_items = 1;
+  chunks = (items + min_items - 1) / min_items;
+  if (chunks > tpool_threads(self))
+    chunks = tpool_threads(self);
+  if (chunks < 1)
+    chunks = 1;
+
+  return chunks;
+}
+
+
+// Run a job and wait for it to finish
+void tpool_run(tpool_t *self, tpool_fn_t fn, void *data, int chunk_count)
+{
+  int i;
+
+  if (self == NULL || chunk_count < 2)
+  {
+    for (i = 0; i < chunk_count; i++)
+      (*fn) (data, i, chunk_count);
+    return;
+  }
+
+  assert(chunk_count <= tpool_threads(self));
+
+  pthread_mutex_lock(&self->lock);
+  self->fn = fn;
+  self->data = data;
+  self->chunk_count = chunk_count;
+  self->pending = chunk_count - 1;
+  self->generation++;
+  pthread_cond_broadcast(&self->start_cond);
+  pthread_mutex_unlock(&self->lock);
+
+  (*fn) (data, 0, chunk_count);
+
+  pthread_mutex_lock(&self->lock);
+  while (self->pending > 0)
+    pthread_cond_wait(&self->done_cond, &self->lock);
+  pthread_mutex_unlock(&self->lock);
+
+  return;
+}
+
+
+// Main loop for the worker threads
+static void *tpool_main(void *arg)
+{
+  tpool_worker_t *worker;
+  tpool_t *self;
+  int generation, run;
+
+  worker = (tpool_worker_t*) arg;
+  self = worker->pool;
+  generation = 0;
+
+  pthread_mutex_lock(&self->lock);
+  while (1)
+  {
+    while (!self->quit && self->generation == generation)
+      pthread_cond_wait(&self->start_cond, &self->lock);
+    if (self->quit)
+      break;
+    generation = self->generation;
+    run = (worker->index < self->chunk_count);
+    pthread_mutex_unlock(&self->lock);
+
+    if (run)
+      (*self->fn) (self->data, worker->index, self->chunk_count);
+
+    pthread_mutex_lock(&self->lock);
+    if (run && --self->pending == 0)
+      pthread_cond_signal(&self->done_cond);
+  }
+  pthread_mutex_unlock(&self->lock);
+
+  return NULL;
+}
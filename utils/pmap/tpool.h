@@ -0,0 +1,73 @@
+/*
+  pmap: simple mapping utilities
+  Copyright (C) 2004 Andrew Howard  ahoward@usc.edu
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA.
+*/
+
+/** @file tpool.h
+
+@brief A minimal pool of worker threads, used by the pmap and rmap
+libraries to spread per-sample and per-scan work across the machine.
+
+A job is split into a number of chunks; chunk i is always run by
+thread i (the calling thread runs chunk 0), so a job splits the same
+way every time it is run with the same chunk count.  Callers should
+make the result independent of the chunk count (e.g., by merging
+per-chunk results in chunk order) so that output does not depend on
+the number of threads.
+
+*/
+
+#ifndef TPOOL_H
+#define TPOOL_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/// @brief Function run for each chunk of a job
+typedef void (*tpool_fn_t) (void *data, int chunk, int chunk_count);
+
+/// @brief Thread pool (opaque)
+typedef struct tpool tpool_t;
+
+/// @brief Number of processors on this machine (at least 1)
+int tpool_default_threads(void);
+
+/// @brief Create a pool with the given number of threads (including the
+/// calling thread).  Returns NULL if no worker threads could be started.
+tpool_t *tpool_alloc(int threads);
+
+/// @brief Destroy a pool
+void tpool_free(tpool_t *self);
+
+/// @brief Number of threads in the pool (including the calling thread)
+int tpool_threads(tpool_t *self);
+
+/// @brief Number of chunks to split the given number of items into, so
+/// that no chunk holds fewer than min_items.  A NULL pool means 1.
+int tpool_chunks(tpool_t *self, int items, int min_items);
+
+/// @brief Run a job split into chunk_count chunks, and wait for all of
+/// them to finish.  A NULL pool runs everything on the calling thread.
+void tpool_run(tpool_t *self, tpool_fn_t fn, void *data, int chunk_count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif